@@ -0,0 +1,700 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_ASYNC_HPP
+#define NOISE_ASYNC_HPP
+
+/**
+ * \file async.hpp
+ * \brief C++20 coroutine driver for Noise sessions over stream sockets.
+ *
+ * This header builds on <noise/protocol.hpp> to run many Noise
+ * connections on one thread without callbacks:
+ *
+ * \code
+ * noise::async::task<void> serve(noise::async::session &s)
+ * {
+ *     if (co_await s.handshake())
+ *         co_return;
+ *     noise::const_bytes payload;
+ *     while (!co_await s.read(payload)) {
+ *         if (co_await s.write(payload))
+ *             break;
+ *     }
+ * }
+ * \endcode
+ *
+ * A noise::async::reactor waits for socket readiness with Linux epoll
+ * and resumes the coroutines that are waiting for it.  Sessions use
+ * the framing from the echo example: each message is preceded by its
+ * length as a 2-byte big-endian value.
+ *
+ * The CPU-heavy part of the handshake can optionally be moved to a
+ * noise::async::worker_pool.  The coroutine hops to a worker thread
+ * around each call to write_message() or read_message() and then hops
+ * back to the reactor thread, so all socket I/O stays on one thread.
+ *
+ * Like <noise/protocol.hpp>, nothing in this header throws; errors are
+ * returned as std::error_code values.  The peer closing the connection
+ * is reported as std::errc::connection_aborted.
+ */
+
+#include <noise/protocol.hpp>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace noise::async {
+
+/** @cond */
+namespace detail {
+
+/* Transfers control to the awaiting coroutine when a task finishes */
+struct final_awaiter
+{
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend
+        (std::coroutine_handle<Promise> handle) noexcept
+    {
+        std::coroutine_handle<> next = handle.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+};
+
+template <typename T>
+struct task_result
+{
+    T value{};
+    void return_value(T v) noexcept { value = std::move(v); }
+    T take() noexcept { return std::move(value); }
+};
+
+template <>
+struct task_result<void>
+{
+    void return_void() noexcept {}
+    void take() noexcept {}
+};
+
+} // namespace detail
+/** @endcond */
+
+/**
+ * \brief Lazily-started coroutine that produces a value of type T.
+ *
+ * The coroutine does not run until the task is awaited, and the
+ * awaiting coroutine is resumed directly when it finishes.
+ */
+template <typename T = void>
+class [[nodiscard]] task
+{
+public:
+    /** @cond */
+    struct promise_type : detail::task_result<T>
+    {
+        std::coroutine_handle<> continuation;
+
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise
+                            (*this));
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        detail::final_awaiter final_suspend() const noexcept { return {}; }
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+    /** @endcond */
+
+    task() noexcept = default;
+    task(const task &) = delete;
+    task(task &&other) noexcept : handle_(other.handle_)
+        { other.handle_ = nullptr; }
+    ~task() { if (handle_) handle_.destroy(); }
+
+    task &operator=(const task &) = delete;
+    task &operator=(task &&other) noexcept
+    {
+        if (this != &other) {
+            if (handle_)
+                handle_.destroy();
+            handle_ = other.handle_;
+            other.handle_ = nullptr;
+        }
+        return *this;
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend
+        (std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+
+    T await_resume() noexcept { return handle_.promise().take(); }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept
+        : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/** @cond */
+namespace detail {
+
+/* Coroutine that runs to completion on its own and then frees itself */
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+/* Waiters for readiness on a single file descriptor */
+struct fd_watch
+{
+    int fd = -1;
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+};
+
+/* Suspends until the reactor reports readiness on an fd_watch */
+struct io_awaiter
+{
+    std::coroutine_handle<> &waiter;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept
+        { waiter = handle; }
+    void await_resume() const noexcept {}
+};
+
+} // namespace detail
+/** @endcond */
+
+/**
+ * \brief Starts a task and lets it run to completion in the background.
+ *
+ * The task runs until its first suspension point before spawn() returns.
+ */
+inline void spawn(task<void> t) noexcept
+{
+    [](task<void> t) -> detail::detached_task { co_await t; }(std::move(t));
+}
+
+/**
+ * \brief Event loop that resumes coroutines when their sockets are ready.
+ *
+ * All sessions that belong to a reactor must be used from the thread
+ * that calls run(), except for the handshake computations that a
+ * session explicitly moves to a worker_pool.
+ */
+class reactor
+{
+public:
+    reactor() noexcept
+        : epfd_(epoll_create1(EPOLL_CLOEXEC)),
+          evfd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          stopped_(false)
+    {
+        if (epfd_ >= 0 && evfd_ >= 0) {
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            epoll_ctl(epfd_, EPOLL_CTL_ADD, evfd_, &event);
+        }
+    }
+
+    reactor(const reactor &) = delete;
+    reactor &operator=(const reactor &) = delete;
+
+    ~reactor()
+    {
+        if (evfd_ >= 0)
+            ::close(evfd_);
+        if (epfd_ >= 0)
+            ::close(epfd_);
+    }
+
+    /** \brief Determine if the epoll and eventfd descriptors were created. */
+    bool valid() const noexcept { return epfd_ >= 0 && evfd_ >= 0; }
+
+    /**
+     * \brief Runs the event loop until stop() is called.
+     */
+    void run() noexcept
+    {
+        epoll_event events[64];
+        while (!stopped_.load(std::memory_order_acquire)) {
+            run_posted();
+            if (stopped_.load(std::memory_order_acquire))
+                break;
+            int count = epoll_wait(epfd_, events, 64, -1);
+            if (count < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            for (int index = 0; index < count; ++index) {
+                detail::fd_watch *watch =
+                    static_cast<detail::fd_watch *>(events[index].data.ptr);
+                if (!watch) {
+                    std::uint64_t value;
+                    while (::read(evfd_, &value, sizeof(value)) > 0)
+                        ;
+                    continue;
+                }
+                std::uint32_t flags = events[index].events;
+                std::coroutine_handle<> reader, writer;
+                if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    std::swap(reader, watch->reader);
+                if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                    std::swap(writer, watch->writer);
+                if (reader)
+                    reader.resume();
+                if (writer)
+                    writer.resume();
+            }
+        }
+    }
+
+    /** \brief Asks run() to return; can be called from any thread. */
+    void stop() noexcept
+    {
+        stopped_.store(true, std::memory_order_release);
+        wake();
+    }
+
+    /**
+     * \brief Queues a coroutine to be resumed on the reactor thread;
+     * can be called from any thread.
+     */
+    void post(std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            posted_.push_back(handle);
+        }
+        wake();
+    }
+
+    /**
+     * \brief Returns an awaitable that resumes the caller on the
+     * reactor thread.
+     */
+    auto schedule() noexcept
+    {
+        struct awaiter
+        {
+            reactor &r;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+                { r.post(handle); }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{*this};
+    }
+
+    /** @cond */
+    std::error_code add(detail::fd_watch &watch) noexcept
+    {
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = &watch;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, watch.fd, &event) < 0)
+            return std::error_code(errno, std::system_category());
+        return std::error_code();
+    }
+
+    void remove(detail::fd_watch &watch) noexcept
+    {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, watch.fd, nullptr);
+    }
+    /** @endcond */
+
+private:
+    int epfd_;
+    int evfd_;
+    std::atomic<bool> stopped_;
+    std::mutex mutex_;
+    std::vector<std::coroutine_handle<>> posted_;
+    std::vector<std::coroutine_handle<>> running_;
+
+    void wake() noexcept
+    {
+        std::uint64_t value = 1;
+        ssize_t result = ::write(evfd_, &value, sizeof(value));
+        (void)result;
+    }
+
+    void run_posted()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_.swap(posted_);
+        }
+        for (std::coroutine_handle<> handle : running_)
+            handle.resume();
+        running_.clear();
+    }
+};
+
+/**
+ * \brief Pool of threads for running handshake computations.
+ */
+class worker_pool
+{
+public:
+    /** \brief Starts \a threads worker threads. */
+    explicit worker_pool(unsigned threads) : stopping_(false)
+    {
+        for (unsigned index = 0; index < threads; ++index)
+            threads_.emplace_back([this] { work(); });
+    }
+
+    worker_pool(const worker_pool &) = delete;
+    worker_pool &operator=(const worker_pool &) = delete;
+
+    /** \brief Stops the worker threads once the queue is empty. */
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cond_.notify_all();
+        for (std::thread &thread : threads_)
+            thread.join();
+    }
+
+    /**
+     * \brief Returns an awaitable that resumes the caller on one of the
+     * worker threads.
+     */
+    auto schedule() noexcept
+    {
+        struct awaiter
+        {
+            worker_pool &pool;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(pool.mutex_);
+                    pool.queue_.push_back(handle);
+                }
+                pool.cond_.notify_one();
+            }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{*this};
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::coroutine_handle<>> queue_;
+    std::vector<std::thread> threads_;
+    bool stopping_;
+
+    void work()
+    {
+        for (;;) {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] {
+                    return stopping_ || !queue_.empty();
+                });
+                if (queue_.empty())
+                    return;
+                handle = queue_.front();
+                queue_.pop_front();
+            }
+            handle.resume();
+        }
+    }
+};
+
+/**
+ * \brief Noise session over a non-blocking stream socket.
+ *
+ * A session owns its socket and its handshake and transport state.
+ * At most one read and one write can be outstanding at a time, and the
+ * session must not be destroyed while another coroutine is suspended
+ * in one of its operations.
+ */
+class session
+{
+public:
+    /**
+     * \brief Constructs a session for a connected socket.
+     *
+     * \param r The reactor that will wait for readiness on the socket.
+     * \param fd The socket, which the session closes when it is destroyed.
+     * \param handshake The handshake to run, with all of its keys set.
+     *
+     * Use error() to check whether the socket could be registered.
+     */
+    session(reactor &r, int fd, noise::handshake_state handshake) noexcept
+        : reactor_(r), pool_(nullptr), handshake_(std::move(handshake))
+    {
+        watch_.fd = fd;
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+            error_ = std::error_code(errno, std::system_category());
+        else
+            error_ = reactor_.add(watch_);
+    }
+
+    session(const session &) = delete;
+    session &operator=(const session &) = delete;
+
+    ~session()
+    {
+        if (!error_)
+            reactor_.remove(watch_);
+        ::close(watch_.fd);
+    }
+
+    /** \brief Gets the error from registering the socket, if any. */
+    std::error_code error() const noexcept { return error_; }
+
+    /** \brief Runs future handshake computations on \a pool. */
+    void set_worker_pool(worker_pool *pool) noexcept { pool_ = pool; }
+
+    /** \brief Gets the handshake, which is empty once handshake() succeeds. */
+    noise::handshake_state &handshake_state() noexcept { return handshake_; }
+
+    /** \brief Gets the cipher for outgoing transport messages. */
+    noise::cipher_state &send_cipher() noexcept { return send_; }
+
+    /** \brief Gets the cipher for incoming transport messages. */
+    noise::cipher_state &receive_cipher() noexcept { return recv_; }
+
+    /**
+     * \brief Runs the handshake to completion and splits the transport
+     * ciphers out of it.
+     *
+     * Handshake payloads are empty when sent and discarded when received.
+     */
+    task<std::error_code> handshake()
+    {
+        std::error_code ec;
+        if (handshake_.action() == NOISE_ACTION_NONE)
+            ec = handshake_.start();
+        while (!ec) {
+            int action = handshake_.action();
+            if (action == NOISE_ACTION_WRITE_MESSAGE) {
+                if (pool_)
+                    co_await pool_->schedule();
+                ec = write_handshake(handshake_, send_buffer_);
+                if (pool_)
+                    co_await reactor_.schedule();
+                if (!ec)
+                    ec = co_await send_all(send_buffer_.data(),
+                                           send_buffer_.size());
+            } else if (action == NOISE_ACTION_READ_MESSAGE) {
+                ec = co_await recv_frame();
+                if (ec)
+                    break;
+                if (pool_)
+                    co_await pool_->schedule();
+                std::size_t payload_len;
+                ec = handshake_.read_message
+                    (noise::bytes(recv_buffer_.data() + 2,
+                                  recv_buffer_.size() - 2),
+                     {}, payload_len);
+                if (pool_)
+                    co_await reactor_.schedule();
+            } else if (action == NOISE_ACTION_SPLIT) {
+                ec = handshake_.split(send_, recv_);
+                handshake_ = noise::handshake_state();
+                break;
+            } else {
+                ec = make_error_code(noise::errc::invalid_state);
+            }
+        }
+        co_return ec;
+    }
+
+    /**
+     * \brief Reads and decrypts the next transport message.
+     *
+     * \param payload Set to the decrypted payload, which stays valid
+     * until the next call to read().
+     */
+    task<std::error_code> read(noise::const_bytes &payload)
+    {
+        std::error_code ec = co_await recv_frame();
+        if (ec)
+            co_return ec;
+        std::size_t len = recv_buffer_.size() - 2;
+        ec = recv_.decrypt
+            (noise::bytes(recv_buffer_.data() + 2, len), len);
+        if (!ec)
+            payload = noise::const_bytes(recv_buffer_.data() + 2, len);
+        co_return ec;
+    }
+
+    /**
+     * \brief Encrypts and sends a transport message.
+     */
+    task<std::error_code> write(noise::const_bytes payload)
+    {
+        std::size_t len = payload.size();
+        std::size_t max_len = len + send_.mac_length();
+        if (max_len > NOISE_MAX_PAYLOAD_LEN)
+            co_return make_error_code(noise::errc::invalid_length);
+        send_buffer_.resize(max_len + 2);
+        if (len)
+            std::memcpy(send_buffer_.data() + 2, payload.data(), len);
+        std::error_code ec = send_.encrypt
+            (noise::bytes(send_buffer_.data() + 2, max_len), len);
+        if (ec)
+            co_return ec;
+        send_buffer_[0] = static_cast<std::uint8_t>(len >> 8);
+        send_buffer_[1] = static_cast<std::uint8_t>(len);
+        co_return co_await send_all(send_buffer_.data(), len + 2);
+    }
+
+    /**
+     * \brief Reads exactly \a data.size() bytes without decrypting them;
+     * e.g. a protocol identifier that precedes the handshake.
+     */
+    task<std::error_code> read_raw(noise::bytes data)
+    {
+        return recv_exact(data.data(), data.size());
+    }
+
+    /**
+     * \brief Sends \a data without encrypting or framing it.
+     */
+    task<std::error_code> write_raw(noise::const_bytes data)
+    {
+        return send_all(data.data(), data.size());
+    }
+
+private:
+    reactor &reactor_;
+    worker_pool *pool_;
+    detail::fd_watch watch_;
+    std::error_code error_;
+    noise::handshake_state handshake_;
+    noise::cipher_state send_;
+    noise::cipher_state recv_;
+    std::vector<std::uint8_t> send_buffer_;
+    std::vector<std::uint8_t> recv_buffer_;
+
+    /* Writes a framed handshake message.  The message is built in a
+       per-thread scratch buffer so that each session only holds on to
+       as much memory as the message needs. */
+    static std::error_code write_handshake
+        (noise::handshake_state &handshake, std::vector<std::uint8_t> &out)
+    {
+        static thread_local std::uint8_t scratch[NOISE_MAX_PAYLOAD_LEN + 2];
+        std::size_t len = 0;
+        std::error_code ec = handshake.write_message
+            (noise::bytes(scratch + 2, NOISE_MAX_PAYLOAD_LEN), len);
+        if (ec)
+            return ec;
+        scratch[0] = static_cast<std::uint8_t>(len >> 8);
+        scratch[1] = static_cast<std::uint8_t>(len);
+        out.assign(scratch, scratch + len + 2);
+        return ec;
+    }
+
+    task<std::error_code> recv_exact(std::uint8_t *data, std::size_t len)
+    {
+        while (len > 0) {
+            ssize_t size = ::recv(watch_.fd, data, len, 0);
+            if (size > 0) {
+                data += size;
+                len -= static_cast<std::size_t>(size);
+            } else if (size == 0) {
+                co_return std::make_error_code(std::errc::connection_aborted);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                co_await detail::io_awaiter{watch_.reader};
+            } else if (errno != EINTR) {
+                co_return std::error_code(errno, std::system_category());
+            }
+        }
+        co_return std::error_code();
+    }
+
+    task<std::error_code> send_all(const std::uint8_t *data, std::size_t len)
+    {
+        while (len > 0) {
+            ssize_t size = ::send(watch_.fd, data, len, MSG_NOSIGNAL);
+            if (size > 0) {
+                data += size;
+                len -= static_cast<std::size_t>(size);
+            } else if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                co_await detail::io_awaiter{watch_.writer};
+            } else if (size < 0 && errno != EINTR) {
+                co_return std::error_code(errno, std::system_category());
+            }
+        }
+        co_return std::error_code();
+    }
+
+    /* Reads a length-prefixed frame into recv_buffer_ */
+    task<std::error_code> recv_frame()
+    {
+        std::uint8_t header[2];
+        std::error_code ec = co_await recv_exact(header, 2);
+        if (ec)
+            co_return ec;
+        std::size_t len = (std::size_t(header[0]) << 8) | header[1];
+        recv_buffer_.resize(len + 2);
+        recv_buffer_[0] = header[0];
+        recv_buffer_[1] = header[1];
+        co_return co_await recv_exact(recv_buffer_.data() + 2, len);
+    }
+};
+
+} // namespace noise::async
+
+#endif
@@ -28,12 +28,16 @@
 #include <noise/protocol/names.h>
 #include <noise/protocol/buffer.h>
 #include <noise/protocol/cipherstate.h>
+#include <noise/protocol/cookiestate.h>
 #include <noise/protocol/hashstate.h>
 #include <noise/protocol/dhstate.h>
 #include <noise/protocol/signstate.h>
 #include <noise/protocol/randstate.h>
 #include <noise/protocol/symmetricstate.h>
 #include <noise/protocol/handshakestate.h>
+#include <noise/protocol/pipestate.h>
+#include <noise/protocol/datagram.h>
+#include <noise/protocol/streamstate.h>
 #include <noise/protocol/util.h>
 
 #endif
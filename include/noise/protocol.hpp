@@ -0,0 +1,725 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_PROTOCOL_HPP
+#define NOISE_PROTOCOL_HPP
+
+/**
+ * \file protocol.hpp
+ * \brief C++17 wrappers for the Noise protocol API.
+ *
+ * The classes in this file are thin, header-only wrappers around the
+ * C API.  Each object owns exactly one C object and frees it when it
+ * goes out of scope.  Objects can be moved but not copied.
+ *
+ * The wrappers never throw and never allocate memory on their own.
+ * Errors are reported as std::error_code values in the "noise" error
+ * category, which compare equal to the corresponding noise::errc values.
+ *
+ * Data is passed as noise::bytes or noise::const_bytes views, which can
+ * be constructed from arrays, from a pointer and a length, or from any
+ * contiguous container with data() and size() members such as
+ * std::vector, std::array, std::string, or std::span.  Encryption and
+ * decryption are performed in place so that no copies are necessary.
+ */
+
+#include <noise/protocol.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace noise {
+
+/**
+ * \brief Error codes from the Noise library.
+ */
+enum class errc : int
+{
+    none                = NOISE_ERROR_NONE,
+    no_memory           = NOISE_ERROR_NO_MEMORY,
+    unknown_id          = NOISE_ERROR_UNKNOWN_ID,
+    unknown_name        = NOISE_ERROR_UNKNOWN_NAME,
+    mac_failure         = NOISE_ERROR_MAC_FAILURE,
+    not_applicable      = NOISE_ERROR_NOT_APPLICABLE,
+    system              = NOISE_ERROR_SYSTEM,
+    remote_key_required = NOISE_ERROR_REMOTE_KEY_REQUIRED,
+    local_key_required  = NOISE_ERROR_LOCAL_KEY_REQUIRED,
+    psk_required        = NOISE_ERROR_PSK_REQUIRED,
+    invalid_length      = NOISE_ERROR_INVALID_LENGTH,
+    invalid_param       = NOISE_ERROR_INVALID_PARAM,
+    invalid_state       = NOISE_ERROR_INVALID_STATE,
+    invalid_nonce       = NOISE_ERROR_INVALID_NONCE,
+    invalid_private_key = NOISE_ERROR_INVALID_PRIVATE_KEY,
+    invalid_public_key  = NOISE_ERROR_INVALID_PUBLIC_KEY,
+    invalid_format      = NOISE_ERROR_INVALID_FORMAT,
+    invalid_signature   = NOISE_ERROR_INVALID_SIGNATURE,
+    cookie_required     = NOISE_ERROR_COOKIE_REQUIRED
+};
+
+/** @cond */
+namespace detail {
+
+class error_category_impl : public std::error_category
+{
+public:
+    const char *name() const noexcept override { return "noise"; }
+
+    std::string message(int ev) const override
+    {
+        char buf[64];
+        noise_strerror(ev, buf, sizeof(buf));
+        return buf;
+    }
+};
+
+} // namespace detail
+/** @endcond */
+
+/**
+ * \brief Gets the error category for Noise error codes.
+ */
+inline const std::error_category &error_category() noexcept
+{
+    static const detail::error_category_impl category;
+    return category;
+}
+
+/**
+ * \brief Makes a std::error_code from a noise::errc value.
+ */
+inline std::error_code make_error_code(errc err) noexcept
+{
+    return std::error_code(static_cast<int>(err), error_category());
+}
+
+/**
+ * \brief Makes a std::error_code from an error code returned by the C API.
+ */
+inline std::error_code make_error_code(int err) noexcept
+{
+    return std::error_code(err, error_category());
+}
+
+/**
+ * \brief Non-owning view of a contiguous sequence of bytes.
+ *
+ * This is a minimal equivalent of std::span<T> for C++17.  It can be
+ * constructed from a pointer and a length, an array, or any contiguous
+ * container of byte-sized elements that has data() and size() members.
+ */
+template <typename T>
+class basic_bytes
+{
+public:
+    using element_type = T;
+    using size_type = std::size_t;
+    using iterator = T *;
+
+    constexpr basic_bytes() noexcept : data_(nullptr), size_(0) {}
+    constexpr basic_bytes(T *data, std::size_t size) noexcept
+        : data_(data), size_(size) {}
+
+    template <typename E, std::size_t N, typename = std::enable_if_t<
+                 std::is_same<std::remove_const_t<E>,
+                              std::remove_const_t<T>>::value &&
+                 (std::is_const<T>::value || !std::is_const<E>::value)>>
+    constexpr basic_bytes(E (&array)[N]) noexcept : data_(array), size_(N) {}
+
+    /* Non-const views can be converted into const views */
+    template <typename U, typename = std::enable_if_t<
+                 std::is_const<T>::value &&
+                 std::is_same<std::remove_const_t<T>, U>::value>>
+    constexpr basic_bytes(const basic_bytes<U> &other) noexcept
+        : data_(other.data()), size_(other.size()) {}
+
+    /* Contiguous containers of bytes or chars */
+    template <typename C, typename E = std::remove_pointer_t<
+                 decltype(std::declval<C &>().data())>,
+              typename = std::enable_if_t<
+                 !std::is_array<C>::value && sizeof(E) == 1 &&
+                 (std::is_const<T>::value || !std::is_const<E>::value) &&
+                 std::is_convertible<decltype(std::declval<C &>().size()),
+                                     std::size_t>::value>>
+    constexpr basic_bytes(C &container) noexcept
+        : data_(reinterpret_cast<T *>(container.data())),
+          size_(container.size()) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+    constexpr T &operator[](std::size_t index) const noexcept
+        { return data_[index]; }
+
+    /** \brief Returns a view of the first \a count bytes. */
+    constexpr basic_bytes first(std::size_t count) const noexcept
+        { return basic_bytes(data_, count); }
+
+    /** \brief Returns a view of \a count bytes starting at \a offset. */
+    constexpr basic_bytes subspan
+        (std::size_t offset, std::size_t count = std::size_t(-1)) const noexcept
+    {
+        return basic_bytes
+            (data_ + offset, count == std::size_t(-1) ? size_ - offset : count);
+    }
+
+private:
+    T *data_;
+    std::size_t size_;
+};
+
+/** \brief Mutable view of bytes */
+using bytes = basic_bytes<std::uint8_t>;
+
+/** \brief Read-only view of bytes */
+using const_bytes = basic_bytes<const std::uint8_t>;
+
+/** @cond */
+namespace detail {
+
+/* Owns a single C object and frees it with "Free" when destroyed */
+template <typename T, int (*Free)(T *)>
+class handle
+{
+public:
+    constexpr handle() noexcept : ptr_(nullptr) {}
+    explicit constexpr handle(T *ptr) noexcept : ptr_(ptr) {}
+    handle(const handle &) = delete;
+    handle(handle &&other) noexcept : ptr_(other.ptr_) { other.ptr_ = nullptr; }
+    ~handle() { if (ptr_) Free(ptr_); }
+
+    handle &operator=(const handle &) = delete;
+    handle &operator=(handle &&other) noexcept
+    {
+        if (this != &other) {
+            reset(other.ptr_);
+            other.ptr_ = nullptr;
+        }
+        return *this;
+    }
+
+    T *get() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+    T *release() noexcept
+    {
+        T *ptr = ptr_;
+        ptr_ = nullptr;
+        return ptr;
+    }
+
+    void reset(T *ptr = nullptr) noexcept
+    {
+        if (ptr_)
+            Free(ptr_);
+        ptr_ = ptr;
+    }
+
+private:
+    T *ptr_;
+};
+
+} // namespace detail
+/** @endcond */
+
+/**
+ * \brief Non-owning reference to a DHState object.
+ *
+ * This is returned by handshake_state for the keys that belong to the
+ * handshake, and is the base class of the owning dh_state class.
+ */
+class dh_ref
+{
+public:
+    constexpr dh_ref() noexcept : ptr_(nullptr) {}
+    explicit constexpr dh_ref(NoiseDHState *ptr) noexcept : ptr_(ptr) {}
+
+    /** \brief Gets the underlying C object. */
+    NoiseDHState *get() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+    int dh_id() const noexcept { return noise_dhstate_get_dh_id(ptr_); }
+    std::size_t private_key_length() const noexcept
+        { return noise_dhstate_get_private_key_length(ptr_); }
+    std::size_t public_key_length() const noexcept
+        { return noise_dhstate_get_public_key_length(ptr_); }
+    std::size_t shared_key_length() const noexcept
+        { return noise_dhstate_get_shared_key_length(ptr_); }
+    bool has_keypair() const noexcept
+        { return noise_dhstate_has_keypair(ptr_) != 0; }
+    bool has_public_key() const noexcept
+        { return noise_dhstate_has_public_key(ptr_) != 0; }
+    bool is_shared() const noexcept
+        { return noise_dhstate_is_shared(ptr_) != 0; }
+
+    std::error_code generate_keypair() noexcept
+        { return make_error_code(noise_dhstate_generate_keypair(ptr_)); }
+
+    std::error_code set_keypair
+        (const_bytes private_key, const_bytes public_key) noexcept
+    {
+        return make_error_code(noise_dhstate_set_keypair
+            (ptr_, private_key.data(), private_key.size(),
+             public_key.data(), public_key.size()));
+    }
+
+    std::error_code set_keypair_private(const_bytes private_key) noexcept
+    {
+        return make_error_code(noise_dhstate_set_keypair_private
+            (ptr_, private_key.data(), private_key.size()));
+    }
+
+    std::error_code get_keypair
+        (bytes private_key, bytes public_key) const noexcept
+    {
+        return make_error_code(noise_dhstate_get_keypair
+            (ptr_, private_key.data(), private_key.size(),
+             public_key.data(), public_key.size()));
+    }
+
+    std::error_code set_public_key(const_bytes public_key) noexcept
+    {
+        return make_error_code(noise_dhstate_set_public_key
+            (ptr_, public_key.data(), public_key.size()));
+    }
+
+    std::error_code get_public_key(bytes public_key) const noexcept
+    {
+        return make_error_code(noise_dhstate_get_public_key
+            (ptr_, public_key.data(), public_key.size()));
+    }
+
+    std::error_code copy_from(dh_ref from) noexcept
+        { return make_error_code(noise_dhstate_copy(ptr_, from.ptr_)); }
+
+    /** \brief Calculates the shared key with the public key in \a other. */
+    std::error_code calculate(dh_ref other, bytes shared_key) const noexcept
+    {
+        return make_error_code(noise_dhstate_calculate
+            (ptr_, other.ptr_, shared_key.data(), shared_key.size()));
+    }
+
+protected:
+    NoiseDHState *ptr_;
+};
+
+/**
+ * \brief Owning wrapper for a DHState object.
+ */
+class dh_state : public dh_ref
+{
+public:
+    dh_state() noexcept = default;
+    explicit dh_state(NoiseDHState *ptr) noexcept : dh_ref(ptr) {}
+    dh_state(const dh_state &) = delete;
+    dh_state(dh_state &&other) noexcept : dh_ref(other.ptr_)
+        { other.ptr_ = nullptr; }
+    ~dh_state() { if (ptr_) noise_dhstate_free(ptr_); }
+
+    dh_state &operator=(const dh_state &) = delete;
+    dh_state &operator=(dh_state &&other) noexcept
+    {
+        if (this != &other) {
+            if (ptr_)
+                noise_dhstate_free(ptr_);
+            ptr_ = other.ptr_;
+            other.ptr_ = nullptr;
+        }
+        return *this;
+    }
+
+    /** \brief Creates a DHState object by algorithm identifier. */
+    static dh_state by_id(int id, std::error_code &ec) noexcept
+    {
+        NoiseDHState *ptr = nullptr;
+        ec = make_error_code(noise_dhstate_new_by_id(&ptr, id));
+        return dh_state(ptr);
+    }
+
+    /** \brief Creates a DHState object by algorithm name; e.g. "25519". */
+    static dh_state by_name(const char *name, std::error_code &ec) noexcept
+    {
+        NoiseDHState *ptr = nullptr;
+        ec = make_error_code(noise_dhstate_new_by_name(&ptr, name));
+        return dh_state(ptr);
+    }
+
+    /**
+     * \brief Makes this keypair immutable so that handshakes on several
+     * threads can use it; call once before handing it out.
+     *
+     * \sa noise_dhstate_share()
+     */
+    std::error_code share() noexcept
+        { return make_error_code(noise_dhstate_share(ptr_)); }
+
+    /** \brief Releases ownership of the underlying C object. */
+    NoiseDHState *release() noexcept
+    {
+        NoiseDHState *ptr = ptr_;
+        ptr_ = nullptr;
+        return ptr;
+    }
+};
+
+/**
+ * \brief Owning wrapper for a CipherState object.
+ */
+class cipher_state
+{
+public:
+    cipher_state() noexcept = default;
+    explicit cipher_state(NoiseCipherState *ptr) noexcept : h_(ptr) {}
+
+    /** \brief Creates a CipherState object by algorithm identifier. */
+    static cipher_state by_id(int id, std::error_code &ec) noexcept
+    {
+        NoiseCipherState *ptr = nullptr;
+        ec = make_error_code(noise_cipherstate_new_by_id(&ptr, id));
+        return cipher_state(ptr);
+    }
+
+    /** \brief Creates a CipherState object by name; e.g. "ChaChaPoly". */
+    static cipher_state by_name(const char *name, std::error_code &ec) noexcept
+    {
+        NoiseCipherState *ptr = nullptr;
+        ec = make_error_code(noise_cipherstate_new_by_name(&ptr, name));
+        return cipher_state(ptr);
+    }
+
+    /** \brief Gets the underlying C object. */
+    NoiseCipherState *get() const noexcept { return h_.get(); }
+    NoiseCipherState *release() noexcept { return h_.release(); }
+    explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+    int cipher_id() const noexcept
+        { return noise_cipherstate_get_cipher_id(h_.get()); }
+    std::size_t key_length() const noexcept
+        { return noise_cipherstate_get_key_length(h_.get()); }
+    std::size_t mac_length() const noexcept
+        { return noise_cipherstate_get_mac_length(h_.get()); }
+    bool has_key() const noexcept
+        { return noise_cipherstate_has_key(h_.get()) != 0; }
+
+    std::error_code init_key(const_bytes key) noexcept
+    {
+        return make_error_code(noise_cipherstate_init_key
+            (h_.get(), key.data(), key.size()));
+    }
+
+    std::error_code set_nonce(std::uint64_t nonce) noexcept
+        { return make_error_code(noise_cipherstate_set_nonce(h_.get(), nonce)); }
+
+    /**
+     * \brief Encrypts a message in place.
+     *
+     * \param buffer The entire buffer, which must have room for the MAC.
+     * \param length On entry, the length of the plaintext at the start of
+     * \a buffer.  On exit, the length of the ciphertext including the MAC.
+     * \param ad The associated data, which may be empty.
+     */
+    std::error_code encrypt
+        (bytes buffer, std::size_t &length, const_bytes ad = {}) noexcept
+    {
+        NoiseBuffer mbuf;
+        mbuf.data = buffer.data();
+        mbuf.size = length;
+        mbuf.max_size = buffer.size();
+        int err = noise_cipherstate_encrypt_with_ad
+            (h_.get(), ad.data(), ad.size(), &mbuf);
+        length = mbuf.size;
+        return make_error_code(err);
+    }
+
+    /**
+     * \brief Decrypts a message in place.
+     *
+     * \param buffer The buffer that contains the ciphertext.
+     * \param length On entry, the length of the ciphertext including the
+     * MAC at the start of \a buffer.  On exit, the length of the plaintext.
+     * \param ad The associated data, which may be empty.
+     */
+    std::error_code decrypt
+        (bytes buffer, std::size_t &length, const_bytes ad = {}) noexcept
+    {
+        NoiseBuffer mbuf;
+        mbuf.data = buffer.data();
+        mbuf.size = length;
+        mbuf.max_size = buffer.size();
+        int err = noise_cipherstate_decrypt_with_ad
+            (h_.get(), ad.data(), ad.size(), &mbuf);
+        length = mbuf.size;
+        return make_error_code(err);
+    }
+
+private:
+    detail::handle<NoiseCipherState, noise_cipherstate_free> h_;
+};
+
+/**
+ * \brief Owning wrapper for a SignState object.
+ */
+class sign_state
+{
+public:
+    sign_state() noexcept = default;
+    explicit sign_state(NoiseSignState *ptr) noexcept : h_(ptr) {}
+
+    /** \brief Creates a SignState object by algorithm identifier. */
+    static sign_state by_id(int id, std::error_code &ec) noexcept
+    {
+        NoiseSignState *ptr = nullptr;
+        ec = make_error_code(noise_signstate_new_by_id(&ptr, id));
+        return sign_state(ptr);
+    }
+
+    /** \brief Creates a SignState object by name; e.g. "Ed25519". */
+    static sign_state by_name(const char *name, std::error_code &ec) noexcept
+    {
+        NoiseSignState *ptr = nullptr;
+        ec = make_error_code(noise_signstate_new_by_name(&ptr, name));
+        return sign_state(ptr);
+    }
+
+    /** \brief Gets the underlying C object. */
+    NoiseSignState *get() const noexcept { return h_.get(); }
+    NoiseSignState *release() noexcept { return h_.release(); }
+    explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+    int sign_id() const noexcept
+        { return noise_signstate_get_sign_id(h_.get()); }
+    std::size_t private_key_length() const noexcept
+        { return noise_signstate_get_private_key_length(h_.get()); }
+    std::size_t public_key_length() const noexcept
+        { return noise_signstate_get_public_key_length(h_.get()); }
+    std::size_t signature_length() const noexcept
+        { return noise_signstate_get_signature_length(h_.get()); }
+    bool has_keypair() const noexcept
+        { return noise_signstate_has_keypair(h_.get()) != 0; }
+    bool has_public_key() const noexcept
+        { return noise_signstate_has_public_key(h_.get()) != 0; }
+
+    std::error_code generate_keypair() noexcept
+        { return make_error_code(noise_signstate_generate_keypair(h_.get())); }
+
+    std::error_code set_keypair_private(const_bytes private_key) noexcept
+    {
+        return make_error_code(noise_signstate_set_keypair_private
+            (h_.get(), private_key.data(), private_key.size()));
+    }
+
+    std::error_code set_public_key(const_bytes public_key) noexcept
+    {
+        return make_error_code(noise_signstate_set_public_key
+            (h_.get(), public_key.data(), public_key.size()));
+    }
+
+    std::error_code get_public_key(bytes public_key) const noexcept
+    {
+        return make_error_code(noise_signstate_get_public_key
+            (h_.get(), public_key.data(), public_key.size()));
+    }
+
+    /** \brief Signs \a message, writing signature_length() bytes. */
+    std::error_code sign(const_bytes message, bytes signature) const noexcept
+    {
+        return make_error_code(noise_signstate_sign
+            (h_.get(), message.data(), message.size(),
+             signature.data(), signature.size()));
+    }
+
+    std::error_code verify
+        (const_bytes message, const_bytes signature) const noexcept
+    {
+        return make_error_code(noise_signstate_verify
+            (h_.get(), message.data(), message.size(),
+             signature.data(), signature.size()));
+    }
+
+private:
+    detail::handle<NoiseSignState, noise_signstate_free> h_;
+};
+
+/**
+ * \brief Owning wrapper for a HandshakeState object.
+ */
+class handshake_state
+{
+public:
+    handshake_state() noexcept = default;
+    explicit handshake_state(NoiseHandshakeState *ptr) noexcept : h_(ptr) {}
+
+    /** \brief Creates a HandshakeState object from a protocol identifier. */
+    static handshake_state by_id
+        (const NoiseProtocolId &id, int role, std::error_code &ec) noexcept
+    {
+        NoiseHandshakeState *ptr = nullptr;
+        ec = make_error_code(noise_handshakestate_new_by_id(&ptr, &id, role));
+        return handshake_state(ptr);
+    }
+
+    /** \brief Creates a HandshakeState object from a protocol name. */
+    static handshake_state by_name
+        (const char *name, int role, std::error_code &ec) noexcept
+    {
+        NoiseHandshakeState *ptr = nullptr;
+        ec = make_error_code(noise_handshakestate_new_by_name(&ptr, name, role));
+        return handshake_state(ptr);
+    }
+
+    /** \brief Gets the underlying C object. */
+    NoiseHandshakeState *get() const noexcept { return h_.get(); }
+    NoiseHandshakeState *release() noexcept { return h_.release(); }
+    explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+    int role() const noexcept
+        { return noise_handshakestate_get_role(h_.get()); }
+    int action() const noexcept
+        { return noise_handshakestate_get_action(h_.get()); }
+
+    /** \brief Gets the local keypair, which is owned by the handshake. */
+    dh_ref local_keypair() const noexcept
+        { return dh_ref(noise_handshakestate_get_local_keypair_dh(h_.get())); }
+
+    /** \brief Gets the remote public key, which is owned by the handshake. */
+    dh_ref remote_public_key() const noexcept
+    {
+        return dh_ref
+            (noise_handshakestate_get_remote_public_key_dh(h_.get()));
+    }
+
+    /** \brief Uses a shared local keypair instead of a private copy. */
+    std::error_code set_local_keypair_shared(const dh_state &key) noexcept
+    {
+        return make_error_code(noise_handshakestate_set_local_keypair_shared
+            (h_.get(), key.get()));
+    }
+
+    bool needs_local_keypair() const noexcept
+        { return noise_handshakestate_needs_local_keypair(h_.get()) != 0; }
+    bool needs_remote_public_key() const noexcept
+        { return noise_handshakestate_needs_remote_public_key(h_.get()) != 0; }
+    bool needs_pre_shared_key() const noexcept
+        { return noise_handshakestate_needs_pre_shared_key(h_.get()) != 0; }
+
+    std::error_code set_prologue(const_bytes prologue) noexcept
+    {
+        return make_error_code(noise_handshakestate_set_prologue
+            (h_.get(), prologue.data(), prologue.size()));
+    }
+
+    std::error_code set_pre_shared_key(const_bytes key) noexcept
+    {
+        return make_error_code(noise_handshakestate_set_pre_shared_key
+            (h_.get(), key.data(), key.size()));
+    }
+
+    std::error_code start() noexcept
+        { return make_error_code(noise_handshakestate_start(h_.get())); }
+
+    std::error_code fallback() noexcept
+        { return make_error_code(noise_handshakestate_fallback(h_.get())); }
+
+    /**
+     * \brief Writes the next handshake message.
+     *
+     * \param message The buffer to write the message to.
+     * \param length Returns the length of the message.
+     * \param payload The payload to send, which may be empty.
+     */
+    std::error_code write_message
+        (bytes message, std::size_t &length, const_bytes payload = {}) noexcept
+    {
+        NoiseBuffer mbuf;
+        NoiseBuffer pbuf;
+        mbuf.data = message.data();
+        mbuf.size = 0;
+        mbuf.max_size = message.size();
+        pbuf.data = const_cast<std::uint8_t *>(payload.data());
+        pbuf.size = payload.size();
+        pbuf.max_size = payload.size();
+        int err = noise_handshakestate_write_message
+            (h_.get(), &mbuf, payload.data() ? &pbuf : nullptr);
+        length = mbuf.size;
+        return make_error_code(err);
+    }
+
+    /**
+     * \brief Reads the next handshake message.
+     *
+     * \param message The message, which is decrypted in place.
+     * \param payload The buffer for the payload.  If this is empty,
+     * then the payload is discarded.
+     * \param length Returns the length of the payload.
+     */
+    std::error_code read_message
+        (bytes message, bytes payload, std::size_t &length) noexcept
+    {
+        NoiseBuffer mbuf;
+        NoiseBuffer pbuf;
+        mbuf.data = message.data();
+        mbuf.size = message.size();
+        mbuf.max_size = message.size();
+        pbuf.data = payload.data();
+        pbuf.size = 0;
+        pbuf.max_size = payload.size();
+        int err = noise_handshakestate_read_message
+            (h_.get(), &mbuf, payload.data() ? &pbuf : nullptr);
+        length = payload.data() ? pbuf.size : 0;
+        return make_error_code(err);
+    }
+
+    /** \brief Splits the completed handshake into two CipherStates. */
+    std::error_code split(cipher_state &send, cipher_state &receive) noexcept
+    {
+        NoiseCipherState *s = nullptr;
+        NoiseCipherState *r = nullptr;
+        int err = noise_handshakestate_split(h_.get(), &s, &r);
+        send = cipher_state(s);
+        receive = cipher_state(r);
+        return make_error_code(err);
+    }
+
+    std::error_code get_handshake_hash(bytes hash) const noexcept
+    {
+        return make_error_code(noise_handshakestate_get_handshake_hash
+            (h_.get(), hash.data(), hash.size()));
+    }
+
+private:
+    detail::handle<NoiseHandshakeState, noise_handshakestate_free> h_;
+};
+
+} // namespace noise
+
+/** @cond */
+namespace std {
+template <>
+struct is_error_code_enum<noise::errc> : true_type {};
+} // namespace std
+/** @endcond */
+
+#endif
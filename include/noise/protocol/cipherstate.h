@@ -49,6 +49,9 @@ int noise_cipherstate_decrypt_with_ad
 int noise_cipherstate_encrypt(NoiseCipherState *state, NoiseBuffer *buffer);
 int noise_cipherstate_decrypt(NoiseCipherState *state, NoiseBuffer *buffer);
 int noise_cipherstate_set_nonce(NoiseCipherState *state, uint64_t nonce);
+int noise_cipherstate_set_lookahead(NoiseCipherState *state, size_t depth);
+size_t noise_cipherstate_get_max_lookahead(const NoiseCipherState *state);
+int noise_cipherstate_precompute(NoiseCipherState *state);
 int noise_cipherstate_get_max_key_length(void);
 int noise_cipherstate_get_max_mac_length(void);
 
@@ -36,6 +36,7 @@ extern "C" {
 #define NOISE_CIPHER_CATEGORY           NOISE_ID('C', 0)
 #define NOISE_CIPHER_CHACHAPOLY         NOISE_ID('C', 1)
 #define NOISE_CIPHER_AESGCM             NOISE_ID('C', 2)
+#define NOISE_CIPHER_AEGIS256           NOISE_ID('C', 3) /* Non-standard */
 
 /* Hash algorithms */
 #define NOISE_HASH_NONE                 0
@@ -44,6 +45,7 @@ extern "C" {
 #define NOISE_HASH_BLAKE2b              NOISE_ID('H', 2)
 #define NOISE_HASH_SHA256               NOISE_ID('H', 3)
 #define NOISE_HASH_SHA512               NOISE_ID('H', 4)
+#define NOISE_HASH_BLAKE3               NOISE_ID('H', 5) /* Non-standard */
 
 /* Diffie-Hellman algorithms */
 #define NOISE_DH_NONE                   0
@@ -146,6 +148,7 @@ extern "C" {
 #define NOISE_ERROR_INVALID_PUBLIC_KEY  NOISE_ID('E', 15)
 #define NOISE_ERROR_INVALID_FORMAT      NOISE_ID('E', 16)
 #define NOISE_ERROR_INVALID_SIGNATURE   NOISE_ID('E', 17)
+#define NOISE_ERROR_COOKIE_REQUIRED     NOISE_ID('E', 18)
 
 /* Maximum length of a packet payload */
 #define NOISE_MAX_PAYLOAD_LEN           65535
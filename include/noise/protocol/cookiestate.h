@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_COOKIESTATE_H
+#define NOISE_COOKIESTATE_H
+
+#include <noise/protocol/buffer.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of bytes that noise_cookiestate_add_macs() appends to a message */
+#define NOISE_COOKIE_MACS_LEN           32
+
+/* Length of a cookie reply message */
+#define NOISE_COOKIE_REPLY_LEN          32
+
+typedef struct NoiseCookieState_s NoiseCookieState;
+
+typedef int (*NoiseLoadCallback)(void *user_data);
+
+int noise_cookiestate_new
+    (NoiseCookieState **state, int hash_id, int role);
+int noise_cookiestate_free(NoiseCookieState *state);
+int noise_cookiestate_get_role(const NoiseCookieState *state);
+int noise_cookiestate_set_responder_key
+    (NoiseCookieState *state, const uint8_t *public_key, size_t public_key_len);
+int noise_cookiestate_set_load_callback
+    (NoiseCookieState *state, NoiseLoadCallback callback, void *user_data);
+int noise_cookiestate_is_under_load(const NoiseCookieState *state);
+int noise_cookiestate_rotate_secret(NoiseCookieState *state);
+int noise_cookiestate_add_macs(NoiseCookieState *state, NoiseBuffer *message);
+int noise_cookiestate_check_macs
+    (NoiseCookieState *state, NoiseBuffer *message,
+     const void *source, size_t source_len);
+int noise_cookiestate_write_reply
+    (NoiseCookieState *state, const NoiseBuffer *message, NoiseBuffer *reply,
+     const void *source, size_t source_len);
+int noise_cookiestate_read_reply
+    (NoiseCookieState *state, const NoiseBuffer *reply);
+int noise_cookiestate_has_cookie(const NoiseCookieState *state);
+int noise_cookiestate_clear_cookie(NoiseCookieState *state);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_DATAGRAM_H
+#define NOISE_DATAGRAM_H
+
+#include <noise/protocol/cipherstate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of packets that are received or sent in one system call */
+#define NOISE_DATAGRAM_BATCH            64
+
+/* Length of the session index and nonce header on every packet */
+#define NOISE_DATAGRAM_HEADER_LEN       12
+
+/* Flags for noise_datagramstate_set_offload() */
+#define NOISE_DATAGRAM_OFFLOAD_GSO      0x01
+#define NOISE_DATAGRAM_OFFLOAD_GRO      0x02
+
+typedef struct NoiseDatagramState_s NoiseDatagramState;
+
+typedef struct
+{
+    uint32_t session;       /**< Local index of the session, or zero */
+    int error;              /**< Result of decrypting the packet */
+    NoiseBuffer payload;    /**< Decrypted payload of the packet */
+    const void *source;     /**< Address that the packet came from */
+    size_t source_len;      /**< Length of the address in bytes */
+
+} NoiseDatagram;
+
+int noise_datagramstate_new
+    (NoiseDatagramState **state, int fd, size_t max_packet_len);
+int noise_datagramstate_free(NoiseDatagramState *state);
+int noise_datagramstate_add_session
+    (NoiseDatagramState *state, NoiseCipherState *send,
+     NoiseCipherState *recv, uint32_t remote_index,
+     const void *peer, size_t peer_len, uint32_t *local_index);
+int noise_datagramstate_remove_session
+    (NoiseDatagramState *state, uint32_t local_index);
+int noise_datagramstate_receive
+    (NoiseDatagramState *state, NoiseDatagram **packets, size_t *count);
+int noise_datagramstate_send
+    (NoiseDatagramState *state, uint32_t local_index,
+     const uint8_t *payload, size_t payload_len);
+int noise_datagramstate_flush(NoiseDatagramState *state);
+int noise_datagramstate_set_offload(NoiseDatagramState *state, int flags);
+int noise_datagramstate_get_offload(const NoiseDatagramState *state);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
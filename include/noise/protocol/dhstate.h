@@ -65,6 +65,8 @@ int noise_dhstate_calculate
      const NoiseDHState *public_key_state,
      uint8_t *shared_key, size_t shared_key_len);
 int noise_dhstate_copy(NoiseDHState *state, const NoiseDHState *from);
+int noise_dhstate_share(NoiseDHState *state);
+int noise_dhstate_is_shared(const NoiseDHState *state);
 int noise_dhstate_format_fingerprint
     (const NoiseDHState *state, int fingerprint_type, char *buffer, size_t len);
 int noise_dhstate_get_role(const NoiseDHState *state);
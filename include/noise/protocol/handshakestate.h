@@ -32,16 +32,23 @@ extern "C" {
 
 typedef struct NoiseHandshakeState_s NoiseHandshakeState;
 
+typedef int (*NoiseRemoteKeyCallback)
+    (void *user_data, const NoiseDHState *remote_key);
+
 int noise_handshakestate_new_by_id
     (NoiseHandshakeState **state, const NoiseProtocolId *protocol_id, int role);
 int noise_handshakestate_new_by_name
     (NoiseHandshakeState **state, const char *protocol_name, int role);
+int noise_handshakestate_check_first_message
+    (const NoiseProtocolId *protocol_id, const NoiseBuffer *message);
 int noise_handshakestate_free(NoiseHandshakeState *state);
 int noise_handshakestate_get_role(const NoiseHandshakeState *state);
 int noise_handshakestate_get_protocol_id
     (const NoiseHandshakeState *state, NoiseProtocolId *id);
 NoiseDHState *noise_handshakestate_get_local_keypair_dh
     (const NoiseHandshakeState *state);
+int noise_handshakestate_set_local_keypair_shared
+    (NoiseHandshakeState *state, NoiseDHState *key);
 NoiseDHState *noise_handshakestate_get_remote_public_key_dh
     (const NoiseHandshakeState *state);
 NoiseDHState *noise_handshakestate_get_fixed_ephemeral_dh
@@ -58,6 +65,11 @@ int noise_handshakestate_needs_local_keypair(const NoiseHandshakeState *state);
 int noise_handshakestate_has_local_keypair(const NoiseHandshakeState *state);
 int noise_handshakestate_needs_remote_public_key(const NoiseHandshakeState *state);
 int noise_handshakestate_has_remote_public_key(const NoiseHandshakeState *state);
+int noise_handshakestate_set_remote_key_callback
+    (NoiseHandshakeState *state, NoiseRemoteKeyCallback callback,
+     void *user_data);
+int noise_handshakestate_set_concurrent_hybrid
+    (NoiseHandshakeState *state, int enable);
 int noise_handshakestate_start(NoiseHandshakeState *state);
 int noise_handshakestate_fallback(NoiseHandshakeState *state);
 int noise_handshakestate_fallback_to(NoiseHandshakeState *state, int pattern_id);
@@ -46,6 +46,9 @@ int noise_hashstate_finalize
 int noise_hashstate_hash_one
     (NoiseHashState *state, const uint8_t *data, size_t data_len,
      uint8_t *hash, size_t hash_len);
+int noise_hashstate_hash_many
+    (int hash_id, const uint8_t * const *inputs, const size_t *input_lens,
+     uint8_t * const *outputs, size_t hash_len, size_t count);
 int noise_hashstate_hash_two
     (NoiseHashState *state, const uint8_t *data1, size_t data1_len,
      const uint8_t *data2, size_t data2_len, uint8_t *hash, size_t hash_len);
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef NOISE_PIPESTATE_H
+#define NOISE_PIPESTATE_H
+
+#include <noise/protocol/handshakestate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct NoisePipeState_s NoisePipeState;
+
+int noise_pipestate_new_by_id
+    (NoisePipeState **state, const NoiseProtocolId *protocol_id);
+int noise_pipestate_new_by_name
+    (NoisePipeState **state, const char *protocol_name);
+int noise_pipestate_free(NoisePipeState *state);
+NoiseDHState *noise_pipestate_get_local_keypair_dh
+    (const NoisePipeState *state);
+NoiseDHState *noise_pipestate_get_remote_public_key_dh
+    (const NoisePipeState *state);
+int noise_pipestate_new_handshake
+    (NoisePipeState *state, NoiseHandshakeState **handshake);
+int noise_pipestate_read_message
+    (NoisePipeState *state, NoiseHandshakeState *handshake,
+     NoiseBuffer *message, NoiseBuffer *payload);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
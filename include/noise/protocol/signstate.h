@@ -58,6 +58,10 @@ int noise_signstate_clear_key(NoiseSignState *state);
 int noise_signstate_sign
     (const NoiseSignState *state, const uint8_t *message, size_t message_len,
      uint8_t *signature, size_t signature_len);
+int noise_signstate_sign_batch
+    (const NoiseSignState *state, const uint8_t * const *messages,
+     const size_t *message_lens, uint8_t * const *signatures,
+     size_t signature_len, size_t count);
 int noise_signstate_verify
     (const NoiseSignState *state, const uint8_t *message, size_t message_len,
      const uint8_t *signature, size_t signature_len);
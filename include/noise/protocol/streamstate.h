@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_STREAMSTATE_H
+#define NOISE_STREAMSTATE_H
+
+#include <noise/protocol/cipherstate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Operations for noise_streamstate_new() */
+#define NOISE_STREAM_ENCRYPT            1
+#define NOISE_STREAM_DECRYPT            2
+
+/* Maximum number of records that can be in flight at once */
+#define NOISE_STREAM_MAX_PENDING        256
+
+/* Maximum number of worker threads */
+#define NOISE_STREAM_MAX_THREADS        64
+
+typedef struct NoiseStreamState_s NoiseStreamState;
+
+int noise_streamstate_new
+    (NoiseStreamState **state, NoiseCipherState *cipher, int operation,
+     size_t num_threads);
+int noise_streamstate_free(NoiseStreamState *state);
+size_t noise_streamstate_get_threads(const NoiseStreamState *state);
+size_t noise_streamstate_get_pending(const NoiseStreamState *state);
+int noise_streamstate_submit
+    (NoiseStreamState *state, const uint8_t *input, size_t input_len,
+     uint8_t *output, size_t output_max);
+int noise_streamstate_next(NoiseStreamState *state, NoiseBuffer *output);
+int noise_streamstate_send_file
+    (NoiseStreamState *state, int sock, int fd, uint64_t offset,
+     uint64_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -44,6 +44,16 @@ static void noise_aesgcm_init_key
     memcpy(st->key, key, 32);
 }
 
+static void noise_aesgcm_copy
+    (NoiseCipherState *state, const NoiseCipherState *from)
+{
+    /* The EVP context is reinitialized for every packet, so the copy
+       only needs the key and can keep its own context */
+    NoiseAESGCMState *st = (NoiseAESGCMState *)state;
+    const NoiseAESGCMState *from_st = (const NoiseAESGCMState *)from;
+    memcpy(st->key, from_st->key, 32);
+}
+
 #define PUT_UINT64_BE(buf, value) \
     do { \
         uint64_t _value = (value); \
@@ -154,15 +164,18 @@ static int noise_aesgcm_decrypt(NoiseCipherState *state, const uint8_t *ad, size
     }
 
     /* Provide the message to be decrypted, and obtain the plaintext output.
-     * EVP_DecryptUpdate can be called multiple times if necessary
+     * The plaintext goes to a temporary buffer so that the ciphertext is
+     * left untouched if the tag does not verify.
      */
-    if (!EVP_DecryptUpdate(st->ctx, data, &len, data, data_len)) {
+    uint8_t out[data_len + 1];
+    if (!EVP_DecryptUpdate(st->ctx, out, &len, data, data_len)) {
         ERR_clear_error();
         return NOISE_ERROR_SYSTEM;
     }
+    int plaintext_len = len;
 
     /* Set expected tag value. Works in OpenSSL 1.0.1d and later */
-    if (!EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_SET_TAG, 16, data + len)) {
+    if (!EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_SET_TAG, 16, data + data_len)) {
         ERR_clear_error();
         return NOISE_ERROR_SYSTEM;
     }
@@ -170,11 +183,15 @@ static int noise_aesgcm_decrypt(NoiseCipherState *state, const uint8_t *ad, size
     /* Finalise the decryption. A positive return value indicates success,
      * anything else is a failure - the plaintext is not trustworthy.
      */
-    if (EVP_DecryptFinal_ex(st->ctx, data + len, &len) <= 0) {
+    if (EVP_DecryptFinal_ex(st->ctx, out + plaintext_len, &len) <= 0) {
         ERR_clear_error();
+        noise_clean(out, data_len);
         return NOISE_ERROR_MAC_FAILURE;
     }
+    plaintext_len += len;
 
+    memcpy(data, out, plaintext_len);
+    noise_clean(out, data_len);
     return NOISE_ERROR_NONE;
 }
 
@@ -196,6 +213,7 @@ NoiseCipherState *noise_aesgcm_new_openssl(void)
     state->parent.key_len = 32;
     state->parent.mac_len = 16;
     state->parent.create = noise_aesgcm_new_openssl;
+    state->parent.copy = noise_aesgcm_copy;
     state->parent.destroy = noise_aesgcm_free;
     state->parent.init_key = noise_aesgcm_init_key;
     state->parent.encrypt = noise_aesgcm_encrypt;
@@ -0,0 +1,628 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * AEGIS-256 as specified in draft-irtf-cfrg-aegis-aead, with a 128-bit tag.
+ *
+ * This is not a standard Noise cipher.  The 64-bit Noise nonce n is mapped
+ * to the 256-bit AEGIS nonce as 24 bytes of zeroes followed by the
+ * big-endian encoding of n, in the same way that AESGCM places n after
+ * 32 bits of zeroes.
+ *
+ * The AES-NI version is selected at runtime on x86-64 processors that
+ * support it.  Otherwise the AES rounds are computed with the constant-time
+ * bitsliced AES code, which is much slower but has no table lookups.
+ */
+
+#include "internal.h"
+#include "crypto/aes/aes-ct64.h"
+#include <string.h>
+
+#if defined(__x86_64__) && \
+        (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define NOISE_AEGIS256_HAVE_AESNI 1
+#include <immintrin.h>
+#endif
+
+/* Messages up to this size are decrypted in a single pass through a
+   scratch buffer on the stack; longer ones take two passes */
+#define NOISE_AEGIS256_SCRATCH 2048
+
+/* noise_clean() zeroes a byte at a time, which costs as much as the
+   decryption itself for a full scratch buffer; use memset() and a
+   compiler barrier instead where the compiler supports it */
+static void aegis256_clean_scratch(uint8_t *scratch, size_t len)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    memset(scratch, 0, len);
+    __asm__ __volatile__("" : : "r"(scratch) : "memory");
+#else
+    noise_clean(scratch, len);
+#endif
+}
+
+typedef struct
+{
+    struct NoiseCipherState_s parent;
+    uint8_t key[32];
+    uint8_t nonce[32];
+
+} NoiseAEGIS256State;
+
+/* Constants from the AEGIS specification */
+static uint8_t const aegis256_c0[16] = {
+    0x00, 0x01, 0x01, 0x02, 0x03, 0x05, 0x08, 0x0d,
+    0x15, 0x22, 0x37, 0x59, 0x90, 0xe9, 0x79, 0x62
+};
+static uint8_t const aegis256_c1[16] = {
+    0xdb, 0x3d, 0x18, 0x55, 0x6d, 0xc2, 0x2f, 0xf1,
+    0x20, 0x11, 0x31, 0x42, 0x73, 0xb5, 0x28, 0xdd
+};
+
+static void noise_aegis256_init_key
+    (NoiseCipherState *state, const uint8_t *key)
+{
+    NoiseAEGIS256State *st = (NoiseAEGIS256State *)state;
+    memcpy(st->key, key, 32);
+}
+
+/**
+ * \brief Formats the AEGIS nonce from the Noise nonce.
+ *
+ * \param st The cipher state for AEGIS256.
+ */
+static void noise_aegis256_setup_nonce(NoiseAEGIS256State *st)
+{
+    uint64_t n = st->parent.n;
+    memset(st->nonce, 0, 24);
+    st->nonce[24] = (uint8_t)(n >> 56);
+    st->nonce[25] = (uint8_t)(n >> 48);
+    st->nonce[26] = (uint8_t)(n >> 40);
+    st->nonce[27] = (uint8_t)(n >> 32);
+    st->nonce[28] = (uint8_t)(n >> 24);
+    st->nonce[29] = (uint8_t)(n >> 16);
+    st->nonce[30] = (uint8_t)(n >> 8);
+    st->nonce[31] = (uint8_t)n;
+}
+
+/**
+ * \brief Formats the final block that holds the AD and message lengths.
+ *
+ * \param block The 16-byte block to format.
+ * \param ad_len The length of the associated data in bytes.
+ * \param len The length of the message in bytes.
+ */
+static void noise_aegis256_lengths
+    (uint8_t *block, size_t ad_len, size_t len)
+{
+    uint64_t ad_bits = ((uint64_t)ad_len) * 8;
+    uint64_t bits = ((uint64_t)len) * 8;
+    uint8_t index;
+    for (index = 0; index < 8; ++index) {
+        block[index] = (uint8_t)(ad_bits >> (index * 8));
+        block[index + 8] = (uint8_t)(bits >> (index * 8));
+    }
+}
+
+/* Portable implementation using the bitsliced AES round */
+
+static void xor_block(uint8_t *out, const uint8_t *a, const uint8_t *b)
+{
+    uint8_t index;
+    for (index = 0; index < 16; ++index)
+        out[index] = a[index] ^ b[index];
+}
+
+/**
+ * \brief Updates the AEGIS state with a message block.
+ *
+ * \param S The six 16-byte state words.
+ * \param m The 16-byte message block.
+ */
+static void aegis256_update(uint8_t S[6][16], const uint8_t *m)
+{
+    uint8_t in[64];
+    uint8_t rk[64];
+    uint8_t out[64];
+
+    /* S'0 = R(S5, S0 ^ M), S'1 = R(S0, S1), S'2 = R(S1, S2), S'3 = R(S2, S3) */
+    memcpy(in, S[5], 16);
+    memcpy(in + 16, S[0], 48);
+    xor_block(rk, S[0], m);
+    memcpy(rk + 16, S[1], 48);
+    aes_ct64_round(in, rk, out);
+
+    /* S'4 = R(S3, S4), S'5 = R(S4, S5); the last two lanes are unused */
+    memcpy(in, S[3], 32);
+    memcpy(rk, S[4], 32);
+    memcpy(S[0], out, 64);
+    aes_ct64_round(in, rk, out);
+    memcpy(S[4], out, 32);
+}
+
+/**
+ * \brief Computes the keystream block from the AEGIS state.
+ *
+ * \param S The six 16-byte state words.
+ * \param z Returns the keystream block.
+ */
+static void aegis256_keystream(uint8_t S[6][16], uint8_t *z)
+{
+    uint8_t index;
+    for (index = 0; index < 16; ++index)
+        z[index] = S[1][index] ^ S[4][index] ^ S[5][index] ^
+                   (S[2][index] & S[3][index]);
+}
+
+static void aegis256_init
+    (uint8_t S[6][16], const uint8_t *key, const uint8_t *nonce)
+{
+    uint8_t kn0[16], kn1[16];
+    int index;
+    xor_block(kn0, key, nonce);
+    xor_block(kn1, key + 16, nonce + 16);
+    memcpy(S[0], kn0, 16);
+    memcpy(S[1], kn1, 16);
+    memcpy(S[2], aegis256_c1, 16);
+    memcpy(S[3], aegis256_c0, 16);
+    xor_block(S[4], key, aegis256_c0);
+    xor_block(S[5], key + 16, aegis256_c1);
+    for (index = 0; index < 4; ++index) {
+        aegis256_update(S, key);
+        aegis256_update(S, key + 16);
+        aegis256_update(S, kn0);
+        aegis256_update(S, kn1);
+    }
+    noise_clean(kn0, sizeof(kn0));
+    noise_clean(kn1, sizeof(kn1));
+}
+
+static void aegis256_absorb(uint8_t S[6][16], const uint8_t *ad, size_t ad_len)
+{
+    uint8_t block[16];
+    while (ad_len >= 16) {
+        aegis256_update(S, ad);
+        ad += 16;
+        ad_len -= 16;
+    }
+    if (ad_len > 0) {
+        memcpy(block, ad, ad_len);
+        memset(block + ad_len, 0, 16 - ad_len);
+        aegis256_update(S, block);
+    }
+}
+
+static void aegis256_finalize
+    (uint8_t S[6][16], size_t ad_len, size_t len, uint8_t *tag)
+{
+    uint8_t t[16];
+    uint8_t index;
+    noise_aegis256_lengths(t, ad_len, len);
+    xor_block(t, t, S[3]);
+    for (index = 0; index < 7; ++index)
+        aegis256_update(S, t);
+    for (index = 0; index < 16; ++index)
+        tag[index] = S[0][index] ^ S[1][index] ^ S[2][index] ^
+                     S[3][index] ^ S[4][index] ^ S[5][index];
+}
+
+/**
+ * \brief Decrypts a run of message blocks.
+ *
+ * \param S The six 16-byte state words.
+ * \param in Points to the ciphertext.
+ * \param out Points to the buffer for the plaintext, which may be the same
+ * as \a in, or NULL to only update the state.
+ * \param len The length of the ciphertext in bytes.
+ */
+static void aegis256_decrypt_blocks
+    (uint8_t S[6][16], const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t z[16];
+    uint8_t block[16];
+    size_t posn, temp;
+    for (posn = 0; posn < len; posn += temp) {
+        temp = len - posn;
+        if (temp > 16)
+            temp = 16;
+        aegis256_keystream(S, z);
+        memcpy(block, in + posn, temp);
+        xor_block(block, block, z);
+        memset(block + temp, 0, 16 - temp);
+        aegis256_update(S, block);
+        if (out)
+            memcpy(out + posn, block, temp);
+    }
+    noise_clean(z, sizeof(z));
+    noise_clean(block, sizeof(block));
+}
+
+static void aegis256_encrypt_portable
+    (const uint8_t *key, const uint8_t *nonce, const uint8_t *ad,
+     size_t ad_len, uint8_t *data, size_t len)
+{
+    uint8_t S[6][16];
+    uint8_t z[16];
+    uint8_t block[16];
+    size_t posn, temp;
+    aegis256_init(S, key, nonce);
+    aegis256_absorb(S, ad, ad_len);
+    for (posn = 0; posn < len; posn += temp) {
+        temp = len - posn;
+        if (temp > 16)
+            temp = 16;
+        memcpy(block, data + posn, temp);
+        memset(block + temp, 0, 16 - temp);
+        aegis256_keystream(S, z);
+        aegis256_update(S, block);
+        xor_block(block, block, z);
+        memcpy(data + posn, block, temp);
+    }
+    aegis256_finalize(S, ad_len, len, data + len);
+    noise_clean(S, sizeof(S));
+    noise_clean(z, sizeof(z));
+    noise_clean(block, sizeof(block));
+}
+
+static int aegis256_decrypt_portable
+    (const uint8_t *key, const uint8_t *nonce, const uint8_t *ad,
+     size_t ad_len, uint8_t *data, size_t len)
+{
+    uint8_t S[6][16];
+    uint8_t scratch[NOISE_AEGIS256_SCRATCH];
+    uint8_t tag[16];
+    uint8_t *out = (len <= sizeof(scratch)) ? scratch : 0;
+    int equal;
+
+    /* AEGIS decrypts before it can check the tag.  Short messages are
+       decrypted into a scratch buffer, and longer ones only have their
+       tag computed, so that the ciphertext is left intact on failure */
+    aegis256_init(S, key, nonce);
+    aegis256_absorb(S, ad, ad_len);
+    aegis256_decrypt_blocks(S, data, out, len);
+    aegis256_finalize(S, ad_len, len, tag);
+    equal = noise_is_equal(data + len, tag, 16);
+    if (equal && out) {
+        memcpy(data, out, len);
+    } else if (equal) {
+        /* Second pass to decrypt in place now that the tag is good */
+        aegis256_init(S, key, nonce);
+        aegis256_absorb(S, ad, ad_len);
+        aegis256_decrypt_blocks(S, data, data, len);
+    }
+    noise_clean(S, sizeof(S));
+    aegis256_clean_scratch(scratch, out ? len : 0);
+    noise_clean(tag, sizeof(tag));
+    return equal ? NOISE_ERROR_NONE : NOISE_ERROR_MAC_FAILURE;
+}
+
+static int noise_aegis256_encrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    NoiseAEGIS256State *st = (NoiseAEGIS256State *)state;
+    noise_aegis256_setup_nonce(st);
+    aegis256_encrypt_portable(st->key, st->nonce, ad, ad_len, data, len);
+    return NOISE_ERROR_NONE;
+}
+
+static int noise_aegis256_decrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    NoiseAEGIS256State *st = (NoiseAEGIS256State *)state;
+    noise_aegis256_setup_nonce(st);
+    return aegis256_decrypt_portable
+        (st->key, st->nonce, ad, ad_len, data, len);
+}
+
+#if NOISE_AEGIS256_HAVE_AESNI
+
+/* Implementation using the AES-NI instructions */
+
+#define AEGIS256_TARGET __attribute__((target("aes,sse2")))
+
+#define AEGIS256_UPDATE(S, m) \
+    do { \
+        __m128i _tmp = S[5]; \
+        S[5] = _mm_aesenc_si128(S[4], S[5]); \
+        S[4] = _mm_aesenc_si128(S[3], S[4]); \
+        S[3] = _mm_aesenc_si128(S[2], S[3]); \
+        S[2] = _mm_aesenc_si128(S[1], S[2]); \
+        S[1] = _mm_aesenc_si128(S[0], S[1]); \
+        S[0] = _mm_aesenc_si128(_tmp, _mm_xor_si128(S[0], (m))); \
+    } while (0)
+
+#define AEGIS256_KEYSTREAM(S) \
+    _mm_xor_si128(_mm_xor_si128(S[1], S[4]), \
+                  _mm_xor_si128(S[5], _mm_and_si128(S[2], S[3])))
+
+#define LOAD(p)     _mm_loadu_si128((const __m128i *)(p))
+#define STORE(p, x) _mm_storeu_si128((__m128i *)(p), (x))
+
+AEGIS256_TARGET
+static void aegis256_init_aesni
+    (__m128i *S, const uint8_t *key, const uint8_t *nonce)
+{
+    __m128i k0 = LOAD(key);
+    __m128i k1 = LOAD(key + 16);
+    __m128i kn0 = _mm_xor_si128(k0, LOAD(nonce));
+    __m128i kn1 = _mm_xor_si128(k1, LOAD(nonce + 16));
+    __m128i c0 = LOAD(aegis256_c0);
+    __m128i c1 = LOAD(aegis256_c1);
+    int index;
+    S[0] = kn0;
+    S[1] = kn1;
+    S[2] = c1;
+    S[3] = c0;
+    S[4] = _mm_xor_si128(k0, c0);
+    S[5] = _mm_xor_si128(k1, c1);
+    for (index = 0; index < 4; ++index) {
+        AEGIS256_UPDATE(S, k0);
+        AEGIS256_UPDATE(S, k1);
+        AEGIS256_UPDATE(S, kn0);
+        AEGIS256_UPDATE(S, kn1);
+    }
+}
+
+AEGIS256_TARGET
+static void aegis256_absorb_aesni(__m128i *S, const uint8_t *ad, size_t ad_len)
+{
+    uint8_t block[16];
+    while (ad_len >= 16) {
+        AEGIS256_UPDATE(S, LOAD(ad));
+        ad += 16;
+        ad_len -= 16;
+    }
+    if (ad_len > 0) {
+        memcpy(block, ad, ad_len);
+        memset(block + ad_len, 0, 16 - ad_len);
+        AEGIS256_UPDATE(S, LOAD(block));
+    }
+}
+
+AEGIS256_TARGET
+static void aegis256_finalize_aesni
+    (__m128i *S, size_t ad_len, size_t len, uint8_t *tag)
+{
+    uint8_t block[16];
+    __m128i t;
+    int index;
+    noise_aegis256_lengths(block, ad_len, len);
+    t = _mm_xor_si128(LOAD(block), S[3]);
+    for (index = 0; index < 7; ++index)
+        AEGIS256_UPDATE(S, t);
+    t = _mm_xor_si128(_mm_xor_si128(S[0], S[1]), _mm_xor_si128(S[2], S[3]));
+    STORE(tag, _mm_xor_si128(t, _mm_xor_si128(S[4], S[5])));
+}
+
+AEGIS256_TARGET __attribute__((__always_inline__))
+static inline void aegis256_decrypt_blocks_aesni
+    (__m128i *S, const uint8_t *in, uint8_t *out, size_t len)
+{
+    __m128i m;
+    uint8_t block[16];
+    size_t posn;
+    for (posn = 0; (posn + 16) <= len; posn += 16) {
+        m = _mm_xor_si128(LOAD(in + posn), AEGIS256_KEYSTREAM(S));
+        if (out)
+            STORE(out + posn, m);
+        AEGIS256_UPDATE(S, m);
+    }
+    if (posn < len) {
+        memcpy(block, in + posn, len - posn);
+        STORE(block, _mm_xor_si128(LOAD(block), AEGIS256_KEYSTREAM(S)));
+        memset(block + len - posn, 0, 16 - (len - posn));
+        m = LOAD(block);
+        AEGIS256_UPDATE(S, m);
+        if (out)
+            memcpy(out + posn, block, len - posn);
+        noise_clean(block, sizeof(block));
+    }
+}
+
+AEGIS256_TARGET
+static void aegis256_encrypt_aesni
+    (const uint8_t *key, const uint8_t *nonce, const uint8_t *ad,
+     size_t ad_len, uint8_t *data, size_t len)
+{
+    __m128i S[6];
+    __m128i m;
+    uint8_t block[16];
+    size_t posn;
+    aegis256_init_aesni(S, key, nonce);
+    aegis256_absorb_aesni(S, ad, ad_len);
+    for (posn = 0; (posn + 16) <= len; posn += 16) {
+        m = LOAD(data + posn);
+        STORE(data + posn, _mm_xor_si128(m, AEGIS256_KEYSTREAM(S)));
+        AEGIS256_UPDATE(S, m);
+    }
+    if (posn < len) {
+        memcpy(block, data + posn, len - posn);
+        memset(block + len - posn, 0, 16 - (len - posn));
+        m = LOAD(block);
+        STORE(block, _mm_xor_si128(m, AEGIS256_KEYSTREAM(S)));
+        AEGIS256_UPDATE(S, m);
+        memcpy(data + posn, block, len - posn);
+        noise_clean(block, sizeof(block));
+    }
+    aegis256_finalize_aesni(S, ad_len, len, data + len);
+    noise_clean(S, sizeof(S));
+}
+
+AEGIS256_TARGET
+static int aegis256_decrypt_aesni
+    (const uint8_t *key, const uint8_t *nonce, const uint8_t *ad,
+     size_t ad_len, uint8_t *data, size_t len)
+{
+    __m128i S[6];
+    uint8_t scratch[NOISE_AEGIS256_SCRATCH];
+    uint8_t tag[16];
+    uint8_t *out = (len <= sizeof(scratch)) ? scratch : 0;
+    int equal;
+
+    /* Same approach as aegis256_decrypt_portable() */
+    aegis256_init_aesni(S, key, nonce);
+    aegis256_absorb_aesni(S, ad, ad_len);
+    aegis256_decrypt_blocks_aesni(S, data, out, len);
+    aegis256_finalize_aesni(S, ad_len, len, tag);
+    equal = noise_is_equal(data + len, tag, 16);
+    if (equal && out) {
+        memcpy(data, out, len);
+    } else if (equal) {
+        aegis256_init_aesni(S, key, nonce);
+        aegis256_absorb_aesni(S, ad, ad_len);
+        aegis256_decrypt_blocks_aesni(S, data, data, len);
+    }
+    noise_clean(S, sizeof(S));
+    aegis256_clean_scratch(scratch, out ? len : 0);
+    noise_clean(tag, sizeof(tag));
+    return equal ? NOISE_ERROR_NONE : NOISE_ERROR_MAC_FAILURE;
+}
+
+static int noise_aegis256_encrypt_aesni
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    NoiseAEGIS256State *st = (NoiseAEGIS256State *)state;
+    noise_aegis256_setup_nonce(st);
+    aegis256_encrypt_aesni(st->key, st->nonce, ad, ad_len, data, len);
+    return NOISE_ERROR_NONE;
+}
+
+static int noise_aegis256_decrypt_aesni
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    NoiseAEGIS256State *st = (NoiseAEGIS256State *)state;
+    noise_aegis256_setup_nonce(st);
+    return aegis256_decrypt_aesni(st->key, st->nonce, ad, ad_len, data, len);
+}
+
+#endif /* NOISE_AEGIS256_HAVE_AESNI */
+
+/**
+ * \brief Determines if the AES-NI version of AEGIS256 can be used.
+ *
+ * \return Non-zero if the processor supports AES-NI.
+ */
+static int noise_aegis256_have_aesni(void)
+{
+#if NOISE_AEGIS256_HAVE_AESNI
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief Encrypts with AEGIS256 using a full 256-bit nonce.
+ *
+ * \param aesni Non-zero for the AES-NI version, or zero for the
+ * portable version.
+ * \param key Points to the 32-byte key.
+ * \param nonce Points to the 32-byte nonce.
+ * \param ad Points to the associated data.
+ * \param ad_len The length of the associated data.
+ * \param data Points to the plaintext, which is encrypted in place and
+ * followed by the 16-byte tag.
+ * \param len The length of the plaintext.
+ *
+ * \return NOISE_ERROR_NONE on success, or NOISE_ERROR_NOT_APPLICABLE if
+ * the AES-NI version was requested and is not available.
+ *
+ * This is used by the unit tests to check each implementation against
+ * the published AEGIS test vectors, which do not use the Noise nonce.
+ */
+int noise_aegis256_encrypt_raw
+    (int aesni, const uint8_t *key, const uint8_t *nonce,
+     const uint8_t *ad, size_t ad_len, uint8_t *data, size_t len)
+{
+    if (aesni) {
+#if NOISE_AEGIS256_HAVE_AESNI
+        if (!noise_aegis256_have_aesni())
+            return NOISE_ERROR_NOT_APPLICABLE;
+        aegis256_encrypt_aesni(key, nonce, ad, ad_len, data, len);
+        return NOISE_ERROR_NONE;
+#else
+        return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+    }
+    aegis256_encrypt_portable(key, nonce, ad, ad_len, data, len);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Decrypts with AEGIS256 using a full 256-bit nonce.
+ *
+ * \param aesni Non-zero for the AES-NI version, or zero for the
+ * portable version.
+ * \param key Points to the 32-byte key.
+ * \param nonce Points to the 32-byte nonce.
+ * \param ad Points to the associated data.
+ * \param ad_len The length of the associated data.
+ * \param data Points to the ciphertext followed by the 16-byte tag.
+ * \param len The length of the ciphertext without the tag.
+ *
+ * \return NOISE_ERROR_NONE on success, NOISE_ERROR_MAC_FAILURE if the
+ * tag is incorrect, or NOISE_ERROR_NOT_APPLICABLE if the AES-NI version
+ * was requested and is not available.
+ *
+ * \sa noise_aegis256_encrypt_raw()
+ */
+int noise_aegis256_decrypt_raw
+    (int aesni, const uint8_t *key, const uint8_t *nonce,
+     const uint8_t *ad, size_t ad_len, uint8_t *data, size_t len)
+{
+    if (aesni) {
+#if NOISE_AEGIS256_HAVE_AESNI
+        if (!noise_aegis256_have_aesni())
+            return NOISE_ERROR_NOT_APPLICABLE;
+        return aegis256_decrypt_aesni(key, nonce, ad, ad_len, data, len);
+#else
+        return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+    }
+    return aegis256_decrypt_portable(key, nonce, ad, ad_len, data, len);
+}
+
+NoiseCipherState *noise_aegis256_new(void)
+{
+    NoiseAEGIS256State *state = noise_new(NoiseAEGIS256State);
+    if (!state)
+        return 0;
+    state->parent.cipher_id = NOISE_CIPHER_AEGIS256;
+    state->parent.key_len = 32;
+    state->parent.mac_len = 16;
+    state->parent.create = noise_aegis256_new;
+    state->parent.init_key = noise_aegis256_init_key;
+    state->parent.encrypt = noise_aegis256_encrypt;
+    state->parent.decrypt = noise_aegis256_decrypt;
+#if NOISE_AEGIS256_HAVE_AESNI
+    if (noise_aegis256_have_aesni()) {
+        state->parent.encrypt = noise_aegis256_encrypt_aesni;
+        state->parent.decrypt = noise_aegis256_decrypt_aesni;
+    }
+#endif
+    return &(state->parent);
+}
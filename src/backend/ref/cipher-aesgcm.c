@@ -21,32 +21,39 @@
  */
 
 #include "internal.h"
-#include "crypto/aes/rijndael-alg-fst.h"
+#include "crypto/aes/aes-ct64.h"
 #include "crypto/ghash/ghash.h"
 #include <string.h>
 
 typedef struct
 {
     struct NoiseCipherState_s parent;
-    uint32_t aes[4 * (MAXNR + 1)];
+    aes_ct64_state aes;
     ghash_state ghash;
     uint8_t counter[16];
     uint8_t hash[16];
+    uint8_t blocks[16 * AES_CT64_BLOCKS];
 
 } NoiseAESGCMState;
 
+/* Number of bytes to encrypt, authenticate, and hash at a time when
+   fusing encryption with the handshake hash.  Must be a multiple of 64
+   so that every chunk but the last uses whole groups of AES blocks */
+#define NOISE_AESGCM_CHUNK  512
+
 static void noise_aesgcm_init_key
     (NoiseCipherState *state, const uint8_t *key)
 {
     NoiseAESGCMState *st = (NoiseAESGCMState *)state;
 
     /* Set the encryption key */
-    rijndaelKeySetupEnc(st->aes, key, 256);
+    aes_ct64_keysched(&(st->aes), key, 32);
 
     /* Construct the hashing key by encrypting a block of zeroes */
-    memset(st->counter, 0, 16);
-    rijndaelEncrypt(st->aes, MAXNR, st->counter, st->hash);
-    ghash_reset(&(st->ghash), st->hash);
+    memset(st->blocks, 0, sizeof(st->blocks));
+    aes_ct64_encrypt(&(st->aes), st->blocks, st->blocks);
+    ghash_reset(&(st->ghash), st->blocks);
+    noise_clean(st->blocks, sizeof(st->blocks));
 }
 
 #define PUT_UINT64(buf, value) \
@@ -82,8 +89,12 @@ static void noise_aesgcm_setup_iv(NoiseAESGCMState *st)
     st->counter[14] = 0;
     st->counter[15] = 1;
 
-    /* Encrypt the counter to create the value to XOR with the hash later */
-    rijndaelEncrypt(st->aes, MAXNR, st->counter, st->hash);
+    /* Encrypt the counter to create the value to XOR with the hash later.
+       The bitsliced AES always works on four blocks, so the extra output
+       blocks are simply discarded */
+    memcpy(st->blocks, st->counter, 16);
+    aes_ct64_encrypt(&(st->aes), st->blocks, st->blocks);
+    memcpy(st->hash, st->blocks, 16);
 
     /* Reset the GHASH state, but keep the same key as before */
     ghash_reset(&(st->ghash), 0);
@@ -99,29 +110,42 @@ static void noise_aesgcm_setup_iv(NoiseAESGCMState *st)
 static void noise_aesgcm_encrypt_or_decrypt
     (NoiseAESGCMState *st, uint8_t *data, size_t len)
 {
-    uint8_t temp, index;
-    uint8_t keystream[16];
+    uint8_t *keystream = st->blocks;
+    size_t temp, index;
+    uint16_t counter;
     while (len > 0) {
-        /* Increment the counter block and encrypt to get keystream data.
+        /* Generate up to four counter blocks and encrypt them in parallel.
            We only need to increment the last two bytes of the counter
            because the maximum payload size of 65535 bytes means a maximum
-           counter value of 4097 (+1 for the hashing nonce) */
-        uint16_t counter = (((uint16_t)(st->counter[15])) |
-                           (((uint16_t)(st->counter[14])) << 8)) + 1;
-        st->counter[15] = (uint8_t)counter;
-        st->counter[14] = (uint8_t)(counter >> 8);
-        rijndaelEncrypt(st->aes, MAXNR, st->counter, keystream);
+           counter value of 4097 (+1 for the hashing nonce).  The counter
+           is only advanced by the number of blocks actually consumed */
+        counter = (((uint16_t)(st->counter[15])) |
+                  (((uint16_t)(st->counter[14])) << 8));
+        for (index = 0; index < AES_CT64_BLOCKS; ++index) {
+            ++counter;
+            memcpy(keystream + index * 16, st->counter, 14);
+            keystream[index * 16 + 14] = (uint8_t)(counter >> 8);
+            keystream[index * 16 + 15] = (uint8_t)counter;
+        }
+        aes_ct64_encrypt(&(st->aes), keystream, keystream);
 
-        /* XOR the input with the keystream block to generate the output */
-        temp = 16;
+        /* XOR the input with the keystream blocks to generate the output */
+        temp = sizeof(st->blocks);
         if (temp > len)
             temp = len;
         for (index = 0; index < temp; ++index)
             data[index] ^= keystream[index];
         data += temp;
         len -= temp;
+
+        /* Advance the counter past the blocks that we used */
+        counter = (((uint16_t)(st->counter[15])) |
+                  (((uint16_t)(st->counter[14])) << 8)) +
+                  (uint16_t)((temp + 15) / 16);
+        st->counter[15] = (uint8_t)counter;
+        st->counter[14] = (uint8_t)(counter >> 8);
     }
-    noise_clean(keystream, sizeof(keystream));
+    noise_clean(st->blocks, sizeof(st->blocks));
 }
 
 /**
@@ -153,33 +177,50 @@ static void noise_aesgcm_finalize_hash
         hash[index] = st->hash[index] ^ value[index];
 }
 
-static int noise_aesgcm_encrypt
+static int noise_aesgcm_encrypt_hash
     (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
-     uint8_t *data, size_t len)
+     uint8_t *data, size_t len, NoiseHashState *hash)
 {
     NoiseAESGCMState *st = (NoiseAESGCMState *)state;
+    size_t posn, chunk;
     noise_aesgcm_setup_iv(st);
     if (ad_len) {
         ghash_update(&(st->ghash), ad, ad_len);
         ghash_pad(&(st->ghash));
     }
-    noise_aesgcm_encrypt_or_decrypt(st, data, len);
-    ghash_update(&(st->ghash), data, len);
+    for (posn = 0; posn < len; posn += chunk) {
+        /* Authenticate and hash each chunk while it is still in the cache */
+        chunk = len - posn;
+        if (chunk > NOISE_AESGCM_CHUNK)
+            chunk = NOISE_AESGCM_CHUNK;
+        noise_aesgcm_encrypt_or_decrypt(st, data + posn, chunk);
+        ghash_update(&(st->ghash), data + posn, chunk);
+        if (hash)
+            (*(hash->update))(hash, data + posn, chunk);
+    }
     noise_aesgcm_finalize_hash(st, data + len, ad_len, len);
     return NOISE_ERROR_NONE;
 }
 
-static int noise_aesgcm_decrypt
+static int noise_aesgcm_decrypt_hash
     (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
-     uint8_t *data, size_t len)
+     uint8_t *data, size_t len, NoiseHashState *hash)
 {
     NoiseAESGCMState *st = (NoiseAESGCMState *)state;
+    size_t posn, chunk;
     noise_aesgcm_setup_iv(st);
     if (ad_len) {
         ghash_update(&(st->ghash), ad, ad_len);
         ghash_pad(&(st->ghash));
     }
-    ghash_update(&(st->ghash), data, len);
+    for (posn = 0; posn < len; posn += chunk) {
+        chunk = len - posn;
+        if (chunk > NOISE_AESGCM_CHUNK)
+            chunk = NOISE_AESGCM_CHUNK;
+        ghash_update(&(st->ghash), data + posn, chunk);
+        if (hash)
+            (*(hash->update))(hash, data + posn, chunk);
+    }
     noise_aesgcm_finalize_hash(st, st->hash, ad_len, len);
     if (!noise_is_equal(data + len, st->hash, 16))
         return NOISE_ERROR_MAC_FAILURE;
@@ -187,6 +228,20 @@ static int noise_aesgcm_decrypt
     return NOISE_ERROR_NONE;
 }
 
+static int noise_aesgcm_encrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    return noise_aesgcm_encrypt_hash(state, ad, ad_len, data, len, 0);
+}
+
+static int noise_aesgcm_decrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    return noise_aesgcm_decrypt_hash(state, ad, ad_len, data, len, 0);
+}
+
 NoiseCipherState *noise_aesgcm_new_ref(void)
 {
     NoiseAESGCMState *state = noise_new(NoiseAESGCMState);
@@ -199,5 +254,7 @@ NoiseCipherState *noise_aesgcm_new_ref(void)
     state->parent.init_key = noise_aesgcm_init_key;
     state->parent.encrypt = noise_aesgcm_encrypt;
     state->parent.decrypt = noise_aesgcm_decrypt;
+    state->parent.encrypt_hash = noise_aesgcm_encrypt_hash;
+    state->parent.decrypt_hash = noise_aesgcm_decrypt_hash;
     return &(state->parent);
 }
@@ -21,18 +21,7 @@
  */
 
 #include "internal.h"
-#include "crypto/chacha/chacha.h"
-#include "crypto/donna/poly1305-donna.h"
-#include <string.h>
-
-typedef struct
-{
-    struct NoiseCipherState_s parent;
-    chacha_ctx chacha;
-    poly1305_context poly1305;
-    uint8_t block[64];
-
-} NoiseChaChaPolyState;
+#include "cipher-chachapoly.h"
 
 static void noise_chachapoly_init_key
     (NoiseCipherState *state, const uint8_t *key)
@@ -41,105 +30,71 @@ static void noise_chachapoly_init_key
     chacha_keysetup(&(st->chacha), key, 256);
 }
 
-#define PUT_UINT64(buf, value) \
-    do { \
-        (buf)[0] = (uint8_t)(value); \
-        (buf)[1] = (uint8_t)((value) >> 8); \
-        (buf)[2] = (uint8_t)((value) >> 16); \
-        (buf)[3] = (uint8_t)((value) >> 24); \
-        (buf)[4] = (uint8_t)((value) >> 32); \
-        (buf)[5] = (uint8_t)((value) >> 40); \
-        (buf)[6] = (uint8_t)((value) >> 48); \
-        (buf)[7] = (uint8_t)((value) >> 56); \
-    } while (0)
-
-/**
- * \brief Sets up a ChaChaPoly context to encrypt/decrypt a block.
- *
- * \param st The encryption state for ChaChaPoly.
- * \param n The nonce for this block.
- */
-static void noise_chachapoly_setup(NoiseChaChaPolyState *st, uint64_t n)
+static int noise_chachapoly_precompute(NoiseCipherState *state, size_t depth)
 {
-    /* Set the initialization vector to the supplied nonce */
-    PUT_UINT64(st->block, n);
-    chacha_ivsetup(&(st->chacha), st->block, 0);
+    NoiseChaChaPolyState *st = (NoiseChaChaPolyState *)state;
+    NoiseChaChaPolyKeystream *ks;
+    uint64_t n;
+    size_t index;
 
-    /* Encrypt an initial block to create the Poly1305 key */
-    memset(st->block, 0, 64);
-    chacha_encrypt_bytes(&(st->chacha), st->block, st->block, 64);
-    poly1305_init(&(st->poly1305), st->block);
-    noise_clean(st->block, sizeof(st->block));
-}
+    /* Allocate the ring the first time that keystream is needed */
+    if (!st->ring) {
+        if (!depth)
+            return NOISE_ERROR_NONE;
+        st->ring = (NoiseChaChaPolyKeystream *)noise_new_object
+            (NOISE_CHACHAPOLY_LOOKAHEAD * sizeof(NoiseChaChaPolyKeystream));
+        if (!st->ring)
+            return NOISE_ERROR_NO_MEMORY;
+    }
 
-/**
- * \brief Pads the Poly1305 input to a multiple of 16 bytes.
- *
- * \param st The encryption state for ChaChaPoly.
- * \param len The length of the input that needs to be padded.
- */
-static void noise_chachapoly_pad_auth(NoiseChaChaPolyState *st, size_t len)
-{
-    len %= 16;
-    if (len) {
-        static uint8_t const padding[16] = {
-            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-        };
-        poly1305_update(&(st->poly1305), padding, 16 - len);
+    /* Wipe anything that is not for one of the next "depth" nonces */
+    for (index = 0; index < NOISE_CHACHAPOLY_LOOKAHEAD; ++index) {
+        ks = &(st->ring[index]);
+        if (ks->valid && (ks->n < state->n || (ks->n - state->n) >= depth))
+            noise_clean(ks, sizeof(NoiseChaChaPolyKeystream));
     }
-}
 
-/**
- * \brief Finalize the Poly1305 hash by adding the lengths.
- *
- * \param st The encryption state for ChaChaPoly.
- * \param ad_len The length of the associated data.
- * \param data_len The length of the ciphertext.
- */
-static void noise_chachapoly_auth_lengths
-    (NoiseChaChaPolyState *st, uint64_t ad_len, uint64_t data_len)
-{
-    PUT_UINT64(st->block, ad_len);
-    PUT_UINT64(st->block + 8, data_len);
-    poly1305_update(&(st->poly1305), st->block, 16);
+    /* Generate the keystream for the nonces that don't have it yet.
+       The all-ones nonce is reserved and will never be used */
+    for (index = 0; index < depth; ++index) {
+        n = state->n + index;
+        if (n == 0xFFFFFFFFFFFFFFFFULL)
+            break;
+        ks = &(st->ring[n % NOISE_CHACHAPOLY_LOOKAHEAD]);
+        if (ks->valid)
+            continue;
+        NOISE_CHACHAPOLY_PUT_UINT64(st->block, n);
+        chacha_ivsetup(&(st->chacha), st->block, 0);
+        memset(st->block, 0, 64);
+        chacha_encrypt_bytes(&(st->chacha), st->block, st->block, 64);
+        memcpy(ks->key, st->block, sizeof(ks->key));
+        noise_clean(st->block, sizeof(st->block));
+        memset(ks->stream, 0, sizeof(ks->stream));
+        chacha_encrypt_bytes
+            (&(st->chacha), ks->stream, ks->stream, sizeof(ks->stream));
+        ks->n = n;
+        ks->valid = 1;
+    }
+    return NOISE_ERROR_NONE;
 }
 
-static int noise_chachapoly_encrypt
-    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
-     uint8_t *data, size_t len)
+static void noise_chachapoly_copy
+    (NoiseCipherState *state, const NoiseCipherState *from)
 {
+    /* The copy starts without any precomputed keystream of its own */
     NoiseChaChaPolyState *st = (NoiseChaChaPolyState *)state;
-    noise_chachapoly_setup(st, state->n);
-    if (ad_len) {
-        poly1305_update(&(st->poly1305), ad, ad_len);
-        noise_chachapoly_pad_auth(st, ad_len);
-    }
-    chacha_encrypt_bytes(&(st->chacha), data, data, len);
-    poly1305_update(&(st->poly1305), data, len);
-    noise_chachapoly_pad_auth(st, len);
-    noise_chachapoly_auth_lengths(st, ad_len, len);
-    poly1305_finish(&(st->poly1305), data + len);
-    return NOISE_ERROR_NONE;
+    const NoiseChaChaPolyState *from_st = (const NoiseChaChaPolyState *)from;
+    memcpy(&(st->chacha), &(from_st->chacha), sizeof(st->chacha));
 }
 
-static int noise_chachapoly_decrypt
-    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
-     uint8_t *data, size_t len)
+static void noise_chachapoly_destroy(NoiseCipherState *state)
 {
     NoiseChaChaPolyState *st = (NoiseChaChaPolyState *)state;
-    noise_chachapoly_setup(st, state->n);
-    if (ad_len) {
-        poly1305_update(&(st->poly1305), ad, ad_len);
-        noise_chachapoly_pad_auth(st, ad_len);
+    if (st->ring) {
+        noise_free(st->ring,
+                   NOISE_CHACHAPOLY_LOOKAHEAD * sizeof(NoiseChaChaPolyKeystream));
+        st->ring = 0;
     }
-    poly1305_update(&(st->poly1305), data, len);
-    noise_chachapoly_pad_auth(st, len);
-    noise_chachapoly_auth_lengths(st, ad_len, len);
-    poly1305_finish(&(st->poly1305), st->block);
-    if (!noise_is_equal(st->block, data + len, 16))
-        return NOISE_ERROR_MAC_FAILURE;
-    chacha_encrypt_bytes(&(st->chacha), data, data, len);
-    return NOISE_ERROR_NONE;
 }
 
 NoiseCipherState *noise_chachapoly_new(void)
@@ -150,9 +105,15 @@ NoiseCipherState *noise_chachapoly_new(void)
     state->parent.cipher_id = NOISE_CIPHER_CHACHAPOLY;
     state->parent.key_len = 32;
     state->parent.mac_len = 16;
+    state->parent.max_lookahead = NOISE_CHACHAPOLY_LOOKAHEAD;
     state->parent.create = noise_chachapoly_new;
     state->parent.init_key = noise_chachapoly_init_key;
     state->parent.encrypt = noise_chachapoly_encrypt;
     state->parent.decrypt = noise_chachapoly_decrypt;
+    state->parent.encrypt_hash = noise_chachapoly_encrypt_hash;
+    state->parent.decrypt_hash = noise_chachapoly_decrypt_hash;
+    state->parent.precompute = noise_chachapoly_precompute;
+    state->parent.copy = noise_chachapoly_copy;
+    state->parent.destroy = noise_chachapoly_destroy;
     return &(state->parent);
 }
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_BACKEND_REF_CIPHER_CHACHAPOLY_H
+#define NOISE_BACKEND_REF_CIPHER_CHACHAPOLY_H
+
+#include "protocol/internal.h"
+#include "crypto/chacha/chacha.h"
+#include "crypto/donna/poly1305-donna.h"
+#include <string.h>
+
+/** @cond */
+
+/* Maximum number of nonces that can be precomputed in lookahead mode */
+#define NOISE_CHACHAPOLY_LOOKAHEAD          4
+
+/* Number of 64-byte keystream blocks to precompute for each nonce */
+#define NOISE_CHACHAPOLY_LOOKAHEAD_BLOCKS   4
+
+/* Number of bytes to encrypt, authenticate, and hash at a time when
+   fusing encryption with the handshake hash.  Must be a multiple of 64 */
+#define NOISE_CHACHAPOLY_CHUNK              512
+
+/* Precomputed Poly1305 key and initial keystream for a single nonce */
+typedef struct
+{
+    uint64_t n;
+    int valid;
+    uint8_t key[32];
+    uint8_t stream[NOISE_CHACHAPOLY_LOOKAHEAD_BLOCKS * 64];
+
+} NoiseChaChaPolyKeystream;
+
+typedef struct
+{
+    struct NoiseCipherState_s parent;
+    chacha_ctx chacha;
+    poly1305_context poly1305;
+    uint8_t block[64];
+    NoiseChaChaPolyKeystream *ring;
+
+} NoiseChaChaPolyState;
+
+#define NOISE_CHACHAPOLY_PUT_UINT64(buf, value) \
+    do { \
+        (buf)[0] = (uint8_t)(value); \
+        (buf)[1] = (uint8_t)((value) >> 8); \
+        (buf)[2] = (uint8_t)((value) >> 16); \
+        (buf)[3] = (uint8_t)((value) >> 24); \
+        (buf)[4] = (uint8_t)((value) >> 32); \
+        (buf)[5] = (uint8_t)((value) >> 40); \
+        (buf)[6] = (uint8_t)((value) >> 48); \
+        (buf)[7] = (uint8_t)((value) >> 56); \
+    } while (0)
+
+/**
+ * \brief Sets up a ChaChaPoly context to encrypt/decrypt a block.
+ *
+ * \param st The encryption state for ChaChaPoly.
+ * \param n The nonce for this block.
+ */
+static inline void noise_chachapoly_setup
+    (NoiseChaChaPolyState *st, uint64_t n)
+{
+    /* Set the initialization vector to the supplied nonce */
+    NOISE_CHACHAPOLY_PUT_UINT64(st->block, n);
+    chacha_ivsetup(&(st->chacha), st->block, 0);
+
+    /* Encrypt an initial block to create the Poly1305 key */
+    memset(st->block, 0, 64);
+    chacha_encrypt_bytes(&(st->chacha), st->block, st->block, 64);
+    poly1305_init(&(st->poly1305), st->block);
+    noise_clean(st->block, sizeof(st->block));
+}
+
+/**
+ * \brief Sets up a ChaChaPoly context to encrypt/decrypt a block,
+ * using precomputed keystream if it is available.
+ *
+ * \param st The encryption state for ChaChaPoly.
+ * \param n The nonce for this block.
+ *
+ * \return The precomputed keystream for \a n, or NULL if there is no
+ * precomputed keystream and the ChaCha20 context has been set up instead.
+ */
+static inline NoiseChaChaPolyKeystream *noise_chachapoly_setup_lookahead
+    (NoiseChaChaPolyState *st, uint64_t n)
+{
+    NoiseChaChaPolyKeystream *ks;
+    if (st->ring) {
+        ks = &(st->ring[n % NOISE_CHACHAPOLY_LOOKAHEAD]);
+        if (ks->valid && ks->n == n) {
+            poly1305_init(&(st->poly1305), ks->key);
+            return ks;
+        }
+    }
+    noise_chachapoly_setup(st, n);
+    return 0;
+}
+
+/**
+ * \brief Encrypts or decrypts data with ChaCha20.
+ *
+ * \param st The encryption state for ChaChaPoly.
+ * \param ks Points to the precomputed keystream to use, or to NULL to use
+ * the ChaCha20 context set up by noise_chachapoly_setup().
+ * \param data The data to be encrypted or decrypted in-place.
+ * \param len The length of the data.
+ *
+ * The precomputed keystream is securely wiped after use and \a ks is set
+ * to NULL.  The ChaCha20 context is positioned after the precomputed
+ * blocks so that later calls will continue with the rest of the keystream.
+ * Except for the last call, \a len must be a multiple of 64.
+ */
+static inline void noise_chachapoly_crypt
+    (NoiseChaChaPolyState *st, NoiseChaChaPolyKeystream **ks,
+     uint8_t *data, size_t len)
+{
+    size_t posn;
+    size_t prelen;
+    if (*ks) {
+        prelen = len < sizeof((*ks)->stream) ? len : sizeof((*ks)->stream);
+        for (posn = 0; posn < prelen; ++posn)
+            data[posn] ^= (*ks)->stream[posn];
+        data += prelen;
+        len -= prelen;
+
+        /* Continue the keystream after the precomputed blocks */
+        NOISE_CHACHAPOLY_PUT_UINT64(st->block, (*ks)->n);
+        NOISE_CHACHAPOLY_PUT_UINT64(st->block + 8,
+                   (uint64_t)(NOISE_CHACHAPOLY_LOOKAHEAD_BLOCKS + 1));
+        chacha_ivsetup(&(st->chacha), st->block, st->block + 8);
+        noise_clean(*ks, sizeof(NoiseChaChaPolyKeystream));
+        *ks = 0;
+    }
+    if (len)
+        chacha_encrypt_bytes(&(st->chacha), data, data, len);
+}
+
+/**
+ * \brief Pads the Poly1305 input to a multiple of 16 bytes.
+ *
+ * \param st The encryption state for ChaChaPoly.
+ * \param len The length of the input that needs to be padded.
+ */
+static inline void noise_chachapoly_pad_auth
+    (NoiseChaChaPolyState *st, size_t len)
+{
+    len %= 16;
+    if (len) {
+        static uint8_t const padding[16] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+        };
+        poly1305_update(&(st->poly1305), padding, 16 - len);
+    }
+}
+
+/**
+ * \brief Finalize the Poly1305 hash by adding the lengths.
+ *
+ * \param st The encryption state for ChaChaPoly.
+ * \param ad_len The length of the associated data.
+ * \param data_len The length of the ciphertext.
+ */
+static inline void noise_chachapoly_auth_lengths
+    (NoiseChaChaPolyState *st, uint64_t ad_len, uint64_t data_len)
+{
+    NOISE_CHACHAPOLY_PUT_UINT64(st->block, ad_len);
+    NOISE_CHACHAPOLY_PUT_UINT64(st->block + 8, data_len);
+    poly1305_update(&(st->poly1305), st->block, 16);
+}
+
+static inline int noise_chachapoly_encrypt_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len, NoiseHashState *hash)
+{
+    NoiseChaChaPolyState *st = (NoiseChaChaPolyState *)state;
+    NoiseChaChaPolyKeystream *ks;
+    size_t posn, chunk;
+    ks = noise_chachapoly_setup_lookahead(st, state->n);
+    if (ad_len) {
+        poly1305_update(&(st->poly1305), ad, ad_len);
+        noise_chachapoly_pad_auth(st, ad_len);
+    }
+    for (posn = 0; posn < len; posn += chunk) {
+        /* Authenticate and hash each chunk while it is still in the cache */
+        chunk = len - posn;
+        if (chunk > NOISE_CHACHAPOLY_CHUNK)
+            chunk = NOISE_CHACHAPOLY_CHUNK;
+        noise_chachapoly_crypt(st, &ks, data + posn, chunk);
+        poly1305_update(&(st->poly1305), data + posn, chunk);
+        if (hash)
+            noise_hash_update(hash, data + posn, chunk);
+    }
+    noise_chachapoly_pad_auth(st, len);
+    noise_chachapoly_auth_lengths(st, ad_len, len);
+    poly1305_finish(&(st->poly1305), data + len);
+    return NOISE_ERROR_NONE;
+}
+
+static inline int noise_chachapoly_decrypt_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len, NoiseHashState *hash)
+{
+    NoiseChaChaPolyState *st = (NoiseChaChaPolyState *)state;
+    NoiseChaChaPolyKeystream *ks;
+    size_t posn, chunk;
+    ks = noise_chachapoly_setup_lookahead(st, state->n);
+    if (ad_len) {
+        poly1305_update(&(st->poly1305), ad, ad_len);
+        noise_chachapoly_pad_auth(st, ad_len);
+    }
+    for (posn = 0; posn < len; posn += chunk) {
+        chunk = len - posn;
+        if (chunk > NOISE_CHACHAPOLY_CHUNK)
+            chunk = NOISE_CHACHAPOLY_CHUNK;
+        poly1305_update(&(st->poly1305), data + posn, chunk);
+        if (hash)
+            noise_hash_update(hash, data + posn, chunk);
+    }
+    noise_chachapoly_pad_auth(st, len);
+    noise_chachapoly_auth_lengths(st, ad_len, len);
+    poly1305_finish(&(st->poly1305), st->block);
+    if (!noise_is_equal(st->block, data + len, 16))
+        return NOISE_ERROR_MAC_FAILURE;
+    noise_chachapoly_crypt(st, &ks, data, len);
+    return NOISE_ERROR_NONE;
+}
+
+static inline int noise_chachapoly_encrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    return noise_chachapoly_encrypt_hash(state, ad, ad_len, data, len, 0);
+}
+
+static inline int noise_chachapoly_decrypt
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     uint8_t *data, size_t len)
+{
+    return noise_chachapoly_decrypt_hash(state, ad, ad_len, data, len, 0);
+}
+
+/** @endcond */
+
+#endif
@@ -21,6 +21,7 @@
  */
 
 #include "internal.h"
+#include "dh-curve25519.h"
 #include "crypto/ed25519/ed25519.h"
 #include <string.h>
 
@@ -29,16 +30,6 @@
    doesn't have an equivalent function for general curve25519 calculations
    so we fall back to the curve25519-donna implementation for that. */
 
-int curve25519_donna(uint8_t *mypublic, const uint8_t *secret, const uint8_t *basepoint);
-
-typedef struct
-{
-    struct NoiseDHState_s parent;
-    uint8_t private_key[32];
-    uint8_t public_key[32];
-
-} NoiseCurve25519State;
-
 static int noise_curve25519_generate_keypair
     (NoiseDHState *state, const NoiseDHState *other)
 {
@@ -91,17 +82,6 @@ static int noise_curve25519_copy
     return NOISE_ERROR_NONE;
 }
 
-static int noise_curve25519_calculate
-    (const NoiseDHState *private_key_state,
-     const NoiseDHState *public_key_state,
-     uint8_t *shared_key)
-{
-    /* Do we need to check that the public key is less than 2^255 - 19? */
-    curve25519_donna(shared_key, private_key_state->private_key,
-                     public_key_state->public_key);
-    return NOISE_ERROR_NONE;
-}
-
 NoiseDHState *noise_curve25519_new(void)
 {
     NoiseCurve25519State *state = noise_new(NoiseCurve25519State);
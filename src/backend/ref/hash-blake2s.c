@@ -21,31 +21,13 @@
  */
 
 #include "internal.h"
-#include "crypto/blake2/blake2s.h"
+#include "hash-blake2s.h"
 
-typedef struct
+static void noise_blake2s_hash_many
+    (NoiseHashState *state, const uint8_t * const *inputs,
+     const size_t *input_lens, uint8_t * const *outputs, size_t count)
 {
-    struct NoiseHashState_s parent;
-    BLAKE2s_context_t blake2;
-
-} NoiseBLAKE2sState;
-
-static void noise_blake2s_reset(NoiseHashState *state)
-{
-    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
-    BLAKE2s_reset(&(st->blake2));
-}
-
-static void noise_blake2s_update(NoiseHashState *state, const uint8_t *data, size_t len)
-{
-    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
-    BLAKE2s_update(&(st->blake2), data, len);
-}
-
-static void noise_blake2s_finalize(NoiseHashState *state, uint8_t *hash)
-{
-    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
-    BLAKE2s_finish(&(st->blake2), hash);
+    BLAKE2s_hash_many(outputs, inputs, input_lens, count);
 }
 
 NoiseHashState *noise_blake2s_new(void)
@@ -59,5 +41,6 @@ NoiseHashState *noise_blake2s_new(void)
     state->parent.reset = noise_blake2s_reset;
     state->parent.update = noise_blake2s_update;
     state->parent.finalize = noise_blake2s_finalize;
+    state->parent.hash_many = noise_blake2s_hash_many;
     return &(state->parent);
 }
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NOISE_BACKEND_REF_HASH_BLAKE2S_H
+#define NOISE_BACKEND_REF_HASH_BLAKE2S_H
+
+#include "protocol/internal.h"
+#include "crypto/blake2/blake2s-inline.h"
+
+/** @cond */
+
+typedef struct
+{
+    struct NoiseHashState_s parent;
+    BLAKE2s_context_t blake2;
+
+} NoiseBLAKE2sState;
+
+static inline void noise_blake2s_reset(NoiseHashState *state)
+{
+    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
+    blake2s_inline_reset(&(st->blake2));
+}
+
+static inline void noise_blake2s_update
+    (NoiseHashState *state, const uint8_t *data, size_t len)
+{
+    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
+    blake2s_inline_update(&(st->blake2), data, len);
+}
+
+static inline void noise_blake2s_finalize(NoiseHashState *state, uint8_t *hash)
+{
+    NoiseBLAKE2sState *st = (NoiseBLAKE2sState *)state;
+    blake2s_inline_finish(&(st->blake2), hash);
+}
+
+/** @endcond */
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "internal.h"
+#include "crypto/blake3/blake3.h"
+
+typedef struct
+{
+    struct NoiseHashState_s parent;
+    BLAKE3_context_t blake3;
+
+} NoiseBLAKE3State;
+
+static void noise_blake3_reset(NoiseHashState *state)
+{
+    NoiseBLAKE3State *st = (NoiseBLAKE3State *)state;
+    BLAKE3_reset(&(st->blake3));
+}
+
+static void noise_blake3_update(NoiseHashState *state, const uint8_t *data, size_t len)
+{
+    NoiseBLAKE3State *st = (NoiseBLAKE3State *)state;
+    BLAKE3_update(&(st->blake3), data, len);
+}
+
+static void noise_blake3_finalize(NoiseHashState *state, uint8_t *hash)
+{
+    NoiseBLAKE3State *st = (NoiseBLAKE3State *)state;
+    BLAKE3_finish(&(st->blake3), hash);
+}
+
+NoiseHashState *noise_blake3_new(void)
+{
+    NoiseBLAKE3State *state = noise_new(NoiseBLAKE3State);
+    if (!state)
+        return 0;
+    state->parent.hash_id = NOISE_HASH_BLAKE3;
+    state->parent.hash_len = 32;
+    state->parent.block_len = 64;
+    state->parent.reset = noise_blake3_reset;
+    state->parent.update = noise_blake3_update;
+    state->parent.finalize = noise_blake3_finalize;
+    return &(state->parent);
+}
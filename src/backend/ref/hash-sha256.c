@@ -48,6 +48,13 @@ static void noise_sha256_finalize(NoiseHashState *state, uint8_t *hash)
     sha256_finish(&(st->sha256), hash);
 }
 
+static void noise_sha256_hash_many
+    (NoiseHashState *state, const uint8_t * const *inputs,
+     const size_t *input_lens, uint8_t * const *outputs, size_t count)
+{
+    sha256_hash_many(outputs, inputs, input_lens, count);
+}
+
 NoiseHashState *noise_sha256_new(void)
 {
     NoiseSHA256State *state = noise_new(NoiseSHA256State);
@@ -59,5 +66,6 @@ NoiseHashState *noise_sha256_new(void)
     state->parent.reset = noise_sha256_reset;
     state->parent.update = noise_sha256_update;
     state->parent.finalize = noise_sha256_finalize;
+    state->parent.hash_many = noise_sha256_hash_many;
     return &(state->parent);
 }
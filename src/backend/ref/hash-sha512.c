@@ -48,6 +48,13 @@ static void noise_sha512_finalize(NoiseHashState *state, uint8_t *hash)
     sha512_finish(&(st->sha512), hash);
 }
 
+static void noise_sha512_hash_many
+    (NoiseHashState *state, const uint8_t * const *inputs,
+     const size_t *input_lens, uint8_t * const *outputs, size_t count)
+{
+    sha512_hash_many(outputs, inputs, input_lens, count);
+}
+
 NoiseHashState *noise_sha512_new(void)
 {
     NoiseSHA512State *state = noise_new(NoiseSHA512State);
@@ -59,5 +66,6 @@ NoiseHashState *noise_sha512_new(void)
     state->parent.reset = noise_sha512_reset;
     state->parent.update = noise_sha512_update;
     state->parent.finalize = noise_sha512_finalize;
+    state->parent.hash_many = noise_sha512_hash_many;
     return &(state->parent);
 }
@@ -77,6 +77,18 @@ static int noise_ed25519_sign
     return NOISE_ERROR_NONE;
 }
 
+static int noise_ed25519_sign_batch
+        (const NoiseSignState *state, const uint8_t * const *messages,
+         const size_t *message_lens, uint8_t * const *signatures,
+         size_t count)
+{
+    const NoiseEd25519State *st = (const NoiseEd25519State *)state;
+    ed25519_sign_batch((const unsigned char **)messages, message_lens,
+                       st->private_key, st->public_key,
+                       (unsigned char **)signatures, count);
+    return NOISE_ERROR_NONE;
+}
+
 static int noise_ed25519_verify
         (const NoiseSignState *state, const uint8_t *message,
          size_t message_len, const uint8_t *signature)
@@ -103,6 +115,7 @@ NoiseSignState *noise_ed25519_new(void)
     state->parent.validate_public_key = noise_ed25519_validate_public_key;
     state->parent.derive_public_key = noise_ed25519_derive_public_key;
     state->parent.sign = noise_ed25519_sign;
+    state->parent.sign_batch = noise_ed25519_sign_batch;
     state->parent.verify = noise_ed25519_verify;
     return &(state->parent);
 }
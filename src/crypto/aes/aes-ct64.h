@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Thomas Pornin <pornin@bolet.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CRYPTO_AES_CT64_h
+#define CRYPTO_AES_CT64_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number of blocks that are encrypted in parallel by aes_ct64_encrypt() */
+#define AES_CT64_BLOCKS     4
+
+typedef struct {
+    unsigned num_rounds;
+    uint64_t sk_exp[120];
+} aes_ct64_state;
+
+void aes_ct64_keysched(aes_ct64_state *state, const uint8_t *key, size_t key_len);
+void aes_ct64_encrypt(const aes_ct64_state *state, const uint8_t *in, uint8_t *out);
+
+/* Applies a single full AES round (SubBytes, ShiftRows, MixColumns, and
+   AddRoundKey) to 4 blocks, each with its own 16-byte round key in "rk" */
+void aes_ct64_round(const uint8_t *in, const uint8_t *rk, uint8_t *out);
+
+#endif
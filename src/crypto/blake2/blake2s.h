@@ -57,6 +57,9 @@ typedef struct
 void BLAKE2s_reset(BLAKE2s_context_t *context);
 void BLAKE2s_update(BLAKE2s_context_t *context, const void *data, size_t size);
 void BLAKE2s_finish(BLAKE2s_context_t *context, uint8_t *hash);
+void BLAKE2s_hash_many
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count);
 
 #ifdef __cplusplus
 };
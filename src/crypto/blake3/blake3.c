@@ -0,0 +1,696 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+    Implementation of BLAKE3 from the specification, with the 32-byte
+    unkeyed hash mode only.
+
+    https://github.com/BLAKE3-team/BLAKE3-specs
+
+    Whole subtrees of 1024-byte chunks are hashed several chunks at a time
+    using the GCC/clang vector extensions, with SSE4.1 and AVX2 versions
+    selected at runtime on x86-64.  Very large inputs can also be split
+    across a few threads if the library was configured with
+    --enable-blake3-threads; this is off by default so that hashing never
+    creates threads behind the application's back.
+*/
+
+#include "blake3.h"
+#include "../blake2/blake2-endian.h"
+#include <string.h>
+
+#if defined(NOISE_BLAKE3_THREADS) && defined(HAVE_PTHREAD)
+#define BLAKE3_USE_THREADS 1
+#include <pthread.h>
+#endif
+
+/* Initialization vector for BLAKE3, which is the same as for BLAKE2s */
+#define BLAKE3_IV0 0x6A09E667
+#define BLAKE3_IV1 0xBB67AE85
+#define BLAKE3_IV2 0x3C6EF372
+#define BLAKE3_IV3 0xA54FF53A
+#define BLAKE3_IV4 0x510E527F
+#define BLAKE3_IV5 0x9B05688C
+#define BLAKE3_IV6 0x1F83D9AB
+#define BLAKE3_IV7 0x5BE0CD19
+
+static uint32_t const iv[8] = {
+    BLAKE3_IV0, BLAKE3_IV1, BLAKE3_IV2, BLAKE3_IV3,
+    BLAKE3_IV4, BLAKE3_IV5, BLAKE3_IV6, BLAKE3_IV7
+};
+
+/* Domain separation flags */
+#define BLAKE3_CHUNK_START  0x01
+#define BLAKE3_CHUNK_END    0x02
+#define BLAKE3_PARENT       0x04
+#define BLAKE3_ROOT         0x08
+
+/* Message word order for each of the 7 rounds, which is the result of
+   applying the BLAKE3 message permutation once per round */
+static uint8_t const schedule[7][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8},
+    { 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1},
+    {10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6},
+    {12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4},
+    { 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7},
+    {11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13}
+};
+
+/* Number of chunks that are hashed as a unit before falling back to
+   recursive splitting of the subtree.  Must be a power of two */
+#define BLAKE3_LEAF_CHUNKS      32
+
+/* Subtrees with at least this many chunks are split across two threads,
+   down to a maximum depth of BLAKE3_THREAD_DEPTH (4 threads in total) */
+#define BLAKE3_THREAD_CHUNKS    512
+#define BLAKE3_THREAD_DEPTH     2
+
+/* Rotate right by a certain number of bits */
+#define rightRotate(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Perform a BLAKE3 quarter round operation */
+#define quarterRound(a, b, c, d, x, y) \
+    do { \
+        (a) += (b) + (x); \
+        (d) = rightRotate((d) ^ (a), 16); \
+        (c) += (d); \
+        (b) = rightRotate((b) ^ (c), 12); \
+        (a) += (b) + (y); \
+        (d) = rightRotate((d) ^ (a), 8); \
+        (c) += (d); \
+        (b) = rightRotate((b) ^ (c), 7); \
+    } while (0)
+
+/* Perform a full BLAKE3 round using the message order in "s" */
+#define fullRound(v, m, s) \
+    do { \
+        quarterRound(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]); \
+        quarterRound(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]); \
+        quarterRound(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]); \
+        quarterRound(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]); \
+        quarterRound(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]); \
+        quarterRound(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]); \
+        quarterRound(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]); \
+        quarterRound(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]); \
+    } while (0)
+
+static uint32_t load_le32(const uint8_t *d)
+{
+    return ((uint32_t)(d[0])) |
+          (((uint32_t)(d[1])) <<  8) |
+          (((uint32_t)(d[2])) << 16) |
+          (((uint32_t)(d[3])) << 24);
+}
+
+static void store_cv(uint8_t *out, const uint32_t *cv)
+{
+    uint8_t index;
+    for (index = 0; index < 8; ++index, out += 4) {
+        uint32_t word = cv[index];
+        out[0] = (uint8_t)word;
+        out[1] = (uint8_t)(word >> 8);
+        out[2] = (uint8_t)(word >> 16);
+        out[3] = (uint8_t)(word >> 24);
+    }
+}
+
+/* Compresses a single block into the chaining value "cv" */
+static void blake3_compress
+    (uint32_t *cv, const uint8_t *block, uint8_t block_len,
+     uint64_t counter, uint8_t flags)
+{
+    uint32_t m[16];
+    uint32_t v[16];
+    uint8_t index;
+
+    /* Format the block to be hashed */
+    for (index = 0; index < 16; ++index)
+        m[index] = load_le32(block + index * 4);
+    for (index = 0; index < 8; ++index)
+        v[index] = cv[index];
+    v[8]  = BLAKE3_IV0;
+    v[9]  = BLAKE3_IV1;
+    v[10] = BLAKE3_IV2;
+    v[11] = BLAKE3_IV3;
+    v[12] = (uint32_t)counter;
+    v[13] = (uint32_t)(counter >> 32);
+    v[14] = block_len;
+    v[15] = flags;
+
+    /* Perform the 7 BLAKE3 rounds */
+    for (index = 0; index < 7; ++index)
+        fullRound(v, m, schedule[index]);
+
+    /* Compute the new chaining value */
+    for (index = 0; index < 8; ++index)
+        cv[index] = v[index] ^ v[index + 8];
+}
+
+/* Hashes "count" inputs of "blocks" 64-byte blocks each, one at a time.
+   Input i uses the block counter "counter + i" if "increment" is set, and
+   its 32-byte chaining value is written to "out + i * 32" */
+static void blake3_hash_many_serial
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+    uint32_t cv[8];
+    size_t n;
+    uint8_t block_flags;
+    while (count > 0) {
+        memcpy(cv, iv, sizeof(cv));
+        for (n = 0; n < blocks; ++n) {
+            block_flags = flags;
+            if (n == 0)
+                block_flags |= flags_start;
+            if (n == (blocks - 1))
+                block_flags |= flags_end;
+            blake3_compress(cv, *inputs + n * 64, 64, counter, block_flags);
+        }
+        store_cv(out, cv);
+        ++inputs;
+        --count;
+        out += 32;
+        if (increment)
+            ++counter;
+    }
+}
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define BLAKE3_USE_LANES 1
+#define BLAKE3_LANES 8
+#if defined(__x86_64__)
+#define BLAKE3_USE_X86 1
+#endif
+#endif
+
+#if BLAKE3_USE_LANES
+
+typedef uint32_t Blake3LanesUInt32 __attribute__((__vector_size__(4 * BLAKE3_LANES)));
+
+#define BLAKE3_INLINE static inline __attribute__((__always_inline__))
+
+#if defined(__clang__)
+#define blake3_shuffle(a, b, ...) __builtin_shufflevector((a), (b), __VA_ARGS__)
+#else
+#define blake3_shuffle(a, b, ...) \
+    __builtin_shuffle((a), (b), (Blake3LanesUInt32){__VA_ARGS__})
+#endif
+
+#if BLAKE2_LITTLE_ENDIAN && BLAKE3_LANES == 8
+
+/* Transposes the 8 rows in "r" so that output i holds word i of every row.
+   The shuffles are the same as the AVX2 unpack and permute instructions */
+BLAKE3_INLINE void blake3_transpose(Blake3LanesUInt32 *out, Blake3LanesUInt32 *r)
+{
+    Blake3LanesUInt32 t0, t1, t2, t3, t4, t5, t6, t7;
+    Blake3LanesUInt32 u0, u1, u2, u3, u4, u5, u6, u7;
+    t0 = blake3_shuffle(r[0], r[1], 0, 8, 1, 9, 4, 12, 5, 13);
+    t1 = blake3_shuffle(r[0], r[1], 2, 10, 3, 11, 6, 14, 7, 15);
+    t2 = blake3_shuffle(r[2], r[3], 0, 8, 1, 9, 4, 12, 5, 13);
+    t3 = blake3_shuffle(r[2], r[3], 2, 10, 3, 11, 6, 14, 7, 15);
+    t4 = blake3_shuffle(r[4], r[5], 0, 8, 1, 9, 4, 12, 5, 13);
+    t5 = blake3_shuffle(r[4], r[5], 2, 10, 3, 11, 6, 14, 7, 15);
+    t6 = blake3_shuffle(r[6], r[7], 0, 8, 1, 9, 4, 12, 5, 13);
+    t7 = blake3_shuffle(r[6], r[7], 2, 10, 3, 11, 6, 14, 7, 15);
+    u0 = blake3_shuffle(t0, t2, 0, 1, 8, 9, 4, 5, 12, 13);
+    u1 = blake3_shuffle(t0, t2, 2, 3, 10, 11, 6, 7, 14, 15);
+    u2 = blake3_shuffle(t1, t3, 0, 1, 8, 9, 4, 5, 12, 13);
+    u3 = blake3_shuffle(t1, t3, 2, 3, 10, 11, 6, 7, 14, 15);
+    u4 = blake3_shuffle(t4, t6, 0, 1, 8, 9, 4, 5, 12, 13);
+    u5 = blake3_shuffle(t4, t6, 2, 3, 10, 11, 6, 7, 14, 15);
+    u6 = blake3_shuffle(t5, t7, 0, 1, 8, 9, 4, 5, 12, 13);
+    u7 = blake3_shuffle(t5, t7, 2, 3, 10, 11, 6, 7, 14, 15);
+    out[0] = blake3_shuffle(u0, u4, 0, 1, 2, 3, 8, 9, 10, 11);
+    out[1] = blake3_shuffle(u1, u5, 0, 1, 2, 3, 8, 9, 10, 11);
+    out[2] = blake3_shuffle(u2, u6, 0, 1, 2, 3, 8, 9, 10, 11);
+    out[3] = blake3_shuffle(u3, u7, 0, 1, 2, 3, 8, 9, 10, 11);
+    out[4] = blake3_shuffle(u0, u4, 4, 5, 6, 7, 12, 13, 14, 15);
+    out[5] = blake3_shuffle(u1, u5, 4, 5, 6, 7, 12, 13, 14, 15);
+    out[6] = blake3_shuffle(u2, u6, 4, 5, 6, 7, 12, 13, 14, 15);
+    out[7] = blake3_shuffle(u3, u7, 4, 5, 6, 7, 12, 13, 14, 15);
+}
+
+#define BLAKE3_USE_TRANSPOSE 1
+
+#endif
+
+typedef uint8_t Blake3LanesUInt8 __attribute__((__vector_size__(4 * BLAKE3_LANES)));
+
+#if defined(__clang__)
+#define blake3_shuffle_bytes(x, ...) \
+    ((Blake3LanesUInt32)__builtin_shufflevector \
+        ((Blake3LanesUInt8)(x), (Blake3LanesUInt8)(x), __VA_ARGS__))
+#else
+#define blake3_shuffle_bytes(x, ...) \
+    ((Blake3LanesUInt32)__builtin_shuffle \
+        ((Blake3LanesUInt8)(x), (Blake3LanesUInt8){__VA_ARGS__}))
+#endif
+
+/* Rotations by 16 and 8 bits can be done with a single byte shuffle on
+   processors that have PSHUFB, but are slower than shifts without it */
+#define rightRotate16Lanes(x) \
+    (byte_rotate ? blake3_shuffle_bytes((x), \
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, \
+        18, 19, 16, 17, 22, 23, 20, 21, 26, 27, 24, 25, 30, 31, 28, 29) \
+     : rightRotate((x), 16))
+#define rightRotate8Lanes(x) \
+    (byte_rotate ? blake3_shuffle_bytes((x), \
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, \
+        17, 18, 19, 16, 21, 22, 23, 20, 25, 26, 27, 24, 29, 30, 31, 28) \
+     : rightRotate((x), 8))
+
+/* Perform a BLAKE3 quarter round operation on all lanes */
+#define quarterRoundLanes(a, b, c, d, x, y) \
+    do { \
+        (a) += (b) + (x); \
+        (d) = rightRotate16Lanes((d) ^ (a)); \
+        (c) += (d); \
+        (b) = rightRotate((b) ^ (c), 12); \
+        (a) += (b) + (y); \
+        (d) = rightRotate8Lanes((d) ^ (a)); \
+        (c) += (d); \
+        (b) = rightRotate((b) ^ (c), 7); \
+    } while (0)
+
+/* Perform a full BLAKE3 round on all lanes */
+#define fullRoundLanes(v, m, s) \
+    do { \
+        quarterRoundLanes(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]); \
+        quarterRoundLanes(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]); \
+        quarterRoundLanes(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]); \
+        quarterRoundLanes(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]); \
+        quarterRoundLanes(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]); \
+        quarterRoundLanes(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]); \
+        quarterRoundLanes(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]); \
+        quarterRoundLanes(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]); \
+    } while (0)
+
+/* Same as blake3_hash_many_serial(), but hashes up to BLAKE3_LANES
+   inputs in parallel, one per vector lane.  "byte_rotate" is a constant
+   that selects byte shuffles for the 16 and 8 bit rotations */
+BLAKE3_INLINE void blake3_hash_lanes
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out, int byte_rotate)
+{
+    Blake3LanesUInt32 h[8];
+    Blake3LanesUInt32 m[16];
+    Blake3LanesUInt32 v[16];
+    Blake3LanesUInt32 counter_low;
+    Blake3LanesUInt32 counter_high;
+#if BLAKE3_USE_TRANSPOSE
+    Blake3LanesUInt32 rows[16];
+    const uint8_t *in[BLAKE3_LANES];
+#else
+    uint32_t words[16][BLAKE3_LANES];
+#endif
+    uint32_t cv[8];
+    size_t n, lane;
+    unsigned index;
+    uint8_t block_flags;
+
+    for (index = 0; index < 8; ++index)
+        h[index] = (Blake3LanesUInt32){0} + iv[index];
+    for (lane = 0; lane < BLAKE3_LANES; ++lane) {
+        uint64_t c = counter + (increment ? lane : 0);
+        counter_low[lane] = (uint32_t)c;
+        counter_high[lane] = (uint32_t)(c >> 32);
+    }
+#if BLAKE3_USE_TRANSPOSE
+    for (lane = 0; lane < BLAKE3_LANES; ++lane)
+        in[lane] = inputs[lane < count ? lane : 0];
+#else
+    memset(words, 0, sizeof(words));
+#endif
+
+    for (n = 0; n < blocks; ++n) {
+        /* Transpose the next block of each input into the lanes */
+#if BLAKE3_USE_TRANSPOSE
+        for (lane = 0; lane < BLAKE3_LANES; ++lane) {
+            memcpy(&(rows[lane]), in[lane] + n * 64, 32);
+            memcpy(&(rows[lane + 8]), in[lane] + n * 64 + 32, 32);
+        }
+        blake3_transpose(m, rows);
+        blake3_transpose(m + 8, rows + 8);
+#else
+        for (lane = 0; lane < count; ++lane) {
+            const uint8_t *d = inputs[lane] + n * 64;
+            for (index = 0; index < 16; ++index, d += 4)
+                words[index][lane] = load_le32(d);
+        }
+        for (index = 0; index < 16; ++index)
+            memcpy(&(m[index]), words[index], sizeof(m[index]));
+#endif
+
+        /* Format the block to be hashed */
+        block_flags = flags;
+        if (n == 0)
+            block_flags |= flags_start;
+        if (n == (blocks - 1))
+            block_flags |= flags_end;
+        for (index = 0; index < 8; ++index)
+            v[index] = h[index];
+        v[8]  = (Blake3LanesUInt32){0} + BLAKE3_IV0;
+        v[9]  = (Blake3LanesUInt32){0} + BLAKE3_IV1;
+        v[10] = (Blake3LanesUInt32){0} + BLAKE3_IV2;
+        v[11] = (Blake3LanesUInt32){0} + BLAKE3_IV3;
+        v[12] = counter_low;
+        v[13] = counter_high;
+        v[14] = (Blake3LanesUInt32){0} + 64;
+        v[15] = (Blake3LanesUInt32){0} + block_flags;
+
+        /* Perform the 7 BLAKE3 rounds, unrolled so that the message
+           word for each step is known at compile time */
+        fullRoundLanes(v, m, schedule[0]);
+        fullRoundLanes(v, m, schedule[1]);
+        fullRoundLanes(v, m, schedule[2]);
+        fullRoundLanes(v, m, schedule[3]);
+        fullRoundLanes(v, m, schedule[4]);
+        fullRoundLanes(v, m, schedule[5]);
+        fullRoundLanes(v, m, schedule[6]);
+        for (index = 0; index < 8; ++index)
+            h[index] = v[index] ^ v[index + 8];
+    }
+
+    /* Save the chaining value of each input in little-endian */
+    for (lane = 0; lane < count; ++lane) {
+        for (index = 0; index < 8; ++index)
+            cv[index] = h[index][lane];
+        store_cv(out + lane * 32, cv);
+    }
+}
+
+static void blake3_hash_lanes_generic
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+    blake3_hash_lanes(inputs, count, blocks, counter, increment,
+                      flags, flags_start, flags_end, out, 0);
+}
+
+#if BLAKE3_USE_X86
+
+__attribute__((target("sse4.1")))
+static void blake3_hash_lanes_sse41
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+    blake3_hash_lanes(inputs, count, blocks, counter, increment,
+                      flags, flags_start, flags_end, out, 1);
+}
+
+__attribute__((target("avx2")))
+static void blake3_hash_lanes_avx2
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+    blake3_hash_lanes(inputs, count, blocks, counter, increment,
+                      flags, flags_start, flags_end, out, 1);
+}
+
+#endif
+
+typedef void (*blake3_hash_lanes_t)
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out);
+
+static blake3_hash_lanes_t blake3_select_lanes(void)
+{
+#if BLAKE3_USE_X86
+    static blake3_hash_lanes_t volatile impl = 0;
+    blake3_hash_lanes_t func = impl;
+    if (!func) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            func = blake3_hash_lanes_avx2;
+        else if (__builtin_cpu_supports("sse4.1"))
+            func = blake3_hash_lanes_sse41;
+        else
+            func = blake3_hash_lanes_generic;
+        impl = func;
+    }
+    return func;
+#else
+    return blake3_hash_lanes_generic;
+#endif
+}
+
+#endif /* BLAKE3_USE_LANES */
+
+/* Hashes "count" inputs of "blocks" blocks each, using the vector lanes
+   when there are enough inputs to make it worthwhile */
+static void blake3_hash_many
+    (const uint8_t * const *inputs, size_t count, size_t blocks,
+     uint64_t counter, int increment, uint8_t flags,
+     uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+#if BLAKE3_USE_LANES
+    blake3_hash_lanes_t func = blake3_select_lanes();
+    size_t lanes;
+    while (count > 2) {
+        lanes = count < BLAKE3_LANES ? count : BLAKE3_LANES;
+        (*func)(inputs, lanes, blocks, counter, increment,
+                flags, flags_start, flags_end, out);
+        inputs += lanes;
+        count -= lanes;
+        out += lanes * 32;
+        if (increment)
+            counter += lanes;
+    }
+#endif
+    blake3_hash_many_serial(inputs, count, blocks, counter, increment,
+                            flags, flags_start, flags_end, out);
+}
+
+/* Hashes a parent node made up of the 64 bytes at "block" */
+static void blake3_hash_parent(const uint8_t *block, uint8_t *out)
+{
+    uint32_t cv[8];
+    memcpy(cv, iv, sizeof(cv));
+    blake3_compress(cv, block, 64, 0, BLAKE3_PARENT);
+    store_cv(out, cv);
+}
+
+/* Hashes a complete subtree of "chunks" chunks, where "chunks" is a
+   power of two, and returns the 32-byte chaining value of its root */
+static void blake3_hash_subtree
+    (const uint8_t *input, size_t chunks, uint64_t counter,
+     uint8_t *out, unsigned depth);
+
+#if BLAKE3_USE_THREADS
+
+typedef struct
+{
+    const uint8_t *input;
+    size_t chunks;
+    uint64_t counter;
+    uint8_t *out;
+    unsigned depth;
+
+} BLAKE3_job_t;
+
+static void *blake3_job_thread(void *arg)
+{
+    BLAKE3_job_t *job = (BLAKE3_job_t *)arg;
+    blake3_hash_subtree
+        (job->input, job->chunks, job->counter, job->out, job->depth);
+    return 0;
+}
+
+#endif
+
+static void blake3_hash_subtree
+    (const uint8_t *input, size_t chunks, uint64_t counter,
+     uint8_t *out, unsigned depth)
+{
+    const uint8_t *inputs[BLAKE3_LEAF_CHUNKS];
+    uint8_t cvs[BLAKE3_LEAF_CHUNKS * 32];
+    size_t index;
+
+    if (chunks <= BLAKE3_LEAF_CHUNKS) {
+        /* Hash all of the chunks and then the parents level by level */
+        inputs[0] = input;
+        for (index = 1; index < chunks; ++index)
+            inputs[index] = input + index * BLAKE3_CHUNK_LEN;
+        blake3_hash_many(inputs, chunks, BLAKE3_CHUNK_LEN / 64, counter, 1,
+                         0, BLAKE3_CHUNK_START, BLAKE3_CHUNK_END, cvs);
+        while (chunks > 1) {
+            chunks /= 2;
+            for (index = 0; index < chunks; ++index)
+                inputs[index] = cvs + index * 64;
+            blake3_hash_many(inputs, chunks, 1, 0, 0,
+                             BLAKE3_PARENT, 0, 0, cvs);
+        }
+        memcpy(out, cvs, 32);
+    } else {
+        /* Hash the two halves, possibly on separate threads */
+        size_t half = chunks / 2;
+        const uint8_t *right = input + half * BLAKE3_CHUNK_LEN;
+#if BLAKE3_USE_THREADS
+        if (chunks >= BLAKE3_THREAD_CHUNKS && depth < BLAKE3_THREAD_DEPTH) {
+            BLAKE3_job_t job;
+            pthread_t thread;
+            job.input = input;
+            job.chunks = half;
+            job.counter = counter;
+            job.out = cvs;
+            job.depth = depth + 1;
+            if (pthread_create(&thread, 0, blake3_job_thread, &job) == 0) {
+                blake3_hash_subtree
+                    (right, half, counter + half, cvs + 32, depth + 1);
+                pthread_join(thread, 0);
+                blake3_hash_parent(cvs, out);
+                return;
+            }
+        }
+#endif
+        blake3_hash_subtree(input, half, counter, cvs, depth + 1);
+        blake3_hash_subtree(right, half, counter + half, cvs + 32, depth + 1);
+        blake3_hash_parent(cvs, out);
+    }
+}
+
+/* Pushes the chaining value of a subtree onto the stack and then merges
+   completed subtrees until there is one entry per 1 bit in the new total
+   number of chunks.  This is only called when more input is coming, so it
+   is never necessary to hold back a merge for the root */
+static void blake3_push_cv
+    (BLAKE3_context_t *context, const uint8_t *cv, uint64_t total_chunks)
+{
+    uint8_t count = 0;
+    while (total_chunks != 0) {
+        count += (uint8_t)(total_chunks & 1);
+        total_chunks >>= 1;
+    }
+    memcpy(context->stack[context->stack_len], cv, 32);
+    ++(context->stack_len);
+    while (context->stack_len > count) {
+        --(context->stack_len);
+        blake3_hash_parent(context->stack[context->stack_len - 1],
+                           context->stack[context->stack_len - 1]);
+    }
+}
+
+void BLAKE3_reset(BLAKE3_context_t *context)
+{
+    memcpy(context->cv, iv, sizeof(context->cv));
+    context->chunk_counter = 0;
+    context->posn = 0;
+    context->blocks_compressed = 0;
+    context->stack_len = 0;
+}
+
+void BLAKE3_update(BLAKE3_context_t *context, const void *data, size_t size)
+{
+    const uint8_t *d = (const uint8_t *)data;
+    uint8_t cv[32];
+    uint64_t chunks;
+    size_t len, temp;
+    while (size > 0) {
+        len = context->blocks_compressed * 64 + context->posn;
+        if (len == BLAKE3_CHUNK_LEN) {
+            /* The current chunk is full and there is more input,
+               so it cannot be the root and can be finalized */
+            blake3_compress(context->cv, context->m, 64,
+                            context->chunk_counter, BLAKE3_CHUNK_END);
+            store_cv(cv, context->cv);
+            ++(context->chunk_counter);
+            blake3_push_cv(context, cv, context->chunk_counter);
+            memcpy(context->cv, iv, sizeof(context->cv));
+            context->posn = 0;
+            context->blocks_compressed = 0;
+            len = 0;
+        }
+        if (len == 0 && size > BLAKE3_CHUNK_LEN) {
+            /* Hash the largest subtree that is aligned with the current
+               position and leaves at least one byte for the last chunk */
+            chunks = 1;
+            while ((chunks * 2 * BLAKE3_CHUNK_LEN) < size)
+                chunks *= 2;
+            while ((context->chunk_counter & (chunks - 1)) != 0)
+                chunks /= 2;
+            blake3_hash_subtree(d, (size_t)chunks, context->chunk_counter,
+                                cv, 0);
+            context->chunk_counter += chunks;
+            blake3_push_cv(context, cv, context->chunk_counter);
+            d += chunks * BLAKE3_CHUNK_LEN;
+            size -= chunks * BLAKE3_CHUNK_LEN;
+            continue;
+        }
+        if (context->posn == 64) {
+            /* Compress the buffered block now that we know it isn't last */
+            blake3_compress(context->cv, context->m, 64,
+                            context->chunk_counter,
+                            context->blocks_compressed ? 0 : BLAKE3_CHUNK_START);
+            ++(context->blocks_compressed);
+            context->posn = 0;
+        }
+        temp = 64 - context->posn;
+        if (temp > size)
+            temp = size;
+        memcpy(context->m + context->posn, d, temp);
+        context->posn += (uint8_t)temp;
+        d += temp;
+        size -= temp;
+    }
+}
+
+void BLAKE3_finish(BLAKE3_context_t *context, uint8_t *hash)
+{
+    uint32_t cv[8];
+    uint8_t block[64];
+    uint8_t block_len = context->posn;
+    uint64_t counter = context->chunk_counter;
+    uint8_t flags = BLAKE3_CHUNK_END;
+    uint8_t index = context->stack_len;
+
+    /* Start with the output of the current chunk */
+    memcpy(cv, context->cv, sizeof(cv));
+    memcpy(block, context->m, block_len);
+    memset(block + block_len, 0, sizeof(block) - block_len);
+    if (!context->blocks_compressed)
+        flags |= BLAKE3_CHUNK_START;
+
+    /* Merge with the subtrees on the stack from right to left */
+    while (index > 0) {
+        --index;
+        blake3_compress(cv, block, block_len, counter, flags);
+        memcpy(block, context->stack[index], 32);
+        store_cv(block + 32, cv);
+        memcpy(cv, iv, sizeof(cv));
+        block_len = 64;
+        counter = 0;
+        flags = BLAKE3_PARENT;
+    }
+
+    /* Compress the root node to get the final hash */
+    blake3_compress(cv, block, block_len, counter, flags | BLAKE3_ROOT);
+    store_cv(hash, cv);
+    memset(cv, 0, sizeof(cv));
+    memset(block, 0, sizeof(block));
+}
@@ -9,7 +9,10 @@
 	void ed25519_hash(uint8_t *hash, const uint8_t *in, size_t inlen);
 */
 
-/* Definitions for using the SHA512 code from Noise-C */
+/* Definitions for using the SHA512 code from Noise-C.  sha512_update()
+   and sha512_finish() select the AVX2/BMI2 compression function at
+   runtime when the CPU supports it, so signing and verification pick
+   it up without any changes to ed25519-donna itself */
 
 #include "../sha2/sha512.h"
 
@@ -90,6 +90,96 @@ ED25519_FN(ed25519_sign) (const unsigned char *m, size_t mlen, const ed25519_sec
 	contract256_modm(RS + 32, S);
 }
 
+/*
+	Number of signatures that share one field inversion in ed25519_sign_batch
+*/
+
+#if !defined(ED25519_SIGN_BATCH)
+#define ED25519_SIGN_BATCH 16
+#endif
+
+/*
+	Packs num points using a single field inversion (Montgomery's trick)
+*/
+
+static void
+ge25519_pack_batch(unsigned char **r, const ge25519 *p, size_t num) {
+	bignum25519 ALIGN(16) acc[ED25519_SIGN_BATCH];
+	bignum25519 ALIGN(16) inv, zi, tx, ty;
+	unsigned char parity[32];
+	size_t i;
+
+	/* acc[i] = z[0] * z[1] * ... * z[i] */
+	curve25519_copy(acc[0], p[0].z);
+	for (i = 1; i < num; i++)
+		curve25519_mul(acc[i], acc[i - 1], p[i].z);
+
+	/* inv = 1 / (z[0] * ... * z[num - 1]) */
+	curve25519_recip(inv, acc[num - 1]);
+
+	/* Peel off one z at a time, from the last point to the first */
+	for (i = num; i-- > 0;) {
+		if (i > 0) {
+			curve25519_mul(zi, inv, acc[i - 1]);
+			curve25519_mul(inv, inv, p[i].z);
+		} else {
+			curve25519_copy(zi, inv);
+		}
+		curve25519_mul(tx, p[i].x, zi);
+		curve25519_mul(ty, p[i].y, zi);
+		curve25519_contract(r[i], ty);
+		curve25519_contract(parity, tx);
+		r[i][31] ^= ((parity[0] & 1) << 7);
+	}
+}
+
+void
+ED25519_FN(ed25519_sign_batch) (const unsigned char **m, const size_t *mlen, const ed25519_secret_key sk, const ed25519_public_key pk, unsigned char **RS, size_t num) {
+	ed25519_hash_context ctx;
+	bignum256modm r[ED25519_SIGN_BATCH], S, a;
+	ge25519 ALIGN(16) R[ED25519_SIGN_BATCH];
+	hash_512bits extsk, hashr, hram;
+	size_t i, count;
+
+	/* The expanded secret key is the same for every message */
+	ed25519_extsk(extsk, sk);
+	expand256_modm(a, extsk, 32);
+
+	while (num > 0) {
+		count = (num < ED25519_SIGN_BATCH) ? num : ED25519_SIGN_BATCH;
+
+		/* r = H(aExt[32..64], m) for all messages in the batch */
+		for (i = 0; i < count; i++) {
+			ed25519_hash_init(&ctx);
+			ed25519_hash_update(&ctx, extsk + 32, 32);
+			ed25519_hash_update(&ctx, m[i], mlen[i]);
+			ed25519_hash_final(&ctx, hashr);
+			expand256_modm(r[i], hashr, 64);
+		}
+
+		/* R = rB */
+		for (i = 0; i < count; i++)
+			ge25519_scalarmult_base_niels(&R[i], ge25519_niels_base_multiples, r[i]);
+
+		/* Compress all of the R values with one shared inversion */
+		ge25519_pack_batch(RS, R, count);
+
+		/* S = (r + H(R,A,m)a) mod L */
+		for (i = 0; i < count; i++) {
+			ed25519_hram(hram, RS[i], pk, m[i], mlen[i]);
+			expand256_modm(S, hram, 64);
+			mul256_modm(S, S, a);
+			add256_modm(S, S, r[i]);
+			contract256_modm(RS[i] + 32, S);
+		}
+
+		m += count;
+		mlen += count;
+		RS += count;
+		num -= count;
+	}
+}
+
 int
 ED25519_FN(ed25519_sign_open) (const unsigned char *m, size_t mlen, const ed25519_public_key pk, const ed25519_signature RS) {
 	ge25519 ALIGN(16) R, A;
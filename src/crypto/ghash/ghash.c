@@ -20,167 +20,179 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+/*
+ * The field multiplication is adapted from the "ctmul64" GHASH in BearSSL:
+ *
+ * Copyright (c) 2016 Thomas Pornin <pornin@bolet.org>
+ * (MIT license, see the top of the file for the conditions)
+ *
+ * Carry-less 64x64 multiplications are emulated with regular integer
+ * multiplications on masked operands, so there are no table lookups
+ * or data-dependent branches.  Four blocks at a time are multiplied by
+ * precomputed powers of H and summed before a single reduction.
+ */
+
 #include "ghash.h"
 #include <string.h>
-#if defined(__WIN32__) || defined(WIN32)
-#ifndef __BIG_ENDIAN
-#define __BIG_ENDIAN 4321
-#endif
-#ifndef __LITTLE_ENDIAN
-#define __LITTLE_ENDIAN 1234
-#endif
-#ifndef __BYTE_ORDER
-#define __BYTE_ORDER __LITTLE_ENDIAN
-#endif
-#elif defined(__APPLE__)
-#include <machine/endian.h>
-#if !defined( __BYTE_ORDER) && defined(__DARWIN_BYTE_ORDER)
-#define __BYTE_ORDER __DARWIN_BYTE_ORDER
-#endif
-#if !defined( __BIG_ENDIAN) && defined(__DARWIN_BIG_ENDIAN)
-#define __BIG_ENDIAN __DARWIN_BIG_ENDIAN
-#endif
-#if !defined( __LITTLE_ENDIAN) && defined(__DARWIN_LITTLE_ENDIAN)
-#define __LITTLE_ENDIAN __DARWIN_LITTLE_ENDIAN
-#endif
-#else
-#include <endian.h>
-#endif
-
-#if defined(GHASH_WORD64)
-
-/* 64-bit version of GHASH */
-
-static uint64_t swapEndian(uint64_t x)
+
+static uint64_t dec64be(const uint8_t *src)
 {
-#if __BYTE_ORDER == __BIG_ENDIAN
-    return x;
-#else
-    return ((x >> 56) & 0x00000000000000FF) |
-           ((x >> 40) & 0x000000000000FF00) |
-           ((x >> 24) & 0x0000000000FF0000) |
-           ((x >>  8) & 0x00000000FF000000) |
-           ((x <<  8) & 0x000000FF00000000) |
-           ((x << 24) & 0x0000FF0000000000) |
-           ((x << 40) & 0x00FF000000000000) |
-           ((x << 56) & 0xFF00000000000000);
-#endif
+    return ((uint64_t)src[0] << 56) | ((uint64_t)src[1] << 48) |
+           ((uint64_t)src[2] << 40) | ((uint64_t)src[3] << 32) |
+           ((uint64_t)src[4] << 24) | ((uint64_t)src[5] << 16) |
+           ((uint64_t)src[6] << 8)  |  (uint64_t)src[7];
 }
 
-static void GF128_mulInit(uint64_t H[2], const void *key)
+static void enc64be(uint8_t *dst, uint64_t x)
 {
-    /* Copy the key into H and convert from big endian to host order */
-    memcpy(H, key, 16);
-    H[0] = swapEndian(H[0]);
-    H[1] = swapEndian(H[1]);
+    dst[0] = (uint8_t)(x >> 56);
+    dst[1] = (uint8_t)(x >> 48);
+    dst[2] = (uint8_t)(x >> 40);
+    dst[3] = (uint8_t)(x >> 32);
+    dst[4] = (uint8_t)(x >> 24);
+    dst[5] = (uint8_t)(x >> 16);
+    dst[6] = (uint8_t)(x >> 8);
+    dst[7] = (uint8_t)x;
 }
 
-static void GF128_mul(uint64_t Y[2], const uint64_t H[2])
+/* Carry-less multiplication of two 64-bit values, keeping the low half */
+static uint64_t bmul64(uint64_t x, uint64_t y)
 {
-    uint64_t Z0 = 0;        /* Z = 0 */
-    uint64_t Z1 = 0;
-    uint64_t V0 = H[0];     /* V = H */
-    uint64_t V1 = H[1];
-
-    /* Multiply Z by V for the set bits in Y, starting at the top.
-       This is a very simple bit by bit version that may not be very
-       fast but it should be resistant to cache timing attacks. */
-    for (uint8_t posn = 0; posn < 16; ++posn) {
-        uint8_t value = ((const uint8_t *)Y)[posn];
-        for (uint8_t bit = 0; bit < 8; ++bit, value <<= 1) {
-            /* Extract the high bit of "value" and turn it into a mask */
-            uint64_t mask = (~((uint64_t)(value >> 7))) + 1;
-
-            /* XOR V with Z if the bit is 1 */
-            Z0 ^= (V0 & mask);
-            Z1 ^= (V1 & mask);
-
-            /* Rotate V right by 1 bit */
-            mask = ((~(V1 & 0x01)) + 1) & 0xE100000000000000ULL;
-            V1 = (V1 >> 1) | (V0 << 63);
-            V0 = (V0 >> 1) ^ mask;
-        }
-    }
+    uint64_t x0, x1, x2, x3;
+    uint64_t y0, y1, y2, y3;
+    uint64_t z0, z1, z2, z3;
 
-    /* We have finished the block so copy Z into Y and byte-swap */
-    Y[0] = swapEndian(Z0);
-    Y[1] = swapEndian(Z1);
+    x0 = x & 0x1111111111111111ULL;
+    x1 = x & 0x2222222222222222ULL;
+    x2 = x & 0x4444444444444444ULL;
+    x3 = x & 0x8888888888888888ULL;
+    y0 = y & 0x1111111111111111ULL;
+    y1 = y & 0x2222222222222222ULL;
+    y2 = y & 0x4444444444444444ULL;
+    y3 = y & 0x8888888888888888ULL;
+    z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+    z0 &= 0x1111111111111111ULL;
+    z1 &= 0x2222222222222222ULL;
+    z2 &= 0x4444444444444444ULL;
+    z3 &= 0x8888888888888888ULL;
+    return z0 | z1 | z2 | z3;
 }
 
-#else /* GHASH_WORD32 */
-
-/* Default 32-bit version of GHASH */
+/* Reverses the bits in a 64-bit value */
+static uint64_t rev64(uint64_t x)
+{
+#define RMS(m, s) \
+    do { \
+        x = ((x & (uint64_t)(m)) << (s)) | ((x >> (s)) & (uint64_t)(m)); \
+    } while (0)
+    RMS(0x5555555555555555ULL, 1);
+    RMS(0x3333333333333333ULL, 2);
+    RMS(0x0F0F0F0F0F0F0F0FULL, 4);
+    RMS(0x00FF00FF00FF00FFULL, 8);
+    RMS(0x0000FFFF0000FFFFULL, 16);
+#undef RMS
+    return (x << 32) | (x >> 32);
+}
 
-static uint32_t swapEndian(uint32_t x)
+/* Sets a power of H in the form needed by GF128_mulAcc() */
+static void GF128_setPower(uint64_t P[4], uint64_t h1, uint64_t h0)
 {
-#if __BYTE_ORDER == __BIG_ENDIAN
-    return x;
-#else
-    return ((x >> 24) & 0x000000FF) |
-           ((x >>  8) & 0x0000FF00) |
-           ((x <<  8) & 0x00FF0000) |
-           ((x << 24) & 0xFF000000);
-#endif
+    P[0] = h1;
+    P[1] = h0;
+    P[2] = rev64(h1);
+    P[3] = rev64(h0);
 }
 
-static void GF128_mulInit(uint32_t H[4], const void *key)
+/* Multiplies (y1, y0) by a power of H and adds the unreduced 256-bit
+   product to V.  Uses Karatsuba on the low and bit-reversed high halves */
+static void GF128_mulAcc(uint64_t V[4], uint64_t y1, uint64_t y0,
+                         const uint64_t P[4])
 {
-    /* Copy the key into H and convert from big endian to host order */
-    memcpy(H, key, 16);
-    H[0] = swapEndian(H[0]);
-    H[1] = swapEndian(H[1]);
-    H[2] = swapEndian(H[2]);
-    H[3] = swapEndian(H[3]);
+    uint64_t h1 = P[0], h0 = P[1], h1r = P[2], h0r = P[3];
+    uint64_t y0r, y1r, y2, y2r, h2, h2r;
+    uint64_t z0, z1, z2, z0h, z1h, z2h;
+
+    y0r = rev64(y0);
+    y1r = rev64(y1);
+    y2 = y0 ^ y1;
+    y2r = y0r ^ y1r;
+    h2 = h0 ^ h1;
+    h2r = h0r ^ h1r;
+
+    z0 = bmul64(y0, h0);
+    z1 = bmul64(y1, h1);
+    z2 = bmul64(y2, h2);
+    z0h = bmul64(y0r, h0r);
+    z1h = bmul64(y1r, h1r);
+    z2h = bmul64(y2r, h2r);
+    z2 ^= z0 ^ z1;
+    z2h ^= z0h ^ z1h;
+    z0h = rev64(z0h) >> 1;
+    z1h = rev64(z1h) >> 1;
+    z2h = rev64(z2h) >> 1;
+
+    V[0] ^= z0;
+    V[1] ^= z0h ^ z2;
+    V[2] ^= z1 ^ z2h;
+    V[3] ^= z1h;
 }
 
-static void GF128_mul(uint32_t Y[4], const uint32_t H[4])
+/* Reduces a 256-bit product modulo the GHASH polynomial */
+static void GF128_reduce(uint64_t *y1, uint64_t *y0, const uint64_t V[4])
 {
-    uint32_t Z0 = 0;        /* Z = 0 */
-    uint32_t Z1 = 0;
-    uint32_t Z2 = 0;
-    uint32_t Z3 = 0;
-    uint32_t V0 = H[0];     /* V = H */
-    uint32_t V1 = H[1];
-    uint32_t V2 = H[2];
-    uint32_t V3 = H[3];
-
-    /* Multiply Z by V for the set bits in Y, starting at the top.
-       This is a very simple bit by bit version that may not be very
-       fast but it should be resistant to cache timing attacks. */
-    for (uint8_t posn = 0; posn < 16; ++posn) {
-        uint8_t value = ((const uint8_t *)Y)[posn];
-        for (uint8_t bit = 0; bit < 8; ++bit, value <<= 1) {
-            /* Extract the high bit of "value" and turn it into a mask */
-            uint32_t mask = (~((uint32_t)(value >> 7))) + 1;
-
-            /* XOR V with Z if the bit is 1 */
-            Z0 ^= (V0 & mask);
-            Z1 ^= (V1 & mask);
-            Z2 ^= (V2 & mask);
-            Z3 ^= (V3 & mask);
-
-            /* Rotate V right by 1 bit */
-            mask = ((~(V3 & 0x01)) + 1) & 0xE1000000;
-            V3 = (V3 >> 1) | (V2 << 31);
-            V2 = (V2 >> 1) | (V1 << 31);
-            V1 = (V1 >> 1) | (V0 << 31);
-            V0 = (V0 >> 1) ^ mask;
-        }
-    }
+    uint64_t v0 = V[0], v1 = V[1], v2 = V[2], v3 = V[3];
+
+    v3 = (v3 << 1) | (v2 >> 63);
+    v2 = (v2 << 1) | (v1 >> 63);
+    v1 = (v1 << 1) | (v0 >> 63);
+    v0 = (v0 << 1);
 
-    /* We have finished the block so copy Z into Y and byte-swap */
-    Y[0] = swapEndian(Z0);
-    Y[1] = swapEndian(Z1);
-    Y[2] = swapEndian(Z2);
-    Y[3] = swapEndian(Z3);
+    v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+    v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+    v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+    v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+
+    *y0 = v2;
+    *y1 = v3;
 }
 
-#endif /* GHASH_WORD32 */
+/* Multiplies (y1, y0) by a power of H */
+static void GF128_mul(uint64_t *y1, uint64_t *y0, const uint64_t P[4])
+{
+    uint64_t V[4] = {0, 0, 0, 0};
+    GF128_mulAcc(V, *y1, *y0, P);
+    GF128_reduce(y1, y0, V);
+}
+
+/* Multiplies Y by H */
+static void ghash_mul(ghash_state *state)
+{
+    uint64_t y1, y0;
+    y1 = dec64be(state->Y);
+    y0 = dec64be(state->Y + 8);
+    GF128_mul(&y1, &y0, state->H[0]);
+    enc64be(state->Y, y1);
+    enc64be(state->Y + 8, y0);
+}
 
 void ghash_reset(ghash_state *state, const void *key)
 {
-    if (key)
-        GF128_mulInit(state->H, (const void *)key);
+    if (key) {
+        uint64_t h1, h0, y1, y0;
+        int i;
+        h1 = dec64be((const uint8_t *)key);
+        h0 = dec64be(((const uint8_t *)key) + 8);
+        GF128_setPower(state->H[0], h1, h0);
+        y1 = h1;
+        y0 = h0;
+        for (i = 1; i < GHASH_POWERS; ++i) {
+            GF128_mul(&y1, &y0, state->H[0]);
+            GF128_setPower(state->H[i], y1, y0);
+        }
+    }
     memset(state->Y, 0, sizeof(state->Y));
     state->posn = 0;
 }
@@ -188,18 +200,41 @@ void ghash_reset(ghash_state *state, const void *key)
 void ghash_update(ghash_state *state, const void *data, size_t len)
 {
     const uint8_t *d = (const uint8_t *)data;
+
+    /* Process four blocks at a time when we are on a block boundary:
+       Y = (Y ^ X1) * H^4 ^ X2 * H^3 ^ X3 * H^2 ^ X4 * H */
+    if (state->posn == 0 && len >= 16 * GHASH_POWERS) {
+        uint64_t y1, y0, V[4];
+        y1 = dec64be(state->Y);
+        y0 = dec64be(state->Y + 8);
+        while (len >= 16 * GHASH_POWERS) {
+            V[0] = V[1] = V[2] = V[3] = 0;
+            GF128_mulAcc(V, y1 ^ dec64be(d), y0 ^ dec64be(d + 8),
+                         state->H[3]);
+            GF128_mulAcc(V, dec64be(d + 16), dec64be(d + 24), state->H[2]);
+            GF128_mulAcc(V, dec64be(d + 32), dec64be(d + 40), state->H[1]);
+            GF128_mulAcc(V, dec64be(d + 48), dec64be(d + 56), state->H[0]);
+            GF128_reduce(&y1, &y0, V);
+            d += 16 * GHASH_POWERS;
+            len -= 16 * GHASH_POWERS;
+        }
+        enc64be(state->Y, y1);
+        enc64be(state->Y + 8, y0);
+    }
+
+    /* Process the remaining data one block at a time */
     while (len > 0) {
         uint8_t size = 16 - state->posn;
         if (size > len)
             size = len;
-        uint8_t *y = ((uint8_t *)state->Y) + state->posn;
+        uint8_t *y = state->Y + state->posn;
         for (uint8_t i = 0; i < size; ++i)
             y[i] ^= d[i];
         state->posn += size;
         len -= size;
         d += size;
         if (state->posn == 16) {
-            GF128_mul(state->Y, state->H);
+            ghash_mul(state);
             state->posn = 0;
         }
     }
@@ -218,7 +253,7 @@ void ghash_pad(ghash_state *state)
     if (state->posn != 0) {
         /* Padding involves XOR'ing the rest of state->Y with zeroes,
            which does nothing.  Immediately process the next chunk */
-        GF128_mul(state->Y, state->H);
+        ghash_mul(state);
         state->posn = 0;
     }
 }
@@ -23,6 +23,17 @@
 #include "sha256.h"
 #include <string.h>
 
+/* sha256_hash_many() processes several messages in parallel using the
+   GCC/clang vector extensions, with an AVX2 version selected at runtime
+   on x86-64.  Other compilers hash the messages one at a time */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define SHA256_USE_LANES 1
+#define SHA256_LANES 8
+#if defined(__x86_64__)
+#define SHA256_USE_AVX2 1
+#endif
+#endif
+
 void sha256_reset(sha256_context_t *context)
 {
     context->h[0] = 0x6a09e667;
@@ -39,26 +50,27 @@ void sha256_reset(sha256_context_t *context)
 
 #define rightRotate(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
 
+static uint32_t const k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 static void sha256_transform(sha256_context_t *context, const uint8_t *m)
 {
-    static uint32_t const k[64] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
     unsigned index;
     uint32_t temp1, temp2;
     uint32_t w[64];
@@ -179,3 +191,217 @@ void sha256_finish(sha256_context_t *context, uint8_t *hash)
     for (posn = 0; posn < 8; ++posn)
         write_be32(hash + posn * 4, context->h[posn]);
 }
+
+void sha256_hash(uint8_t *hash, const void *data, size_t size)
+{
+    sha256_context_t context;
+    sha256_reset(&context);
+    sha256_update(&context, data, size);
+    sha256_finish(&context, hash);
+}
+
+/**
+ * \brief Fetches a block of the padded form of a message.
+ *
+ * \param block Returns the 64 bytes of the block.
+ * \param data Points to the message.
+ * \param size Length of the message in bytes.
+ * \param n Index of the block to fetch.
+ * \param nblocks Total number of blocks in the padded message.
+ */
+static void sha256_padded_block
+    (uint8_t *block, const uint8_t *data, size_t size, size_t n, size_t nblocks)
+{
+    size_t posn = n * 64;
+    size_t len = 0;
+    uint64_t bits;
+    if (posn < size) {
+        len = size - posn;
+        if (len > 64)
+            len = 64;
+        memcpy(block, data + posn, len);
+    }
+    memset(block + len, 0, 64 - len);
+    if (size >= posn && size < (posn + 64))
+        block[size - posn] = 0x80;
+    if (n == (nblocks - 1)) {
+        bits = ((uint64_t)size) * 8;
+        write_be32(block + 64 - 8, (uint32_t)(bits >> 32));
+        write_be32(block + 64 - 4, (uint32_t)bits);
+    }
+}
+
+#if SHA256_USE_LANES
+
+typedef uint32_t sha256_lanes_t __attribute__((__vector_size__(4 * SHA256_LANES)));
+
+#define SHA256_INLINE static inline __attribute__((__always_inline__))
+
+/* Round function for several independent messages at once */
+#define SHA256_LANE_ROUND(a, b, c, d, e, f, g, h, n) \
+    do { \
+        sha256_lanes_t temp1, temp2; \
+        temp1 = (h) + k[index + (n)] + w[index + (n)] + \
+            (rightRotate((e), 6) ^ rightRotate((e), 11) ^ \
+             rightRotate((e), 25)) + \
+            (((e) & (f)) ^ ((~(e)) & (g))); \
+        temp2 = (rightRotate((a), 2) ^ rightRotate((a), 13) ^ \
+                 rightRotate((a), 22)) + \
+            (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c))); \
+        (d) += temp1; \
+        (h) = temp1 + temp2; \
+    } while (0)
+
+/* Compresses one block from each lane; w[0..15] holds the message words */
+SHA256_INLINE void sha256_transform_lanes(sha256_lanes_t *hv, sha256_lanes_t *w)
+{
+    unsigned index;
+    sha256_lanes_t a = hv[0];
+    sha256_lanes_t b = hv[1];
+    sha256_lanes_t c = hv[2];
+    sha256_lanes_t d = hv[3];
+    sha256_lanes_t e = hv[4];
+    sha256_lanes_t f = hv[5];
+    sha256_lanes_t g = hv[6];
+    sha256_lanes_t h = hv[7];
+
+    for (index = 16; index < 64; ++index) {
+        w[index] = w[index - 16] + w[index - 7] +
+            (rightRotate(w[index - 15], 7) ^
+             rightRotate(w[index - 15], 18) ^
+             (w[index - 15] >> 3)) +
+            (rightRotate(w[index - 2], 17) ^
+             rightRotate(w[index - 2], 19) ^
+             (w[index - 2] >> 10));
+    }
+
+    for (index = 0; index < 64; index += 8) {
+        SHA256_LANE_ROUND(a, b, c, d, e, f, g, h, 0);
+        SHA256_LANE_ROUND(h, a, b, c, d, e, f, g, 1);
+        SHA256_LANE_ROUND(g, h, a, b, c, d, e, f, 2);
+        SHA256_LANE_ROUND(f, g, h, a, b, c, d, e, 3);
+        SHA256_LANE_ROUND(e, f, g, h, a, b, c, d, 4);
+        SHA256_LANE_ROUND(d, e, f, g, h, a, b, c, 5);
+        SHA256_LANE_ROUND(c, d, e, f, g, h, a, b, 6);
+        SHA256_LANE_ROUND(b, c, d, e, f, g, h, a, 7);
+    }
+
+    hv[0] += a;
+    hv[1] += b;
+    hv[2] += c;
+    hv[3] += d;
+    hv[4] += e;
+    hv[5] += f;
+    hv[6] += g;
+    hv[7] += h;
+}
+
+/* Hashes up to SHA256_LANES messages in parallel.  Lanes run in lockstep
+   until the longest message is done; each lane's hash is saved after its
+   own final block and the extra work on shorter lanes is discarded */
+SHA256_INLINE void sha256_hash_lanes
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    sha256_lanes_t hv[8];
+    sha256_lanes_t w[64];
+    uint8_t block[64];
+    size_t nblocks[SHA256_LANES];
+    size_t max_blocks = 0;
+    size_t n, lane;
+    unsigned index;
+
+    for (lane = 0; lane < count; ++lane) {
+        nblocks[lane] = (sizes[lane] + 8) / 64 + 1;
+        if (nblocks[lane] > max_blocks)
+            max_blocks = nblocks[lane];
+    }
+    hv[0] = (sha256_lanes_t){0} + 0x6a09e667;
+    hv[1] = (sha256_lanes_t){0} + 0xbb67ae85;
+    hv[2] = (sha256_lanes_t){0} + 0x3c6ef372;
+    hv[3] = (sha256_lanes_t){0} + 0xa54ff53a;
+    hv[4] = (sha256_lanes_t){0} + 0x510e527f;
+    hv[5] = (sha256_lanes_t){0} + 0x9b05688c;
+    hv[6] = (sha256_lanes_t){0} + 0x1f83d9ab;
+    hv[7] = (sha256_lanes_t){0} + 0x5be0cd19;
+    memset(w, 0, sizeof(w));
+
+    for (n = 0; n < max_blocks; ++n) {
+        /* Transpose the next block of each message into the lanes */
+        for (lane = 0; lane < count; ++lane) {
+            if (n >= nblocks[lane])
+                continue;
+            sha256_padded_block(block, data[lane], sizes[lane], n, nblocks[lane]);
+            for (index = 0; index < 16; ++index) {
+                w[index][lane] = (((uint32_t)(block[index * 4])) << 24) |
+                                 (((uint32_t)(block[index * 4 + 1])) << 16) |
+                                 (((uint32_t)(block[index * 4 + 2])) << 8) |
+                                  ((uint32_t)(block[index * 4 + 3]));
+            }
+        }
+
+        sha256_transform_lanes(hv, w);
+
+        /* Save the hash for any lanes that have just finished */
+        for (lane = 0; lane < count; ++lane) {
+            if (n != (nblocks[lane] - 1))
+                continue;
+            for (index = 0; index < 8; ++index)
+                write_be32(hashes[lane] + index * 4, hv[index][lane]);
+        }
+    }
+}
+
+static void sha256_hash_lanes_generic
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    sha256_hash_lanes(hashes, data, sizes, count);
+}
+
+#if SHA256_USE_AVX2
+
+__attribute__((target("avx2")))
+static void sha256_hash_lanes_avx2
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    sha256_hash_lanes(hashes, data, sizes, count);
+}
+
+#endif
+
+#endif /* SHA256_USE_LANES */
+
+void sha256_hash_many
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+#if SHA256_USE_LANES
+    size_t lanes;
+#if SHA256_USE_AVX2
+    static volatile int use_avx2 = -1;
+    if (use_avx2 < 0) {
+        __builtin_cpu_init();
+        use_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+#endif
+    while (count > 1) {
+        lanes = count < SHA256_LANES ? count : SHA256_LANES;
+#if SHA256_USE_AVX2
+        if (use_avx2)
+            sha256_hash_lanes_avx2(hashes, data, sizes, lanes);
+        else
+#endif
+            sha256_hash_lanes_generic(hashes, data, sizes, lanes);
+        hashes += lanes;
+        data += lanes;
+        sizes += lanes;
+        count -= lanes;
+    }
+#endif
+    while (count > 0) {
+        sha256_hash(*hashes++, *data++, *sizes++);
+        --count;
+    }
+}
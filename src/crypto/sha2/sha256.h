@@ -42,6 +42,10 @@ typedef struct
 void sha256_reset(sha256_context_t *context);
 void sha256_update(sha256_context_t *context, const void *data, size_t size);
 void sha256_finish(sha256_context_t *context, uint8_t *hash);
+void sha256_hash(uint8_t *hash, const void *data, size_t size);
+void sha256_hash_many
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count);
 
 #ifdef __cplusplus
 };
@@ -23,6 +23,21 @@
 #include "sha512.h"
 #include <string.h>
 
+/* The AVX2/BMI2 compression function needs the GCC/clang "target"
+   attribute and CPU detection builtins, and is only used on x86-64 */
+#if !defined(SHA512_NO_AVX2) && defined(__x86_64__) && \
+        (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SHA512_HAVE_AVX2 1
+#endif
+
+/* sha512_hash_many() processes several messages in parallel using the
+   GCC/clang vector extensions.  Other compilers hash the messages one
+   at a time */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define SHA512_USE_LANES 1
+#define SHA512_LANES 4
+#endif
+
 void sha512_reset(sha512_context_t *context)
 {
     static uint64_t const hash_start[8] = {
@@ -37,37 +52,49 @@ void sha512_reset(sha512_context_t *context)
 
 #define rightRotate(v, n) (((v) >> (n)) | ((v) << (64 - (n))))
 
-static void sha512_transform(sha512_context_t *context, const uint8_t *m)
+static uint64_t const k[80] = {
+    0x428A2F98D728AE22ULL, 0x7137449123EF65CDULL, 0xB5C0FBCFEC4D3B2FULL,
+    0xE9B5DBA58189DBBCULL, 0x3956C25BF348B538ULL, 0x59F111F1B605D019ULL,
+    0x923F82A4AF194F9BULL, 0xAB1C5ED5DA6D8118ULL, 0xD807AA98A3030242ULL,
+    0x12835B0145706FBEULL, 0x243185BE4EE4B28CULL, 0x550C7DC3D5FFB4E2ULL,
+    0x72BE5D74F27B896FULL, 0x80DEB1FE3B1696B1ULL, 0x9BDC06A725C71235ULL,
+    0xC19BF174CF692694ULL, 0xE49B69C19EF14AD2ULL, 0xEFBE4786384F25E3ULL,
+    0x0FC19DC68B8CD5B5ULL, 0x240CA1CC77AC9C65ULL, 0x2DE92C6F592B0275ULL,
+    0x4A7484AA6EA6E483ULL, 0x5CB0A9DCBD41FBD4ULL, 0x76F988DA831153B5ULL,
+    0x983E5152EE66DFABULL, 0xA831C66D2DB43210ULL, 0xB00327C898FB213FULL,
+    0xBF597FC7BEEF0EE4ULL, 0xC6E00BF33DA88FC2ULL, 0xD5A79147930AA725ULL,
+    0x06CA6351E003826FULL, 0x142929670A0E6E70ULL, 0x27B70A8546D22FFCULL,
+    0x2E1B21385C26C926ULL, 0x4D2C6DFC5AC42AEDULL, 0x53380D139D95B3DFULL,
+    0x650A73548BAF63DEULL, 0x766A0ABB3C77B2A8ULL, 0x81C2C92E47EDAEE6ULL,
+    0x92722C851482353BULL, 0xA2BFE8A14CF10364ULL, 0xA81A664BBC423001ULL,
+    0xC24B8B70D0F89791ULL, 0xC76C51A30654BE30ULL, 0xD192E819D6EF5218ULL,
+    0xD69906245565A910ULL, 0xF40E35855771202AULL, 0x106AA07032BBD1B8ULL,
+    0x19A4C116B8D2D0C8ULL, 0x1E376C085141AB53ULL, 0x2748774CDF8EEB99ULL,
+    0x34B0BCB5E19B48A8ULL, 0x391C0CB3C5C95A63ULL, 0x4ED8AA4AE3418ACBULL,
+    0x5B9CCA4F7763E373ULL, 0x682E6FF3D6B2B8A3ULL, 0x748F82EE5DEFB2FCULL,
+    0x78A5636F43172F60ULL, 0x84C87814A1F0AB72ULL, 0x8CC702081A6439ECULL,
+    0x90BEFFFA23631E28ULL, 0xA4506CEBDE82BDE9ULL, 0xBEF9A3F7B2C67915ULL,
+    0xC67178F2E372532BULL, 0xCA273ECEEA26619CULL, 0xD186B8C721C0C207ULL,
+    0xEADA7DD6CDE0EB1EULL, 0xF57D4F7FEE6ED178ULL, 0x06F067AA72176FBAULL,
+    0x0A637DC5A2C898A6ULL, 0x113F9804BEF90DAEULL, 0x1B710B35131C471BULL,
+    0x28DB77F523047D84ULL, 0x32CAAB7B40C72493ULL, 0x3C9EBE0A15C9BEBCULL,
+    0x431D67C49C100D4CULL, 0x4CC5D4BECB3E42B6ULL, 0x597F299CFC657E2AULL,
+    0x5FCB6FAB3AD6FAECULL, 0x6C44198C4A475817ULL
+};
+
+/* Round function shared by all versions of the compression function.
+   "wk" is the sum of the message schedule word and the round constant */
+#define SHA512_ROUND(a, b, c, d, e, f, g, h, wk) \
+    (temp1 = (h) + (wk) + \
+        (rightRotate((e), 14) ^ rightRotate((e), 18) ^ rightRotate((e), 41)) + \
+        (((e) & (f)) ^ ((~(e)) & (g))), \
+     temp2 = (rightRotate((a), 28) ^ rightRotate((a), 34) ^ rightRotate((a), 39)) + \
+        (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c))), \
+     (d) += temp1, \
+     (h) = temp1 + temp2)
+
+static void sha512_transform_generic(sha512_context_t *context, const uint8_t *m)
 {
-    static uint64_t const k[80] = {
-        0x428A2F98D728AE22ULL, 0x7137449123EF65CDULL, 0xB5C0FBCFEC4D3B2FULL,
-        0xE9B5DBA58189DBBCULL, 0x3956C25BF348B538ULL, 0x59F111F1B605D019ULL,
-        0x923F82A4AF194F9BULL, 0xAB1C5ED5DA6D8118ULL, 0xD807AA98A3030242ULL,
-        0x12835B0145706FBEULL, 0x243185BE4EE4B28CULL, 0x550C7DC3D5FFB4E2ULL,
-        0x72BE5D74F27B896FULL, 0x80DEB1FE3B1696B1ULL, 0x9BDC06A725C71235ULL,
-        0xC19BF174CF692694ULL, 0xE49B69C19EF14AD2ULL, 0xEFBE4786384F25E3ULL,
-        0x0FC19DC68B8CD5B5ULL, 0x240CA1CC77AC9C65ULL, 0x2DE92C6F592B0275ULL,
-        0x4A7484AA6EA6E483ULL, 0x5CB0A9DCBD41FBD4ULL, 0x76F988DA831153B5ULL,
-        0x983E5152EE66DFABULL, 0xA831C66D2DB43210ULL, 0xB00327C898FB213FULL,
-        0xBF597FC7BEEF0EE4ULL, 0xC6E00BF33DA88FC2ULL, 0xD5A79147930AA725ULL,
-        0x06CA6351E003826FULL, 0x142929670A0E6E70ULL, 0x27B70A8546D22FFCULL,
-        0x2E1B21385C26C926ULL, 0x4D2C6DFC5AC42AEDULL, 0x53380D139D95B3DFULL,
-        0x650A73548BAF63DEULL, 0x766A0ABB3C77B2A8ULL, 0x81C2C92E47EDAEE6ULL,
-        0x92722C851482353BULL, 0xA2BFE8A14CF10364ULL, 0xA81A664BBC423001ULL,
-        0xC24B8B70D0F89791ULL, 0xC76C51A30654BE30ULL, 0xD192E819D6EF5218ULL,
-        0xD69906245565A910ULL, 0xF40E35855771202AULL, 0x106AA07032BBD1B8ULL,
-        0x19A4C116B8D2D0C8ULL, 0x1E376C085141AB53ULL, 0x2748774CDF8EEB99ULL,
-        0x34B0BCB5E19B48A8ULL, 0x391C0CB3C5C95A63ULL, 0x4ED8AA4AE3418ACBULL,
-        0x5B9CCA4F7763E373ULL, 0x682E6FF3D6B2B8A3ULL, 0x748F82EE5DEFB2FCULL,
-        0x78A5636F43172F60ULL, 0x84C87814A1F0AB72ULL, 0x8CC702081A6439ECULL,
-        0x90BEFFFA23631E28ULL, 0xA4506CEBDE82BDE9ULL, 0xBEF9A3F7B2C67915ULL,
-        0xC67178F2E372532BULL, 0xCA273ECEEA26619CULL, 0xD186B8C721C0C207ULL,
-        0xEADA7DD6CDE0EB1EULL, 0xF57D4F7FEE6ED178ULL, 0x06F067AA72176FBAULL,
-        0x0A637DC5A2C898A6ULL, 0x113F9804BEF90DAEULL, 0x1B710B35131C471BULL,
-        0x28DB77F523047D84ULL, 0x32CAAB7B40C72493ULL, 0x3C9EBE0A15C9BEBCULL,
-        0x431D67C49C100D4CULL, 0x4CC5D4BECB3E42B6ULL, 0x597F299CFC657E2AULL,
-        0x5FCB6FAB3AD6FAECULL, 0x6C44198C4A475817ULL
-    };
     unsigned index;
     uint64_t temp1, temp2;
     uint64_t w[80];
@@ -106,26 +133,16 @@ static void sha512_transform(sha512_context_t *context, const uint8_t *m)
              (w[index - 2] >> 6));
     }
 
-    // Round function.
-#define SHA512_ROUND(a, b, c, d, e, f, g, h, n) \
-    (temp1 = (h) + k[index + (n)] + w[index + (n)] + \
-        (rightRotate((e), 14) ^ rightRotate((e), 18) ^ rightRotate((e), 41)) + \
-        (((e) & (f)) ^ ((~(e)) & (g))), \
-     temp2 = (rightRotate((a), 28) ^ rightRotate((a), 34) ^ rightRotate((a), 39)) + \
-        (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c))), \
-     (d) += temp1, \
-     (h) = temp1 + temp2)
-
     /* Compression function main loop */
     for (index = 0; index < 80; index += 8) {
-        SHA512_ROUND(a, b, c, d, e, f, g, h, 0);
-        SHA512_ROUND(h, a, b, c, d, e, f, g, 1);
-        SHA512_ROUND(g, h, a, b, c, d, e, f, 2);
-        SHA512_ROUND(f, g, h, a, b, c, d, e, 3);
-        SHA512_ROUND(e, f, g, h, a, b, c, d, 4);
-        SHA512_ROUND(d, e, f, g, h, a, b, c, 5);
-        SHA512_ROUND(c, d, e, f, g, h, a, b, 6);
-        SHA512_ROUND(b, c, d, e, f, g, h, a, 7);
+        SHA512_ROUND(a, b, c, d, e, f, g, h, k[index] + w[index]);
+        SHA512_ROUND(h, a, b, c, d, e, f, g, k[index + 1] + w[index + 1]);
+        SHA512_ROUND(g, h, a, b, c, d, e, f, k[index + 2] + w[index + 2]);
+        SHA512_ROUND(f, g, h, a, b, c, d, e, k[index + 3] + w[index + 3]);
+        SHA512_ROUND(e, f, g, h, a, b, c, d, k[index + 4] + w[index + 4]);
+        SHA512_ROUND(d, e, f, g, h, a, b, c, k[index + 5] + w[index + 5]);
+        SHA512_ROUND(c, d, e, f, g, h, a, b, k[index + 6] + w[index + 6]);
+        SHA512_ROUND(b, c, d, e, f, g, h, a, k[index + 7] + w[index + 7]);
     }
 
     /* Add the compressed chunk to the current hash value */
@@ -139,6 +156,166 @@ static void sha512_transform(sha512_context_t *context, const uint8_t *m)
     context->h[7] += h;
 }
 
+#if defined(SHA512_HAVE_AVX2)
+
+#include <immintrin.h>
+
+#define SHA512_TARGET __attribute__((target("avx2,bmi2")))
+
+/* 64-bit rotate right of each lane in a vector */
+#define mm256_ror_epi64(x, n) \
+    _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+#define mm_ror_epi64(x, n) \
+    _mm_or_si128(_mm_srli_epi64((x), (n)), _mm_slli_epi64((x), 64 - (n)))
+
+/* Message schedule sigma functions on 4 and 2 words at a time */
+#define SIGMA0_4(x) \
+    _mm256_xor_si256(_mm256_xor_si256(mm256_ror_epi64((x), 1), \
+                                      mm256_ror_epi64((x), 8)), \
+                     _mm256_srli_epi64((x), 7))
+#define SIGMA1_2(x) \
+    _mm_xor_si128(_mm_xor_si128(mm_ror_epi64((x), 19), \
+                                mm_ror_epi64((x), 61)), \
+                  _mm_srli_epi64((x), 6))
+
+/* Adds the round constants to four schedule words and saves the result */
+#define SHA512_STORE_WK(index, x) \
+    _mm256_storeu_si256 \
+        ((__m256i *)(wk + (index)), \
+         _mm256_add_epi64((x), _mm256_loadu_si256((const __m256i *)(k + (index)))))
+
+/* Computes schedule words index .. index + 3 from the previous 16 words
+   in X0 .. X3, then shifts the new words into X3 */
+#define SHA512_SCHEDULE(index) \
+    do { \
+        __m256i w15, w7, x; \
+        __m128i lo, hi; \
+        w15 = _mm256_alignr_epi8 \
+            (_mm256_permute2x128_si256(X0, X1, 0x21), X0, 8); \
+        w7 = _mm256_alignr_epi8 \
+            (_mm256_permute2x128_si256(X2, X3, 0x21), X2, 8); \
+        x = _mm256_add_epi64(_mm256_add_epi64(X0, w7), SIGMA0_4(w15)); \
+        lo = _mm_add_epi64(_mm256_castsi256_si128(x), \
+                           SIGMA1_2(_mm256_extracti128_si256(X3, 1))); \
+        hi = _mm_add_epi64(_mm256_extracti128_si256(x, 1), SIGMA1_2(lo)); \
+        x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1); \
+        SHA512_STORE_WK((index), x); \
+        X0 = X1; \
+        X1 = X2; \
+        X2 = X3; \
+        X3 = x; \
+    } while (0)
+
+/*
+ * Compression function in the style of Intel's "sha512_rorx": the message
+ * schedule is expanded four words at a time with AVX2 while the scalar
+ * rounds run, and the round constants are added in the same pass.
+ * Compiling the rounds for BMI2 lets the compiler use the flag-free
+ * "rorx" rotate, which schedules better alongside the other ALU operations.
+ */
+SHA512_TARGET
+static void sha512_transform_avx2(sha512_context_t *context, const uint8_t *m)
+{
+    const __m256i bswap = _mm256_set_epi8
+        (8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+         8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    unsigned index;
+    uint64_t temp1, temp2;
+    uint64_t wk[80];
+    __m256i X0, X1, X2, X3;
+
+    uint64_t a = context->h[0];
+    uint64_t b = context->h[1];
+    uint64_t c = context->h[2];
+    uint64_t d = context->h[3];
+    uint64_t e = context->h[4];
+    uint64_t f = context->h[5];
+    uint64_t g = context->h[6];
+    uint64_t h = context->h[7];
+
+    /* Load the 16 message words and convert from big endian.  The last
+       16 words of the schedule are kept in registers from here on */
+    X0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)m), bswap);
+    X1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(m + 32)), bswap);
+    X2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(m + 64)), bswap);
+    X3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(m + 96)), bswap);
+    SHA512_STORE_WK(0, X0);
+    SHA512_STORE_WK(4, X1);
+    SHA512_STORE_WK(8, X2);
+    SHA512_STORE_WK(12, X3);
+
+    /* Extend the first 16 words to 80, four at a time, interleaved with
+       the rounds that use earlier words so that the vector unit and the
+       scalar ALUs are busy at the same time.  The sigma1 term for the last
+       two words in a group depends on the first two, so it is done as two
+       halves of two words each */
+    for (index = 0; index < 64; index += 8) {
+        SHA512_SCHEDULE(index + 16);
+        SHA512_ROUND(a, b, c, d, e, f, g, h, wk[index]);
+        SHA512_ROUND(h, a, b, c, d, e, f, g, wk[index + 1]);
+        SHA512_ROUND(g, h, a, b, c, d, e, f, wk[index + 2]);
+        SHA512_ROUND(f, g, h, a, b, c, d, e, wk[index + 3]);
+        SHA512_SCHEDULE(index + 20);
+        SHA512_ROUND(e, f, g, h, a, b, c, d, wk[index + 4]);
+        SHA512_ROUND(d, e, f, g, h, a, b, c, wk[index + 5]);
+        SHA512_ROUND(c, d, e, f, g, h, a, b, wk[index + 6]);
+        SHA512_ROUND(b, c, d, e, f, g, h, a, wk[index + 7]);
+    }
+
+    /* The last 16 rounds do not need any more schedule words */
+    for (; index < 80; index += 8) {
+        SHA512_ROUND(a, b, c, d, e, f, g, h, wk[index]);
+        SHA512_ROUND(h, a, b, c, d, e, f, g, wk[index + 1]);
+        SHA512_ROUND(g, h, a, b, c, d, e, f, wk[index + 2]);
+        SHA512_ROUND(f, g, h, a, b, c, d, e, wk[index + 3]);
+        SHA512_ROUND(e, f, g, h, a, b, c, d, wk[index + 4]);
+        SHA512_ROUND(d, e, f, g, h, a, b, c, wk[index + 5]);
+        SHA512_ROUND(c, d, e, f, g, h, a, b, wk[index + 6]);
+        SHA512_ROUND(b, c, d, e, f, g, h, a, wk[index + 7]);
+    }
+
+    context->h[0] += a;
+    context->h[1] += b;
+    context->h[2] += c;
+    context->h[3] += d;
+    context->h[4] += e;
+    context->h[5] += f;
+    context->h[6] += g;
+    context->h[7] += h;
+}
+
+/* Which version of the compression function to use: 0 if not yet
+   determined, 1 for the generic C version, 2 for AVX2/BMI2 */
+static volatile int sha512_impl = 0;
+
+static int sha512_have_avx2(void)
+{
+    int impl = sha512_impl;
+    if (!impl) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+            impl = 2;
+        else
+            impl = 1;
+        sha512_impl = impl;
+    }
+    return impl == 2;
+}
+
+static void sha512_transform(sha512_context_t *context, const uint8_t *m)
+{
+    if (sha512_have_avx2())
+        sha512_transform_avx2(context, m);
+    else
+        sha512_transform_generic(context, m);
+}
+
+#else /* !SHA512_HAVE_AVX2 */
+
+#define sha512_transform sha512_transform_generic
+
+#endif /* !SHA512_HAVE_AVX2 */
+
 void sha512_update(sha512_context_t *context, const void *data, size_t size)
 {
     const uint8_t *d = (const uint8_t *)data;
@@ -204,3 +381,202 @@ void sha512_hash(uint8_t *hash, const void *data, size_t size)
     sha512_update(&context, data, size);
     sha512_finish(&context, hash);
 }
+
+/**
+ * \brief Fetches a block of the padded form of a message.
+ *
+ * \param block Returns the 128 bytes of the block.
+ * \param data Points to the message.
+ * \param size Length of the message in bytes.
+ * \param n Index of the block to fetch.
+ * \param nblocks Total number of blocks in the padded message.
+ */
+static void sha512_padded_block
+    (uint8_t *block, const uint8_t *data, size_t size, size_t n, size_t nblocks)
+{
+    size_t posn = n * 128;
+    size_t len = 0;
+    if (posn < size) {
+        len = size - posn;
+        if (len > 128)
+            len = 128;
+        memcpy(block, data + posn, len);
+    }
+    memset(block + len, 0, 128 - len);
+    if (size >= posn && size < (posn + 128))
+        block[size - posn] = 0x80;
+    if (n == (nblocks - 1))
+        write_be64(block + 128 - 8, ((uint64_t)size) * 8);
+}
+
+#if SHA512_USE_LANES
+
+typedef uint64_t sha512_lanes_t __attribute__((__vector_size__(8 * SHA512_LANES)));
+
+#define SHA512_INLINE static inline __attribute__((__always_inline__))
+
+/* Round function for several independent messages at once */
+#define SHA512_LANE_ROUND(a, b, c, d, e, f, g, h, n) \
+    do { \
+        sha512_lanes_t temp1, temp2; \
+        temp1 = (h) + k[index + (n)] + w[index + (n)] + \
+            (rightRotate((e), 14) ^ rightRotate((e), 18) ^ \
+             rightRotate((e), 41)) + \
+            (((e) & (f)) ^ ((~(e)) & (g))); \
+        temp2 = (rightRotate((a), 28) ^ rightRotate((a), 34) ^ \
+                 rightRotate((a), 39)) + \
+            (((a) & (b)) ^ ((a) & (c)) ^ ((b) & (c))); \
+        (d) += temp1; \
+        (h) = temp1 + temp2; \
+    } while (0)
+
+/* Compresses one block from each lane; w[0..15] holds the message words */
+SHA512_INLINE void sha512_transform_lanes(sha512_lanes_t *hv, sha512_lanes_t *w)
+{
+    unsigned index;
+    sha512_lanes_t a = hv[0];
+    sha512_lanes_t b = hv[1];
+    sha512_lanes_t c = hv[2];
+    sha512_lanes_t d = hv[3];
+    sha512_lanes_t e = hv[4];
+    sha512_lanes_t f = hv[5];
+    sha512_lanes_t g = hv[6];
+    sha512_lanes_t h = hv[7];
+
+    for (index = 16; index < 80; ++index) {
+        w[index] = w[index - 16] + w[index - 7] +
+            (rightRotate(w[index - 15], 1) ^
+             rightRotate(w[index - 15], 8) ^
+             (w[index - 15] >> 7)) +
+            (rightRotate(w[index - 2], 19) ^
+             rightRotate(w[index - 2], 61) ^
+             (w[index - 2] >> 6));
+    }
+
+    for (index = 0; index < 80; index += 8) {
+        SHA512_LANE_ROUND(a, b, c, d, e, f, g, h, 0);
+        SHA512_LANE_ROUND(h, a, b, c, d, e, f, g, 1);
+        SHA512_LANE_ROUND(g, h, a, b, c, d, e, f, 2);
+        SHA512_LANE_ROUND(f, g, h, a, b, c, d, e, 3);
+        SHA512_LANE_ROUND(e, f, g, h, a, b, c, d, 4);
+        SHA512_LANE_ROUND(d, e, f, g, h, a, b, c, 5);
+        SHA512_LANE_ROUND(c, d, e, f, g, h, a, b, 6);
+        SHA512_LANE_ROUND(b, c, d, e, f, g, h, a, 7);
+    }
+
+    hv[0] += a;
+    hv[1] += b;
+    hv[2] += c;
+    hv[3] += d;
+    hv[4] += e;
+    hv[5] += f;
+    hv[6] += g;
+    hv[7] += h;
+}
+
+/* Hashes up to SHA512_LANES messages in parallel.  Lanes run in lockstep
+   until the longest message is done; each lane's hash is saved after its
+   own final block and the extra work on shorter lanes is discarded */
+SHA512_INLINE void sha512_hash_lanes
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    static uint64_t const hash_start[8] = {
+        0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL,
+        0xA54FF53A5F1D36F1ULL, 0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+        0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+    };
+    sha512_lanes_t hv[8];
+    sha512_lanes_t w[80];
+    uint8_t block[128];
+    size_t nblocks[SHA512_LANES];
+    size_t max_blocks = 0;
+    size_t n, lane;
+    unsigned index;
+
+    for (lane = 0; lane < count; ++lane) {
+        nblocks[lane] = (sizes[lane] + 16) / 128 + 1;
+        if (nblocks[lane] > max_blocks)
+            max_blocks = nblocks[lane];
+    }
+    for (index = 0; index < 8; ++index)
+        hv[index] = (sha512_lanes_t){0} + hash_start[index];
+    memset(w, 0, sizeof(w));
+
+    for (n = 0; n < max_blocks; ++n) {
+        /* Transpose the next block of each message into the lanes */
+        for (lane = 0; lane < count; ++lane) {
+            const uint8_t *m = block;
+            if (n >= nblocks[lane])
+                continue;
+            sha512_padded_block(block, data[lane], sizes[lane], n, nblocks[lane]);
+            for (index = 0; index < 16; ++index, m += 8) {
+                w[index][lane] = (((uint64_t)(m[0])) << 56) |
+                                 (((uint64_t)(m[1])) << 48) |
+                                 (((uint64_t)(m[2])) << 40) |
+                                 (((uint64_t)(m[3])) << 32) |
+                                 (((uint64_t)(m[4])) << 24) |
+                                 (((uint64_t)(m[5])) << 16) |
+                                 (((uint64_t)(m[6])) << 8) |
+                                  ((uint64_t)(m[7]));
+            }
+        }
+
+        sha512_transform_lanes(hv, w);
+
+        /* Save the hash for any lanes that have just finished */
+        for (lane = 0; lane < count; ++lane) {
+            if (n != (nblocks[lane] - 1))
+                continue;
+            for (index = 0; index < 8; ++index)
+                write_be64(hashes[lane] + index * 8, hv[index][lane]);
+        }
+    }
+}
+
+static void sha512_hash_lanes_generic
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    sha512_hash_lanes(hashes, data, sizes, count);
+}
+
+#if defined(SHA512_HAVE_AVX2)
+
+SHA512_TARGET
+static void sha512_hash_lanes_avx2
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+    sha512_hash_lanes(hashes, data, sizes, count);
+}
+
+#endif
+
+#endif /* SHA512_USE_LANES */
+
+void sha512_hash_many
+    (uint8_t * const *hashes, const uint8_t * const *data,
+     const size_t *sizes, size_t count)
+{
+#if SHA512_USE_LANES
+    size_t lanes;
+    while (count > 1) {
+        lanes = count < SHA512_LANES ? count : SHA512_LANES;
+#if defined(SHA512_HAVE_AVX2)
+        if (sha512_have_avx2())
+            sha512_hash_lanes_avx2(hashes, data, sizes, lanes);
+        else
+#endif
+            sha512_hash_lanes_generic(hashes, data, sizes, lanes);
+        hashes += lanes;
+        data += lanes;
+        sizes += lanes;
+        count -= lanes;
+    }
+#endif
+    while (count > 0) {
+        sha512_hash(*hashes++, *data++, *sizes++);
+        --count;
+    }
+}
@@ -91,6 +91,12 @@ int noise_cipherstate_new_by_id(NoiseCipherState **state, int id)
         *state = noise_aesgcm_new();
         break;
 
+#if NOISE_USE_AEGIS256
+    case NOISE_CIPHER_AEGIS256:
+        *state = noise_aegis256_new();
+        break;
+#endif
+
     default:
         return NOISE_ERROR_UNKNOWN_ID;
     }
@@ -227,6 +233,10 @@ int noise_cipherstate_init_key
     if (key_len != state->key_len)
         return NOISE_ERROR_INVALID_LENGTH;
 
+    /* Discard keystream that was precomputed with the previous key */
+    if (state->precompute)
+        (*(state->precompute))(state, 0);
+
     /* Set the key */
     (*(state->init_key))(state, key);
     state->has_key = 1;
@@ -294,42 +304,7 @@ int noise_cipherstate_encrypt_with_ad
     (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
      NoiseBuffer *buffer)
 {
-    int err;
-
-    /* Validate the parameters */
-    if (!state || (!ad && ad_len) || !buffer || !(buffer->data))
-        return NOISE_ERROR_INVALID_PARAM;
-    if (buffer->size > buffer->max_size)
-        return NOISE_ERROR_INVALID_LENGTH;
-
-    /* If the key hasn't been set yet, return the plaintext as-is */
-    if (!state->has_key) {
-        if (buffer->size > NOISE_MAX_PAYLOAD_LEN)
-            return NOISE_ERROR_INVALID_LENGTH;
-        return NOISE_ERROR_NONE;
-    }
-
-    /* Make sure that there is room for the MAC */
-    if (buffer->size > (size_t)(NOISE_MAX_PAYLOAD_LEN - state->mac_len))
-        return NOISE_ERROR_INVALID_LENGTH;
-    if ((buffer->max_size - buffer->size) < state->mac_len)
-        return NOISE_ERROR_INVALID_LENGTH;
-
-    /* If the nonce has overflowed, then further encryption is impossible.
-       The value 2^64 - 1 is reserved (Noise specification revision 30),
-       so if the nonce has reached that value then overflow has occurred. */
-    if (state->n == 0xFFFFFFFFFFFFFFFFULL)
-        return NOISE_ERROR_INVALID_NONCE;
-
-    /* Encrypt the plaintext and authenticate it */
-    err = (*(state->encrypt))(state, ad, ad_len, buffer->data, buffer->size);
-    ++(state->n);
-    if (err != NOISE_ERROR_NONE)
-        return err;
-
-    /* Adjust the output length for the MAC and return */
-    buffer->size += state->mac_len;
-    return NOISE_ERROR_NONE;
+    return noise_cipherstate_encrypt_and_hash(state, ad, ad_len, buffer, 0);
 }
 
 /**
@@ -374,39 +349,7 @@ int noise_cipherstate_decrypt_with_ad
     (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
      NoiseBuffer *buffer)
 {
-    int err;
-
-    /* Validate the parameters */
-    if (!state || (!ad && ad_len) || !buffer || !(buffer->data))
-        return NOISE_ERROR_INVALID_PARAM;
-    if (buffer->size > buffer->max_size || buffer->size > NOISE_MAX_PAYLOAD_LEN)
-        return NOISE_ERROR_INVALID_LENGTH;
-
-    /* If the key hasn't been set yet, return the ciphertext as-is */
-    if (!state->has_key)
-        return NOISE_ERROR_NONE;
-
-    /* Make sure there are enough bytes for the MAC */
-    if (buffer->size < state->mac_len)
-        return NOISE_ERROR_INVALID_LENGTH;
-
-    /* If the nonce has overflowed, then further decryption is impossible.
-       The value 2^64 - 1 is reserved (Noise specification revision 30),
-       so if the nonce has reached that value then overflow has occurred. */
-    if (state->n == 0xFFFFFFFFFFFFFFFFULL)
-        return NOISE_ERROR_INVALID_NONCE;
-
-    /* Decrypt the ciphertext and check the MAC */
-    err = (*(state->decrypt))
-        (state, ad, ad_len, buffer->data, buffer->size - state->mac_len);
-    if (err != NOISE_ERROR_NONE)
-        return err;
-
-    ++(state->n);
-
-    /* Adjust the output length for the MAC and return */
-    buffer->size -= state->mac_len;
-    return NOISE_ERROR_NONE;
+    return noise_cipherstate_decrypt_and_hash(state, ad, ad_len, buffer, 0);
 }
 
 /**
@@ -529,11 +472,105 @@ int noise_cipherstate_set_nonce(NoiseCipherState *state, uint64_t nonce)
     if (state->n > nonce)
         return NOISE_ERROR_INVALID_NONCE;
 
-    /* Set the nonce and return */
+    /* Discard any precomputed keystream, set the nonce, and return */
+    if (state->precompute)
+        (*(state->precompute))(state, 0);
     state->n = nonce;
     return NOISE_ERROR_NONE;
 }
 
+/**
+ * \brief Sets the number of upcoming nonces to precompute keystream for.
+ *
+ * \param state The CipherState object.
+ * \param depth The number of nonces to precompute, or zero to disable
+ * keystream lookahead.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the cipher back end does not
+ * support keystream lookahead.
+ * \return NOISE_ERROR_INVALID_LENGTH if \a depth is greater than the
+ * value returned by noise_cipherstate_get_max_lookahead().
+ *
+ * Keystream lookahead is intended for latency-sensitive applications
+ * that send small packets.  The application calls
+ * noise_cipherstate_precompute() while it is otherwise idle to generate
+ * the per-packet keystream for the next \a depth nonces.  When the packets
+ * are later encrypted or decrypted, the precomputed keystream is used
+ * and then securely wiped, leaving only the XOR and MAC operations on
+ * the critical path.
+ *
+ * Changing the lookahead depth discards any keystream that has already
+ * been precomputed.  Lookahead is disabled by default.
+ *
+ * \sa noise_cipherstate_precompute(), noise_cipherstate_get_max_lookahead()
+ */
+int noise_cipherstate_set_lookahead(NoiseCipherState *state, size_t depth)
+{
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!state->precompute || !state->max_lookahead)
+        return NOISE_ERROR_NOT_APPLICABLE;
+    if (depth > state->max_lookahead)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* Discard the old keystream and set the new depth */
+    (*(state->precompute))(state, 0);
+    state->lookahead = (uint8_t)depth;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the maximum lookahead depth for a CipherState object.
+ *
+ * \param state The CipherState object.
+ *
+ * \return The maximum number of nonces that can be precomputed, or zero
+ * if the back end does not support keystream lookahead or \a state is NULL.
+ *
+ * \sa noise_cipherstate_set_lookahead()
+ */
+size_t noise_cipherstate_get_max_lookahead(const NoiseCipherState *state)
+{
+    if (!state || !state->precompute)
+        return 0;
+    return state->max_lookahead;
+}
+
+/**
+ * \brief Precomputes the keystream for the next few nonces.
+ *
+ * \param state The CipherState object.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if the key has not been set yet.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * hold the precomputed keystream.
+ *
+ * This function does nothing if keystream lookahead has not been enabled
+ * with noise_cipherstate_set_lookahead().  Nonces that already have
+ * precomputed keystream are skipped, so this function can be called as
+ * often as convenient.
+ *
+ * \sa noise_cipherstate_set_lookahead()
+ */
+int noise_cipherstate_precompute(NoiseCipherState *state)
+{
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!state->has_key)
+        return NOISE_ERROR_INVALID_STATE;
+
+    /* Precompute the keystream if lookahead is enabled */
+    if (!state->lookahead)
+        return NOISE_ERROR_NONE;
+    return (*(state->precompute))(state, state->lookahead);
+}
+
 /**
  * \brief Gets the maximum key length for the supported algorithms.
  *
@@ -555,3 +592,276 @@ int noise_cipherstate_get_max_mac_length(void)
 }
 
 /**@}*/
+
+/**
+ * \brief Encrypts a block of data with a CipherState object and adds
+ * the ciphertext to a running hash.
+ *
+ * \param state The CipherState object.
+ * \param ad Points to the associated data, which can be NULL only if
+ * \a ad_len is zero.
+ * \param ad_len The length of the associated data in bytes.
+ * \param buffer The buffer containing the plaintext on entry and the
+ * ciphertext plus MAC on exit.
+ * \param hash The HashState to update with the ciphertext plus MAC,
+ * or NULL to only encrypt.  The caller is responsible for resetting and
+ * finalizing the HashState.
+ *
+ * \return The same values as noise_cipherstate_encrypt_with_ad().
+ *
+ * If the back end supports it, the ciphertext is added to \a hash while
+ * it is still in the cache rather than in a second pass over \a buffer.
+ * The contents of \a hash are undefined if an error occurs.
+ *
+ * \note Not part of the public API.
+ *
+ * \sa noise_cipherstate_encrypt_with_ad()
+ */
+int noise_cipherstate_encrypt_and_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     NoiseBuffer *buffer, NoiseHashState *hash)
+{
+    int err;
+
+    /* Validate the parameters */
+    if (!state || (!ad && ad_len) || !buffer || !(buffer->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (buffer->size > buffer->max_size)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* If the key hasn't been set yet, return the plaintext as-is */
+    if (!state->has_key) {
+        if (buffer->size > NOISE_MAX_PAYLOAD_LEN)
+            return NOISE_ERROR_INVALID_LENGTH;
+        if (hash)
+            noise_hash_update(hash, buffer->data, buffer->size);
+        return NOISE_ERROR_NONE;
+    }
+
+    /* Make sure that there is room for the MAC */
+    if (buffer->size > (size_t)(NOISE_MAX_PAYLOAD_LEN - state->mac_len))
+        return NOISE_ERROR_INVALID_LENGTH;
+    if ((buffer->max_size - buffer->size) < state->mac_len)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* If the nonce has overflowed, then further encryption is impossible.
+       The value 2^64 - 1 is reserved (Noise specification revision 30),
+       so if the nonce has reached that value then overflow has occurred. */
+    if (state->n == 0xFFFFFFFFFFFFFFFFULL)
+        return NOISE_ERROR_INVALID_NONCE;
+
+    /* Encrypt the plaintext and authenticate it, hashing the ciphertext
+       as we go if the back end can do that in a single pass */
+    if (hash && state->encrypt_hash) {
+        err = noise_cipher_encrypt_hash
+            (state, ad, ad_len, buffer->data, buffer->size, hash);
+        ++(state->n);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        noise_hash_update(hash, buffer->data + buffer->size, state->mac_len);
+    } else {
+        err = noise_cipher_encrypt
+            (state, ad, ad_len, buffer->data, buffer->size);
+        ++(state->n);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        if (hash) {
+            noise_hash_update
+                (hash, buffer->data, buffer->size + state->mac_len);
+        }
+    }
+
+    /* Adjust the output length for the MAC and return */
+    buffer->size += state->mac_len;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Decrypts a block of data with a CipherState object and adds
+ * the ciphertext to a running hash.
+ *
+ * \param state The CipherState object.
+ * \param ad Points to the associated data, which can be NULL only if
+ * \a ad_len is zero.
+ * \param ad_len The length of the associated data in bytes.
+ * \param buffer The buffer containing the ciphertext plus MAC on entry
+ * and the plaintext on exit.
+ * \param hash The HashState to update with the ciphertext plus MAC,
+ * or NULL to only decrypt.  The caller is responsible for resetting and
+ * finalizing the HashState.
+ *
+ * \return The same values as noise_cipherstate_decrypt_with_ad().
+ *
+ * If the back end supports it, the ciphertext is added to \a hash in
+ * the same pass that checks the MAC.  The contents of \a hash are
+ * undefined if an error occurs.
+ *
+ * \note Not part of the public API.
+ *
+ * \sa noise_cipherstate_decrypt_with_ad()
+ */
+int noise_cipherstate_decrypt_and_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     NoiseBuffer *buffer, NoiseHashState *hash)
+{
+    size_t len;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || (!ad && ad_len) || !buffer || !(buffer->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (buffer->size > buffer->max_size || buffer->size > NOISE_MAX_PAYLOAD_LEN)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* If the key hasn't been set yet, return the ciphertext as-is */
+    if (!state->has_key) {
+        if (hash)
+            noise_hash_update(hash, buffer->data, buffer->size);
+        return NOISE_ERROR_NONE;
+    }
+
+    /* Make sure there are enough bytes for the MAC */
+    if (buffer->size < state->mac_len)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* If the nonce has overflowed, then further decryption is impossible.
+       The value 2^64 - 1 is reserved (Noise specification revision 30),
+       so if the nonce has reached that value then overflow has occurred. */
+    if (state->n == 0xFFFFFFFFFFFFFFFFULL)
+        return NOISE_ERROR_INVALID_NONCE;
+
+    /* Decrypt the ciphertext and check the MAC.  The ciphertext must be
+       hashed before it is overwritten with the plaintext */
+    len = buffer->size - state->mac_len;
+    if (hash && state->decrypt_hash) {
+        err = noise_cipher_decrypt_hash
+            (state, ad, ad_len, buffer->data, len, hash);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        noise_hash_update(hash, buffer->data + len, state->mac_len);
+    } else {
+        if (hash)
+            noise_hash_update(hash, buffer->data, buffer->size);
+        err = noise_cipher_decrypt(state, ad, ad_len, buffer->data, len);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+    }
+
+    ++(state->n);
+
+    /* Adjust the output length for the MAC and return */
+    buffer->size -= state->mac_len;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Decrypts a group of packets that carry explicit nonces.
+ *
+ * \param state The CipherState object.
+ * \param nonces The nonce for each packet, which may be in any order.
+ * \param ads Points to the associated data for each packet.
+ * \param ad_len The length of the associated data for every packet.
+ * \param buffers The buffers containing the ciphertext plus MAC for each
+ * packet on entry and the plaintext on exit.
+ * \param errors Set to the result of decrypting each packet, which is one
+ * of the values that noise_cipherstate_decrypt_with_ad() returns.
+ * \param count The number of packets.
+ *
+ * \return NOISE_ERROR_NONE if the parameters are valid, even if some of
+ * the packets failed to decrypt.
+ * \return NOISE_ERROR_INVALID_PARAM if a parameter is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if the key has not been set yet.
+ *
+ * This is intended for datagram transports where packets can be lost
+ * or reordered, so the caller is responsible for replay protection.
+ * The nonce in \a state is ignored and is left set to one more than
+ * the last packet's nonce.
+ *
+ * \note Not part of the public API.
+ *
+ * \sa noise_cipherstate_decrypt_with_ad()
+ */
+int noise_cipherstate_decrypt_explicit
+    (NoiseCipherState *state, const uint64_t *nonces,
+     const uint8_t * const *ads, size_t ad_len,
+     NoiseBuffer *buffers, int *errors, size_t count)
+{
+    NoiseBuffer *buffer;
+    size_t index;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || !nonces || !ads || !buffers || !errors)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!state->has_key)
+        return NOISE_ERROR_INVALID_STATE;
+
+    /* Decrypt each of the packets with the cipher's direct entry point */
+    for (index = 0; index < count; ++index) {
+        buffer = &(buffers[index]);
+        if (!(buffer->data) || buffer->size > buffer->max_size ||
+                buffer->size > NOISE_MAX_PAYLOAD_LEN ||
+                buffer->size < state->mac_len) {
+            errors[index] = NOISE_ERROR_INVALID_LENGTH;
+            continue;
+        }
+        if (nonces[index] == 0xFFFFFFFFFFFFFFFFULL) {
+            errors[index] = NOISE_ERROR_INVALID_NONCE;
+            continue;
+        }
+        state->n = nonces[index];
+        err = noise_cipher_decrypt
+            (state, ads[index], ad_len, buffer->data,
+             buffer->size - state->mac_len);
+        ++(state->n);
+        if (err == NOISE_ERROR_NONE)
+            buffer->size -= state->mac_len;
+        errors[index] = err;
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Creates a copy of a CipherState with the same key and nonce.
+ *
+ * \param clone Points to the variable where to store the pointer to
+ * the new CipherState object.
+ * \param state The CipherState to copy.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a clone or \a state is NULL.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * create the copy.
+ *
+ * The copy can be used on a different thread to \a state, which is how
+ * a single session's packets are encrypted on several threads at once.
+ * Lookahead is disabled on the copy.
+ *
+ * \note Not part of the public API.
+ */
+int noise_cipherstate_clone
+    (NoiseCipherState **clone, const NoiseCipherState *state)
+{
+    size_t base = sizeof(struct NoiseCipherState_s);
+    NoiseCipherState *copy;
+
+    /* Validate the parameters */
+    if (!clone || !state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *clone = 0;
+
+    /* Create a new object of the same type and copy the key across */
+    copy = (*(state->create))();
+    if (!copy)
+        return NOISE_ERROR_NO_MEMORY;
+    if (state->copy) {
+        (*(state->copy))(copy, state);
+    } else {
+        memcpy(((uint8_t *)copy) + base, ((const uint8_t *)state) + base,
+               state->size - base);
+    }
+    copy->has_key = state->has_key;
+    copy->n = state->n;
+    *clone = copy;
+    return NOISE_ERROR_NONE;
+}
@@ -0,0 +1,696 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "internal.h"
+#include <string.h>
+
+/**
+ * \file cookiestate.h
+ * \brief CookieState interface
+ */
+
+/**
+ * \file cookiestate.c
+ * \brief CookieState implementation
+ */
+
+/**
+ * \defgroup cookiestate CookieState API
+ *
+ * The CookieState API provides an optional stateless cookie layer that
+ * a responder can use to shed floods of handshake messages from spoofed
+ * source addresses before allocating a HandshakeState or performing any
+ * Diffie-Hellman operations.  The design follows the cookie mechanism
+ * from WireGuard.
+ *
+ * The initiator calls noise_cookiestate_add_macs() on every first
+ * handshake message, which appends two 16-byte MAC values:
+ *
+ * \li "mac1" is keyed with a hash of the responder's static public key
+ * and covers the handshake message.  It shows that the sender knows
+ * who it is talking to, and is cheap for the responder to check.
+ * \li "mac2" is keyed with the most recent cookie that the initiator
+ * received from the responder and covers the handshake message plus
+ * "mac1".  It is all-zeroes if the initiator does not have a cookie.
+ *
+ * The responder calls noise_cookiestate_check_macs() before doing
+ * anything else with the message.  Messages with a bad "mac1" should be
+ * silently dropped.  If the responder's load callback reports that it
+ * is under load and "mac2" is not valid for the message's source address,
+ * then noise_cookiestate_check_macs() returns NOISE_ERROR_COOKIE_REQUIRED
+ * and the responder answers with a cookie reply from
+ * noise_cookiestate_write_reply() instead of processing the handshake.
+ *
+ * Cookies are computed from the source address with a secret value that
+ * the responder should rotate every few minutes with
+ * noise_cookiestate_rotate_secret().  The responder keeps no per-source
+ * state at all.  Cookies derived from the current and the previous secret
+ * are accepted.
+ *
+ * A cookie reply consists of the 16-byte cookie followed by a 16-byte
+ * MAC that binds the reply to the "mac1" value of the message that
+ * triggered it.  The initiator will only accept a reply to a message that
+ * it actually sent.  The cookie itself is not encrypted, but it is bound
+ * to the source address so it is only useful to a party that can already
+ * receive packets at that address.
+ *
+ * The MAC's and cookies are computed with HMAC using the hash algorithm
+ * that is supplied to noise_cookiestate_new(), truncated to 16 bytes.
+ */
+/**@{*/
+
+/**
+ * \typedef NoiseCookieState
+ * \brief Opaque object that represents a CookieState.
+ */
+
+/**
+ * \typedef NoiseLoadCallback
+ * \brief Callback function that reports whether a responder is under load.
+ *
+ * \param user_data The user data pointer that was supplied to
+ * noise_cookiestate_set_load_callback().
+ *
+ * \return Non-zero if the responder is under load and should require
+ * cookies on incoming handshake messages, or zero if not.
+ */
+
+/** @cond */
+
+/** Length of the MAC values and cookies */
+#define NOISE_COOKIE_LEN 16
+
+/** Length of the responder's secret value for generating cookies */
+#define NOISE_COOKIE_SECRET_LEN 32
+
+/** Label for deriving the "mac1" key from the responder's public key */
+#define NOISE_COOKIE_LABEL_MAC1 "mac1----"
+
+/** Label for deriving the cookie reply key from the responder's public key */
+#define NOISE_COOKIE_LABEL_REPLY "cookie--"
+
+/**
+ * \brief Internal structure of the NoiseCookieState type.
+ */
+struct NoiseCookieState_s
+{
+    /** \brief Total size of the structure */
+    size_t size;
+
+    /** \brief The role; either initiator or responder */
+    int role;
+
+    /** \brief Points to the HashState object for computing MAC values */
+    NoiseHashState *hash;
+
+    /** \brief Key for "mac1", derived from the responder's public key */
+    uint8_t mac1_key[NOISE_MAX_HASHLEN];
+
+    /** \brief Key for authenticating cookie replies */
+    uint8_t reply_key[NOISE_MAX_HASHLEN];
+
+    /** \brief Current secret for generating cookies (responder only) */
+    uint8_t secret[NOISE_COOKIE_SECRET_LEN];
+
+    /** \brief Previous secret for generating cookies (responder only) */
+    uint8_t prev_secret[NOISE_COOKIE_SECRET_LEN];
+
+    /** \brief Last cookie received from the responder (initiator only) */
+    uint8_t cookie[NOISE_COOKIE_LEN];
+
+    /** \brief Last "mac1" value sent to the responder (initiator only) */
+    uint8_t last_mac1[NOISE_COOKIE_LEN];
+
+    /** \brief Non-zero if \ref cookie is valid */
+    uint8_t has_cookie;
+
+    /** \brief Non-zero if \ref last_mac1 is valid */
+    uint8_t has_last_mac1;
+
+    /** \brief Callback that reports whether the responder is under load */
+    NoiseLoadCallback load_callback;
+
+    /** \brief User data to pass to \ref load_callback */
+    void *load_user_data;
+};
+
+/** @endcond */
+
+/**
+ * \brief Computes a truncated MAC value over one or two data blocks.
+ *
+ * \param state The CookieState object.
+ * \param key Points to the key for the MAC.
+ * \param key_len Length of the \a key in bytes.
+ * \param data1 Points to the first data block.
+ * \param data1_len Length of the first data block in bytes.
+ * \param data2 Points to the second data block, which may be NULL.
+ * \param data2_len Length of the second data block in bytes.
+ * \param mac Points to the NOISE_COOKIE_LEN byte buffer for the MAC.
+ */
+static void noise_cookiestate_mac
+    (NoiseCookieState *state, const uint8_t *key, size_t key_len,
+     const uint8_t *data1, size_t data1_len,
+     const uint8_t *data2, size_t data2_len, uint8_t *mac)
+{
+    uint8_t temp[NOISE_MAX_HASHLEN];
+    noise_hashstate_hmac
+        (state->hash, key, key_len, data1, data1_len, data2, data2_len, temp);
+    memcpy(mac, temp, NOISE_COOKIE_LEN);
+    noise_clean(temp, sizeof(temp));
+}
+
+/**
+ * \brief Computes the cookie for a source address.
+ *
+ * \param state The CookieState object.
+ * \param secret The secret to use to generate the cookie.
+ * \param source Points to the source address.
+ * \param source_len Length of the source address in bytes.
+ * \param cookie Points to the NOISE_COOKIE_LEN byte buffer for the cookie.
+ */
+static void noise_cookiestate_make_cookie
+    (NoiseCookieState *state, const uint8_t *secret,
+     const void *source, size_t source_len, uint8_t *cookie)
+{
+    static uint8_t const empty[1] = {0};
+    if (!source_len)
+        source = empty;
+    noise_cookiestate_mac
+        (state, secret, NOISE_COOKIE_SECRET_LEN,
+         (const uint8_t *)source, source_len, 0, 0, cookie);
+}
+
+/**
+ * \brief Creates a new CookieState object.
+ *
+ * \param state Points to the variable where to store the pointer to
+ * the new CookieState object.
+ * \param hash_id The identifier for the hash algorithm to use to compute
+ * MAC values; e.g. NOISE_HASH_BLAKE2s.  Both parties must agree on the
+ * hash algorithm.
+ * \param role The role for the new object, either NOISE_ROLE_INITIATOR or
+ * NOISE_ROLE_RESPONDER.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL or \a role is
+ * not one of NOISE_ROLE_INITIATOR or NOISE_ROLE_RESPONDER.
+ * \return NOISE_ERROR_UNKNOWN_ID if \a hash_id is unknown.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new CookieState object.
+ *
+ * The new object is initialized as though the responder's public key
+ * was empty.  Call noise_cookiestate_set_responder_key() to bind the
+ * "mac1" values to the responder's static public key.
+ *
+ * \sa noise_cookiestate_free(), noise_cookiestate_set_responder_key()
+ */
+int noise_cookiestate_new
+    (NoiseCookieState **state, int hash_id, int role)
+{
+    NoiseHashState *hash;
+    int err;
+
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    if (role != NOISE_ROLE_INITIATOR && role != NOISE_ROLE_RESPONDER)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Create the HashState object */
+    err = noise_hashstate_new_by_id(&hash, hash_id);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+
+    /* Create the CookieState object */
+    *state = noise_new(NoiseCookieState);
+    if (!(*state)) {
+        noise_hashstate_free(hash);
+        return NOISE_ERROR_NO_MEMORY;
+    }
+    (*state)->role = role;
+    (*state)->hash = hash;
+
+    /* Generate the initial secrets and the default keys */
+    if (role == NOISE_ROLE_RESPONDER) {
+        noise_rand_bytes((*state)->prev_secret, NOISE_COOKIE_SECRET_LEN);
+        noise_rand_bytes((*state)->secret, NOISE_COOKIE_SECRET_LEN);
+    }
+    noise_cookiestate_set_responder_key(*state, (*state)->cookie, 0);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Frees a CookieState object after destroying all sensitive material.
+ *
+ * \param state The CookieState object to free.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * \sa noise_cookiestate_new()
+ */
+int noise_cookiestate_free(NoiseCookieState *state)
+{
+    /* Validate the parameter */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Free the sub objects and then clean and free the memory */
+    noise_hashstate_free(state->hash);
+    noise_free(state, state->size);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the role that a CookieState object is playing.
+ *
+ * \param state The CookieState object.
+ *
+ * \return Returns one of NOISE_ROLE_INITIATOR or NOISE_ROLE_RESPONDER
+ * if \a state is non-NULL, or zero if \a state is NULL.
+ */
+int noise_cookiestate_get_role(const NoiseCookieState *state)
+{
+    return state ? state->role : 0;
+}
+
+/**
+ * \brief Sets the responder's static public key for a CookieState.
+ *
+ * \param state The CookieState object.
+ * \param public_key Points to the responder's static public key.
+ * \param public_key_len The length of the \a public_key in bytes.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a public_key is NULL.
+ *
+ * The "mac1" values and the cookie replies are keyed with values that
+ * are derived from the responder's static public key.  Both parties must
+ * set the same key.  If the handshake pattern does not give the initiator
+ * prior knowledge of the responder's key, then both parties can use some
+ * other value that is known ahead of time, such as a service name.
+ */
+int noise_cookiestate_set_responder_key
+    (NoiseCookieState *state, const uint8_t *public_key, size_t public_key_len)
+{
+    NoiseHashState *hash;
+
+    /* Validate the parameters */
+    if (!state || !public_key)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Derive the "mac1" and cookie reply keys */
+    hash = state->hash;
+    noise_hashstate_hash_two
+        (hash, (const uint8_t *)NOISE_COOKIE_LABEL_MAC1,
+         strlen(NOISE_COOKIE_LABEL_MAC1), public_key, public_key_len,
+         state->mac1_key, hash->hash_len);
+    noise_hashstate_hash_two
+        (hash, (const uint8_t *)NOISE_COOKIE_LABEL_REPLY,
+         strlen(NOISE_COOKIE_LABEL_REPLY), public_key, public_key_len,
+         state->reply_key, hash->hash_len);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Sets the callback that reports whether a responder is under load.
+ *
+ * \param state The CookieState object.
+ * \param callback The callback function to invoke, or NULL to indicate
+ * that the responder is never under load.
+ * \param user_data User data to pass to the \a callback.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not a responder.
+ *
+ * The \a callback is invoked by noise_cookiestate_check_macs() for every
+ * message that has a valid "mac1".  A typical implementation compares the
+ * number of handshakes in progress or the depth of the receive queue
+ * against a threshold.  The callback should be cheap as it is invoked
+ * once for every incoming handshake message.
+ *
+ * \sa noise_cookiestate_is_under_load(), noise_cookiestate_check_macs()
+ */
+int noise_cookiestate_set_load_callback
+    (NoiseCookieState *state, NoiseLoadCallback callback, void *user_data)
+{
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_RESPONDER)
+        return NOISE_ERROR_INVALID_STATE;
+    state->load_callback = callback;
+    state->load_user_data = user_data;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Determine if a responder is currently under load.
+ *
+ * \param state The CookieState object.
+ *
+ * \return Returns 1 if the load callback reports that the responder is
+ * under load, or 0 if it is not under load or there is no load callback.
+ * Also returns zero if \a state is NULL.
+ *
+ * \sa noise_cookiestate_set_load_callback()
+ */
+int noise_cookiestate_is_under_load(const NoiseCookieState *state)
+{
+    if (!state || !state->load_callback)
+        return 0;
+    return (*(state->load_callback))(state->load_user_data) != 0;
+}
+
+/**
+ * \brief Rotates the responder's secret for generating cookies.
+ *
+ * \param state The CookieState object.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not a responder.
+ *
+ * The responder should call this function periodically; every two minutes
+ * is typical.  Cookies that were generated with the current secret will
+ * continue to be accepted until the next rotation, after which initiators
+ * must obtain a new cookie.
+ */
+int noise_cookiestate_rotate_secret(NoiseCookieState *state)
+{
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_RESPONDER)
+        return NOISE_ERROR_INVALID_STATE;
+    memcpy(state->prev_secret, state->secret, NOISE_COOKIE_SECRET_LEN);
+    noise_rand_bytes(state->secret, NOISE_COOKIE_SECRET_LEN);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Adds the "mac1" and "mac2" values to an outgoing handshake message.
+ *
+ * \param state The CookieState object.
+ * \param message The handshake message, which will be extended by
+ * NOISE_COOKIE_MACS_LEN bytes.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a message is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not an initiator.
+ * \return NOISE_ERROR_INVALID_LENGTH if there is insufficient space in
+ * \a message for the MAC values.
+ *
+ * This function is normally called on the message that was written by
+ * noise_handshakestate_write_message() for the first message of the
+ * handshake.  If the responder sends back a cookie reply, then the
+ * application can pass the reply to noise_cookiestate_read_reply(),
+ * reset the message size to its original value, and call this function
+ * again to add a valid "mac2" before retransmitting the message.
+ *
+ * \sa noise_cookiestate_check_macs(), noise_cookiestate_read_reply()
+ */
+int noise_cookiestate_add_macs(NoiseCookieState *state, NoiseBuffer *message)
+{
+    uint8_t *mac1;
+    uint8_t *mac2;
+
+    /* Validate the parameters */
+    if (!state || !message || !(message->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_INITIATOR)
+        return NOISE_ERROR_INVALID_STATE;
+    if (message->size > message->max_size ||
+            (message->max_size - message->size) < NOISE_COOKIE_MACS_LEN)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* Compute "mac1" over the message */
+    mac1 = message->data + message->size;
+    mac2 = mac1 + NOISE_COOKIE_LEN;
+    noise_cookiestate_mac
+        (state, state->mac1_key, state->hash->hash_len,
+         message->data, message->size, 0, 0, mac1);
+    memcpy(state->last_mac1, mac1, NOISE_COOKIE_LEN);
+    state->has_last_mac1 = 1;
+
+    /* Compute "mac2" over the message and "mac1" if we have a cookie */
+    if (state->has_cookie) {
+        noise_cookiestate_mac
+            (state, state->cookie, NOISE_COOKIE_LEN,
+             message->data, message->size + NOISE_COOKIE_LEN, 0, 0, mac2);
+    } else {
+        memset(mac2, 0, NOISE_COOKIE_LEN);
+    }
+    message->size += NOISE_COOKIE_MACS_LEN;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Checks the "mac1" and "mac2" values on an incoming handshake message.
+ *
+ * \param state The CookieState object.
+ * \param message The handshake message.  On success the size will be
+ * reduced by NOISE_COOKIE_MACS_LEN to remove the MAC values.
+ * \param source Points to an identifier for the source of the message,
+ * usually the remote IP address and port.  May be NULL if \a source_len
+ * is zero.
+ * \param source_len The length of the \a source identifier in bytes.
+ *
+ * \return NOISE_ERROR_NONE if the message should be processed.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a message is NULL,
+ * or \a source is NULL and \a source_len is not zero.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not a responder.
+ * \return NOISE_ERROR_INVALID_LENGTH if \a message is too short to
+ * contain the MAC values.
+ * \return NOISE_ERROR_MAC_FAILURE if "mac1" is incorrect, in which case
+ * the message should be silently dropped.
+ * \return NOISE_ERROR_COOKIE_REQUIRED if the responder is under load and
+ * "mac2" is not valid for \a source.  The \a message is left unmodified
+ * and the application should pass it to noise_cookiestate_write_reply()
+ * to generate a cookie reply.
+ *
+ * No memory is allocated and no public key operations are performed by
+ * this function, which makes it suitable for running on every message
+ * that is received by the responder.
+ *
+ * \sa noise_cookiestate_add_macs(), noise_cookiestate_write_reply()
+ */
+int noise_cookiestate_check_macs
+    (NoiseCookieState *state, NoiseBuffer *message,
+     const void *source, size_t source_len)
+{
+    uint8_t cookie[NOISE_COOKIE_LEN];
+    uint8_t mac[NOISE_COOKIE_LEN];
+    size_t body_len;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || !message || !(message->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!source && source_len)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_RESPONDER)
+        return NOISE_ERROR_INVALID_STATE;
+    if (message->size < NOISE_COOKIE_MACS_LEN ||
+            message->size > message->max_size)
+        return NOISE_ERROR_INVALID_LENGTH;
+    body_len = message->size - NOISE_COOKIE_MACS_LEN;
+
+    /* Check "mac1" */
+    noise_cookiestate_mac
+        (state, state->mac1_key, state->hash->hash_len,
+         message->data, body_len, 0, 0, mac);
+    if (!noise_is_equal(mac, message->data + body_len, NOISE_COOKIE_LEN)) {
+        noise_clean(mac, sizeof(mac));
+        return NOISE_ERROR_MAC_FAILURE;
+    }
+
+    /* If we are under load, then check "mac2" against the cookies
+       for the current and previous secrets */
+    err = NOISE_ERROR_NONE;
+    if (noise_cookiestate_is_under_load(state)) {
+        noise_cookiestate_make_cookie
+            (state, state->secret, source, source_len, cookie);
+        noise_cookiestate_mac
+            (state, cookie, NOISE_COOKIE_LEN,
+             message->data, body_len + NOISE_COOKIE_LEN, 0, 0, mac);
+        if (!noise_is_equal(mac, message->data + body_len + NOISE_COOKIE_LEN,
+                            NOISE_COOKIE_LEN)) {
+            noise_cookiestate_make_cookie
+                (state, state->prev_secret, source, source_len, cookie);
+            noise_cookiestate_mac
+                (state, cookie, NOISE_COOKIE_LEN,
+                 message->data, body_len + NOISE_COOKIE_LEN, 0, 0, mac);
+            if (!noise_is_equal
+                    (mac, message->data + body_len + NOISE_COOKIE_LEN,
+                     NOISE_COOKIE_LEN)) {
+                err = NOISE_ERROR_COOKIE_REQUIRED;
+            }
+        }
+    }
+
+    /* Strip the MAC values from the message if it is acceptable */
+    if (err == NOISE_ERROR_NONE)
+        message->size = body_len;
+    noise_clean(cookie, sizeof(cookie));
+    noise_clean(mac, sizeof(mac));
+    return err;
+}
+
+/**
+ * \brief Writes a cookie reply for a handshake message.
+ *
+ * \param state The CookieState object.
+ * \param message The handshake message that triggered the reply, including
+ * the MAC values that were checked by noise_cookiestate_check_macs().
+ * \param reply The buffer to write the reply to, which must have space
+ * for at least NOISE_COOKIE_REPLY_LEN bytes.
+ * \param source Points to an identifier for the source of the message,
+ * which must be the same as was passed to noise_cookiestate_check_macs().
+ * May be NULL if \a source_len is zero.
+ * \param source_len The length of the \a source identifier in bytes.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state, \a message, or \a reply
+ * is NULL, or \a source is NULL and \a source_len is not zero.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not a responder.
+ * \return NOISE_ERROR_INVALID_LENGTH if \a message is too short to
+ * contain the MAC values or \a reply is too small for the reply.
+ *
+ * \sa noise_cookiestate_check_macs(), noise_cookiestate_read_reply()
+ */
+int noise_cookiestate_write_reply
+    (NoiseCookieState *state, const NoiseBuffer *message, NoiseBuffer *reply,
+     const void *source, size_t source_len)
+{
+    const uint8_t *mac1;
+
+    /* Validate the parameters */
+    if (!reply)
+        return NOISE_ERROR_INVALID_PARAM;
+    reply->size = 0;
+    if (!state || !message || !(message->data) || !(reply->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!source && source_len)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_RESPONDER)
+        return NOISE_ERROR_INVALID_STATE;
+    if (message->size < NOISE_COOKIE_MACS_LEN ||
+            reply->max_size < NOISE_COOKIE_REPLY_LEN)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* Format the reply as the cookie plus a MAC that binds it to "mac1" */
+    mac1 = message->data + message->size - NOISE_COOKIE_MACS_LEN;
+    noise_cookiestate_make_cookie
+        (state, state->secret, source, source_len, reply->data);
+    noise_cookiestate_mac
+        (state, state->reply_key, state->hash->hash_len,
+         reply->data, NOISE_COOKIE_LEN, mac1, NOISE_COOKIE_LEN,
+         reply->data + NOISE_COOKIE_LEN);
+    reply->size = NOISE_COOKIE_REPLY_LEN;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Reads a cookie reply from the responder.
+ *
+ * \param state The CookieState object.
+ * \param reply The reply that was received from the responder.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a reply is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is not an initiator, or
+ * no handshake message has been sent with noise_cookiestate_add_macs().
+ * \return NOISE_ERROR_INVALID_LENGTH if \a reply is the wrong size.
+ * \return NOISE_ERROR_MAC_FAILURE if \a reply is not a response to the
+ * last message that was sent by this initiator.
+ *
+ * On success, the cookie is saved and will be used for "mac2" on the
+ * next call to noise_cookiestate_add_macs().
+ *
+ * \sa noise_cookiestate_add_macs(), noise_cookiestate_clear_cookie()
+ */
+int noise_cookiestate_read_reply
+    (NoiseCookieState *state, const NoiseBuffer *reply)
+{
+    uint8_t mac[NOISE_COOKIE_LEN];
+    int err;
+
+    /* Validate the parameters */
+    if (!state || !reply || !(reply->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->role != NOISE_ROLE_INITIATOR || !state->has_last_mac1)
+        return NOISE_ERROR_INVALID_STATE;
+    if (reply->size != NOISE_COOKIE_REPLY_LEN)
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* Check that the reply is bound to our last "mac1" value */
+    noise_cookiestate_mac
+        (state, state->reply_key, state->hash->hash_len,
+         reply->data, NOISE_COOKIE_LEN, state->last_mac1, NOISE_COOKIE_LEN,
+         mac);
+    if (noise_is_equal(mac, reply->data + NOISE_COOKIE_LEN, NOISE_COOKIE_LEN)) {
+        memcpy(state->cookie, reply->data, NOISE_COOKIE_LEN);
+        state->has_cookie = 1;
+        err = NOISE_ERROR_NONE;
+    } else {
+        err = NOISE_ERROR_MAC_FAILURE;
+    }
+    noise_clean(mac, sizeof(mac));
+    return err;
+}
+
+/**
+ * \brief Determine if an initiator has a cookie from the responder.
+ *
+ * \param state The CookieState object.
+ *
+ * \return Returns 1 if \a state has a cookie, or 0 if it does not.
+ * Also returns zero if \a state is NULL.
+ */
+int noise_cookiestate_has_cookie(const NoiseCookieState *state)
+{
+    return state ? state->has_cookie : 0;
+}
+
+/**
+ * \brief Clears the cookie that an initiator received from the responder.
+ *
+ * \param state The CookieState object.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * Cookies expire when the responder rotates its secret.  The initiator
+ * should clear cookies that are older than the responder's rotation period.
+ */
+int noise_cookiestate_clear_cookie(NoiseCookieState *state)
+{
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    noise_clean(state->cookie, sizeof(state->cookie));
+    state->has_cookie = 0;
+    return NOISE_ERROR_NONE;
+}
+
+/**@}*/
@@ -0,0 +1,1252 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* For recvmmsg() and sendmmsg() */
+#endif
+#include "internal.h"
+#include <string.h>
+#include <stdlib.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#if defined(__linux__)
+#include <netinet/udp.h>
+#endif
+#endif
+
+/**
+ * \file datagram.h
+ * \brief DatagramState interface
+ */
+
+/**
+ * \file datagram.c
+ * \brief DatagramState implementation
+ */
+
+/**
+ * \defgroup datagramstate DatagramState API
+ *
+ * The DatagramState API moves transport messages for many sessions over
+ * a single datagram socket, such as a UDP socket that a server shares
+ * between all of its clients.  Packets are received and sent in batches
+ * of up to \ref NOISE_DATAGRAM_BATCH with one system call each way
+ * where the platform has recvmmsg() and sendmmsg().
+ *
+ * Datagrams can be lost or reordered, so each packet starts with a
+ * header of \ref NOISE_DATAGRAM_HEADER_LEN bytes rather than relying on
+ * implicit nonces:
+ *
+ * \li A 32-bit big-endian session index, which is chosen by the receiver.
+ * \li The 64-bit big-endian nonce that the packet was encrypted with.
+ *
+ * The header is authenticated as the associated data for the packet.
+ * Each session keeps a sliding window of the last 64 nonces so that
+ * replayed packets are rejected while reordered packets are accepted.
+ *
+ * The sessions are set up with the CipherState objects from
+ * noise_handshakestate_split() after a handshake has been performed by
+ * some other means.  Both peers call noise_datagramstate_add_session()
+ * and exchange the local indexes that it returns, usually in the
+ * handshake payloads.
+ *
+ * The packets from each call to noise_datagramstate_receive() are grouped
+ * by session and each group is decrypted in a single pass over that
+ * session's CipherState.  Replies are queued with
+ * noise_datagramstate_send() and sent together by
+ * noise_datagramstate_flush().
+ *
+ * On Linux, noise_datagramstate_set_offload() can also enable UDP
+ * segmentation offload.  With \ref NOISE_DATAGRAM_OFFLOAD_GSO, runs of
+ * queued packets to the same peer are laid out back to back and handed
+ * to the kernel as one super-buffer that it splits into datagrams.
+ * With \ref NOISE_DATAGRAM_OFFLOAD_GRO, the kernel coalesces incoming
+ * datagrams from the same flow and the DatagramState splits them up
+ * again before decrypting the segments in place.  Either way the packets
+ * on the wire are unchanged, so the peer does not need offload support.
+ */
+/**@{*/
+
+/**
+ * \typedef NoiseDatagramState
+ * \brief Opaque object that represents a DatagramState.
+ */
+
+/**
+ * \typedef NoiseDatagram
+ * \brief Information about a packet that was received by
+ * noise_datagramstate_receive().
+ */
+
+/** @cond */
+
+#if !defined(__WIN32__) && !defined(WIN32)
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+typedef struct mmsghdr NoiseMsgHdr;
+#else
+typedef struct
+{
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+
+} NoiseMsgHdr;
+#endif
+
+/* Maximum number of messages to receive per call when GRO is enabled */
+#define NOISE_DATAGRAM_GRO_MESSAGES     8
+
+/* Maximum length of a coalesced GRO message */
+#define NOISE_DATAGRAM_GRO_LEN          65536
+
+/* Maximum number of segments in one GSO or GRO message */
+#define NOISE_DATAGRAM_MAX_SEGMENTS     64
+
+/* Maximum total length of a GSO message, which is the IPv4 limit */
+#define NOISE_DATAGRAM_GSO_MAX_LEN      65507
+
+/* Control message buffer that is aligned for struct cmsghdr */
+typedef union
+{
+    struct cmsghdr align;
+    uint8_t data[CMSG_SPACE(sizeof(int))];
+
+} NoiseCmsgBuffer;
+
+/**
+ * \brief Information about a session in a DatagramState.
+ */
+typedef struct
+{
+    /** \brief CipherState for outgoing packets, or NULL if the slot is free */
+    NoiseCipherState *send;
+
+    /** \brief CipherState for incoming packets */
+    NoiseCipherState *recv;
+
+    /** \brief Session index that the peer chose */
+    uint32_t remote_index;
+
+    /** \brief Length of the peer's address */
+    socklen_t peer_len;
+
+    /** \brief Address of the peer */
+    struct sockaddr_storage peer;
+
+    /** \brief One more than the highest nonce received, or zero if none */
+    uint64_t recv_max;
+
+    /** \brief Bit i is set if nonce recv_max - 1 - i has been received */
+    uint64_t window;
+
+} NoiseDatagramSession;
+
+/**
+ * \brief Internal structure of the NoiseDatagramState type.
+ */
+struct NoiseDatagramState_s
+{
+    /** \brief Total size of the structure including the packet buffers */
+    size_t size;
+
+    /** \brief The datagram socket */
+    int fd;
+
+    /** \brief Maximum length of a packet including the header and MAC */
+    size_t max_packet_len;
+
+    /** \brief Table of sessions, indexed by local session index - 1 */
+    NoiseDatagramSession *sessions;
+
+    /** \brief Number of slots in the session table */
+    size_t num_sessions;
+
+    /** \brief Offload features that are enabled */
+    int offload;
+
+    /** \brief Number of outgoing packets that are waiting to be flushed */
+    size_t num_queued;
+
+    /** \brief Number of bytes of \ref tx_data that are in use */
+    size_t tx_used;
+
+    /** \brief Buffers for incoming packets, one per message */
+    uint8_t *rx_data;
+
+    /** \brief Size of each buffer in \ref rx_data */
+    size_t rx_slot_len;
+
+    /** \brief Number of messages to receive per call */
+    size_t rx_count;
+
+    /** \brief Outgoing packets, laid out back to back */
+    uint8_t *tx_data;
+
+    /** \brief Information about the incoming packets for the caller */
+    NoiseDatagram *packets;
+
+    /** \brief Flags the incoming packets that have been decrypted */
+    uint8_t *done;
+
+    /** \brief Maximum number of entries in \ref packets */
+    size_t max_packets;
+
+    /** \brief Buffers and packet information when GRO is enabled */
+    void *gro_block;
+
+    /** \brief Size of \ref gro_block */
+    size_t gro_block_len;
+
+    /** \brief Message headers for incoming packets */
+    NoiseMsgHdr rx_msgs[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Message headers for outgoing packets */
+    NoiseMsgHdr tx_msgs[NOISE_DATAGRAM_BATCH];
+
+    /** \brief I/O vectors for incoming packets */
+    struct iovec rx_iov[NOISE_DATAGRAM_BATCH];
+
+    /** \brief I/O vectors for outgoing packets */
+    struct iovec tx_iov[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Source addresses of incoming packets */
+    struct sockaddr_storage rx_addrs[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Destination addresses of outgoing packets */
+    struct sockaddr_storage tx_addrs[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Control messages for incoming packets */
+    NoiseCmsgBuffer rx_control[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Control messages for outgoing GSO messages */
+    NoiseCmsgBuffer tx_control[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Message headers for outgoing GSO messages */
+    NoiseMsgHdr gso_msgs[NOISE_DATAGRAM_BATCH];
+
+    /** \brief I/O vectors for outgoing GSO messages */
+    struct iovec gso_iov[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Index of the first queued packet in each GSO message */
+    size_t gso_first[NOISE_DATAGRAM_BATCH + 1];
+
+    /** \brief Packet information when GRO is disabled */
+    NoiseDatagram default_packets[NOISE_DATAGRAM_BATCH];
+
+    /** \brief Decryption flags when GRO is disabled */
+    uint8_t default_done[NOISE_DATAGRAM_BATCH];
+};
+
+/**
+ * \brief Reads a 32-bit big-endian value.
+ */
+static uint32_t noise_datagram_read32(const uint8_t *data)
+{
+    return (((uint32_t)(data[0])) << 24) | (((uint32_t)(data[1])) << 16) |
+           (((uint32_t)(data[2])) << 8) | ((uint32_t)(data[3]));
+}
+
+/**
+ * \brief Writes a 32-bit big-endian value.
+ */
+static void noise_datagram_write32(uint8_t *data, uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+/**
+ * \brief Checks a nonce against a session's replay window.
+ *
+ * \return Non-zero if the nonce has not been received before.
+ */
+static int noise_datagram_check_nonce
+    (const NoiseDatagramSession *session, uint64_t nonce)
+{
+    uint64_t diff;
+    if (nonce >= session->recv_max)
+        return 1;
+    diff = session->recv_max - 1 - nonce;
+    if (diff >= 64)
+        return 0;
+    return !(session->window & (((uint64_t)1) << diff));
+}
+
+/**
+ * \brief Marks a nonce as received in a session's replay window.
+ */
+static void noise_datagram_update_nonce
+    (NoiseDatagramSession *session, uint64_t nonce)
+{
+    uint64_t shift;
+    if (nonce >= session->recv_max) {
+        shift = nonce + 1 - session->recv_max;
+        session->window = (shift >= 64) ? 0 : (session->window << shift);
+        session->window |= 1;
+        session->recv_max = nonce + 1;
+    } else {
+        session->window |= ((uint64_t)1) << (session->recv_max - 1 - nonce);
+    }
+}
+
+/**
+ * \brief Looks up a session by local index.
+ *
+ * \return A pointer to the session, or NULL if it does not exist.
+ */
+static NoiseDatagramSession *noise_datagram_find_session
+    (NoiseDatagramState *state, uint32_t local_index)
+{
+    NoiseDatagramSession *session;
+    if (local_index == 0 || local_index > state->num_sessions)
+        return 0;
+    session = &(state->sessions[local_index - 1]);
+    return session->send ? session : 0;
+}
+
+/**
+ * \brief Decrypts all of the packets in a batch that belong to the
+ * same session as the packet at \a first.
+ *
+ * \param state The DatagramState object.
+ * \param first Index of the first packet for the session in the batch.
+ * \param count Number of packets in the batch.
+ *
+ * At most \ref NOISE_DATAGRAM_BATCH packets are decrypted per call.
+ * The rest are left for another call if GRO produced a larger batch.
+ */
+static void noise_datagram_decrypt_group
+    (NoiseDatagramState *state, size_t first, size_t count)
+{
+    uint8_t *done = state->done;
+    NoiseDatagramSession *session;
+    uint64_t nonces[NOISE_DATAGRAM_BATCH];
+    const uint8_t *ads[NOISE_DATAGRAM_BATCH];
+    NoiseBuffer buffers[NOISE_DATAGRAM_BATCH];
+    int errors[NOISE_DATAGRAM_BATCH];
+    size_t members[NOISE_DATAGRAM_BATCH];
+    size_t num_members = 0;
+    uint32_t local_index = state->packets[first].session;
+    NoiseDatagram *packet;
+    const uint8_t *header;
+    size_t index;
+    uint64_t nonce;
+    int err;
+
+    /* Collect the packets for this session that pass the replay check */
+    session = noise_datagram_find_session(state, local_index);
+    for (index = first; index < count &&
+                        num_members < NOISE_DATAGRAM_BATCH; ++index) {
+        packet = &(state->packets[index]);
+        if (done[index] || packet->session != local_index)
+            continue;
+        done[index] = 1;
+        if (!session) {
+            packet->error = NOISE_ERROR_UNKNOWN_ID;
+            packet->payload.size = 0;
+            continue;
+        }
+        header = packet->payload.data - NOISE_DATAGRAM_HEADER_LEN;
+        nonce = (((uint64_t)noise_datagram_read32(header + 4)) << 32) |
+                noise_datagram_read32(header + 8);
+        if (!noise_datagram_check_nonce(session, nonce)) {
+            packet->error = NOISE_ERROR_INVALID_NONCE;
+            packet->payload.size = 0;
+            continue;
+        }
+        nonces[num_members] = nonce;
+        ads[num_members] = header;
+        buffers[num_members] = packet->payload;
+        members[num_members++] = index;
+    }
+    if (!num_members)
+        return;
+
+    /* Decrypt the group in one pass over the session's CipherState */
+    err = noise_cipherstate_decrypt_explicit
+        (session->recv, nonces, ads, NOISE_DATAGRAM_HEADER_LEN,
+         buffers, errors, num_members);
+
+    /* Update the replay window, which also catches duplicates that were
+       in the same batch as the first copy of a packet */
+    for (index = 0; index < num_members; ++index) {
+        packet = &(state->packets[members[index]]);
+        if (err != NOISE_ERROR_NONE) {
+            packet->error = err;
+        } else if (errors[index] != NOISE_ERROR_NONE) {
+            packet->error = errors[index];
+        } else if (!noise_datagram_check_nonce(session, nonces[index])) {
+            packet->error = NOISE_ERROR_INVALID_NONCE;
+        } else {
+            noise_datagram_update_nonce(session, nonces[index]);
+            packet->payload.size = buffers[index].size;
+            packet->error = NOISE_ERROR_NONE;
+        }
+        if (packet->error != NOISE_ERROR_NONE)
+            packet->payload.size = 0;
+    }
+}
+
+/**
+ * \brief Frees the receive buffers for GRO and goes back to the
+ * default buffers.
+ */
+static void noise_datagram_free_gro(NoiseDatagramState *state)
+{
+    if (!state->gro_block)
+        return;
+    noise_free(state->gro_block, state->gro_block_len);
+    state->gro_block = 0;
+    state->gro_block_len = 0;
+    state->rx_data = (uint8_t *)(state + 1);
+    state->rx_slot_len = state->max_packet_len;
+    state->rx_count = NOISE_DATAGRAM_BATCH;
+    state->packets = state->default_packets;
+    state->done = state->default_done;
+    state->max_packets = NOISE_DATAGRAM_BATCH;
+}
+
+/**
+ * \brief Allocates the larger receive buffers that GRO needs.
+ *
+ * \return NOISE_ERROR_NONE on success or NOISE_ERROR_NO_MEMORY.
+ *
+ * Coalesced messages can be up to 64K in size and can hold many packets,
+ * so fewer messages are received per call into much larger buffers.
+ */
+static int noise_datagram_alloc_gro(NoiseDatagramState *state)
+{
+    size_t max_packets =
+        NOISE_DATAGRAM_GRO_MESSAGES * NOISE_DATAGRAM_MAX_SEGMENTS;
+    size_t rx_len = NOISE_DATAGRAM_GRO_MESSAGES * NOISE_DATAGRAM_GRO_LEN;
+    size_t packets_len = max_packets * sizeof(NoiseDatagram);
+    uint8_t *block = (uint8_t *)noise_new_object
+        (packets_len + rx_len + max_packets);
+    if (!block)
+        return NOISE_ERROR_NO_MEMORY;
+    state->gro_block = block;
+    state->gro_block_len = packets_len + rx_len + max_packets;
+    state->packets = (NoiseDatagram *)block;
+    state->rx_data = block + packets_len;
+    state->done = state->rx_data + rx_len;
+    state->rx_slot_len = NOISE_DATAGRAM_GRO_LEN;
+    state->rx_count = NOISE_DATAGRAM_GRO_MESSAGES;
+    state->max_packets = max_packets;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Parses the header of an incoming packet.
+ *
+ * \param packet Returns the information about the packet.
+ * \param data Points to the packet.
+ * \param len Length of the packet.
+ * \param hdr The message that the packet arrived in.
+ *
+ * \return Non-zero if the packet needs to be decrypted.
+ */
+static int noise_datagram_parse
+    (NoiseDatagram *packet, uint8_t *data, size_t len,
+     const struct msghdr *hdr)
+{
+    packet->source = hdr->msg_name;
+    packet->source_len = hdr->msg_namelen;
+    if (len < (NOISE_DATAGRAM_HEADER_LEN + 16) ||
+            (hdr->msg_flags & MSG_TRUNC) != 0) {
+        packet->session = 0;
+        packet->error = NOISE_ERROR_INVALID_LENGTH;
+        noise_buffer_init(packet->payload);
+        return 0;
+    }
+    packet->session = noise_datagram_read32(data);
+    packet->error = NOISE_ERROR_NONE;
+    noise_buffer_set_input(packet->payload, data + NOISE_DATAGRAM_HEADER_LEN,
+                           len - NOISE_DATAGRAM_HEADER_LEN);
+    return 1;
+}
+
+/**
+ * \brief Gets the segment size of a coalesced GRO message.
+ *
+ * \return The segment size, or the length of the message if it was
+ * not coalesced.
+ */
+static size_t noise_datagram_segment_len(struct msghdr *hdr, size_t len)
+{
+#if defined(UDP_GRO)
+    struct cmsghdr *cmsg;
+    int segment_len;
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&segment_len, CMSG_DATA(cmsg), sizeof(int));
+            if (segment_len > 0 && (size_t)segment_len < len)
+                return (size_t)segment_len;
+        }
+    }
+#else
+    (void)hdr;
+#endif
+    return len;
+}
+
+/**
+ * \brief Groups the queued packets into GSO messages.
+ *
+ * \return The number of GSO messages.
+ *
+ * A message is a run of consecutive packets to the same peer that all
+ * have the same length, except for the last which may be shorter.  The
+ * packets are already back to back in \ref tx_data, so each message is
+ * one contiguous buffer.  Runs of one packet are sent as-is.
+ */
+static size_t noise_datagram_build_gso(NoiseDatagramState *state)
+{
+    size_t num_msgs = 0;
+    size_t index = 0;
+    size_t first;
+    size_t segment_len;
+    size_t total;
+    size_t len;
+    struct msghdr *hdr;
+    struct cmsghdr *cmsg;
+    uint16_t gso_size;
+
+    while (index < state->num_queued) {
+        /* Extend the run for as long as the packets can be segmented */
+        first = index;
+        segment_len = state->tx_iov[first].iov_len;
+        total = segment_len;
+        for (++index; index < state->num_queued; ++index) {
+            len = state->tx_iov[index].iov_len;
+            if ((index - first) >= NOISE_DATAGRAM_MAX_SEGMENTS ||
+                    len > segment_len ||
+                    (total + len) > NOISE_DATAGRAM_GSO_MAX_LEN ||
+                    state->tx_msgs[index].msg_hdr.msg_namelen !=
+                        state->tx_msgs[first].msg_hdr.msg_namelen ||
+                    memcmp(&(state->tx_addrs[index]),
+                           &(state->tx_addrs[first]),
+                           state->tx_msgs[first].msg_hdr.msg_namelen) != 0)
+                break;
+            total += len;
+            if (len < segment_len) {
+                ++index;
+                break;
+            }
+        }
+
+        /* Format the message, with the segment size if there is a run */
+        hdr = &(state->gso_msgs[num_msgs].msg_hdr);
+        memset(hdr, 0, sizeof(struct msghdr));
+        state->gso_iov[num_msgs].iov_base = state->tx_iov[first].iov_base;
+        state->gso_iov[num_msgs].iov_len = total;
+        hdr->msg_name = &(state->tx_addrs[first]);
+        hdr->msg_namelen = state->tx_msgs[first].msg_hdr.msg_namelen;
+        hdr->msg_iov = &(state->gso_iov[num_msgs]);
+        hdr->msg_iovlen = 1;
+#if defined(UDP_SEGMENT)
+        if ((index - first) > 1) {
+            hdr->msg_control = state->tx_control[num_msgs].data;
+            hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsg = CMSG_FIRSTHDR(hdr);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            gso_size = (uint16_t)segment_len;
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(uint16_t));
+        }
+#else
+        (void)cmsg;
+        (void)gso_size;
+#endif
+        state->gso_first[num_msgs++] = first;
+    }
+    state->gso_first[num_msgs] = state->num_queued;
+    return num_msgs;
+}
+
+#if !defined(HAVE_RECVMMSG) || !defined(HAVE_SENDMMSG)
+
+/* Fallbacks that use one system call per packet */
+
+static int recvmmsg(int fd, NoiseMsgHdr *msgs, unsigned int vlen,
+                    int flags, void *timeout)
+{
+    unsigned int index;
+    ssize_t len;
+    (void)flags;
+    (void)timeout;
+    for (index = 0; index < vlen; ++index) {
+        len = recvmsg(fd, &(msgs[index].msg_hdr), index ? MSG_DONTWAIT : 0);
+        if (len < 0)
+            return index ? (int)index : -1;
+        msgs[index].msg_len = (unsigned int)len;
+    }
+    return (int)index;
+}
+
+static int sendmmsg(int fd, NoiseMsgHdr *msgs, unsigned int vlen, int flags)
+{
+    unsigned int index;
+    ssize_t len;
+    for (index = 0; index < vlen; ++index) {
+        len = sendmsg(fd, &(msgs[index].msg_hdr), flags);
+        if (len < 0)
+            return index ? (int)index : -1;
+        msgs[index].msg_len = (unsigned int)len;
+    }
+    return (int)index;
+}
+
+#define MSG_WAITFORONE 0
+
+#endif
+
+#endif /* !WIN32 */
+
+/** @endcond */
+
+/**
+ * \brief Creates a new DatagramState object.
+ *
+ * \param state Points to the variable where to store the pointer to
+ * the new DatagramState object.
+ * \param fd The datagram socket to send and receive packets on.  The
+ * socket may be blocking or non-blocking, and the caller retains
+ * ownership of it.
+ * \param max_packet_len The maximum length of a packet on the wire,
+ * including the header and MAC.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL, \a fd is
+ * negative, or \a max_packet_len is too small to hold the header and
+ * a MAC or too large for a Noise transport message.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the platform does not have
+ * the required socket functions.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new DatagramState object.
+ *
+ * \sa noise_datagramstate_free()
+ */
+int noise_datagramstate_new
+    (NoiseDatagramState **state, int fd, size_t max_packet_len)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    NoiseDatagramState *new_state;
+    size_t buffers_len;
+
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    if (fd < 0 || max_packet_len < (NOISE_DATAGRAM_HEADER_LEN + 16) ||
+            max_packet_len > (NOISE_DATAGRAM_HEADER_LEN + NOISE_MAX_PAYLOAD_LEN))
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Allocate the object with the packet buffers on the end */
+    buffers_len = max_packet_len * NOISE_DATAGRAM_BATCH;
+    new_state = noise_new_object(sizeof(NoiseDatagramState) + buffers_len * 2);
+    if (!new_state)
+        return NOISE_ERROR_NO_MEMORY;
+    new_state->fd = fd;
+    new_state->max_packet_len = max_packet_len;
+    new_state->rx_data = (uint8_t *)(new_state + 1);
+    new_state->rx_slot_len = max_packet_len;
+    new_state->rx_count = NOISE_DATAGRAM_BATCH;
+    new_state->tx_data = new_state->rx_data + buffers_len;
+    new_state->packets = new_state->default_packets;
+    new_state->done = new_state->default_done;
+    new_state->max_packets = NOISE_DATAGRAM_BATCH;
+    *state = new_state;
+    return NOISE_ERROR_NONE;
+#else
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    (void)fd;
+    (void)max_packet_len;
+    return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+}
+
+/**
+ * \brief Frees a DatagramState object after destroying all sensitive
+ * material.
+ *
+ * \param state The DatagramState object to free.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * The CipherState objects for all remaining sessions are freed.  Packets
+ * that are still queued for sending are discarded; the socket is not
+ * closed.
+ *
+ * \sa noise_datagramstate_new()
+ */
+int noise_datagramstate_free(NoiseDatagramState *state)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    size_t index;
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    for (index = 0; index < state->num_sessions; ++index) {
+        if (state->sessions[index].send) {
+            noise_cipherstate_free(state->sessions[index].send);
+            noise_cipherstate_free(state->sessions[index].recv);
+        }
+    }
+    if (state->sessions) {
+        noise_clean(state->sessions,
+                    state->num_sessions * sizeof(NoiseDatagramSession));
+        free(state->sessions);
+    }
+    noise_datagram_free_gro(state);
+    noise_free(state, state->size);
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Adds a session to a DatagramState.
+ *
+ * \param state The DatagramState object.
+ * \param send The CipherState to encrypt outgoing packets with.
+ * \param recv The CipherState to decrypt incoming packets with.
+ * \param remote_index The session index that the peer chose for this
+ * session, which is put into every outgoing packet.
+ * \param peer Points to the socket address of the peer.
+ * \param peer_len The length of the \a peer address.
+ * \param local_index Points to the variable where to store the session
+ * index that the peer must put into its packets.  It is never zero.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state, \a send, \a recv,
+ * \a peer, or \a local_index is NULL, or \a peer_len is too large.
+ * \return NOISE_ERROR_INVALID_STATE if the keys have not been set on
+ * \a send and \a recv.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * add the session.
+ *
+ * On success, the DatagramState takes ownership of \a send and \a recv
+ * and will free them when the session is removed.  The nonce of \a send
+ * is used for the next outgoing packet; the nonce of \a recv is ignored
+ * because the nonces are carried in the packets.
+ *
+ * \sa noise_datagramstate_remove_session()
+ */
+int noise_datagramstate_add_session
+    (NoiseDatagramState *state, NoiseCipherState *send,
+     NoiseCipherState *recv, uint32_t remote_index,
+     const void *peer, size_t peer_len, uint32_t *local_index)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    NoiseDatagramSession *sessions;
+    NoiseDatagramSession *session;
+    size_t new_num;
+    size_t index;
+
+    /* Validate the parameters */
+    if (!state || !send || !recv || !peer || !local_index)
+        return NOISE_ERROR_INVALID_PARAM;
+    *local_index = 0;
+    if (!peer_len || peer_len > sizeof(struct sockaddr_storage))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!send->has_key || !recv->has_key)
+        return NOISE_ERROR_INVALID_STATE;
+
+    /* Find a free slot, or grow the table to make one */
+    for (index = 0; index < state->num_sessions; ++index) {
+        if (!state->sessions[index].send)
+            break;
+    }
+    if (index >= state->num_sessions) {
+        if (state->num_sessions >= 0x7FFFFFFF)
+            return NOISE_ERROR_NO_MEMORY;
+        new_num = state->num_sessions ? state->num_sessions * 2 : 16;
+        sessions = (NoiseDatagramSession *)calloc
+            (new_num, sizeof(NoiseDatagramSession));
+        if (!sessions)
+            return NOISE_ERROR_NO_MEMORY;
+        if (state->sessions) {
+            memcpy(sessions, state->sessions,
+                   state->num_sessions * sizeof(NoiseDatagramSession));
+            noise_clean(state->sessions,
+                        state->num_sessions * sizeof(NoiseDatagramSession));
+            free(state->sessions);
+        }
+        state->sessions = sessions;
+        state->num_sessions = new_num;
+    }
+
+    /* Fill in the session details */
+    session = &(state->sessions[index]);
+    memset(session, 0, sizeof(NoiseDatagramSession));
+    session->send = send;
+    session->recv = recv;
+    session->remote_index = remote_index;
+    session->peer_len = (socklen_t)peer_len;
+    memcpy(&(session->peer), peer, peer_len);
+    *local_index = (uint32_t)(index + 1);
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    (void)send;
+    (void)recv;
+    (void)remote_index;
+    (void)peer;
+    (void)peer_len;
+    (void)local_index;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Removes a session from a DatagramState.
+ *
+ * \param state The DatagramState object.
+ * \param local_index The local index of the session to remove.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_UNKNOWN_ID if \a local_index is not a session.
+ *
+ * The CipherState objects for the session are freed.  Packets for the
+ * session that are already queued for sending are still sent by the
+ * next call to noise_datagramstate_flush().  The local index may be
+ * reused by a later call to noise_datagramstate_add_session().
+ *
+ * \sa noise_datagramstate_add_session()
+ */
+int noise_datagramstate_remove_session
+    (NoiseDatagramState *state, uint32_t local_index)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    NoiseDatagramSession *session;
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    session = noise_datagram_find_session(state, local_index);
+    if (!session)
+        return NOISE_ERROR_UNKNOWN_ID;
+    noise_cipherstate_free(session->send);
+    noise_cipherstate_free(session->recv);
+    noise_clean(session, sizeof(NoiseDatagramSession));
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    (void)local_index;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Receives and decrypts a batch of packets.
+ *
+ * \param state The DatagramState object.
+ * \param packets Points to the variable where to store a pointer to the
+ * array of received packets.
+ * \param count Points to the variable where to store the number of
+ * packets in the array.
+ *
+ * \return NOISE_ERROR_NONE on success, including when no packets were
+ * available on a non-blocking socket or the call was interrupted.
+ * \return NOISE_ERROR_INVALID_PARAM if a parameter is NULL.
+ * \return NOISE_ERROR_SYSTEM if the socket reported an error, in which
+ * case the details are in errno.
+ *
+ * On a blocking socket this waits for at least one packet and then
+ * returns up to \ref NOISE_DATAGRAM_BATCH packets that are available
+ * without waiting further.
+ *
+ * Each packet reports its own result in its \c error field:
+ * NOISE_ERROR_INVALID_LENGTH if it is too short or was truncated,
+ * NOISE_ERROR_UNKNOWN_ID if the session index is not known,
+ * NOISE_ERROR_INVALID_NONCE if it is a replay or is too old for the
+ * replay window, or NOISE_ERROR_MAC_FAILURE if it failed to decrypt.
+ * Only packets whose \c error is NOISE_ERROR_NONE have a payload.
+ *
+ * The array and the payloads remain valid until the next call to
+ * noise_datagramstate_receive() or noise_datagramstate_free().
+ */
+int noise_datagramstate_receive
+    (NoiseDatagramState *state, NoiseDatagram **packets, size_t *count)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    struct msghdr *hdr;
+    uint8_t *data;
+    size_t num_packets;
+    size_t segment_len;
+    size_t msg_len;
+    size_t offset;
+    size_t index;
+    int received;
+
+    /* Validate the parameters */
+    if (packets)
+        *packets = 0;
+    if (count)
+        *count = 0;
+    if (!state || !packets || !count)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Set up the message headers and receive the batch */
+    for (index = 0; index < state->rx_count; ++index) {
+        hdr = &(state->rx_msgs[index].msg_hdr);
+        memset(hdr, 0, sizeof(struct msghdr));
+        state->rx_iov[index].iov_base =
+            state->rx_data + index * state->rx_slot_len;
+        state->rx_iov[index].iov_len = state->rx_slot_len;
+        hdr->msg_name = &(state->rx_addrs[index]);
+        hdr->msg_namelen = sizeof(struct sockaddr_storage);
+        hdr->msg_iov = &(state->rx_iov[index]);
+        hdr->msg_iovlen = 1;
+        if (state->offload & NOISE_DATAGRAM_OFFLOAD_GRO) {
+            hdr->msg_control = state->rx_control[index].data;
+            hdr->msg_controllen = sizeof(state->rx_control[index].data);
+        }
+    }
+    received = recvmmsg(state->fd, state->rx_msgs,
+                        (unsigned int)(state->rx_count), MSG_WAITFORONE, 0);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return NOISE_ERROR_NONE;
+        return NOISE_ERROR_SYSTEM;
+    }
+
+    /* Parse the packet headers, splitting coalesced messages into the
+       original datagrams.  Segments beyond the expected maximum are
+       dropped as though the network had lost them */
+    num_packets = 0;
+    for (index = 0; index < (size_t)received; ++index) {
+        hdr = &(state->rx_msgs[index].msg_hdr);
+        data = (uint8_t *)(state->rx_iov[index].iov_base);
+        msg_len = state->rx_msgs[index].msg_len;
+        segment_len = msg_len;
+        if (state->offload & NOISE_DATAGRAM_OFFLOAD_GRO)
+            segment_len = noise_datagram_segment_len(hdr, msg_len);
+        offset = 0;
+        do {
+            if (num_packets >= state->max_packets)
+                break;
+            if (segment_len > (msg_len - offset))
+                segment_len = msg_len - offset;
+            state->done[num_packets] = !noise_datagram_parse
+                (&(state->packets[num_packets]), data + offset,
+                 segment_len, hdr);
+            ++num_packets;
+            offset += segment_len;
+        } while (offset < msg_len);
+    }
+
+    /* Decrypt the packets one session at a time */
+    for (index = 0; index < num_packets; ++index) {
+        if (!state->done[index])
+            noise_datagram_decrypt_group(state, index, num_packets);
+    }
+    *packets = state->packets;
+    *count = num_packets;
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    (void)packets;
+    (void)count;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Encrypts a packet and queues it to be sent.
+ *
+ * \param state The DatagramState object.
+ * \param local_index The local index of the session to send on.
+ * \param payload Points to the payload to send.
+ * \param payload_len The length of the payload.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a payload is NULL.
+ * \return NOISE_ERROR_UNKNOWN_ID if \a local_index is not a session.
+ * \return NOISE_ERROR_INVALID_LENGTH if the packet would be longer
+ * than the maximum packet length.
+ * \return NOISE_ERROR_INVALID_NONCE if the session has run out of nonces.
+ * \return NOISE_ERROR_SYSTEM if the queue was full and flushing it failed.
+ *
+ * The queue is flushed automatically when it is full.  Otherwise the
+ * packet is not sent until noise_datagramstate_flush() is called.
+ *
+ * \sa noise_datagramstate_flush()
+ */
+int noise_datagramstate_send
+    (NoiseDatagramState *state, uint32_t local_index,
+     const uint8_t *payload, size_t payload_len)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    NoiseDatagramSession *session;
+    struct msghdr *hdr;
+    NoiseBuffer mbuf;
+    uint8_t *data;
+    uint64_t nonce;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || (!payload && payload_len))
+        return NOISE_ERROR_INVALID_PARAM;
+    session = noise_datagram_find_session(state, local_index);
+    if (!session)
+        return NOISE_ERROR_UNKNOWN_ID;
+    if (payload_len > (state->max_packet_len - NOISE_DATAGRAM_HEADER_LEN) ||
+            (payload_len + session->send->mac_len) >
+                (state->max_packet_len - NOISE_DATAGRAM_HEADER_LEN))
+        return NOISE_ERROR_INVALID_LENGTH;
+
+    /* Make room in the queue if necessary */
+    if (state->num_queued >= NOISE_DATAGRAM_BATCH) {
+        err = noise_datagramstate_flush(state);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+    }
+
+    /* Format the header and encrypt the payload after it.  The packets
+       are packed back to back so that runs of them can be sent with GSO */
+    data = state->tx_data + state->tx_used;
+    nonce = session->send->n;
+    noise_datagram_write32(data, session->remote_index);
+    noise_datagram_write32(data + 4, (uint32_t)(nonce >> 32));
+    noise_datagram_write32(data + 8, (uint32_t)nonce);
+    memcpy(data + NOISE_DATAGRAM_HEADER_LEN, payload, payload_len);
+    noise_buffer_set_inout
+        (mbuf, data + NOISE_DATAGRAM_HEADER_LEN, payload_len,
+         state->max_packet_len - NOISE_DATAGRAM_HEADER_LEN);
+    err = noise_cipherstate_encrypt_with_ad
+        (session->send, data, NOISE_DATAGRAM_HEADER_LEN, &mbuf);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+
+    /* Queue the packet with a copy of the peer's address, which keeps it
+       valid if the session is removed or the table grows before flushing */
+    hdr = &(state->tx_msgs[state->num_queued].msg_hdr);
+    memset(hdr, 0, sizeof(struct msghdr));
+    memcpy(&(state->tx_addrs[state->num_queued]), &(session->peer),
+           session->peer_len);
+    state->tx_iov[state->num_queued].iov_base = data;
+    state->tx_iov[state->num_queued].iov_len =
+        NOISE_DATAGRAM_HEADER_LEN + mbuf.size;
+    hdr->msg_name = &(state->tx_addrs[state->num_queued]);
+    hdr->msg_namelen = session->peer_len;
+    hdr->msg_iov = &(state->tx_iov[state->num_queued]);
+    hdr->msg_iovlen = 1;
+    state->tx_used += NOISE_DATAGRAM_HEADER_LEN + mbuf.size;
+    ++(state->num_queued);
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    (void)local_index;
+    (void)payload;
+    (void)payload_len;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Sends all of the packets that are queued on a DatagramState.
+ *
+ * \param state The DatagramState object.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_SYSTEM if the socket reported an error, in which
+ * case the details are in errno.
+ *
+ * If the socket is non-blocking and its send buffer fills up, then the
+ * remaining packets are dropped as they would be by a congested network.
+ * The queue is empty on return, whatever the result.
+ *
+ * If GSO is enabled but the kernel rejects a segmented message, then
+ * GSO is disabled and the packets are sent individually instead.
+ *
+ * \sa noise_datagramstate_send(), noise_datagramstate_set_offload()
+ */
+int noise_datagramstate_flush(NoiseDatagramState *state)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    size_t sent = 0;
+    size_t num_msgs;
+    size_t msgs_sent;
+    int result;
+
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Send runs of packets as GSO messages if possible */
+    if ((state->offload & NOISE_DATAGRAM_OFFLOAD_GSO) && state->num_queued) {
+        num_msgs = noise_datagram_build_gso(state);
+        msgs_sent = 0;
+        while (msgs_sent < num_msgs) {
+            result = sendmmsg(state->fd, state->gso_msgs + msgs_sent,
+                              (unsigned int)(num_msgs - msgs_sent), 0);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    state->num_queued = 0;
+                    state->tx_used = 0;
+                    return NOISE_ERROR_NONE;
+                }
+                state->offload &= ~NOISE_DATAGRAM_OFFLOAD_GSO;
+                break;
+            }
+            msgs_sent += (size_t)result;
+        }
+        sent = state->gso_first[msgs_sent];
+    }
+
+    /* Send the remaining packets one datagram each */
+    while (sent < state->num_queued) {
+        result = sendmmsg(state->fd, state->tx_msgs + sent,
+                          (unsigned int)(state->num_queued - sent), 0);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            state->num_queued = 0;
+            state->tx_used = 0;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return NOISE_ERROR_NONE;
+            return NOISE_ERROR_SYSTEM;
+        }
+        sent += (size_t)result;
+    }
+    state->num_queued = 0;
+    state->tx_used = 0;
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Enables or disables UDP segmentation offload on a DatagramState.
+ *
+ * \param state The DatagramState object.
+ * \param flags Zero or more of \ref NOISE_DATAGRAM_OFFLOAD_GSO and
+ * \ref NOISE_DATAGRAM_OFFLOAD_GRO, combined with bitwise-OR.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL or \a flags
+ * contains unknown bits.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the platform or the socket does
+ * not support one of the requested features, in which case nothing
+ * is changed.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory for
+ * the GRO receive buffers.
+ *
+ * GSO sends each run of queued packets to the same peer as one system
+ * call's worth of data that the kernel or the network card splits into
+ * datagrams.  For the best results, send full-sized packets so that
+ * the runs are long.
+ *
+ * GRO asks the kernel to coalesce incoming datagrams, which are split
+ * again by noise_datagramstate_receive().  It needs about 540K of extra
+ * receive buffers.  The packets from a previous call to
+ * noise_datagramstate_receive() are no longer valid after GRO is
+ * enabled or disabled.
+ *
+ * \sa noise_datagramstate_get_offload()
+ */
+int noise_datagramstate_set_offload(NoiseDatagramState *state, int flags)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    int value;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || (flags & ~(NOISE_DATAGRAM_OFFLOAD_GSO |
+                             NOISE_DATAGRAM_OFFLOAD_GRO)) != 0)
+        return NOISE_ERROR_INVALID_PARAM;
+#if !defined(UDP_SEGMENT)
+    if (flags & NOISE_DATAGRAM_OFFLOAD_GSO)
+        return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+
+    /* Turn GRO on or off in the kernel and resize the receive buffers */
+    if ((flags ^ state->offload) & NOISE_DATAGRAM_OFFLOAD_GRO) {
+#if defined(UDP_GRO)
+        value = (flags & NOISE_DATAGRAM_OFFLOAD_GRO) != 0;
+        if (value) {
+            err = noise_datagram_alloc_gro(state);
+            if (err != NOISE_ERROR_NONE)
+                return err;
+        }
+        if (setsockopt(state->fd, IPPROTO_UDP, UDP_GRO,
+                       &value, sizeof(value)) < 0) {
+            if (value) {
+                noise_datagram_free_gro(state);
+                return NOISE_ERROR_NOT_APPLICABLE;
+            }
+        }
+        if (!value)
+            noise_datagram_free_gro(state);
+#else
+        (void)value;
+        (void)err;
+        return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+    }
+    state->offload = flags;
+    return NOISE_ERROR_NONE;
+#else
+    (void)state;
+    (void)flags;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**
+ * \brief Gets the UDP segmentation offload features that are enabled
+ * on a DatagramState.
+ *
+ * \param state The DatagramState object.
+ *
+ * \return The features that are enabled, or zero if \a state is NULL.
+ * The \ref NOISE_DATAGRAM_OFFLOAD_GSO flag is cleared if the kernel
+ * rejected a segmented message.
+ *
+ * \sa noise_datagramstate_set_offload()
+ */
+int noise_datagramstate_get_offload(const NoiseDatagramState *state)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    return state ? state->offload : 0;
+#else
+    (void)state;
+    return 0;
+#endif
+}
+
+/**@}*/
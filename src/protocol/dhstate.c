@@ -48,6 +48,44 @@
  * \brief Opaque object that represents a DHState.
  */
 
+/**
+ * \brief Adds a reference to a shared DHState object.
+ *
+ * \param state The DHState object, which must already have been shared
+ * with noise_dhstate_share().
+ *
+ * The reference count is updated atomically, so many threads can add
+ * references to the same object at once.
+ *
+ * \note Not part of the public API.
+ */
+void noise_dhstate_acquire(NoiseDHState *state)
+{
+#if defined(__GNUC__)
+    __atomic_add_fetch(&(state->refs), 1, __ATOMIC_RELAXED);
+#else
+    ++(state->refs);
+#endif
+}
+
+/**
+ * \brief Releases a reference to a shared DHState object.
+ *
+ * \param state The DHState object.
+ *
+ * \return The number of extra references before this one was released.
+ * Zero indicates that the caller held the last reference and the object
+ * should be destroyed.
+ */
+static int noise_dhstate_release(NoiseDHState *state)
+{
+#if defined(__GNUC__)
+    return __atomic_sub_fetch(&(state->refs), 1, __ATOMIC_ACQ_REL) + 1;
+#else
+    return (state->refs)--;
+#endif
+}
+
 /**
  * \brief Creates a new DHState object by its algorithm identifier.
  *
@@ -141,7 +179,12 @@ int noise_dhstate_new_by_name(NoiseDHState **state, const char *name)
  * \return NOISE_ERROR_NONE on success.
  * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
  *
- * \sa noise_dhstate_new_by_id(), noise_dhstate_new_by_name()
+ * If \a state has been shared with noise_dhstate_share(), then this
+ * drops one reference and the object is only destroyed when the last
+ * reference is dropped.
+ *
+ * \sa noise_dhstate_new_by_id(), noise_dhstate_new_by_name(),
+ * noise_dhstate_share()
  */
 int noise_dhstate_free(NoiseDHState *state)
 {
@@ -149,6 +192,10 @@ int noise_dhstate_free(NoiseDHState *state)
     if (!state)
         return NOISE_ERROR_INVALID_PARAM;
 
+    /* Drop a reference if the object is still shared with others */
+    if (state->shared && noise_dhstate_release(state) > 0)
+        return NOISE_ERROR_NONE;
+
     /* Call the backend-specific destroy function if necessary */
     if (state->destroy)
         (*(state->destroy))(state);
@@ -279,6 +326,8 @@ int noise_dhstate_has_public_key(const NoiseDHState *state)
  *
  * \return NOISE_ERROR_NONE on success.
  * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * \note This function needs to generate random key material for the
  * private key, so the system random number generator must be properly
@@ -293,6 +342,8 @@ int noise_dhstate_generate_keypair(NoiseDHState *state)
     /* Validate the parameter */
     if (!state)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
 
     /* Generate the new keypair */
     err = (*(state->generate_keypair))(state, 0);
@@ -315,6 +366,8 @@ int noise_dhstate_generate_keypair(NoiseDHState *state)
  * do not have the same algorithm identifier.
  * \return NOISE_ERROR_INVALID_STATE if dependent parameters are required
  * but \a other does not currently contain any.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * This function is intended for generating ephemeral keypairs for
  * algorithms like New Hope where the keypair for Bob depends upon
@@ -338,6 +391,8 @@ int noise_dhstate_generate_dependent_keypair
         return NOISE_ERROR_INVALID_PARAM;
     if (other && state->dh_id != other->dh_id)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
 
     /* Generate the new keypair */
     err = (*(state->generate_keypair))(state, other);
@@ -362,6 +417,8 @@ int noise_dhstate_generate_dependent_keypair
  * \a public_key_len is incorrect for the algorithm.
  * \return NOISE_ERROR_INVALID_PRIVATE_KEY if \a private_key is not valid.
  * \return NOISE_ERROR_INVALID_PUBLIC_KEY if \a public_key is not valid.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * The algorithm may decide to defer NOISE_ERROR_INVALID_PRIVATE_KEY or
  * NOISE_ERROR_INVALID_PUBLIC_KEY to later when the keypair is actually
@@ -379,6 +436,8 @@ int noise_dhstate_set_keypair
     /* Validate the parameters */
     if (!state || !private_key || !public_key)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
     if (private_key_len != state->private_key_len)
         return NOISE_ERROR_INVALID_LENGTH;
     if (public_key_len != state->public_key_len)
@@ -408,6 +467,8 @@ int noise_dhstate_set_keypair
  * \return NOISE_ERROR_INVALID_PRIVATE_KEY if \a private_key is not valid.
  * \return NOISE_ERROR_INVALID_PUBLIC_KEY if \a public_key that is derived
  * from the \a private_key is not valid.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * The algorithm may decide to defer NOISE_ERROR_INVALID_PRIVATE_KEY or
  * NOISE_ERROR_INVALID_PUBLIC_KEY to later when the keypair is actually
@@ -427,6 +488,8 @@ int noise_dhstate_set_keypair_private
     /* Validate the parameters */
     if (!state || !private_key)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
     if (private_key_len != state->private_key_len)
         return NOISE_ERROR_INVALID_LENGTH;
 
@@ -496,6 +559,8 @@ int noise_dhstate_get_keypair
  * for the algorithm.
  * \return NOISE_ERROR_INVALID_PUBLIC_KEY if \a public_key is not valid
  * and it is not the special null value.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * After this function succeeds, the DHState will only contain a public key.
  * Any existing private key will be cleared.  Thus, this function is useful
@@ -515,6 +580,8 @@ int noise_dhstate_set_public_key
     /* Validate the parameters */
     if (!state || !public_key)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
     if (public_key_len != state->public_key_len)
         return NOISE_ERROR_INVALID_LENGTH;
 
@@ -570,6 +637,8 @@ int noise_dhstate_get_public_key
  * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
  * \return NOISE_ERROR_INVALID_PARAM if \a state does not support null
  * public keys.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * \sa noise_dhstate_is_null_public_key()
  */
@@ -578,6 +647,8 @@ int noise_dhstate_set_null_public_key(NoiseDHState *state)
     /* Validate the parameter */
     if (!state || !state->nulls_allowed)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
 
     /* Clear the key to all-zeroes */
     memset(state->public_key, 0, state->public_key_len);
@@ -616,6 +687,8 @@ int noise_dhstate_is_null_public_key(const NoiseDHState *state)
  *
  * \return NOISE_ERROR_NONE on success.
  * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * \sa noise_dhstate_has_keypair(), noise_dhstate_has_public_key()
  */
@@ -624,6 +697,8 @@ int noise_dhstate_clear_key(NoiseDHState *state)
     /* Validate the parameter */
     if (!state)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
 
     /* Clear the key to all-zeroes */
     memset(state->public_key, 0, state->public_key_len);
@@ -706,7 +781,7 @@ int noise_dhstate_calculate
         (public_key_state->public_key, public_key_state->public_key_len);
 
     /* Perform the calculation */
-    err = (*(private_key_state->calculate))
+    err = noise_dh_calculate
         (private_key_state, public_key_state, shared_key);
 
     /* If the public key was null, then we need to set the shared key
@@ -726,6 +801,8 @@ int noise_dhstate_calculate
  * \return NOISE_ERROR_INVALID_PARAM if \a state or \a from is NULL.
  * \return NOISE_ERROR_NOT_APPLICABLE if \a from does not have the same
  * key type identifier as \a state.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  */
 int noise_dhstate_copy(NoiseDHState *state, const NoiseDHState *from)
 {
@@ -738,6 +815,8 @@ int noise_dhstate_copy(NoiseDHState *state, const NoiseDHState *from)
         return NOISE_ERROR_NOT_APPLICABLE;
     if (state == from)
         return NOISE_ERROR_NONE;
+    if (state->shared)
+        return NOISE_ERROR_INVALID_STATE;
 
     /* Copy the key information across */
     err = (*(state->copy))(state, from, 0);
@@ -747,6 +826,65 @@ int noise_dhstate_copy(NoiseDHState *state, const NoiseDHState *from)
     return err;
 }
 
+/**
+ * \brief Shares a DHState object that contains a keypair.
+ *
+ * \param state The DHState object to share.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the algorithm for \a state only
+ * supports ephemeral keys.
+ * \return NOISE_ERROR_INVALID_STATE if \a state does not contain a keypair.
+ *
+ * This function makes \a state immutable so that it can be handed to
+ * noise_handshakestate_set_local_keypair_shared().  Functions that would
+ * modify the key fail with NOISE_ERROR_INVALID_STATE afterwards.
+ *
+ * Call this function once, before \a state is made visible to other
+ * threads.  After that, many HandshakeState objects can use the key at
+ * once, including from multiple threads, without copying the key or
+ * deriving the public key again.  Each HandshakeState adds a reference,
+ * and the key material is destroyed when the caller and every
+ * HandshakeState have released theirs with noise_dhstate_free().
+ *
+ * Sharing an object that is already shared has no further effect.
+ *
+ * \sa noise_dhstate_is_shared(),
+ * noise_handshakestate_set_local_keypair_shared()
+ */
+int noise_dhstate_share(NoiseDHState *state)
+{
+    /* Validate the parameter */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->ephemeral_only)
+        return NOISE_ERROR_NOT_APPLICABLE;
+    if (state->key_type != NOISE_KEY_TYPE_KEYPAIR)
+        return NOISE_ERROR_INVALID_STATE;
+
+    /* Freeze the key.  The flag is never written again, so other threads
+       can test it without synchronization once they have the object */
+    if (!state->shared)
+        state->shared = 1;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Determine if a DHState object has been shared.
+ *
+ * \param state The DHState object.
+ *
+ * \return Returns non-zero if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified, or zero otherwise.
+ *
+ * \sa noise_dhstate_share()
+ */
+int noise_dhstate_is_shared(const NoiseDHState *state)
+{
+    return state ? state->shared : 0;
+}
+
 /**
  * \brief Formats the public key fingerprint for the key within a DHState.
  *
@@ -818,6 +956,8 @@ int noise_dhstate_get_role(const NoiseDHState *state)
  * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
  * \return NOISE_ERROR_INVALID_PARAM if \a role is not one of
  * NOISE_ROLE_INITIATOR, NOISE_ROLE_RESPONDER, or zero.
+ * \return NOISE_ERROR_INVALID_STATE if \a state has been shared with
+ * noise_dhstate_share() and can no longer be modified.
  *
  * This function is intended for use with algorithms that have a different
  * method for calculating public keys and shared secrets for the two parties
@@ -838,6 +978,8 @@ int noise_dhstate_set_role(NoiseDHState *state, int role)
         return NOISE_ERROR_INVALID_PARAM;
     if (role != NOISE_ROLE_INITIATOR && role != NOISE_ROLE_RESPONDER && role)
         return NOISE_ERROR_INVALID_PARAM;
+    if (state->shared && role != state->role)
+        return NOISE_ERROR_INVALID_STATE;
     state->role = role;
     if (state->change_role)
         (*(state->change_role))(state);
@@ -61,6 +61,7 @@ static const char * const error_strings[] = {
     "Invalid public key",
     "Invalid format",
     "Invalid signature",
+    "Cookie required",
     "END"
 };
 #define num_error_strings (sizeof(error_strings) / sizeof(error_strings[0]) - 1)
@@ -21,6 +21,7 @@
  */
 
 #include "internal.h"
+#include "crypto/newhope/params.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -323,6 +324,176 @@ int noise_handshakestate_new_by_name
     return noise_handshakestate_new(state, symmetric, role);
 }
 
+/**
+ * \brief Gets the length of the public key that an initiator sends for
+ * a DH algorithm, without allocating a DHState object.
+ *
+ * \param dh_id The DH algorithm identifier.
+ *
+ * \return The public key length, or zero if \a dh_id is unknown.
+ */
+static size_t noise_handshakestate_initiator_key_len(int dh_id)
+{
+    switch (dh_id) {
+    case NOISE_DH_CURVE25519:   return 32;
+    case NOISE_DH_CURVE448:     return 56;
+    case NOISE_DH_NEWHOPE:      return NEWHOPE_SENDABYTES;
+    default:                    break;
+    }
+    return 0;
+}
+
+/**
+ * \brief Gets the length of the MAC for a cipher algorithm, without
+ * allocating a CipherState object.
+ *
+ * \param cipher_id The cipher algorithm identifier.
+ *
+ * \return The MAC length, or zero if \a cipher_id is unknown.
+ */
+static size_t noise_handshakestate_cipher_mac_len(int cipher_id)
+{
+    switch (cipher_id) {
+    case NOISE_CIPHER_CHACHAPOLY:   return 16;
+    case NOISE_CIPHER_AESGCM:       return 16;
+#if NOISE_USE_AEGIS256
+    case NOISE_CIPHER_AEGIS256:     return 16;
+#endif
+    default:                        break;
+    }
+    return 0;
+}
+
+/**
+ * \brief Checks the structure of the first handshake message before
+ * allocating a HandshakeState for the responder.
+ *
+ * \param protocol_id The protocol identifier that the responder will
+ * use to process the message.
+ * \param message The first handshake message from the initiator.
+ *
+ * \return NOISE_ERROR_NONE if the message is plausible and should be
+ * processed with a new HandshakeState.
+ * \return NOISE_ERROR_INVALID_PARAM if \a protocol_id or \a message is NULL.
+ * \return NOISE_ERROR_UNKNOWN_ID if \a protocol_id contains an unknown
+ * prefix, pattern, DH, or cipher identifier.
+ * \return NOISE_ERROR_NOT_APPLICABLE if \a protocol_id refers to a
+ * fallback pattern, which never starts a new handshake, or the combination
+ * of pattern and DH algorithms is not permitted.
+ * \return NOISE_ERROR_INVALID_LENGTH if the size of \a message is
+ * incorrect for the first message of the handshake pattern.
+ * \return NOISE_ERROR_INVALID_PUBLIC_KEY if the initiator's ephemeral
+ * key in \a message is the null public key.
+ *
+ * This function walks the tokens for the first message of the pattern to
+ * determine the smallest valid message size, using only the fixed key and
+ * MAC lengths of the algorithms in \a protocol_id.  It does not allocate
+ * any memory or perform any cryptographic operations, so a responder can
+ * discard truncated, oversized, and obviously invalid messages for
+ * almost no cost:
+ *
+ * \code
+ * if (noise_cookiestate_check_macs(cookie, &mbuf, addr, addr_len) != NOISE_ERROR_NONE)
+ *     return;
+ * if (noise_handshakestate_check_first_message(&id, &mbuf) != NOISE_ERROR_NONE)
+ *     return;
+ * noise_handshakestate_new_by_id(&handshake, &id, NOISE_ROLE_RESPONDER);
+ * \endcode
+ *
+ * The \a protocol_id can be parsed once with noise_protocol_name_to_id()
+ * and then reused for every incoming message.  When combined with
+ * noise_cookiestate_check_macs() as above, only messages with a valid
+ * "mac1" and a plausible structure will cause heap state to be allocated.
+ *
+ * A message that passes this check may still fail to authenticate when
+ * it is passed to noise_handshakestate_read_message().
+ *
+ * \sa noise_handshakestate_new_by_id(), noise_cookiestate_check_macs()
+ */
+int noise_handshakestate_check_first_message
+    (const NoiseProtocolId *protocol_id, const NoiseBuffer *message)
+{
+    const uint8_t *pattern;
+    const uint8_t *tokens;
+    NoisePatternFlags_t flags;
+    size_t dh_len;
+    size_t hybrid_len;
+    size_t mac_len;
+    size_t min_size;
+    int has_key;
+
+    /* Validate the parameters */
+    if (!protocol_id || !message || !(message->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    if (protocol_id->prefix_id != NOISE_PREFIX_STANDARD &&
+            protocol_id->prefix_id != NOISE_PREFIX_PSK)
+        return NOISE_ERROR_UNKNOWN_ID;
+    pattern = noise_pattern_lookup(protocol_id->pattern_id);
+    dh_len = noise_handshakestate_initiator_key_len(protocol_id->dh_id);
+    mac_len = noise_handshakestate_cipher_mac_len(protocol_id->cipher_id);
+    if (!pattern || !dh_len || !mac_len)
+        return NOISE_ERROR_UNKNOWN_ID;
+    if (protocol_id->hybrid_id != NOISE_DH_NONE) {
+        hybrid_len = noise_handshakestate_initiator_key_len
+            (protocol_id->hybrid_id);
+        if (!hybrid_len)
+            return NOISE_ERROR_UNKNOWN_ID;
+    } else {
+        hybrid_len = 0;
+    }
+
+    /* Fallback patterns never start a handshake, the hybrid DH algorithm
+       must be present if and only if the pattern uses it, and ephemeral-only
+       DH algorithms cannot be used with static keys */
+    flags = ((NoisePatternFlags_t)(pattern[0])) |
+           (((NoisePatternFlags_t)(pattern[1])) << 8);
+    if ((flags & (NOISE_PAT_FLAG_LOCAL_EPHEM_REQ |
+                  NOISE_PAT_FLAG_REMOTE_EPHEM_REQ)) != 0)
+        return NOISE_ERROR_NOT_APPLICABLE;
+    if (((flags & NOISE_PAT_FLAG_LOCAL_HYBRID) != 0) != (hybrid_len != 0))
+        return NOISE_ERROR_NOT_APPLICABLE;
+    if (protocol_id->dh_id == NOISE_DH_NEWHOPE &&
+            (flags & (NOISE_PAT_FLAG_LOCAL_STATIC |
+                      NOISE_PAT_FLAG_REMOTE_STATIC)) != 0)
+        return NOISE_ERROR_NOT_APPLICABLE;
+
+    /* Walk the tokens for the first message to determine its minimum size.
+       Encrypted values carry a MAC once a key has been mixed into the
+       chaining key, which is from the start for PSK protocols. */
+    has_key = (protocol_id->prefix_id == NOISE_PREFIX_PSK);
+    min_size = 0;
+    for (tokens = pattern + 2; *tokens != NOISE_TOKEN_END &&
+                               *tokens != NOISE_TOKEN_FLIP_DIR; ++tokens) {
+        switch (*tokens) {
+        case NOISE_TOKEN_E:
+            /* Reject the null ephemeral key here rather than later */
+            if (message->size >= (min_size + dh_len) &&
+                    protocol_id->dh_id != NOISE_DH_NEWHOPE &&
+                    noise_is_zero(message->data + min_size, dh_len))
+                return NOISE_ERROR_INVALID_PUBLIC_KEY;
+            min_size += dh_len;
+            break;
+        case NOISE_TOKEN_S:
+            min_size += dh_len + (has_key ? mac_len : 0);
+            break;
+        case NOISE_TOKEN_F:
+            min_size += hybrid_len + (has_key ? mac_len : 0);
+            break;
+        default:
+            /* All other tokens mix a DH result into the chaining key */
+            has_key = 1;
+            break;
+        }
+    }
+    if (has_key)
+        min_size += mac_len;
+
+    /* Check the size of the message against the expected size */
+    if (message->size < min_size || message->size > NOISE_MAX_PAYLOAD_LEN)
+        return NOISE_ERROR_INVALID_LENGTH;
+    return NOISE_ERROR_NONE;
+}
+
 /**
  * \brief Frees a HandshakeState object after destroying all sensitive material.
  *
@@ -420,6 +591,58 @@ NoiseDHState *noise_handshakestate_get_local_keypair_dh
     return state ? state->dh_local_static : 0;
 }
 
+/**
+ * \brief Uses a shared DHState object for the local static keypair.
+ *
+ * \param state The HandshakeState object.
+ * \param key The DHState object that contains the local static keypair.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a key is NULL.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the handshake does not use a
+ * local static keypair, or \a key is for a different algorithm.
+ * \return NOISE_ERROR_INVALID_STATE if the protocol has already started
+ * or \a key has not been shared with noise_dhstate_share().
+ *
+ * This function is an alternative to setting the keypair on the object
+ * returned by noise_handshakestate_get_local_keypair_dh().  The
+ * HandshakeState keeps a reference to \a key instead of a copy.  Servers
+ * that accept many handshakes with the same long-term key can create the
+ * key once, share it, and then hand it to every new HandshakeState
+ * without copying or validating it again.
+ *
+ * The reference is added atomically and \a key is not otherwise modified,
+ * so HandshakeState objects on different threads can attach the same key
+ * at the same time.
+ *
+ * The caller still owns its own reference to \a key and must eventually
+ * release it with noise_dhstate_free().  The key material is destroyed
+ * once the last HandshakeState that uses it has also been freed.
+ *
+ * \sa noise_handshakestate_get_local_keypair_dh(), noise_dhstate_share()
+ */
+int noise_handshakestate_set_local_keypair_shared
+    (NoiseHandshakeState *state, NoiseDHState *key)
+{
+    /* Validate the parameters */
+    if (!state || !key)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!state->dh_local_static || key->dh_id != state->dh_local_static->dh_id)
+        return NOISE_ERROR_NOT_APPLICABLE;
+    if (state->action != NOISE_ACTION_NONE)
+        return NOISE_ERROR_INVALID_STATE;
+    if (key == state->dh_local_static)
+        return NOISE_ERROR_NONE;
+    if (!key->shared)
+        return NOISE_ERROR_INVALID_STATE;
+
+    /* Add a reference to the shared key and drop the private object */
+    noise_dhstate_acquire(key);
+    noise_dhstate_free(state->dh_local_static);
+    state->dh_local_static = key;
+    return NOISE_ERROR_NONE;
+}
+
 /**
  * \brief Gets the DHState object that contains the remote static public key.
  *
@@ -739,6 +962,106 @@ int noise_handshakestate_has_remote_public_key(const NoiseHandshakeState *state)
     return noise_dhstate_has_public_key(state->dh_remote_static);
 }
 
+/**
+ * \typedef NoiseRemoteKeyCallback
+ * \brief Callback function for checking a remote static public key.
+ *
+ * \param user_data The user data pointer that was supplied to
+ * noise_handshakestate_set_remote_key_callback().
+ * \param remote_key The DHState object that contains the remote static
+ * public key that was just received from the remote party.
+ *
+ * \return NOISE_ERROR_NONE if the handshake should continue, or any other
+ * error code to abort the handshake.  The error code will be returned
+ * from noise_handshakestate_read_message().
+ */
+
+/**
+ * \brief Sets a callback that checks the remote static public key as
+ * soon as it has been received during the handshake.
+ *
+ * \param state The HandshakeState object.
+ * \param callback The callback function to invoke, or NULL to disable
+ * the callback.
+ * \param user_data User data to pass to the \a callback.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * The \a callback is invoked by noise_handshakestate_read_message()
+ * immediately after the remote party's static public key has been
+ * decrypted from an "s" token, and before any of the remaining tokens
+ * in the message are processed.  This allows the application to check
+ * the key against an access control list and to abort the handshake
+ * before performing the expensive Diffie-Hellman operations that follow.
+ *
+ * If the \a callback returns an error, then the handshake fails with
+ * that error code.  NOISE_ERROR_INVALID_PUBLIC_KEY is a suitable code
+ * for keys that are not authorized to connect.
+ *
+ * The callback is not invoked for remote static public keys that are
+ * supplied by the application ahead of time on the object returned by
+ * noise_handshakestate_get_remote_public_key_dh().  The setting is
+ * preserved across calls to noise_handshakestate_fallback().
+ *
+ * \sa noise_handshakestate_read_message(),
+ * noise_handshakestate_get_remote_public_key_dh()
+ */
+int noise_handshakestate_set_remote_key_callback
+    (NoiseHandshakeState *state, NoiseRemoteKeyCallback callback,
+     void *user_data)
+{
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    state->remote_key_callback = callback;
+    state->remote_key_user_data = user_data;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Enables or disables running the hybrid forward secrecy DH
+ * operations concurrently with the classical DH operations.
+ *
+ * \param state The HandshakeState object.
+ * \param enable Non-zero to enable concurrent operations, or zero to
+ * perform all operations serially on the calling thread.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the protocol does not use hybrid
+ * forward secrecy, or the library was built without thread support.
+ *
+ * When enabled, noise_handshakestate_write_message() generates the local
+ * hybrid keypair for an "f" token on a helper thread while the classical
+ * ephemeral keypair is generated on the calling thread.  Once both hybrid
+ * keys are known, the shared key for a later "ff" token in the same message
+ * is calculated on a helper thread while the calling thread performs the
+ * classical DH operations in between.  The results are always mixed into
+ * the handshake in pattern order, so the messages and the session keys are
+ * identical to those produced by the serial implementation.
+ *
+ * This reduces the latency of a single handshake when spare cores are
+ * available, at the cost of starting a short-lived thread for each
+ * operation.  The helper threads never outlive the call to
+ * noise_handshakestate_write_message() or noise_handshakestate_read_message()
+ * that created them.  Concurrent operations are disabled by default.
+ */
+int noise_handshakestate_set_concurrent_hybrid
+    (NoiseHandshakeState *state, int enable)
+{
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!state->dh_local_hybrid)
+        return NOISE_ERROR_NOT_APPLICABLE;
+#if defined(HAVE_PTHREAD)
+    state->concurrent_hybrid = (enable != 0);
+    return NOISE_ERROR_NONE;
+#else
+    (void)enable;
+    return NOISE_ERROR_NOT_APPLICABLE;
+#endif
+}
+
 /**
  * \brief Mixes a public key value into the handshake hash.
  *
@@ -1137,6 +1460,162 @@ static int noise_handshake_mix_dh
     return err;
 }
 
+/**
+ * \brief Performs a hybrid DH job.
+ *
+ * \param job The job to perform.
+ */
+static void noise_hybrid_job_perform(NoiseHybridJob *job)
+{
+    if (job->op == NOISE_HYBRID_JOB_KEYGEN) {
+        job->err = noise_dhstate_generate_dependent_keypair
+            (job->local, job->remote);
+    } else {
+        job->err = noise_dhstate_calculate
+            (job->local, job->remote, job->shared, job->local->shared_key_len);
+    }
+}
+
+#if defined(HAVE_PTHREAD)
+
+/**
+ * \brief Entry point for the helper thread that runs a hybrid DH job.
+ *
+ * \param arg Points to the NoiseHybridJob.
+ *
+ * \return Always NULL.
+ */
+static void *noise_hybrid_job_thread(void *arg)
+{
+    noise_hybrid_job_perform((NoiseHybridJob *)arg);
+    return 0;
+}
+
+#endif
+
+/**
+ * \brief Starts a hybrid DH job on a helper thread.
+ *
+ * \param state The HandshakeState object.
+ * \param op The operation to perform.
+ *
+ * If the helper thread cannot be started, then the job is performed
+ * immediately on the calling thread instead.
+ */
+static void noise_hybrid_job_start(NoiseHandshakeState *state, int op)
+{
+    NoiseHybridJob *job = &(state->hybrid_job);
+    job->op = op;
+    job->threaded = 0;
+    job->err = NOISE_ERROR_NONE;
+    job->local = state->dh_local_hybrid;
+    job->remote = state->dh_remote_hybrid;
+#if defined(HAVE_PTHREAD)
+    if (pthread_create(&(job->thread), 0, noise_hybrid_job_thread, job) == 0) {
+        job->threaded = 1;
+        return;
+    }
+#endif
+    noise_hybrid_job_perform(job);
+}
+
+/**
+ * \brief Waits for a hybrid DH job to finish.
+ *
+ * \param state The HandshakeState object.
+ *
+ * \return The result of the job.
+ *
+ * This function does nothing if there is no pending job.
+ */
+static int noise_hybrid_job_finish(NoiseHandshakeState *state)
+{
+    NoiseHybridJob *job = &(state->hybrid_job);
+#if defined(HAVE_PTHREAD)
+    if (job->threaded) {
+        pthread_join(job->thread, 0);
+        job->threaded = 0;
+    }
+#endif
+    job->op = NOISE_HYBRID_JOB_NONE;
+    return job->err;
+}
+
+/**
+ * \brief Determine if a token appears later in the current message.
+ *
+ * \param tokens Points to the next token to be processed.
+ * \param token The token to look for.
+ *
+ * \return Non-zero if \a token appears before the end of the message.
+ */
+static int noise_handshake_message_has_token(const uint8_t *tokens, uint8_t token)
+{
+    while (*tokens != NOISE_TOKEN_END && *tokens != NOISE_TOKEN_FLIP_DIR) {
+        if (*tokens == token)
+            return 1;
+        ++tokens;
+    }
+    return 0;
+}
+
+/**
+ * \brief Starts calculating the "ff" shared key on a helper thread if
+ * the "ff" token appears later in the current message.
+ *
+ * \param state The HandshakeState object, positioned on an "f" token.
+ */
+static void noise_handshake_start_hybrid_dh(NoiseHandshakeState *state)
+{
+    if (state->concurrent_hybrid &&
+            noise_handshake_message_has_token
+                (state->tokens + 1, NOISE_TOKEN_FF)) {
+        noise_hybrid_job_start(state, NOISE_HYBRID_JOB_CALCULATE);
+    }
+}
+
+/**
+ * \brief Mixes the "ff" shared key into the chaining key.
+ *
+ * \param state The HandshakeState object.
+ *
+ * \return NOISE_ERROR_NONE on success, or an error code from
+ * noise_dhstate_calculate() otherwise.
+ *
+ * If the shared key is being calculated on a helper thread, then this
+ * function waits for the result.  Otherwise the shared key is calculated
+ * on the calling thread.
+ */
+static int noise_handshake_mix_hybrid_dh(NoiseHandshakeState *state)
+{
+    size_t len;
+    int err;
+    if (state->hybrid_job.op != NOISE_HYBRID_JOB_CALCULATE) {
+        return noise_handshake_mix_dh
+            (state, state->dh_local_hybrid, state->dh_remote_hybrid);
+    }
+    err = noise_hybrid_job_finish(state);
+    len = state->dh_local_hybrid->shared_key_len;
+    noise_symmetricstate_mix_key(state->symmetric, state->hybrid_job.shared, len);
+    noise_clean(state->hybrid_job.shared, len);
+    return err;
+}
+
+/**
+ * \brief Waits for any pending hybrid DH job and discards its result.
+ *
+ * \param state The HandshakeState object.
+ *
+ * This is used to make sure that no helper threads are left running
+ * if a handshake message is abandoned part-way through due to an error.
+ */
+static void noise_handshakestate_finish_hybrid(NoiseHandshakeState *state)
+{
+    if (state->hybrid_job.op != NOISE_HYBRID_JOB_NONE)
+        noise_hybrid_job_finish(state);
+    noise_clean(state->hybrid_job.shared, sizeof(state->hybrid_job.shared));
+}
+
 /**
  * \brief Internal implementation of noise_handshakestate_write_message().
  *
@@ -1157,6 +1636,21 @@ static int noise_handshakestate_write
     uint8_t token;
     int err;
 
+    /* If the message contains an "f" token, then start generating the
+       local hybrid keypair while we process the earlier tokens.  The
+       remote hybrid key cannot change while we are writing */
+    if (state->concurrent_hybrid && !state->dh_fixed_hybrid &&
+            noise_handshake_message_has_token(state->tokens, NOISE_TOKEN_F)) {
+        if (state->dh_remote_hybrid->key_type == NOISE_KEY_TYPE_NO_KEY) {
+            noise_dhstate_set_role
+                (state->dh_local_hybrid, NOISE_ROLE_INITIATOR);
+        } else {
+            noise_dhstate_set_role
+                (state->dh_local_hybrid, NOISE_ROLE_RESPONDER);
+        }
+        noise_hybrid_job_start(state, NOISE_HYBRID_JOB_KEYGEN);
+    }
+
     /* Process tokens until the direction changes or the pattern ends */
     for (;;) {
         token = *(state->tokens);
@@ -1267,14 +1761,21 @@ static int noise_handshakestate_write
                then the hybrid key may have already been provided. */
             if (!state->dh_local_hybrid || !state->dh_remote_hybrid)
                 return NOISE_ERROR_INVALID_STATE;
-            if (state->dh_remote_hybrid->key_type == NOISE_KEY_TYPE_NO_KEY) {
+            if (state->hybrid_job.op == NOISE_HYBRID_JOB_KEYGEN) {
+                /* The role was set before the helper thread started and
+                   must not be written again while it uses the object */
+            } else if (state->dh_remote_hybrid->key_type ==
+                           NOISE_KEY_TYPE_NO_KEY) {
                 noise_dhstate_set_role
                     (state->dh_local_hybrid, NOISE_ROLE_INITIATOR);
             } else {
                 noise_dhstate_set_role
                     (state->dh_local_hybrid, NOISE_ROLE_RESPONDER);
             }
-            if (!state->dh_fixed_hybrid) {
+            if (state->hybrid_job.op == NOISE_HYBRID_JOB_KEYGEN) {
+                /* Wait for the keypair that is being generated concurrently */
+                err = noise_hybrid_job_finish(state);
+            } else if (!state->dh_fixed_hybrid) {
                 err = noise_dhstate_generate_dependent_keypair
                     (state->dh_local_hybrid, state->dh_remote_hybrid);
             } else {
@@ -1297,11 +1798,11 @@ static int noise_handshakestate_write
             err = noise_symmetricstate_encrypt_and_hash(state->symmetric, &rest);
             if (err != NOISE_ERROR_NONE)
                 break;
+            noise_handshake_start_hybrid_dh(state);
             break;
         case NOISE_TOKEN_FF:
             /* DH operation with local and remote hybrid keys */
-            err = noise_handshake_mix_dh
-                (state, state->dh_local_hybrid, state->dh_remote_hybrid);
+            err = noise_handshake_mix_hybrid_dh(state);
             break;
         default:
             /* Unknown token code in the pattern.  This shouldn't happen.
@@ -1394,6 +1895,7 @@ int noise_handshakestate_write_message
 
     /* Perform the write */
     err = noise_handshakestate_write(state, message, payload);
+    noise_handshakestate_finish_hybrid(state);
     if (err != NOISE_ERROR_NONE) {
         /* Set the state to "failed" and empty the message buffer */
         state->action = NOISE_ACTION_FAILED;
@@ -1502,6 +2004,13 @@ static int noise_handshakestate_read
             msg.data += len;
             msg.size -= len;
             msg.max_size -= len;
+
+            /* Give the application a chance to reject the remote static
+               key before we perform any more DH operations with it */
+            if (state->remote_key_callback) {
+                err = (*(state->remote_key_callback))
+                    (state->remote_key_user_data, state->dh_remote_static);
+            }
             break;
         case NOISE_TOKEN_EE:
             /* DH operation with initiator and responder ephemeral keys */
@@ -1570,11 +2079,11 @@ static int noise_handshakestate_read
                 err = NOISE_ERROR_INVALID_PUBLIC_KEY;
                 break;
             }
+            noise_handshake_start_hybrid_dh(state);
             break;
         case NOISE_TOKEN_FF:
             /* DH operation with local and remote hybrid keys */
-            err = noise_handshake_mix_dh
-                (state, state->dh_local_hybrid, state->dh_remote_hybrid);
+            err = noise_handshake_mix_hybrid_dh(state);
             break;
         default:
             /* Unknown token code in the pattern.  This shouldn't happen.
@@ -1621,6 +2130,8 @@ static int noise_handshakestate_read
  * which terminates the handshake.
  * \return NOISE_ERROR_PUBLIC_KEY if an invalid remote public key is seen
  * during the processing of this message.
+ * \return Any error code that was returned by the callback that was
+ * registered with noise_handshakestate_set_remote_key_callback().
  *
  * If \a payload is NULL, then the message payload will be authenticated
  * and then discarded, regardless of its length.  If the application was
@@ -1656,6 +2167,7 @@ int noise_handshakestate_read_message
 
     /* Perform the read */
     err = noise_handshakestate_read(state, message, payload);
+    noise_handshakestate_finish_hybrid(state);
     noise_clean(message->data, message->size);
     if (err != NOISE_ERROR_NONE)
         state->action = NOISE_ACTION_FAILED;
@@ -95,6 +95,12 @@ int noise_hashstate_new_by_id(NoiseHashState **state, int id)
         *state = noise_sha512_new();
         break;
 
+#if NOISE_USE_BLAKE3
+    case NOISE_HASH_BLAKE3:
+        *state = noise_blake3_new();
+        break;
+#endif
+
     default:
         return NOISE_ERROR_UNKNOWN_ID;
     }
@@ -225,7 +231,7 @@ int noise_hashstate_reset(NoiseHashState *state)
         return NOISE_ERROR_INVALID_PARAM;
 
     /* Reset the hash state */
-    (*(state->reset))(state);
+    noise_hash_reset(state);
     return NOISE_ERROR_NONE;
 }
 
@@ -249,7 +255,7 @@ int noise_hashstate_update
         return NOISE_ERROR_INVALID_PARAM;
 
     /* Update the hash state */
-    (*(state->update))(state, data, data_len);
+    noise_hash_update(state, data, data_len);
     return NOISE_ERROR_NONE;
 }
 
@@ -278,7 +284,7 @@ int noise_hashstate_finalize
         return NOISE_ERROR_INVALID_LENGTH;
 
     /* Finalize the hash state */
-    (*(state->finalize))(state, hash);
+    noise_hash_finalize(state, hash);
     return NOISE_ERROR_NONE;
 }
 
@@ -316,9 +322,77 @@ int noise_hashstate_hash_one
         return NOISE_ERROR_INVALID_LENGTH;
 
     /* Hash the data */
-    (*(state->reset))(state);
-    (*(state->update))(state, data, data_len);
-    (*(state->finalize))(state, hash);
+    noise_hash_reset(state);
+    noise_hash_update(state, data, data_len);
+    noise_hash_finalize(state, hash);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Hashes several independent data buffers in one call.
+ *
+ * \param hash_id The identifier for the hash algorithm to use;
+ * e.g. NOISE_HASH_BLAKE2s.
+ * \param inputs Points to an array of \a count data buffers to be hashed.
+ * \param input_lens Points to an array of \a count data lengths.
+ * \param outputs Points to an array of \a count return buffers for
+ * the hash values.
+ * \param hash_len The length of each buffer in \a outputs.
+ * \param count The number of data buffers to hash.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if one of \a inputs, \a input_lens,
+ * or \a outputs is NULL, or one of the input or output pointers is NULL.
+ * \return NOISE_ERROR_UNKNOWN_ID if \a hash_id is unknown.
+ * \return NOISE_ERROR_INVALID_LENGTH if \a hash_len is not the same
+ * as the hash length for the algorithm.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate a HashState for the algorithm.
+ *
+ * The result for each input is the same as calling
+ * noise_hashstate_hash_one() on it.  Back ends that support it hash
+ * several short inputs in parallel by packing them into SIMD lanes,
+ * which is much faster than hashing them one at a time.  Output
+ * buffers must not overlap the inputs.
+ *
+ * \sa noise_hashstate_hash_one()
+ */
+int noise_hashstate_hash_many
+    (int hash_id, const uint8_t * const *inputs, const size_t *input_lens,
+     uint8_t * const *outputs, size_t hash_len, size_t count)
+{
+    NoiseHashState *state;
+    size_t index;
+    int err;
+
+    /* Validate the parameters */
+    if (!inputs || !input_lens || !outputs)
+        return NOISE_ERROR_INVALID_PARAM;
+    for (index = 0; index < count; ++index) {
+        if (!inputs[index] || !outputs[index])
+            return NOISE_ERROR_INVALID_PARAM;
+    }
+
+    /* Create a HashState to get the length and the back end */
+    err = noise_hashstate_new_by_id(&state, hash_id);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    if (hash_len != state->hash_len) {
+        noise_hashstate_free(state);
+        return NOISE_ERROR_INVALID_LENGTH;
+    }
+
+    /* Hash all of the inputs */
+    if (state->hash_many) {
+        (*(state->hash_many))(state, inputs, input_lens, outputs, count);
+    } else {
+        for (index = 0; index < count; ++index) {
+            noise_hash_reset(state);
+            noise_hash_update(state, inputs[index], input_lens[index]);
+            noise_hash_finalize(state, outputs[index]);
+        }
+    }
+    noise_hashstate_free(state);
     return NOISE_ERROR_NONE;
 }
 
@@ -359,10 +433,10 @@ int noise_hashstate_hash_two
         return NOISE_ERROR_INVALID_LENGTH;
 
     /* Hash the data */
-    (*(state->reset))(state);
-    (*(state->update))(state, data1, data1_len);
-    (*(state->update))(state, data2, data2_len);
-    (*(state->finalize))(state, hash);
+    noise_hash_reset(state);
+    noise_hash_update(state, data1, data1_len);
+    noise_hash_update(state, data2, data2_len);
+    noise_hash_finalize(state, hash);
     return NOISE_ERROR_NONE;
 }
 
@@ -403,7 +477,7 @@ static void noise_hashstate_xor_key(uint8_t *key, size_t key_len, uint8_t value)
  *
  * Reference: <a href="http://tools.ietf.org/html/rfc2104">RFC 2104</a>
  */
-static void noise_hashstate_hmac
+void noise_hashstate_hmac
     (NoiseHashState *state, const uint8_t *key, size_t key_len,
      const uint8_t *data1, size_t data1_len,
      const uint8_t *data2, size_t data2_len, uint8_t *hash)
@@ -420,29 +494,29 @@ static void noise_hashstate_hmac
         memcpy(key_block, key, key_len);
         memset(key_block + key_len, 0, block_len - key_len);
     } else {
-        (*(state->reset))(state);
-        (*(state->update))(state, key, key_len);
-        (*(state->finalize))(state, key_block);
+        noise_hash_reset(state);
+        noise_hash_update(state, key, key_len);
+        noise_hash_finalize(state, key_block);
         memset(key_block + hash_len, 0, block_len - hash_len);
     }
     noise_hashstate_xor_key(key_block, block_len, HMAC_IPAD);
 
     /* Calculate the inner hash */
-    (*(state->reset))(state);
-    (*(state->update))(state, key_block, block_len);
-    (*(state->update))(state, data1, data1_len);
+    noise_hash_reset(state);
+    noise_hash_update(state, key_block, block_len);
+    noise_hash_update(state, data1, data1_len);
     if (data2)
-        (*(state->update))(state, data2, data2_len);
-    (*(state->finalize))(state, hash);
+        noise_hash_update(state, data2, data2_len);
+    noise_hash_finalize(state, hash);
 
     /* Format the key for the outer hashing context */
     noise_hashstate_xor_key(key_block, block_len, HMAC_IPAD ^ HMAC_OPAD);
 
     /* Calculate the outer hash */
-    (*(state->reset))(state);
-    (*(state->update))(state, key_block, block_len);
-    (*(state->update))(state, hash, hash_len);
-    (*(state->finalize))(state, hash);
+    noise_hash_reset(state);
+    noise_hash_update(state, key_block, block_len);
+    noise_hash_update(state, hash, hash_len);
+    noise_hash_finalize(state, hash);
 
     /* Clean up and exit */
     noise_clean(key_block, state->block_len);
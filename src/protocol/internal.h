@@ -29,6 +29,9 @@
 #else
 #include <alloca.h>
 #endif
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -52,6 +55,11 @@ extern "C" {
  */
 #define NOISE_PSK_LEN 32
 
+/**
+ * \brief Maximum shared key length over all supported DH algorithms.
+ */
+#define NOISE_MAX_DH_SHARED_LEN 56
+
 /**
  * \brief Internal structure of the NoiseCipherState type.
  */
@@ -72,6 +80,15 @@ struct NoiseCipherState_s
     /** \brief Length of the MAC for this cipher in bytes */
     uint8_t mac_len;
 
+    /**
+     * \brief Maximum number of nonces that can be precomputed, or zero
+     * if the back end does not support lookahead.
+     */
+    uint8_t max_lookahead;
+
+    /** \brief Number of nonces to precompute, or zero if disabled */
+    uint8_t lookahead;
+
     /** \brief The nonce value for the next packet */
     uint64_t n;
 
@@ -130,6 +147,84 @@ struct NoiseCipherState_s
     int (*decrypt)(NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
                    uint8_t *data, size_t len);
 
+    /**
+     * \brief Encrypts data with this CipherState and adds the ciphertext
+     * to a running hash in the same pass.
+     *
+     * \param state Points to the CipherState.
+     * \param ad Points to the associated data to include in the
+     * MAC computation.
+     * \param ad_len The length of the associated data; may be zero.
+     * \param data Points to the plaintext on entry, and to the ciphertext
+     * plus MAC on exit.
+     * \param len The length of the plaintext.
+     * \param hash The HashState to update with the ciphertext, excluding
+     * the MAC.  The caller is responsible for resetting and finalizing it.
+     *
+     * \return NOISE_ERROR_NONE on success.
+     *
+     * This pointer can be NULL if the back end does not have a fused
+     * implementation, in which case the caller will hash the ciphertext
+     * after calling \ref encrypt.
+     */
+    int (*encrypt_hash)(NoiseCipherState *state, const uint8_t *ad,
+                        size_t ad_len, uint8_t *data, size_t len,
+                        NoiseHashState *hash);
+
+    /**
+     * \brief Decrypts data with this CipherState and adds the ciphertext
+     * to a running hash in the same pass as the MAC check.
+     *
+     * \param state Points to the CipherState.
+     * \param ad Points to the associated data to include in the
+     * MAC computation.
+     * \param ad_len The length of the associated data; may be zero.
+     * \param data Points to the ciphertext plus MAC on entry, and to
+     * the plaintext on exit.
+     * \param len The length of the ciphertext, excluding the MAC.
+     * \param hash The HashState to update with the ciphertext, excluding
+     * the MAC.  The caller is responsible for resetting and finalizing it.
+     *
+     * \return NOISE_ERROR_NONE on success, NOISE_ERROR_MAC_FAILURE
+     * if the MAC check failed.
+     *
+     * This pointer can be NULL if the back end does not have a fused
+     * implementation, in which case the caller will hash the ciphertext
+     * before calling \ref decrypt.
+     */
+    int (*decrypt_hash)(NoiseCipherState *state, const uint8_t *ad,
+                        size_t ad_len, uint8_t *data, size_t len,
+                        NoiseHashState *hash);
+
+    /**
+     * \brief Precomputes the per-packet keystream for upcoming nonces.
+     *
+     * \param state Points to the CipherState.
+     * \param depth The number of nonces to precompute, starting at \ref n.
+     *
+     * \return NOISE_ERROR_NONE on success, or NOISE_ERROR_NO_MEMORY if
+     * there is insufficient memory to hold the precomputed keystream.
+     *
+     * Any precomputed keystream for nonces outside the range
+     * \ref n ... \ref n + \a depth - 1 is securely discarded.  If \a depth
+     * is zero, then all precomputed keystream is discarded.
+     *
+     * This pointer can be NULL if the back end does not support lookahead.
+     */
+    int (*precompute)(NoiseCipherState *state, size_t depth);
+
+    /**
+     * \brief Copies the key from another CipherState of the same type.
+     *
+     * \param state Points to the CipherState to copy into.
+     * \param from Points to the CipherState to copy from.
+     *
+     * This pointer can be NULL if the back end's state is plain data
+     * that can be copied with memcpy().  Back ends that hold pointers
+     * must provide it so that the copy does not share them.
+     */
+    void (*copy)(NoiseCipherState *state, const NoiseCipherState *from);
+
     /**
      * \brief Destroys this CipherState prior to the memory being freed.
      *
@@ -187,6 +282,25 @@ struct NoiseHashState_s
      */
     void (*finalize)(NoiseHashState *state, uint8_t *hash);
 
+    /**
+     * \brief Hashes several independent inputs in one call.
+     *
+     * \param state Points to the HashState.
+     * \param inputs Points to the \a count inputs to be hashed.
+     * \param input_lens Points to the lengths of the \a inputs.
+     * \param outputs Points to the \a count buffers to receive the hash
+     * values, each of which must be at least \ref hash_len bytes in length.
+     * \param count The number of inputs to hash.
+     *
+     * The state's own hashing context is not used or modified.
+     *
+     * This pointer can be NULL if the back end has no faster way to hash
+     * several inputs than resetting and updating the state for each one.
+     */
+    void (*hash_many)
+        (NoiseHashState *state, const uint8_t * const *inputs,
+         const size_t *input_lens, uint8_t * const *outputs, size_t count);
+
     /**
      * \brief Destroys this HashState prior to the memory being freed.
      *
@@ -230,6 +344,9 @@ struct NoiseDHState_s
     /** \brief Non-zero if null public keys are allowed with this algorithm */
     uint8_t nulls_allowed : 1;
 
+    /** \brief Non-zero if the key is shared and can no longer be modified */
+    uint8_t shared : 1;
+
     /** \brief Length of the private key for this algorithm in bytes */
     uint16_t private_key_len;
 
@@ -239,6 +356,9 @@ struct NoiseDHState_s
     /** \brief Length of the shared key for this algorithm in bytes */
     uint16_t shared_key_len;
 
+    /** \brief Number of extra references held by HandshakeState objects */
+    int refs;
+
     /** \brief Points to the private key in the subclass state */
     uint8_t *private_key;
 
@@ -479,6 +599,25 @@ struct NoiseSignState_s
         (const NoiseSignState *state, const uint8_t *message,
          size_t message_len, const uint8_t *signature);
 
+    /**
+     * \brief Signs a batch of messages with the same keypair.
+     *
+     * \param state Points to the SignState.
+     * \param messages Points to the messages to be signed.
+     * \param message_lens Points to the lengths of the \a messages.
+     * \param signatures Points to the signature buffers to fill.
+     * \param count The number of messages to sign.
+     *
+     * \return NOISE_ERROR_NONE on success.
+     *
+     * This pointer can be NULL if the back end has no faster way to
+     * sign several messages than calling sign() repeatedly.
+     */
+    int (*sign_batch)
+        (const NoiseSignState *state, const uint8_t * const *messages,
+         const size_t *message_lens, uint8_t * const *signatures,
+         size_t count);
+
     /**
      * \brief Destroys this SignState prior to the memory being freed.
      *
@@ -525,6 +664,41 @@ struct NoiseSymmetricState_s
     uint8_t h[NOISE_MAX_HASHLEN];
 };
 
+/* Operations that can be performed by a hybrid DH job */
+#define NOISE_HYBRID_JOB_NONE       0   /**< No job is pending */
+#define NOISE_HYBRID_JOB_KEYGEN     1   /**< Generate the local hybrid key */
+#define NOISE_HYBRID_JOB_CALCULATE  2   /**< Calculate the "ff" shared key */
+
+/**
+ * \brief Hybrid DH operation that runs concurrently with the classical
+ * DH operations for the same handshake message.
+ */
+typedef struct
+{
+    /** \brief The pending operation, or NOISE_HYBRID_JOB_NONE */
+    int op;
+
+    /** \brief Non-zero if the operation is running on a helper thread */
+    int threaded;
+
+    /** \brief Result of the operation */
+    int err;
+
+#if defined(HAVE_PTHREAD)
+    /** \brief The helper thread that is running the operation */
+    pthread_t thread;
+#endif
+
+    /** \brief Local hybrid DHState object for the operation */
+    NoiseDHState *local;
+
+    /** \brief Remote hybrid DHState object for the operation */
+    const NoiseDHState *remote;
+
+    /** \brief Shared key that results from NOISE_HYBRID_JOB_CALCULATE */
+    uint8_t shared[NOISE_MAX_DH_SHARED_LEN];
+} NoiseHybridJob;
+
 /**
  * \brief Internal structure of the NoiseHandshakeState type.
  */
@@ -583,6 +757,18 @@ struct NoiseHandshakeState_s
 
     /** \brief Length of the prologue value in bytes */
     size_t prologue_len;
+
+    /** \brief Callback to check the remote static key once it is known */
+    NoiseRemoteKeyCallback remote_key_callback;
+
+    /** \brief User data to pass to \ref remote_key_callback */
+    void *remote_key_user_data;
+
+    /** \brief Non-zero to run hybrid DH operations on a helper thread */
+    int concurrent_hybrid;
+
+    /** \brief Hybrid DH operation that is pending for this message */
+    NoiseHybridJob hybrid_job;
 };
 
 /* Handshake message pattern tokens (must be single-byte values) */
@@ -650,15 +836,47 @@ struct NoiseHandshakeState_s
 
 void noise_rand_bytes(void *bytes, size_t size);
 
+void noise_hashstate_hmac
+    (NoiseHashState *state, const uint8_t *key, size_t key_len,
+     const uint8_t *data1, size_t data1_len,
+     const uint8_t *data2, size_t data2_len, uint8_t *hash);
+
+int noise_cipherstate_encrypt_and_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     NoiseBuffer *buffer, NoiseHashState *hash);
+int noise_cipherstate_decrypt_and_hash
+    (NoiseCipherState *state, const uint8_t *ad, size_t ad_len,
+     NoiseBuffer *buffer, NoiseHashState *hash);
+int noise_cipherstate_clone
+    (NoiseCipherState **clone, const NoiseCipherState *state);
+int noise_cipherstate_decrypt_explicit
+    (NoiseCipherState *state, const uint64_t *nonces,
+     const uint8_t * const *ads, size_t ad_len,
+     NoiseBuffer *buffers, int *errors, size_t count);
+
+void noise_dhstate_acquire(NoiseDHState *state);
+
 /** @cond */
 
 NoiseCipherState *noise_chachapoly_new(void);
 NoiseCipherState *noise_aesgcm_new(void);
+#if NOISE_USE_AEGIS256
+NoiseCipherState *noise_aegis256_new(void);
+int noise_aegis256_encrypt_raw
+    (int aesni, const uint8_t *key, const uint8_t *nonce,
+     const uint8_t *ad, size_t ad_len, uint8_t *data, size_t len);
+int noise_aegis256_decrypt_raw
+    (int aesni, const uint8_t *key, const uint8_t *nonce,
+     const uint8_t *ad, size_t ad_len, uint8_t *data, size_t len);
+#endif
 
 NoiseHashState *noise_blake2s_new(void);
 NoiseHashState *noise_blake2b_new(void);
 NoiseHashState *noise_sha256_new(void);
 NoiseHashState *noise_sha512_new(void);
+#if NOISE_USE_BLAKE3
+NoiseHashState *noise_blake3_new(void);
+#endif
 
 NoiseDHState *noise_curve25519_new(void);
 NoiseDHState *noise_curve448_new(void);
@@ -670,6 +888,84 @@ typedef uint16_t NoisePatternFlags_t;
 
 /** @endcond */
 
+/**
+ * \def noise_hash_reset(state)
+ * \brief Resets a HashState; see NoiseHashState_s::reset.
+ *
+ * The noise_hash_*(), noise_cipher_*(), and noise_dh_*() macros are
+ * used by the protocol layer for all calls into the back ends.
+ * Normally they call through the function pointers in the state object.
+ *
+ * If the library is configured with "--enable-fixed-suite", then the
+ * reference back ends for BLAKE2s, ChaChaPoly, and Curve25519 are
+ * included into the protocol layer from their headers instead.  The
+ * BLAKE2s core and the ChaChaPoly wrappers are inlined at the call site,
+ * and the ChaCha20, Poly1305, and Curve25519 cores are called directly.
+ * Other algorithms use the function pointers as usual, behind a
+ * predictable branch on the algorithm identifier.
+ */
+#if NOISE_FIXED_SUITE
+
+#define noise_hash_reset(state) \
+    ((state)->hash_id == NOISE_HASH_BLAKE2s ? \
+        noise_blake2s_reset((state)) : \
+        (*((state)->reset))((state)))
+#define noise_hash_update(state, data, len) \
+    ((state)->hash_id == NOISE_HASH_BLAKE2s ? \
+        noise_blake2s_update((state), (data), (len)) : \
+        (*((state)->update))((state), (data), (len)))
+#define noise_hash_finalize(state, hash) \
+    ((state)->hash_id == NOISE_HASH_BLAKE2s ? \
+        noise_blake2s_finalize((state), (hash)) : \
+        (*((state)->finalize))((state), (hash)))
+#define noise_cipher_encrypt(state, ad, ad_len, data, len) \
+    ((state)->cipher_id == NOISE_CIPHER_CHACHAPOLY ? \
+        noise_chachapoly_encrypt((state), (ad), (ad_len), (data), (len)) : \
+        (*((state)->encrypt))((state), (ad), (ad_len), (data), (len)))
+#define noise_cipher_decrypt(state, ad, ad_len, data, len) \
+    ((state)->cipher_id == NOISE_CIPHER_CHACHAPOLY ? \
+        noise_chachapoly_decrypt((state), (ad), (ad_len), (data), (len)) : \
+        (*((state)->decrypt))((state), (ad), (ad_len), (data), (len)))
+#define noise_cipher_encrypt_hash(state, ad, ad_len, data, len, hash) \
+    ((state)->cipher_id == NOISE_CIPHER_CHACHAPOLY ? \
+        noise_chachapoly_encrypt_hash \
+            ((state), (ad), (ad_len), (data), (len), (hash)) : \
+        (*((state)->encrypt_hash)) \
+            ((state), (ad), (ad_len), (data), (len), (hash)))
+#define noise_cipher_decrypt_hash(state, ad, ad_len, data, len, hash) \
+    ((state)->cipher_id == NOISE_CIPHER_CHACHAPOLY ? \
+        noise_chachapoly_decrypt_hash \
+            ((state), (ad), (ad_len), (data), (len), (hash)) : \
+        (*((state)->decrypt_hash)) \
+            ((state), (ad), (ad_len), (data), (len), (hash)))
+#define noise_dh_calculate(priv, pub, shared_key) \
+    ((priv)->dh_id == NOISE_DH_CURVE25519 ? \
+        noise_curve25519_calculate((priv), (pub), (shared_key)) : \
+        (*((priv)->calculate))((priv), (pub), (shared_key)))
+
+#else /* !NOISE_FIXED_SUITE */
+
+#define noise_hash_reset(state) \
+    ((*((state)->reset))((state)))
+#define noise_hash_update(state, data, len) \
+    ((*((state)->update))((state), (data), (len)))
+#define noise_hash_finalize(state, hash) \
+    ((*((state)->finalize))((state), (hash)))
+#define noise_cipher_encrypt(state, ad, ad_len, data, len) \
+    ((*((state)->encrypt))((state), (ad), (ad_len), (data), (len)))
+#define noise_cipher_decrypt(state, ad, ad_len, data, len) \
+    ((*((state)->decrypt))((state), (ad), (ad_len), (data), (len)))
+#define noise_cipher_encrypt_hash(state, ad, ad_len, data, len, hash) \
+    ((*((state)->encrypt_hash)) \
+        ((state), (ad), (ad_len), (data), (len), (hash)))
+#define noise_cipher_decrypt_hash(state, ad, ad_len, data, len, hash) \
+    ((*((state)->decrypt_hash)) \
+        ((state), (ad), (ad_len), (data), (len), (hash)))
+#define noise_dh_calculate(priv, pub, shared_key) \
+    ((*((priv)->calculate))((priv), (pub), (shared_key)))
+
+#endif /* !NOISE_FIXED_SUITE */
+
 const uint8_t *noise_pattern_lookup(int id);
 NoisePatternFlags_t noise_pattern_reverse_flags(NoisePatternFlags_t flags);
 
@@ -677,4 +973,10 @@ NoisePatternFlags_t noise_pattern_reverse_flags(NoisePatternFlags_t flags);
 };
 #endif
 
+#if NOISE_FIXED_SUITE
+#include "backend/ref/hash-blake2s.h"
+#include "backend/ref/cipher-chachapoly.h"
+#include "backend/ref/dh-curve25519.h"
+#endif
+
 #endif
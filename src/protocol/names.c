@@ -57,12 +57,18 @@ static NoiseIdMapping const algorithm_names[] = {
     /* Cipher algorithsm */
     {NOISE_CIPHER_CHACHAPOLY,   "ChaChaPoly",   10},
     {NOISE_CIPHER_AESGCM,       "AESGCM",        6},
+#if NOISE_USE_AEGIS256
+    {NOISE_CIPHER_AEGIS256,     "AEGIS256",      8},
+#endif
 
     /* Hash algorithms */
     {NOISE_HASH_BLAKE2s,        "BLAKE2s",       7},
     {NOISE_HASH_BLAKE2b,        "BLAKE2b",       7},
     {NOISE_HASH_SHA256,         "SHA256",        6},
     {NOISE_HASH_SHA512,         "SHA512",        6},
+#if NOISE_USE_BLAKE3
+    {NOISE_HASH_BLAKE3,         "BLAKE3",        6},
+#endif
 
     /* Diffie-Hellman algorithms */
     {NOISE_DH_CURVE25519,       "25519",         5},
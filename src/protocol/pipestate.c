@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "internal.h"
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * \file pipestate.h
+ * \brief PipeState interface
+ */
+
+/**
+ * \file pipestate.c
+ * \brief PipeState implementation
+ */
+
+/**
+ * \defgroup pipestate PipeState API
+ *
+ * The PipeState API implements the client side of the "Noise Pipes"
+ * protocol on top of the \ref handshakestate "HandshakeState" API.
+ * A PipeState holds the client's static keypair and a cache of the
+ * server's static public key.
+ *
+ * \li If the server's key is not cached, then the client performs a
+ * full "XX" handshake and learns the server's key from it.
+ * \li If the server's key is cached, then the client attempts an
+ * abbreviated "IK" handshake, which saves a round trip.
+ * \li If the server cannot decrypt the "IK" message, usually because it
+ * has changed its static key, then it replies with the first message of
+ * "XXfallback".  The client detects this when the reply fails to decrypt
+ * and transparently switches to "XXfallback".
+ *
+ * In all cases the cache is updated with the key that the server
+ * authenticated during the handshake.  The "hfs" variants of the
+ * patterns are supported in the same way.
+ *
+ * The application uses noise_pipestate_new_handshake() to create each
+ * new HandshakeState, and then sets the prologue and the pre-shared key
+ * and calls noise_handshakestate_start() as usual.  Outgoing messages are
+ * written with noise_handshakestate_write_message(), but incoming messages
+ * must be passed to noise_pipestate_read_message() so that the fallback
+ * can be handled and the cache updated.  Once the handshake is ready to
+ * split, the application calls noise_handshakestate_split() and
+ * noise_handshakestate_free() as usual.
+ *
+ * A PipeState can be reused for any number of connections to the same
+ * server.  To persist the cache across runs of the application, save the
+ * public key from noise_pipestate_get_remote_public_key_dh() after each
+ * handshake and restore it into the same object on startup.
+ */
+/**@{*/
+
+/**
+ * \typedef NoisePipeState
+ * \brief Opaque object that represents a PipeState.
+ */
+
+/** @cond */
+
+/**
+ * \brief Internal structure of the NoisePipeState type.
+ */
+struct NoisePipeState_s
+{
+    /** \brief Total size of the structure */
+    size_t size;
+
+    /** \brief Protocol identifier for the abbreviated handshake */
+    NoiseProtocolId id;
+
+    /** \brief Pattern identifier for the full handshake */
+    int full_pattern_id;
+
+    /** \brief Pattern identifier for the fallback handshake */
+    int fallback_pattern_id;
+
+    /** \brief Points to the DHState object for the local static key */
+    NoiseDHState *dh_local_static;
+
+    /** \brief Points to the DHState object for the cached server key */
+    NoiseDHState *dh_remote_static;
+};
+
+/** @endcond */
+
+/**
+ * \brief Creates a new PipeState object by protocol identifier.
+ *
+ * \param state Points to the variable where to store the pointer to
+ * the new PipeState object.
+ * \param protocol_id The protocol identifier for the abbreviated handshake,
+ * which must use the "IK" or "IKhfs" handshake pattern.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if either \a state or \a protocol_id
+ * is NULL.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the handshake pattern in
+ * \a protocol_id is not "IK" or "IKhfs", or the DH algorithm is
+ * ephemeral-only.
+ * \return NOISE_ERROR_UNKNOWN_ID if the DH algorithm in \a protocol_id
+ * is unknown.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new PipeState object.
+ *
+ * The full and fallback handshakes use the same prefix and algorithms
+ * as \a protocol_id, with the "XX" and "XXfallback" patterns respectively.
+ *
+ * \sa noise_pipestate_free(), noise_pipestate_new_by_name()
+ */
+int noise_pipestate_new_by_id
+    (NoisePipeState **state, const NoiseProtocolId *protocol_id)
+{
+    int full_pattern_id;
+    int fallback_pattern_id;
+    int err;
+
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    if (!protocol_id)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Determine the patterns to use for the full and fallback handshakes */
+    if (protocol_id->pattern_id == NOISE_PATTERN_IK) {
+        full_pattern_id = NOISE_PATTERN_XX;
+        fallback_pattern_id = NOISE_PATTERN_XX_FALLBACK;
+    } else if (protocol_id->pattern_id == NOISE_PATTERN_IK_HFS) {
+        full_pattern_id = NOISE_PATTERN_XX_HFS;
+        fallback_pattern_id = NOISE_PATTERN_XX_FALLBACK_HFS;
+    } else {
+        return NOISE_ERROR_NOT_APPLICABLE;
+    }
+
+    /* Create the PipeState object */
+    *state = noise_new(NoisePipeState);
+    if (!(*state))
+        return NOISE_ERROR_NO_MEMORY;
+    (*state)->id = *protocol_id;
+    (*state)->full_pattern_id = full_pattern_id;
+    (*state)->fallback_pattern_id = fallback_pattern_id;
+
+    /* Create the DHState objects for the static keys */
+    err = noise_dhstate_new_by_id
+        (&((*state)->dh_local_static), protocol_id->dh_id);
+    if (err == NOISE_ERROR_NONE) {
+        err = noise_dhstate_new_by_id
+            (&((*state)->dh_remote_static), protocol_id->dh_id);
+    }
+    if (err == NOISE_ERROR_NONE &&
+            (*state)->dh_local_static->ephemeral_only) {
+        err = NOISE_ERROR_NOT_APPLICABLE;
+    }
+    if (err != NOISE_ERROR_NONE) {
+        noise_pipestate_free(*state);
+        *state = 0;
+        return err;
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Creates a new PipeState object by protocol name.
+ *
+ * \param state Points to the variable where to store the pointer to
+ * the new PipeState object.
+ * \param protocol_name The name of the Noise protocol to use for the
+ * abbreviated handshake; e.g. "Noise_IK_25519_ChaChaPoly_BLAKE2s".
+ * This string must be NUL-terminated.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if either \a state or \a protocol_name
+ * is NULL.
+ * \return NOISE_ERROR_UNKNOWN_NAME if the \a protocol_name is unknown.
+ * \return NOISE_ERROR_NOT_APPLICABLE if the handshake pattern in
+ * \a protocol_name is not "IK" or "IKhfs", or the DH algorithm is
+ * ephemeral-only.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new PipeState object.
+ *
+ * \sa noise_pipestate_free(), noise_pipestate_new_by_id()
+ */
+int noise_pipestate_new_by_name
+    (NoisePipeState **state, const char *protocol_name)
+{
+    NoiseProtocolId id;
+    int err;
+
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    if (!protocol_name)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Parse the protocol name and create the object */
+    err = noise_protocol_name_to_id(&id, protocol_name, strlen(protocol_name));
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    return noise_pipestate_new_by_id(state, &id);
+}
+
+/**
+ * \brief Frees a PipeState object after destroying all sensitive material.
+ *
+ * \param state The PipeState object to free.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * HandshakeState objects that were created with
+ * noise_pipestate_new_handshake() are not affected and must be freed
+ * separately.
+ *
+ * \sa noise_pipestate_new_by_id(), noise_pipestate_new_by_name()
+ */
+int noise_pipestate_free(NoisePipeState *state)
+{
+    /* Validate the parameter */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Free the sub objects and then clean and free the memory */
+    if (state->dh_local_static)
+        noise_dhstate_free(state->dh_local_static);
+    if (state->dh_remote_static)
+        noise_dhstate_free(state->dh_remote_static);
+    noise_free(state, state->size);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the DHState object that contains the client's static keypair.
+ *
+ * \param state The PipeState object.
+ *
+ * \return Returns a pointer to the DHState object for the local static
+ * keypair, or NULL if \a state is NULL.
+ *
+ * The application must set the local keypair on the returned object
+ * before calling noise_pipestate_new_handshake().
+ *
+ * \sa noise_pipestate_get_remote_public_key_dh()
+ */
+NoiseDHState *noise_pipestate_get_local_keypair_dh
+    (const NoisePipeState *state)
+{
+    return state ? state->dh_local_static : 0;
+}
+
+/**
+ * \brief Gets the DHState object that caches the server's static public key.
+ *
+ * \param state The PipeState object.
+ *
+ * \return Returns a pointer to the DHState object for the cached server
+ * key, or NULL if \a state is NULL.
+ *
+ * The application can set a public key on the returned object to restore
+ * a previously saved cache entry, call noise_dhstate_get_public_key()
+ * to save the current entry, or call noise_dhstate_clear_key() to
+ * forget the entry and force a full handshake next time.
+ *
+ * \sa noise_pipestate_get_local_keypair_dh()
+ */
+NoiseDHState *noise_pipestate_get_remote_public_key_dh
+    (const NoisePipeState *state)
+{
+    return state ? state->dh_remote_static : 0;
+}
+
+/**
+ * \brief Creates a new HandshakeState for a connection to the server.
+ *
+ * \param state The PipeState object.
+ * \param handshake Points to the variable where to store the pointer to
+ * the new HandshakeState object.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a handshake is NULL.
+ * \return NOISE_ERROR_LOCAL_KEY_REQUIRED if the local keypair has not
+ * been set on the object from noise_pipestate_get_local_keypair_dh().
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new HandshakeState object.
+ *
+ * The new HandshakeState is an initiator that uses the abbreviated
+ * handshake if the server's key is cached, or the full handshake if not.
+ * The local keypair and the cached server key are already set on the
+ * returned object.  The application sets the prologue and the pre-shared
+ * key if necessary, and then calls noise_handshakestate_start().
+ *
+ * \sa noise_pipestate_read_message()
+ */
+int noise_pipestate_new_handshake
+    (NoisePipeState *state, NoiseHandshakeState **handshake)
+{
+    NoiseProtocolId id;
+    int err;
+
+    /* Validate the parameters */
+    if (!handshake)
+        return NOISE_ERROR_INVALID_PARAM;
+    *handshake = 0;
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!noise_dhstate_has_keypair(state->dh_local_static))
+        return NOISE_ERROR_LOCAL_KEY_REQUIRED;
+
+    /* Use the abbreviated handshake only if we know the server's key */
+    id = state->id;
+    if (!noise_dhstate_has_public_key(state->dh_remote_static))
+        id.pattern_id = state->full_pattern_id;
+
+    /* Create the HandshakeState and populate it with the keys */
+    err = noise_handshakestate_new_by_id(handshake, &id, NOISE_ROLE_INITIATOR);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    err = noise_dhstate_copy
+        (noise_handshakestate_get_local_keypair_dh(*handshake),
+         state->dh_local_static);
+    if (err == NOISE_ERROR_NONE && id.pattern_id == state->id.pattern_id) {
+        err = noise_dhstate_copy
+            (noise_handshakestate_get_remote_public_key_dh(*handshake),
+             state->dh_remote_static);
+    }
+    if (err != NOISE_ERROR_NONE) {
+        noise_handshakestate_free(*handshake);
+        *handshake = 0;
+    }
+    return err;
+}
+
+/**
+ * \brief Reads a handshake message from the server, falling back to
+ * "XXfallback" if the abbreviated handshake fails.
+ *
+ * \param state The PipeState object.
+ * \param handshake The HandshakeState object that was created by
+ * noise_pipestate_new_handshake().
+ * \param message Points to the incoming handshake message to be unpacked.
+ * \param payload Points to the buffer to fill with the message payload.
+ * This can be NULL if the application does not need the message payload.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state, \a handshake, or
+ * \a message is NULL.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * save a copy of the message for a possible fallback.
+ * \return Any of the error codes from noise_handshakestate_read_message().
+ *
+ * If \a handshake is waiting for the server's response to the first
+ * abbreviated handshake message and the response fails to decrypt, then
+ * \a handshake is converted to the fallback pattern and the response is
+ * processed again.  The application can check which pattern was used with
+ * noise_handshakestate_get_protocol_id().  If the response also fails
+ * to decrypt as a fallback message, then the error from the second
+ * attempt is returned.
+ *
+ * When the full or fallback handshake has authenticated the server's
+ * static public key, the key is copied into the cache.
+ *
+ * \sa noise_pipestate_new_handshake(), noise_handshakestate_read_message()
+ */
+int noise_pipestate_read_message
+    (NoisePipeState *state, NoiseHandshakeState *handshake,
+     NoiseBuffer *message, NoiseBuffer *payload)
+{
+    NoiseProtocolId id;
+    NoiseDHState *remote;
+    uint8_t *copy;
+    size_t copy_len;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || !handshake || !message || !(message->data))
+        return NOISE_ERROR_INVALID_PARAM;
+    err = noise_handshakestate_get_protocol_id(handshake, &id);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+
+    /* Reading the message destroys it, so if this is the response to
+       the abbreviated handshake we need a copy in case of fallback */
+    if (id.pattern_id == state->id.pattern_id &&
+            noise_handshakestate_get_role(handshake) == NOISE_ROLE_INITIATOR &&
+            noise_handshakestate_get_action(handshake) ==
+                NOISE_ACTION_READ_MESSAGE &&
+            message->size <= message->max_size) {
+        copy_len = message->size;
+        copy = (uint8_t *)malloc(copy_len ? copy_len : 1);
+        if (!copy)
+            return NOISE_ERROR_NO_MEMORY;
+        memcpy(copy, message->data, copy_len);
+        err = noise_handshakestate_read_message(handshake, message, payload);
+        if (err == NOISE_ERROR_MAC_FAILURE) {
+            /* The server could not process our abbreviated message,
+               so try to read the response as a fallback message */
+            err = noise_handshakestate_fallback_to
+                (handshake, state->fallback_pattern_id);
+            if (err == NOISE_ERROR_NONE)
+                err = noise_handshakestate_start(handshake);
+            if (err == NOISE_ERROR_NONE) {
+                memcpy(message->data, copy, copy_len);
+                message->size = copy_len;
+                err = noise_handshakestate_read_message
+                    (handshake, message, payload);
+            }
+        }
+        noise_free(copy, copy_len);
+    } else {
+        err = noise_handshakestate_read_message(handshake, message, payload);
+    }
+    if (err != NOISE_ERROR_NONE)
+        return err;
+
+    /* Update the cache with the server's key from a full or fallback
+       handshake.  The abbreviated handshake uses the cached key as-is */
+    noise_handshakestate_get_protocol_id(handshake, &id);
+    if (id.pattern_id != state->id.pattern_id) {
+        remote = noise_handshakestate_get_remote_public_key_dh(handshake);
+        if (noise_dhstate_has_public_key(remote))
+            err = noise_dhstate_copy(state->dh_remote_static, remote);
+    }
+    return err;
+}
+
+/**@}*/
@@ -0,0 +1,1200 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* For MAP_POPULATE */
+#endif
+#include "internal.h"
+#include <string.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_POLL)
+#include <poll.h>
+#endif
+#endif
+
+/**
+ * \file streamstate.h
+ * \brief StreamState interface
+ */
+
+/**
+ * \file streamstate.c
+ * \brief StreamState implementation
+ */
+
+/**
+ * \defgroup streamstate StreamState API
+ *
+ * The StreamState API spreads the transport messages of a single
+ * session over several threads so that one high-bandwidth stream is
+ * not limited to the speed of one core.
+ *
+ * Normally the nonce in a CipherState is incremented by each call to
+ * noise_cipherstate_encrypt_with_ad(), which forces the messages to be
+ * encrypted one after another.  A StreamState instead reserves the next
+ * nonce from the session's CipherState when each record is submitted,
+ * and worker threads then encrypt runs of consecutive records at the
+ * same time with private copies of the key.  Each record is written to
+ * an output buffer that the caller assigned when it was submitted, and
+ * noise_streamstate_next() hands the records back in their original
+ * order for the caller to write to the network.
+ *
+ * The receive side works the same way with \ref NOISE_STREAM_DECRYPT.
+ * The messages on the wire are the same as those from
+ * noise_cipherstate_encrypt(), so the two sides can use a StreamState
+ * or a plain CipherState independently of each other.
+ *
+ * Records can be submitted and collected from different threads, for
+ * example a reader thread and a writer thread.  If the library was built
+ * without thread support, or the StreamState was created with no worker
+ * threads, then each record is processed during the call to
+ * noise_streamstate_submit() instead.
+ *
+ * noise_streamstate_send_file() builds a complete pipeline on top of an
+ * encrypting StreamState for sending the contents of a file: one thread
+ * maps or reads the file ahead in large windows, the workers encrypt
+ * directly from those windows, and the calling thread writes the
+ * finished records to the socket.
+ */
+/**@{*/
+
+/**
+ * \typedef NoiseStreamState
+ * \brief Opaque object that represents a StreamState.
+ */
+
+/** @cond */
+
+/* Status of a record slot */
+#define NOISE_STREAM_FREE       0
+#define NOISE_STREAM_PENDING    1
+#define NOISE_STREAM_DONE       2
+
+/* Maximum number of records that a worker claims at once */
+#define NOISE_STREAM_MAX_CLAIM  8
+
+/**
+ * \brief Information about a record in a StreamState.
+ */
+typedef struct
+{
+    /** \brief Points to the input data for the record */
+    const uint8_t *input;
+
+    /** \brief Length of the input data */
+    size_t input_len;
+
+    /** \brief Points to the buffer for the output of the record */
+    uint8_t *output;
+
+    /** \brief Maximum length of the output buffer */
+    size_t output_max;
+
+    /** \brief Length of the output once the record has been processed */
+    size_t output_len;
+
+    /** \brief Nonce that was reserved for the record */
+    uint64_t nonce;
+
+    /** \brief Status of the record slot */
+    int status;
+
+    /** \brief Result of processing the record */
+    int err;
+
+} NoiseStreamRecord;
+
+/**
+ * \brief Information about a worker thread in a StreamState.
+ */
+typedef struct
+{
+    /** \brief Points back to the StreamState that owns the worker */
+    NoiseStreamState *stream;
+
+    /** \brief Private copy of the session's CipherState */
+    NoiseCipherState *cipher;
+
+#if defined(HAVE_PTHREAD)
+    /** \brief The worker thread */
+    pthread_t thread;
+#endif
+
+    /** \brief Non-zero if the worker thread is running */
+    int started;
+
+} NoiseStreamWorker;
+
+/**
+ * \brief Internal structure of the NoiseStreamState type.
+ */
+struct NoiseStreamState_s
+{
+    /** \brief Total size of the structure including the workers */
+    size_t size;
+
+    /** \brief NOISE_STREAM_ENCRYPT or NOISE_STREAM_DECRYPT */
+    int operation;
+
+    /** \brief Session CipherState that nonces are reserved from */
+    NoiseCipherState *cipher;
+
+    /** \brief Number of worker threads that are running */
+    size_t num_threads;
+
+    /** \brief Number of entries in \ref workers */
+    size_t num_workers;
+
+    /** \brief Sequence number of the oldest record not yet collected */
+    uint64_t head;
+
+    /** \brief Sequence number of the next record for a worker to claim */
+    uint64_t claim;
+
+    /** \brief Sequence number of the next record to be submitted */
+    uint64_t tail;
+
+    /** \brief Non-zero when the worker threads have been asked to stop */
+    int stopping;
+
+#if defined(HAVE_PTHREAD)
+    /** \brief Protects the sequence numbers and record status values */
+    pthread_mutex_t mutex;
+
+    /** \brief Signalled when records are submitted or on shutdown */
+    pthread_cond_t work_cond;
+
+    /** \brief Signalled when records have been processed */
+    pthread_cond_t done_cond;
+#endif
+
+    /** \brief Ring of records, indexed by sequence number */
+    NoiseStreamRecord records[NOISE_STREAM_MAX_PENDING];
+
+    /** \brief Workers, which are allocated on the end of the structure */
+    NoiseStreamWorker workers[1];
+};
+
+#if defined(HAVE_PTHREAD)
+#define noise_stream_lock(state)    pthread_mutex_lock(&((state)->mutex))
+#define noise_stream_unlock(state)  pthread_mutex_unlock(&((state)->mutex))
+#else
+#define noise_stream_lock(state)    do { ; } while (0)
+#define noise_stream_unlock(state)  do { ; } while (0)
+#endif
+
+/**
+ * \brief Encrypts or decrypts a single record.
+ *
+ * \param state The StreamState object.
+ * \param cipher The worker's private CipherState.
+ * \param record The record to process.
+ */
+static void noise_stream_process
+    (const NoiseStreamState *state, NoiseCipherState *cipher,
+     NoiseStreamRecord *record)
+{
+    size_t mac_len = cipher->mac_len;
+    if (record->output != record->input)
+        memmove(record->output, record->input, record->input_len);
+    cipher->n = record->nonce;
+    if (state->operation == NOISE_STREAM_ENCRYPT) {
+        record->err = noise_cipher_encrypt
+            (cipher, 0, 0, record->output, record->input_len);
+        record->output_len = record->input_len + mac_len;
+    } else {
+        record->err = noise_cipher_decrypt
+            (cipher, 0, 0, record->output, record->input_len - mac_len);
+        record->output_len = record->input_len - mac_len;
+    }
+    if (record->err != NOISE_ERROR_NONE)
+        record->output_len = 0;
+}
+
+#if defined(HAVE_PTHREAD)
+
+/**
+ * \brief Entry point for a worker thread.
+ *
+ * \param arg Points to the NoiseStreamWorker.
+ *
+ * \return Always NULL.
+ *
+ * The worker claims runs of consecutive records, processes them without
+ * holding the lock, and then marks them as done.  The size of each run
+ * is scaled to the backlog so that the threads share the work evenly.
+ */
+static void *noise_stream_worker_thread(void *arg)
+{
+    NoiseStreamWorker *worker = (NoiseStreamWorker *)arg;
+    NoiseStreamState *state = worker->stream;
+    uint64_t first;
+    uint64_t count;
+    uint64_t seq;
+
+    noise_stream_lock(state);
+    for (;;) {
+        while (!state->stopping && state->claim == state->tail)
+            pthread_cond_wait(&(state->work_cond), &(state->mutex));
+        if (state->stopping)
+            break;
+        first = state->claim;
+        count = (state->tail - first) / state->num_threads;
+        if (count < 1)
+            count = 1;
+        else if (count > NOISE_STREAM_MAX_CLAIM)
+            count = NOISE_STREAM_MAX_CLAIM;
+        state->claim += count;
+        noise_stream_unlock(state);
+
+        for (seq = first; seq < (first + count); ++seq) {
+            noise_stream_process
+                (state, worker->cipher,
+                 &(state->records[seq % NOISE_STREAM_MAX_PENDING]));
+        }
+
+        noise_stream_lock(state);
+        for (seq = first; seq < (first + count); ++seq)
+            state->records[seq % NOISE_STREAM_MAX_PENDING].status =
+                NOISE_STREAM_DONE;
+        if (first == state->head)
+            pthread_cond_broadcast(&(state->done_cond));
+    }
+    noise_stream_unlock(state);
+    return 0;
+}
+
+#endif
+
+/** @endcond */
+
+/**
+ * \brief Creates a new StreamState object.
+ *
+ * \param state Points to the variable where to store the pointer to
+ * the new StreamState object.
+ * \param cipher The session's CipherState, which must already have a key.
+ * \param operation NOISE_STREAM_ENCRYPT or NOISE_STREAM_DECRYPT.
+ * \param num_threads The number of worker threads to start, which is
+ * usually the number of spare cores.  Zero processes every record on the
+ * thread that submits it.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a cipher is NULL,
+ * \a operation is not valid, or \a num_threads is greater than
+ * \ref NOISE_STREAM_MAX_THREADS.
+ * \return NOISE_ERROR_INVALID_STATE if the key has not been set on
+ * \a cipher yet.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory to
+ * allocate the new StreamState object.
+ * \return NOISE_ERROR_SYSTEM if the thread synchronization objects
+ * could not be created.
+ *
+ * The StreamState does not take ownership of \a cipher, which must not
+ * be freed or used directly while the StreamState exists.  Its nonce
+ * advances by one for each record that is submitted, so afterwards it
+ * can carry on from where the StreamState left off.
+ *
+ * If some of the worker threads cannot be started, the StreamState uses
+ * the ones that did start; see noise_streamstate_get_threads().
+ *
+ * \sa noise_streamstate_free(), noise_streamstate_submit()
+ */
+int noise_streamstate_new
+    (NoiseStreamState **state, NoiseCipherState *cipher, int operation,
+     size_t num_threads)
+{
+    NoiseStreamState *new_state;
+    size_t num_workers;
+    size_t index;
+    int err;
+
+    /* Validate the parameters */
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+    *state = 0;
+    if (!cipher || num_threads > NOISE_STREAM_MAX_THREADS)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (operation != NOISE_STREAM_ENCRYPT && operation != NOISE_STREAM_DECRYPT)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (!cipher->has_key)
+        return NOISE_ERROR_INVALID_STATE;
+#if !defined(HAVE_PTHREAD)
+    num_threads = 0;
+#endif
+
+    /* Allocate the object with one worker per thread, or a single
+       worker for processing the records inline */
+    num_workers = num_threads ? num_threads : 1;
+    new_state = noise_new_object
+        (sizeof(NoiseStreamState) +
+         (num_workers - 1) * sizeof(NoiseStreamWorker));
+    if (!new_state)
+        return NOISE_ERROR_NO_MEMORY;
+    new_state->operation = operation;
+    new_state->num_workers = num_workers;
+    for (index = 0; index < num_workers; ++index) {
+        new_state->workers[index].stream = new_state;
+        err = noise_cipherstate_clone
+            (&(new_state->workers[index].cipher), cipher);
+        if (err != NOISE_ERROR_NONE) {
+            noise_streamstate_free(new_state);
+            return err;
+        }
+    }
+
+#if defined(HAVE_PTHREAD)
+    /* Create the synchronization objects and start the threads */
+    if (pthread_mutex_init(&(new_state->mutex), 0) != 0) {
+        noise_streamstate_free(new_state);
+        return NOISE_ERROR_SYSTEM;
+    }
+    if (pthread_cond_init(&(new_state->work_cond), 0) != 0) {
+        pthread_mutex_destroy(&(new_state->mutex));
+        noise_streamstate_free(new_state);
+        return NOISE_ERROR_SYSTEM;
+    }
+    if (pthread_cond_init(&(new_state->done_cond), 0) != 0) {
+        pthread_cond_destroy(&(new_state->work_cond));
+        pthread_mutex_destroy(&(new_state->mutex));
+        noise_streamstate_free(new_state);
+        return NOISE_ERROR_SYSTEM;
+    }
+    new_state->cipher = cipher;
+    noise_stream_lock(new_state);
+    for (index = 0; index < num_threads; ++index) {
+        NoiseStreamWorker *worker = &(new_state->workers[index]);
+        if (pthread_create(&(worker->thread), 0,
+                           noise_stream_worker_thread, worker) != 0)
+            break;
+        worker->started = 1;
+        ++(new_state->num_threads);
+    }
+    noise_stream_unlock(new_state);
+#else
+    new_state->cipher = cipher;
+#endif
+    *state = new_state;
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Frees a StreamState object after destroying all sensitive
+ * material.
+ *
+ * \param state The StreamState object to free.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL.
+ *
+ * The worker threads are stopped and any records that have not been
+ * collected are discarded, although their nonces remain used up in the
+ * session's CipherState.
+ *
+ * \sa noise_streamstate_new()
+ */
+int noise_streamstate_free(NoiseStreamState *state)
+{
+    size_t index;
+    if (!state)
+        return NOISE_ERROR_INVALID_PARAM;
+#if defined(HAVE_PTHREAD)
+    if (state->cipher) {
+        /* The synchronization objects only exist once the cipher has
+           been set, so stop the threads and clean them up */
+        noise_stream_lock(state);
+        state->stopping = 1;
+        pthread_cond_broadcast(&(state->work_cond));
+        noise_stream_unlock(state);
+        for (index = 0; index < state->num_workers; ++index) {
+            if (state->workers[index].started)
+                pthread_join(state->workers[index].thread, 0);
+        }
+        pthread_cond_destroy(&(state->done_cond));
+        pthread_cond_destroy(&(state->work_cond));
+        pthread_mutex_destroy(&(state->mutex));
+    }
+#endif
+    for (index = 0; index < state->num_workers; ++index) {
+        if (state->workers[index].cipher)
+            noise_cipherstate_free(state->workers[index].cipher);
+    }
+    noise_free(state, state->size);
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Gets the number of worker threads that a StreamState is using.
+ *
+ * \param state The StreamState object.
+ *
+ * \return The number of worker threads, or zero if \a state is NULL or
+ * the records are processed on the thread that submits them.
+ */
+size_t noise_streamstate_get_threads(const NoiseStreamState *state)
+{
+    return state ? state->num_threads : 0;
+}
+
+/**
+ * \brief Gets the number of records that have been submitted to a
+ * StreamState but not yet collected.
+ *
+ * \param state The StreamState object.
+ *
+ * \return The number of pending records, or zero if \a state is NULL.
+ */
+size_t noise_streamstate_get_pending(const NoiseStreamState *state)
+{
+    NoiseStreamState *st = (NoiseStreamState *)state;
+    size_t pending;
+    if (!st)
+        return 0;
+    noise_stream_lock(st);
+    pending = (size_t)(st->tail - st->head);
+    noise_stream_unlock(st);
+    return pending;
+}
+
+/**
+ * \brief Submits a record to a StreamState for encryption or decryption.
+ *
+ * \param state The StreamState object.
+ * \param input Points to the plaintext to encrypt, or to the ciphertext
+ * plus MAC to decrypt.
+ * \param input_len The length of the \a input data.
+ * \param output Points to the buffer for the result, which may be the
+ * same as \a input but must not otherwise overlap it.
+ * \param output_max The size of the \a output buffer, which must be at
+ * least \a input_len plus the MAC length when encrypting, or at least
+ * \a input_len when decrypting.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state, \a input, or \a output
+ * is NULL.
+ * \return NOISE_ERROR_INVALID_LENGTH if the record is too long for a
+ * Noise transport message, the ciphertext is shorter than a MAC, or
+ * \a output_max is too small.
+ * \return NOISE_ERROR_INVALID_STATE if \ref NOISE_STREAM_MAX_PENDING
+ * records are already waiting to be collected.
+ * \return NOISE_ERROR_INVALID_NONCE if the session has run out of nonces.
+ *
+ * The record is given the next nonce in the session.  The caller must
+ * keep \a input and \a output valid until the record is returned by
+ * noise_streamstate_next().
+ *
+ * \sa noise_streamstate_next()
+ */
+int noise_streamstate_submit
+    (NoiseStreamState *state, const uint8_t *input, size_t input_len,
+     uint8_t *output, size_t output_max)
+{
+    NoiseStreamRecord *record;
+    size_t mac_len;
+
+    /* Validate the parameters */
+    if (!state || !input || !output)
+        return NOISE_ERROR_INVALID_PARAM;
+    mac_len = state->cipher->mac_len;
+    if (state->operation == NOISE_STREAM_ENCRYPT) {
+        if (input_len > (NOISE_MAX_PAYLOAD_LEN - mac_len) ||
+                output_max < (input_len + mac_len))
+            return NOISE_ERROR_INVALID_LENGTH;
+    } else {
+        if (input_len < mac_len || input_len > NOISE_MAX_PAYLOAD_LEN ||
+                output_max < input_len)
+            return NOISE_ERROR_INVALID_LENGTH;
+    }
+
+    /* Reserve a slot and the next nonce */
+    noise_stream_lock(state);
+    if ((state->tail - state->head) >= NOISE_STREAM_MAX_PENDING) {
+        noise_stream_unlock(state);
+        return NOISE_ERROR_INVALID_STATE;
+    }
+    if (state->cipher->n == 0xFFFFFFFFFFFFFFFFULL) {
+        noise_stream_unlock(state);
+        return NOISE_ERROR_INVALID_NONCE;
+    }
+    record = &(state->records[state->tail % NOISE_STREAM_MAX_PENDING]);
+    record->input = input;
+    record->input_len = input_len;
+    record->output = output;
+    record->output_max = output_max;
+    record->output_len = 0;
+    record->nonce = (state->cipher->n)++;
+    record->err = NOISE_ERROR_NONE;
+    record->status = NOISE_STREAM_PENDING;
+    ++(state->tail);
+
+    /* Hand the record to the workers, or process it now if there are none */
+    if (state->num_threads) {
+#if defined(HAVE_PTHREAD)
+        pthread_cond_signal(&(state->work_cond));
+#endif
+        noise_stream_unlock(state);
+    } else {
+        ++(state->claim);
+        noise_stream_unlock(state);
+        noise_stream_process(state, state->workers[0].cipher, record);
+        noise_stream_lock(state);
+        record->status = NOISE_STREAM_DONE;
+        noise_stream_unlock(state);
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Collects the next record from a StreamState, in order.
+ *
+ * \param state The StreamState object.
+ * \param output Returns the output buffer for the record, with its
+ * size set to the length of the ciphertext plus MAC when encrypting or
+ * the plaintext when decrypting.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state or \a output is NULL.
+ * \return NOISE_ERROR_INVALID_STATE if there are no records pending.
+ * \return NOISE_ERROR_MAC_FAILURE if the record failed to decrypt,
+ * in which case the size of \a output is zero.  The stream should
+ * be abandoned, as it would be for noise_cipherstate_decrypt().
+ *
+ * This function waits for the oldest record to be processed if the
+ * worker threads have not finished it yet.
+ *
+ * \sa noise_streamstate_submit()
+ */
+int noise_streamstate_next(NoiseStreamState *state, NoiseBuffer *output)
+{
+    NoiseStreamRecord *record;
+    int err;
+
+    /* Validate the parameters */
+    if (output)
+        noise_buffer_init(*output);
+    if (!state || !output)
+        return NOISE_ERROR_INVALID_PARAM;
+
+    /* Wait for the oldest record to finish and then release it */
+    noise_stream_lock(state);
+    if (state->head == state->tail) {
+        noise_stream_unlock(state);
+        return NOISE_ERROR_INVALID_STATE;
+    }
+    record = &(state->records[state->head % NOISE_STREAM_MAX_PENDING]);
+#if defined(HAVE_PTHREAD)
+    while (record->status != NOISE_STREAM_DONE)
+        pthread_cond_wait(&(state->done_cond), &(state->mutex));
+#endif
+    noise_buffer_set_inout(*output, record->output, record->output_len,
+                           record->output_max);
+    err = record->err;
+    record->status = NOISE_STREAM_FREE;
+    ++(state->head);
+    noise_stream_unlock(state);
+    return err;
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+
+/** @cond */
+
+/* Plaintext bytes in each record that noise_streamstate_send_file()
+   sends.  This is a multiple of the page size that leaves room for the
+   MAC within the 65535 byte limit on Noise messages */
+#define NOISE_STREAM_FILE_CHUNK     61440
+
+/* Number of records in each window of the file */
+#define NOISE_STREAM_FILE_RECORDS   32
+
+/* Size of each window of the file, which is a multiple of the page size */
+#define NOISE_STREAM_FILE_WINDOW    \
+    ((size_t)NOISE_STREAM_FILE_CHUNK * NOISE_STREAM_FILE_RECORDS)
+
+/* Number of windows that are loaded at once, which double-buffers the
+   file so that one window is read while the other is encrypted */
+#define NOISE_STREAM_FILE_WINDOWS   2
+
+/* Number of output slots, enough for every record in the windows */
+#define NOISE_STREAM_FILE_SLOTS     \
+    (NOISE_STREAM_FILE_RECORDS * NOISE_STREAM_FILE_WINDOWS)
+
+/**
+ * \brief Information about a window of a file that is being sent.
+ */
+typedef struct
+{
+    /** \brief Points to the file data for the window */
+    const uint8_t *data;
+
+    /** \brief Number of bytes of file data in the window */
+    size_t len;
+
+    /** \brief Start of the memory mapping for the window, or NULL if
+        the window was read into a buffer */
+    void *map;
+
+    /** \brief Length of the memory mapping */
+    size_t map_len;
+
+    /** \brief Result of loading the window */
+    int err;
+
+    /** \brief Value of errno if \ref err is NOISE_ERROR_SYSTEM */
+    int sys_errno;
+
+} NoiseStreamWindow;
+
+/**
+ * \brief State of a call to noise_streamstate_send_file().
+ */
+typedef struct
+{
+    /** \brief Total size of the structure */
+    size_t size;
+
+    /** \brief File descriptor to read from */
+    int fd;
+
+    /** \brief Offset of the first byte to send within the file */
+    uint64_t offset;
+
+    /** \brief Number of bytes to send */
+    uint64_t len;
+
+    /** \brief Non-zero to memory-map the windows rather than read them */
+    int use_map;
+
+    /** \brief Buffers for windows that are read rather than mapped */
+    uint8_t *buffers;
+
+    /** \brief Number of windows that have been loaded so far */
+    uint64_t loaded;
+
+    /** \brief Number of windows whose records have all been written */
+    uint64_t released;
+
+    /** \brief Number of windows in the range to send */
+    uint64_t num_windows;
+
+#if defined(HAVE_PTHREAD)
+    /** \brief Protects \ref loaded, \ref released, and \ref stopping */
+    pthread_mutex_t mutex;
+
+    /** \brief Signalled when a window is loaded or released */
+    pthread_cond_t cond;
+
+    /** \brief The read-ahead thread */
+    pthread_t thread;
+#endif
+
+    /** \brief Non-zero if the read-ahead thread is running */
+    int started;
+
+    /** \brief Non-zero when the read-ahead thread has been asked to stop */
+    int stopping;
+
+    /** \brief The windows, indexed by window number */
+    NoiseStreamWindow windows[NOISE_STREAM_FILE_WINDOWS];
+
+} NoiseStreamFile;
+
+#if defined(HAVE_PTHREAD)
+#define noise_stream_file_lock(file)    \
+    pthread_mutex_lock(&((file)->mutex))
+#define noise_stream_file_unlock(file)  \
+    pthread_mutex_unlock(&((file)->mutex))
+#else
+#define noise_stream_file_lock(file)    do { ; } while (0)
+#define noise_stream_file_unlock(file)  do { ; } while (0)
+#endif
+
+/**
+ * \brief Loads a window of a file into memory.
+ *
+ * \param file The file state.
+ * \param index The number of the window to load.
+ *
+ * Windows are mapped if possible, with the pages faulted in by this
+ * thread rather than by the workers that encrypt them.  Otherwise, or if
+ * mapping fails, the window is read into a buffer.
+ */
+static void noise_stream_file_load(NoiseStreamFile *file, uint64_t index)
+{
+    NoiseStreamWindow *window =
+        &(file->windows[index % NOISE_STREAM_FILE_WINDOWS]);
+    uint64_t start = index * NOISE_STREAM_FILE_WINDOW;
+    uint64_t remaining = file->len - start;
+    uint8_t *buffer;
+    size_t done;
+    ssize_t result;
+
+    start += file->offset;
+    window->len = remaining < NOISE_STREAM_FILE_WINDOW
+                ? (size_t)remaining : NOISE_STREAM_FILE_WINDOW;
+    window->map = 0;
+    window->err = NOISE_ERROR_NONE;
+#if defined(HAVE_MMAP)
+    if (file->use_map) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t delta = (size_t)(start % page);
+        int flags = MAP_SHARED;
+        void *map;
+#if defined(MAP_POPULATE)
+        flags |= MAP_POPULATE;
+#endif
+        map = mmap(0, delta + window->len, PROT_READ, flags,
+                   file->fd, (off_t)(start - delta));
+        if (map != MAP_FAILED) {
+            window->map = map;
+            window->map_len = delta + window->len;
+            window->data = ((const uint8_t *)map) + delta;
+#if !defined(MAP_POPULATE)
+            for (done = 0; done < window->len; done += page)
+                (void)(((const volatile uint8_t *)(window->data))[done]);
+#endif
+            return;
+        }
+        file->use_map = 0;
+    }
+#endif
+
+    /* Read the window into its buffer */
+    if (!file->buffers) {
+        file->buffers = (uint8_t *)noise_new_object
+            (NOISE_STREAM_FILE_WINDOW * NOISE_STREAM_FILE_WINDOWS);
+        if (!file->buffers) {
+            window->err = NOISE_ERROR_NO_MEMORY;
+            return;
+        }
+    }
+    buffer = file->buffers +
+        (size_t)(index % NOISE_STREAM_FILE_WINDOWS) * NOISE_STREAM_FILE_WINDOW;
+    window->data = buffer;
+    for (done = 0; done < window->len; done += (size_t)result) {
+        result = pread(file->fd, buffer + done, window->len - done,
+                       (off_t)(start + done));
+        if (result > 0)
+            continue;
+        if (result < 0 && errno == EINTR) {
+            result = 0;
+            continue;
+        }
+        if (result < 0) {
+            window->err = NOISE_ERROR_SYSTEM;
+            window->sys_errno = errno;
+        } else {
+            /* The file was truncated while it was being sent */
+            window->err = NOISE_ERROR_INVALID_LENGTH;
+        }
+        return;
+    }
+}
+
+#if defined(HAVE_PTHREAD)
+
+/**
+ * \brief Entry point for the read-ahead thread.
+ *
+ * \param arg Points to the NoiseStreamFile.
+ *
+ * \return Always NULL.
+ *
+ * The thread loads each window as soon as the window that previously
+ * used its slot has been released, and stops early if loading fails.
+ */
+static void *noise_stream_file_thread(void *arg)
+{
+    NoiseStreamFile *file = (NoiseStreamFile *)arg;
+    uint64_t index;
+    int err;
+
+    noise_stream_file_lock(file);
+    for (index = 0; index < file->num_windows; ++index) {
+        while (!file->stopping &&
+                    (index - file->released) >= NOISE_STREAM_FILE_WINDOWS)
+            pthread_cond_wait(&(file->cond), &(file->mutex));
+        if (file->stopping)
+            break;
+        noise_stream_file_unlock(file);
+        noise_stream_file_load(file, index);
+        err = file->windows[index % NOISE_STREAM_FILE_WINDOWS].err;
+        noise_stream_file_lock(file);
+        ++(file->loaded);
+        pthread_cond_broadcast(&(file->cond));
+        if (err != NOISE_ERROR_NONE)
+            break;
+    }
+    noise_stream_file_unlock(file);
+    return 0;
+}
+
+#endif
+
+/**
+ * \brief Determines if a window of a file is ready to be encrypted.
+ *
+ * \param file The file state.
+ * \param index The number of the window.
+ * \param wait Non-zero to wait for the window if it is not ready yet.
+ *
+ * \return Non-zero if the window is ready, or zero if not.
+ *
+ * Without a read-ahead thread the window is loaded on the spot, as long
+ * as the window that previously used its slot has been released.
+ */
+static int noise_stream_file_ready
+    (NoiseStreamFile *file, uint64_t index, int wait)
+{
+    int ready;
+    if (file->started) {
+        noise_stream_file_lock(file);
+#if defined(HAVE_PTHREAD)
+        while (wait && file->loaded <= index)
+            pthread_cond_wait(&(file->cond), &(file->mutex));
+#endif
+        ready = file->loaded > index;
+        noise_stream_file_unlock(file);
+        return ready;
+    }
+    (void)wait;
+    if (file->loaded <= index) {
+        if ((index - file->released) >= NOISE_STREAM_FILE_WINDOWS)
+            return 0;
+        noise_stream_file_load(file, index);
+        ++(file->loaded);
+    }
+    return 1;
+}
+
+/**
+ * \brief Releases a window of a file once all of its records are written.
+ *
+ * \param file The file state.
+ * \param index The number of the window.
+ */
+static void noise_stream_file_release(NoiseStreamFile *file, uint64_t index)
+{
+    NoiseStreamWindow *window =
+        &(file->windows[index % NOISE_STREAM_FILE_WINDOWS]);
+#if defined(HAVE_MMAP)
+    if (window->map) {
+        munmap(window->map, window->map_len);
+        window->map = 0;
+    }
+#endif
+    noise_stream_file_lock(file);
+    ++(file->released);
+#if defined(HAVE_PTHREAD)
+    pthread_cond_signal(&(file->cond));
+#endif
+    noise_stream_file_unlock(file);
+}
+
+/**
+ * \brief Writes all of a block of data to a file descriptor.
+ *
+ * \param fd The file descriptor, which may be non-blocking.
+ * \param data Points to the data to write.
+ * \param len The length of the data.
+ *
+ * \return NOISE_ERROR_NONE on success or NOISE_ERROR_SYSTEM on error.
+ */
+static int noise_stream_write(int fd, const uint8_t *data, size_t len)
+{
+    ssize_t result;
+    while (len > 0) {
+        result = write(fd, data, len);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+#if defined(HAVE_POLL)
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+                    continue;
+            }
+#endif
+            return NOISE_ERROR_SYSTEM;
+        }
+        data += result;
+        len -= (size_t)result;
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/**
+ * \brief Encrypts the records of a file and writes them out in order.
+ *
+ * \param state The StreamState object.
+ * \param file The file state.
+ * \param sock The descriptor to write the records to.
+ * \param slots Output slots for the records.
+ * \param slot_size Size of each output slot.
+ *
+ * \return NOISE_ERROR_NONE on success or an error code otherwise.
+ */
+static int noise_stream_file_pump
+    (NoiseStreamState *state, NoiseStreamFile *file, int sock,
+     uint8_t *slots, size_t slot_size)
+{
+    uint64_t total = (file->len + NOISE_STREAM_FILE_CHUNK - 1) /
+                     NOISE_STREAM_FILE_CHUNK;
+    uint64_t submitted = 0;
+    uint64_t sent = 0;
+    uint64_t max_pending;
+    NoiseStreamWindow *window;
+    NoiseBuffer mbuf;
+    uint8_t *slot;
+    size_t posn;
+    size_t len;
+    int err;
+
+    /* Keep enough records in flight for the workers to claim full runs,
+       and no more, so that the output slots stay warm in the cache */
+    max_pending = state->num_threads * NOISE_STREAM_MAX_CLAIM * 2;
+    if (max_pending < 1)
+        max_pending = 1;
+    else if (max_pending > NOISE_STREAM_FILE_SLOTS)
+        max_pending = NOISE_STREAM_FILE_SLOTS;
+
+    while (sent < total) {
+        /* Submit the records from the windows that are ready, waiting
+           for the next window only if there is nothing else to do */
+        while (submitted < total && (submitted - sent) < max_pending) {
+            if (!noise_stream_file_ready
+                    (file, submitted / NOISE_STREAM_FILE_RECORDS,
+                     submitted == sent))
+                break;
+            window = &(file->windows[(submitted / NOISE_STREAM_FILE_RECORDS)
+                                     % NOISE_STREAM_FILE_WINDOWS]);
+            if (window->err != NOISE_ERROR_NONE) {
+                errno = window->sys_errno;
+                return window->err;
+            }
+            posn = (size_t)(submitted % NOISE_STREAM_FILE_RECORDS) *
+                   NOISE_STREAM_FILE_CHUNK;
+            len = window->len - posn;
+            if (len > NOISE_STREAM_FILE_CHUNK)
+                len = NOISE_STREAM_FILE_CHUNK;
+            slot = slots + (size_t)(submitted % max_pending) * slot_size;
+            err = noise_streamstate_submit
+                (state, window->data + posn, len, slot + 2, slot_size - 2);
+            if (err != NOISE_ERROR_NONE)
+                return err;
+            ++submitted;
+        }
+
+        /* Write the next record with its big-endian length prefix */
+        err = noise_streamstate_next(state, &mbuf);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        mbuf.data[-2] = (uint8_t)(mbuf.size >> 8);
+        mbuf.data[-1] = (uint8_t)mbuf.size;
+        err = noise_stream_write(sock, mbuf.data - 2, mbuf.size + 2);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        ++sent;
+        if ((sent % NOISE_STREAM_FILE_RECORDS) == 0 || sent == total) {
+            noise_stream_file_release
+                (file, (sent - 1) / NOISE_STREAM_FILE_RECORDS);
+        }
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/** @endcond */
+
+#endif /* !WIN32 */
+
+/**
+ * \brief Encrypts part of a file and writes it to a socket.
+ *
+ * \param state The StreamState object, which must have been created
+ * with \ref NOISE_STREAM_ENCRYPT.
+ * \param sock The socket or other descriptor to write the encrypted
+ * records to.  It may be non-blocking.
+ * \param fd The file descriptor to read the plaintext from.
+ * \param offset The offset of the first byte to send within the file.
+ * \param len The number of bytes to send.
+ *
+ * \return NOISE_ERROR_NONE on success.
+ * \return NOISE_ERROR_INVALID_PARAM if \a state is NULL or one of the
+ * descriptors is invalid.
+ * \return NOISE_ERROR_INVALID_STATE if \a state is for decryption or
+ * has records that have not been collected yet.
+ * \return NOISE_ERROR_INVALID_LENGTH if the range extends past the end
+ * of the file.
+ * \return NOISE_ERROR_INVALID_NONCE if the session ran out of nonces.
+ * \return NOISE_ERROR_NO_MEMORY if there is insufficient memory for the
+ * output buffers.
+ * \return NOISE_ERROR_SYSTEM if reading the file or writing to the
+ * socket failed, in which case the details are in errno.
+ *
+ * The data is sent as a sequence of transport messages, each preceded by
+ * its length as a 2-byte big-endian value, which is the framing used by
+ * the echo example.  Any receiver that decrypts the messages in order
+ * with the session's CipherState can read them.
+ *
+ * The file is loaded in large windows by a separate read-ahead thread.
+ * Regular files are memory-mapped and encrypted directly from the page
+ * cache, and other seekable files such as block devices are read with
+ * pread().  Two windows are kept in
+ * memory so that the next window is being loaded while the current one
+ * is encrypted.  The worker threads of \a state encrypt each record out
+ * of place into an output buffer, and the calling thread writes the
+ * records to \a sock in order as they are finished.  Disk reads,
+ * encryption, and network writes therefore all overlap.
+ *
+ * Encryption happens on the calling thread if \a state has no worker
+ * threads, and loading happens on the calling thread if the library was
+ * built without thread support.
+ *
+ * If an error occurs, then the session should be abandoned because the
+ * nonces for some records may have been used without those records being
+ * written.  A mapped file must not be truncated while it is being sent.
+ *
+ * \sa noise_streamstate_new()
+ */
+int noise_streamstate_send_file
+    (NoiseStreamState *state, int sock, int fd, uint64_t offset,
+     uint64_t len)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    NoiseStreamFile *file;
+    NoiseBuffer mbuf;
+    struct stat st;
+    uint8_t *slots;
+    size_t slot_size;
+#if defined(HAVE_MMAP)
+    size_t index;
+#endif
+    int sys_errno;
+    int err;
+
+    /* Validate the parameters */
+    if (!state || sock < 0 || fd < 0)
+        return NOISE_ERROR_INVALID_PARAM;
+    if (state->operation != NOISE_STREAM_ENCRYPT ||
+            noise_streamstate_get_pending(state) != 0)
+        return NOISE_ERROR_INVALID_STATE;
+    if ((offset + len) < offset)
+        return NOISE_ERROR_INVALID_LENGTH;
+    if (fstat(fd, &st) < 0)
+        return NOISE_ERROR_SYSTEM;
+    if (S_ISREG(st.st_mode) && (offset + len) > (uint64_t)(st.st_size))
+        return NOISE_ERROR_INVALID_LENGTH;
+    if (!len)
+        return NOISE_ERROR_NONE;
+
+    /* Allocate the file state and the output slots, which have room for
+       the length prefix in front of each record */
+    file = (NoiseStreamFile *)noise_new_object(sizeof(NoiseStreamFile));
+    if (!file)
+        return NOISE_ERROR_NO_MEMORY;
+    slot_size = 2 + NOISE_STREAM_FILE_CHUNK + state->cipher->mac_len;
+    slots = (uint8_t *)noise_new_object(slot_size * NOISE_STREAM_FILE_SLOTS);
+    if (!slots) {
+        noise_free(file, file->size);
+        return NOISE_ERROR_NO_MEMORY;
+    }
+    file->fd = fd;
+    file->offset = offset;
+    file->len = len;
+#if defined(HAVE_MMAP)
+    file->use_map = S_ISREG(st.st_mode);
+#endif
+    file->num_windows = (len + NOISE_STREAM_FILE_WINDOW - 1) /
+                        NOISE_STREAM_FILE_WINDOW;
+
+#if defined(HAVE_PTHREAD)
+    /* Start the read-ahead thread, or load the windows inline if the
+       thread cannot be started */
+    if (pthread_mutex_init(&(file->mutex), 0) != 0) {
+        noise_free(slots, slot_size * NOISE_STREAM_FILE_SLOTS);
+        noise_free(file, file->size);
+        return NOISE_ERROR_SYSTEM;
+    }
+    if (pthread_cond_init(&(file->cond), 0) != 0) {
+        pthread_mutex_destroy(&(file->mutex));
+        noise_free(slots, slot_size * NOISE_STREAM_FILE_SLOTS);
+        noise_free(file, file->size);
+        return NOISE_ERROR_SYSTEM;
+    }
+    if (pthread_create(&(file->thread), 0,
+                       noise_stream_file_thread, file) == 0)
+        file->started = 1;
+#endif
+
+    /* Run the pipeline */
+    err = noise_stream_file_pump(state, file, sock, slots, slot_size);
+    sys_errno = errno;
+
+    /* Discard any records that are still in flight so that the workers
+       are finished with the windows, then stop the read-ahead thread */
+    while (noise_streamstate_get_pending(state) != 0)
+        noise_streamstate_next(state, &mbuf);
+#if defined(HAVE_PTHREAD)
+    noise_stream_file_lock(file);
+    file->stopping = 1;
+    pthread_cond_broadcast(&(file->cond));
+    noise_stream_file_unlock(file);
+    if (file->started)
+        pthread_join(file->thread, 0);
+    pthread_cond_destroy(&(file->cond));
+    pthread_mutex_destroy(&(file->mutex));
+#endif
+
+    /* Clean up the windows and buffers */
+#if defined(HAVE_MMAP)
+    for (index = 0; index < NOISE_STREAM_FILE_WINDOWS; ++index) {
+        if (file->windows[index].map)
+            munmap(file->windows[index].map, file->windows[index].map_len);
+    }
+#endif
+    noise_free(file->buffers,
+               NOISE_STREAM_FILE_WINDOW * NOISE_STREAM_FILE_WINDOWS);
+    noise_free(slots, slot_size * NOISE_STREAM_FILE_SLOTS);
+    noise_free(file, file->size);
+    errno = sys_errno;
+    return err;
+#else
+    (void)state;
+    (void)sock;
+    (void)fd;
+    (void)offset;
+    (void)len;
+    return NOISE_ERROR_INVALID_PARAM;
+#endif
+}
+
+/**@}*/
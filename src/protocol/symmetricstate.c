@@ -363,15 +363,17 @@ int noise_symmetricstate_encrypt_and_hash
     if (!state->cipher)
         return NOISE_ERROR_INVALID_STATE;
 
-    /* Encrypt the plaintext using the underlying cipher */
+    /* Encrypt the plaintext using the underlying cipher and feed the
+       ciphertext into the handshake hash in the same pass.  "h" is the
+       associated data, so we must not overwrite it until the end */
     hash_len = noise_hashstate_get_hash_length(state->hash);
-    err = noise_cipherstate_encrypt_with_ad
-        (state->cipher, state->h, hash_len, buffer);
+    noise_hash_reset(state->hash);
+    noise_hash_update(state->hash, state->h, hash_len);
+    err = noise_cipherstate_encrypt_and_hash
+        (state->cipher, state->h, hash_len, buffer, state->hash);
     if (err != NOISE_ERROR_NONE)
         return err;
-
-    /* Feed the ciphertext into the handshake hash */
-    noise_symmetricstate_mix_hash(state, buffer->data, buffer->size);
+    noise_hash_finalize(state->hash, state->h);
     return NOISE_ERROR_NONE;
 }
 
@@ -422,21 +424,18 @@ int noise_symmetricstate_decrypt_and_hash
             return NOISE_ERROR_INVALID_LENGTH;
     }
 
-    /* Feed the ciphertext into the handshake hash first.  We make a
-       temporary copy of the hash.  If the decryption fails below,
-       then we don't update the handshake hash with the bogus data */
+    /* Decrypt the ciphertext using the underlying cipher and feed the
+       ciphertext into the handshake hash in the same pass as the MAC
+       check.  If the decryption fails, then we don't update the
+       handshake hash with the bogus data */
     hash_len = noise_hashstate_get_hash_length(state->hash);
-    noise_hashstate_hash_two
-        (state->hash, state->h, hash_len,
-         buffer->data, buffer->size, temp, hash_len);
-
-    /* Decrypt the ciphertext using the underlying cipher */
-    err = noise_cipherstate_decrypt_with_ad
-        (state->cipher, state->h, hash_len, buffer);
-    if (err != NOISE_ERROR_NONE) {
-        noise_clean(temp, sizeof(temp));
+    noise_hash_reset(state->hash);
+    noise_hash_update(state->hash, state->h, hash_len);
+    err = noise_cipherstate_decrypt_and_hash
+        (state->cipher, state->h, hash_len, buffer, state->hash);
+    if (err != NOISE_ERROR_NONE)
         return err;
-    }
+    noise_hash_finalize(state->hash, temp);
 
     /* Update the handshake hash */
     memcpy(state->h, temp, hash_len);
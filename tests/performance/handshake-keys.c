@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "handshake-keys.h"
+
+/* Generates a static keypair for one side of a handshake */
+NoiseDHState *handshake_keypair(int dh_id)
+{
+    NoiseDHState *dh;
+    if (noise_dhstate_new_by_id(&dh, dh_id) != NOISE_ERROR_NONE)
+        return 0;
+    if (noise_dhstate_generate_keypair(dh) != NOISE_ERROR_NONE) {
+        noise_dhstate_free(dh);
+        return 0;
+    }
+    return dh;
+}
+
+/* Sets up the static keys that one side of a handshake needs */
+int handshake_setup_keys
+    (NoiseHandshakeState *state, const NoiseDHState *local,
+     const NoiseDHState *remote)
+{
+    uint8_t public_key[128];
+    size_t len;
+    int err;
+    if (noise_handshakestate_needs_local_keypair(state)) {
+        err = noise_dhstate_copy
+            (noise_handshakestate_get_local_keypair_dh(state), local);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+    }
+    if (noise_handshakestate_needs_remote_public_key(state)) {
+        len = noise_dhstate_get_public_key_length(remote);
+        err = noise_dhstate_get_public_key(remote, public_key, len);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        err = noise_dhstate_set_public_key
+            (noise_handshakestate_get_remote_public_key_dh(state),
+             public_key, len);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+    }
+    return NOISE_ERROR_NONE;
+}
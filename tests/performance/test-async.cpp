@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs many concurrent connections of the echo example's protocol
+ * through the coroutine driver in <noise/async.hpp>.  Each connection
+ * is a socket pair with an echo client coroutine on one end and an
+ * echo server coroutine on the other, all on one reactor thread.
+ * Handshake computations can optionally be moved to worker threads.
+ */
+
+#include <noise/async.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sys/resource.h>
+
+/* Echo protocol bytes; see examples/echo/echo-server/echo-common.h */
+#define ECHO_PSK_DISABLED           0x00
+#define ECHO_PATTERN_NN             0x00
+#define ECHO_PATTERN_XX             0x0A
+#define ECHO_CIPHER_CHACHAPOLY      0x00
+#define ECHO_DH_25519               0x00
+#define ECHO_HASH_BLAKE2s           0x02
+
+/* Size of the messages that the clients echo */
+#define MESSAGE_SIZE 64
+
+/* Parsed command-line options */
+static int connections = 2000;
+static int concurrency = 500;
+static int messages = 10;
+static unsigned workers = 0;
+static bool use_xx = false;
+
+/* Shared state for the benchmark run */
+static noise::async::reactor *loop;
+static noise::async::worker_pool *pool;
+static noise::dh_state client_key;
+static noise::dh_state server_key;
+static int started;
+static int finished;
+static int failed;
+
+static void start_connection();
+
+static noise::handshake_state new_handshake
+    (int role, const uint8_t *id, size_t id_len, const noise::dh_state &key)
+{
+    std::error_code ec;
+    noise::handshake_state handshake = noise::handshake_state::by_name
+        (use_xx ? "Noise_XX_25519_ChaChaPoly_BLAKE2s"
+                : "Noise_NN_25519_ChaChaPoly_BLAKE2s", role, ec);
+    if (!ec)
+        ec = handshake.set_prologue(noise::const_bytes(id, id_len));
+    if (!ec && use_xx)
+        ec = handshake.set_local_keypair_shared(key);
+    if (ec)
+        return noise::handshake_state();
+    return handshake;
+}
+
+/* Called when either end of a connection finishes.  The server end
+   finishes last, so that is when the next connection is started.  Once
+   both ends of every connection have finished, the reactor is stopped */
+static void connection_done(bool ok, bool client)
+{
+    if (!ok)
+        ++failed;
+    ++finished;
+    if (!client && started < connections)
+        start_connection();
+    else if (finished == connections * 2)
+        loop->stop();
+}
+
+/* Server end of one connection: reads the echo protocol identifier and
+   then echoes every transport message until the client disconnects */
+static noise::async::task<bool> serve_echo(noise::async::session &session)
+{
+    uint8_t id[5];
+    if (session.error() || co_await session.read_raw(id))
+        co_return false;
+    if (id[0] != ECHO_PSK_DISABLED ||
+            id[1] != (use_xx ? ECHO_PATTERN_XX : ECHO_PATTERN_NN) ||
+            id[2] != ECHO_CIPHER_CHACHAPOLY || id[3] != ECHO_DH_25519 ||
+            id[4] != ECHO_HASH_BLAKE2s) {
+        co_return false;
+    }
+    session.handshake_state() =
+        new_handshake(NOISE_ROLE_RESPONDER, id, sizeof(id), server_key);
+    if (!session.handshake_state() || co_await session.handshake())
+        co_return false;
+    noise::const_bytes payload;
+    std::error_code ec;
+    while (!(ec = co_await session.read(payload))) {
+        if (co_await session.write(payload))
+            co_return false;
+    }
+    co_return ec == std::errc::connection_aborted;
+}
+
+static noise::async::task<void> echo_server(int fd)
+{
+    bool ok;
+    {
+        noise::async::session session(*loop, fd, noise::handshake_state());
+        session.set_worker_pool(pool);
+        ok = co_await serve_echo(session);
+    }
+    connection_done(ok, false);
+}
+
+/* Client end of one connection: performs the handshake and then sends
+   the messages one at a time, checking that each one comes back */
+static noise::async::task<void> echo_client(int fd)
+{
+    uint8_t id[5] = {
+        ECHO_PSK_DISABLED,
+        static_cast<uint8_t>(use_xx ? ECHO_PATTERN_XX : ECHO_PATTERN_NN),
+        ECHO_CIPHER_CHACHAPOLY, ECHO_DH_25519, ECHO_HASH_BLAKE2s
+    };
+    uint8_t message[MESSAGE_SIZE];
+    bool ok;
+    {
+        noise::async::session session(*loop, fd, new_handshake
+            (NOISE_ROLE_INITIATOR, id, sizeof(id), client_key));
+        session.set_worker_pool(pool);
+        ok = !session.error() && session.handshake_state() &&
+             !co_await session.write_raw(id) &&
+             !co_await session.handshake();
+        for (int count = 0; ok && count < messages; ++count) {
+            noise::const_bytes payload;
+            memset(message, count, sizeof(message));
+            ok = !co_await session.write(message) &&
+                 !co_await session.read(payload) &&
+                 payload.size() == sizeof(message) &&
+                 !memcmp(payload.data(), message, sizeof(message));
+        }
+    }
+    connection_done(ok, true);
+}
+
+static void start_connection()
+{
+    int fds[2];
+    ++started;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("socketpair");
+        connection_done(false, true);
+        connection_done(false, false);
+        return;
+    }
+    noise::async::spawn(echo_server(fds[0]));
+    noise::async::spawn(echo_client(fds[1]));
+}
+
+/* Raises the open file limit to allow two descriptors per connection */
+static void raise_fd_limit()
+{
+    struct rlimit limit;
+    rlim_t needed = static_cast<rlim_t>(concurrency) * 2 + 64;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur >= needed)
+        return;
+    limit.rlim_cur = limit.rlim_max < needed ? limit.rlim_max : needed;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < needed) {
+        concurrency = static_cast<int>((limit.rlim_cur - 64) / 2);
+        fprintf(stderr, "open file limit reduces concurrency to %d\n",
+                concurrency);
+    }
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--connections N] [--concurrency N] "
+                    "[--messages N] [--workers N] [--xx]\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+    for (int index = 1; index < argc; ++index) {
+        const char *opt = argv[index];
+        if (!strcmp(opt, "--xx")) {
+            use_xx = true;
+            continue;
+        }
+        if ((index + 1) >= argc || atoi(argv[index + 1]) < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        int value = atoi(argv[++index]);
+        if (!strcmp(opt, "--connections") && value > 0) {
+            connections = value;
+        } else if (!strcmp(opt, "--concurrency") && value > 0) {
+            concurrency = value;
+        } else if (!strcmp(opt, "--messages")) {
+            messages = value;
+        } else if (!strcmp(opt, "--workers")) {
+            workers = static_cast<unsigned>(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (concurrency > connections)
+        concurrency = connections;
+
+    if (noise_init() != NOISE_ERROR_NONE) {
+        fprintf(stderr, "Noise initialization failed\n");
+        return 1;
+    }
+    raise_fd_limit();
+
+    /* The static keys are shared by every handshake on each side */
+    std::error_code ec;
+    client_key = noise::dh_state::by_id(NOISE_DH_CURVE25519, ec);
+    if (!ec)
+        ec = client_key.generate_keypair();
+    if (!ec)
+        server_key = noise::dh_state::by_id(NOISE_DH_CURVE25519, ec);
+    if (!ec)
+        ec = server_key.generate_keypair();
+    if (!ec)
+        ec = client_key.share();
+    if (!ec)
+        ec = server_key.share();
+    if (ec) {
+        fprintf(stderr, "key generation: %s\n", ec.message().c_str());
+        return 1;
+    }
+
+    noise::async::reactor reactor;
+    if (!reactor.valid()) {
+        perror("epoll");
+        return 1;
+    }
+    std::unique_ptr<noise::async::worker_pool> worker_threads;
+    if (workers > 0)
+        worker_threads.reset(new noise::async::worker_pool(workers));
+    loop = &reactor;
+    pool = worker_threads.get();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int count = 0; count < concurrency; ++count)
+        start_connection();
+    reactor.run();
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - start).count();
+
+    printf("%s, %d connections, %d at a time, %d messages each, "
+           "%u workers\n", use_xx ? "XX" : "NN", connections, concurrency,
+           messages, workers);
+    printf("%-20s%12.2f\n", "connections/sec", connections / elapsed);
+    printf("%-20s%12.2f\n", "round trips/sec",
+           (double)connections * messages / elapsed);
+    if (failed) {
+        fprintf(stderr, "%d connections failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Measures the packets per second per core that a UDP receiver can
+ * decrypt over loopback, comparing the batched DatagramState API against
+ * a receiver that calls recvfrom() and decrypts one packet at a time.
+ * The batched API is measured with and without UDP GSO and GRO.
+ * The sender and the receiver run on the same thread, and the rate is
+ * based on the CPU time that the process used, including system time.
+ */
+
+#include <noise/protocol.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Number of packets to push through the receiver in each test */
+#define PACKET_COUNT    200000
+
+/* Maximum packet size on the wire, which is a typical Internet MTU */
+#define MAX_PACKET_LEN  1452
+
+/* Length of the MAC on each packet */
+#define MAC_LEN         16
+
+static uint8_t const key[32] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f
+};
+
+typedef struct
+{
+    int sender;
+    int receiver;
+    struct sockaddr_in sender_addr;
+    struct sockaddr_in receiver_addr;
+
+} SocketPair;
+
+static double cpu_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int bind_loopback(struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(struct sockaddr_in);
+    int size = 4 * 1024 * 1024;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)addr, len) < 0 ||
+            getsockname(fd, (struct sockaddr *)addr, &len) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static int open_pair(SocketPair *pair)
+{
+    pair->sender = bind_loopback(&pair->sender_addr);
+    pair->receiver = bind_loopback(&pair->receiver_addr);
+    if (pair->sender < 0 || pair->receiver < 0) {
+        perror("socket");
+        return 0;
+    }
+    return 1;
+}
+
+static void close_pair(SocketPair *pair)
+{
+    close(pair->sender);
+    close(pair->receiver);
+}
+
+static NoiseCipherState *new_cipher(int cipher_id)
+{
+    NoiseCipherState *cipher = 0;
+    if (noise_cipherstate_new_by_id(&cipher, cipher_id) != NOISE_ERROR_NONE)
+        return 0;
+    noise_cipherstate_init_key(cipher, key, sizeof(key));
+    return cipher;
+}
+
+static void write_header(uint8_t *packet, uint64_t nonce)
+{
+    int posn;
+    packet[0] = packet[1] = packet[2] = 0;
+    packet[3] = 1;
+    for (posn = 0; posn < 8; ++posn)
+        packet[4 + posn] = (uint8_t)(nonce >> (56 - posn * 8));
+}
+
+static uint64_t read_nonce(const uint8_t *packet)
+{
+    uint64_t nonce = 0;
+    int posn;
+    for (posn = 0; posn < 8; ++posn)
+        nonce = (nonce << 8) | packet[4 + posn];
+    return nonce;
+}
+
+/* Sends and receives packets one at a time with sendto() and recvfrom(),
+   using the same packet format as DatagramState */
+static double perf_single(int cipher_id, size_t payload_len, long *lost)
+{
+    NoiseCipherState *send = new_cipher(cipher_id);
+    NoiseCipherState *recv = new_cipher(cipher_id);
+    static uint8_t packet[MAX_PACKET_LEN];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    NoiseBuffer mbuf;
+    SocketPair pair;
+    long received = 0;
+    long sent;
+    double start, elapsed;
+    ssize_t len;
+    uint64_t nonce;
+    int batch;
+
+    if (!send || !recv || !open_pair(&pair))
+        exit(1);
+    start = cpu_seconds();
+    for (sent = 0; sent < PACKET_COUNT; ) {
+        /* Send the same number of packets per round as the batched test */
+        for (batch = 0; batch < NOISE_DATAGRAM_BATCH; ++batch, ++sent) {
+            write_header(packet, (uint64_t)sent);
+            memset(packet + NOISE_DATAGRAM_HEADER_LEN, 0xAA, payload_len);
+            noise_buffer_set_inout(mbuf, packet + NOISE_DATAGRAM_HEADER_LEN,
+                                   payload_len,
+                                   sizeof(packet) - NOISE_DATAGRAM_HEADER_LEN);
+            noise_cipherstate_encrypt_with_ad
+                (send, packet, NOISE_DATAGRAM_HEADER_LEN, &mbuf);
+            sendto(pair.sender, packet, NOISE_DATAGRAM_HEADER_LEN + mbuf.size,
+                   0, (struct sockaddr *)&pair.receiver_addr,
+                   sizeof(pair.receiver_addr));
+        }
+        for (;;) {
+            from_len = sizeof(from);
+            len = recvfrom(pair.receiver, packet, sizeof(packet), 0,
+                           (struct sockaddr *)&from, &from_len);
+            if (len < (NOISE_DATAGRAM_HEADER_LEN + MAC_LEN))
+                break;
+            nonce = read_nonce(packet);
+            if (noise_cipherstate_set_nonce(recv, nonce) != NOISE_ERROR_NONE)
+                continue;
+            noise_buffer_set_input(mbuf, packet + NOISE_DATAGRAM_HEADER_LEN,
+                                   len - NOISE_DATAGRAM_HEADER_LEN);
+            if (noise_cipherstate_decrypt_with_ad
+                    (recv, packet, NOISE_DATAGRAM_HEADER_LEN, &mbuf) ==
+                        NOISE_ERROR_NONE)
+                ++received;
+        }
+    }
+    elapsed = cpu_seconds() - start;
+    close_pair(&pair);
+    noise_cipherstate_free(send);
+    noise_cipherstate_free(recv);
+    *lost = sent - received;
+    return received / elapsed;
+}
+
+/* Sends and receives packets in batches with DatagramState, returning
+   zero if the requested offload features are not supported */
+static double perf_batched
+    (int cipher_id, size_t payload_len, int offload, long *lost)
+{
+    NoiseDatagramState *sender;
+    NoiseDatagramState *receiver;
+    NoiseDatagram *packets;
+    uint8_t payload[MAX_PACKET_LEN];
+    SocketPair pair;
+    uint32_t send_index;
+    uint32_t recv_index;
+    long received = 0;
+    long sent;
+    double start, elapsed;
+    size_t count;
+    size_t index;
+    int batch;
+
+    if (!open_pair(&pair))
+        exit(1);
+    if (noise_datagramstate_new(&sender, pair.sender, MAX_PACKET_LEN) !=
+                NOISE_ERROR_NONE ||
+            noise_datagramstate_new(&receiver, pair.receiver, MAX_PACKET_LEN) !=
+                NOISE_ERROR_NONE ||
+            noise_datagramstate_add_session
+                (sender, new_cipher(cipher_id), new_cipher(cipher_id), 1,
+                 &pair.receiver_addr, sizeof(pair.receiver_addr),
+                 &send_index) != NOISE_ERROR_NONE ||
+            noise_datagramstate_add_session
+                (receiver, new_cipher(cipher_id), new_cipher(cipher_id), 1,
+                 &pair.sender_addr, sizeof(pair.sender_addr),
+                 &recv_index) != NOISE_ERROR_NONE) {
+        fprintf(stderr, "DatagramState setup failed\n");
+        exit(1);
+    }
+    if (noise_datagramstate_set_offload(sender, offload) != NOISE_ERROR_NONE ||
+            noise_datagramstate_set_offload(receiver, offload) !=
+                NOISE_ERROR_NONE) {
+        noise_datagramstate_free(sender);
+        noise_datagramstate_free(receiver);
+        close_pair(&pair);
+        *lost = 0;
+        return 0;
+    }
+    start = cpu_seconds();
+    for (sent = 0; sent < PACKET_COUNT; ) {
+        for (batch = 0; batch < NOISE_DATAGRAM_BATCH; ++batch, ++sent) {
+            memset(payload, 0xAA, payload_len);
+            noise_datagramstate_send(sender, send_index, payload, payload_len);
+        }
+        noise_datagramstate_flush(sender);
+        for (;;) {
+            if (noise_datagramstate_receive(receiver, &packets, &count) !=
+                    NOISE_ERROR_NONE || !count)
+                break;
+            for (index = 0; index < count; ++index) {
+                if (packets[index].error == NOISE_ERROR_NONE)
+                    ++received;
+            }
+        }
+    }
+    elapsed = cpu_seconds() - start;
+    if (offload && noise_datagramstate_get_offload(sender) != offload)
+        received = 0; /* The kernel rejected GSO part way through */
+    noise_datagramstate_free(sender);
+    noise_datagramstate_free(receiver);
+    close_pair(&pair);
+    *lost = sent - received;
+    return received / elapsed;
+}
+
+static void perf_datagram(int cipher_id, size_t payload_len)
+{
+    long single_lost;
+    long batched_lost;
+    long offload_lost;
+    double single = perf_single(cipher_id, payload_len, &single_lost);
+    double batched = perf_batched
+        (cipher_id, payload_len, 0, &batched_lost);
+    double offload = perf_batched
+        (cipher_id, payload_len,
+         NOISE_DATAGRAM_OFFLOAD_GSO | NOISE_DATAGRAM_OFFLOAD_GRO,
+         &offload_lost);
+    printf("%-12s%6d%14.0f%14.0f%8.2f",
+           noise_id_to_name(NOISE_CIPHER_CATEGORY, cipher_id),
+           (int)payload_len, single, batched, batched / single);
+    if (offload > 0)
+        printf("%14.0f%8.2f\n", offload, offload / single);
+    else
+        printf("%14s%8s\n", "n/a", "");
+    if (single_lost || batched_lost || offload_lost) {
+        printf("    lost %ld one-at-a-time, %ld batched, %ld GSO/GRO "
+               "packets\n", single_lost, batched_lost, offload_lost);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s\n", argv[0]);
+        return 1;
+    }
+    if (noise_init() != NOISE_ERROR_NONE) {
+        fprintf(stderr, "Noise initialization failed\n");
+        return 1;
+    }
+
+    printf("Packets per CPU second, %d packets per round\n",
+           NOISE_DATAGRAM_BATCH);
+    printf("Cipher        Size  one-at-a-time       batched   ratio"
+           "       GSO/GRO   ratio\n");
+    perf_datagram(NOISE_CIPHER_CHACHAPOLY, 64);
+    perf_datagram(NOISE_CIPHER_CHACHAPOLY, MAX_PACKET_LEN -
+                  NOISE_DATAGRAM_HEADER_LEN - MAC_LEN);
+    perf_datagram(NOISE_CIPHER_AESGCM, 64);
+    perf_datagram(NOISE_CIPHER_AESGCM, MAX_PACKET_LEN -
+                  NOISE_DATAGRAM_HEADER_LEN - MAC_LEN);
+    return 0;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    fprintf(stderr, "%s: datagram sockets are not supported\n", argv[0]);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+    This program reports the number of allocations and the number of
+    bytes that the library requests from the system allocator while
+    creating handshakes, running them to completion, splitting them into
+    transport sessions, and loading certificates with the keys library.
+
+    The program is linked with "-Wl,--wrap=malloc" and friends so that
+    every allocation made by the statically-linked libraries passes
+    through the wrappers below.  Byte counts are the sizes that were
+    requested, not including the allocator's own overhead.  Allocations
+    made inside shared libraries such as OpenSSL are not seen.
+
+    When run with "--check", every result is compared against a budget
+    and the program fails if a budget is exceeded.  The program always
+    fails if any memory is still held once all objects have been freed,
+    or if the number of frees does not match the number of allocations.
+    This is intended to catch leaks and accidental growth in the size of
+    the library's objects and in the number of allocations they make.
+*/
+
+#include <noise/protocol.h>
+#include <noise/keys.h>
+#include "handshake-keys.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CERT_BUFSIZ     4096
+#define CHAIN_LENGTH    3
+
+/* Every block is preceded by a header that records its size, rounded
+   up so that the caller's memory is still suitably aligned */
+typedef union
+{
+    size_t size;
+    long double align1;
+    void *align2;
+
+} AllocHeader;
+
+static size_t num_allocs = 0;
+static size_t num_frees = 0;
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+
+/* Snapshot of the counters at the start of a measurement */
+typedef struct
+{
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+
+} FootprintMark;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void *record_alloc(AllocHeader *header, size_t size)
+{
+    if (!header)
+        return 0;
+    header->size = size;
+    ++num_allocs;
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    return header + 1;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return record_alloc
+        ((AllocHeader *)__real_malloc(sizeof(AllocHeader) + size), size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (((size_t)-1) - sizeof(AllocHeader)) / size)
+        return 0;
+    return record_alloc
+        ((AllocHeader *)__real_calloc(1, sizeof(AllocHeader) + nmemb * size),
+         nmemb * size);
+}
+
+void __wrap_free(void *ptr)
+{
+    AllocHeader *header;
+    if (!ptr)
+        return;
+    header = ((AllocHeader *)ptr) - 1;
+    ++num_frees;
+    live_bytes -= header->size;
+    __real_free(header);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    AllocHeader *header;
+    size_t old_size;
+    if (!ptr)
+        return __wrap_malloc(size);
+    header = ((AllocHeader *)ptr) - 1;
+    old_size = header->size;
+    header = (AllocHeader *)__real_realloc(header, sizeof(AllocHeader) + size);
+    if (!header)
+        return 0;
+    header->size = size;
+    ++num_allocs;
+    ++num_frees;
+    live_bytes += size - old_size;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    return header + 1;
+}
+
+/* Records the counters at the start of a measurement */
+static void footprint_begin(FootprintMark *mark)
+{
+    mark->allocs = num_allocs;
+    mark->frees = num_frees;
+    mark->bytes = live_bytes;
+    peak_bytes = live_bytes;
+}
+
+static int check_budgets = 0;
+static int budget_failures = 0;
+
+/* Compares a result against its budget when running in "--check" mode */
+static void check_budget
+    (const char *name, const char *what, size_t value, size_t budget)
+{
+    if (check_budgets && value > budget) {
+        fprintf(stderr, "%s: %s is %lu, which exceeds the budget of %lu\n",
+                name, what, (unsigned long)value, (unsigned long)budget);
+        ++budget_failures;
+    }
+}
+
+/* Verifies that everything allocated since "mark" has been freed */
+static void check_leaks(const char *name, const FootprintMark *mark)
+{
+    size_t allocs = num_allocs - mark->allocs;
+    size_t frees = num_frees - mark->frees;
+    if (live_bytes != mark->bytes) {
+        fprintf(stderr, "%s: %lu bytes were not freed\n",
+                name, (unsigned long)(live_bytes - mark->bytes));
+        ++budget_failures;
+    }
+    if (allocs != frees) {
+        fprintf(stderr, "%s: %lu allocations but %lu frees\n",
+                name, (unsigned long)allocs, (unsigned long)frees);
+        ++budget_failures;
+    }
+}
+
+/* Runs a handshake between two parties and returns the initiator's
+   transport ciphers after freeing everything else */
+static int run_handshake
+    (const NoiseProtocolId *id, NoiseHandshakeState *initiator,
+     const NoiseDHState *initiator_key, const NoiseDHState *responder_key,
+     NoiseCipherState **send_cipher, NoiseCipherState **recv_cipher)
+{
+    NoiseHandshakeState *responder = 0;
+    NoiseHandshakeState *send;
+    NoiseHandshakeState *recv;
+    NoiseCipherState *c1 = 0;
+    NoiseCipherState *c2 = 0;
+    NoiseBuffer mbuf;
+    uint8_t message[4096];
+    int err;
+
+    err = noise_handshakestate_new_by_id
+        (&responder, id, NOISE_ROLE_RESPONDER);
+    if (err == NOISE_ERROR_NONE)
+        err = handshake_setup_keys(initiator, initiator_key, responder_key);
+    if (err == NOISE_ERROR_NONE)
+        err = handshake_setup_keys(responder, responder_key, initiator_key);
+    if (err == NOISE_ERROR_NONE)
+        err = noise_handshakestate_start(initiator);
+    if (err == NOISE_ERROR_NONE)
+        err = noise_handshakestate_start(responder);
+    send = initiator;
+    recv = responder;
+    while (err == NOISE_ERROR_NONE &&
+           noise_handshakestate_get_action(send)
+                == NOISE_ACTION_WRITE_MESSAGE) {
+        noise_buffer_set_output(mbuf, message, sizeof(message));
+        err = noise_handshakestate_write_message(send, &mbuf, 0);
+        if (err == NOISE_ERROR_NONE)
+            err = noise_handshakestate_read_message(recv, &mbuf, 0);
+        send = (send == initiator) ? responder : initiator;
+        recv = (recv == initiator) ? responder : initiator;
+    }
+    if (err == NOISE_ERROR_NONE)
+        err = noise_handshakestate_split(initiator, send_cipher, recv_cipher);
+    if (err == NOISE_ERROR_NONE)
+        err = noise_handshakestate_split(responder, &c1, &c2);
+    noise_cipherstate_free(c1);
+    noise_cipherstate_free(c2);
+    noise_handshakestate_free(responder);
+    return err;
+}
+
+/* Measures the footprint of a complete handshake and the resulting
+   transport session for a specific protocol */
+static void footprint_handshake
+    (const char *protocol, size_t max_new, size_t max_allocs,
+     size_t max_peak, size_t max_session)
+{
+    NoiseHandshakeState *initiator = 0;
+    NoiseCipherState *send_cipher = 0;
+    NoiseCipherState *recv_cipher = 0;
+    NoiseDHState *initiator_key;
+    NoiseDHState *responder_key;
+    NoiseProtocolId id;
+    FootprintMark start, mark;
+    size_t new_allocs, new_bytes;
+    size_t hs_allocs, hs_frees, hs_peak, session;
+    int err;
+
+    if (noise_protocol_name_to_id(&id, protocol, strlen(protocol))
+            != NOISE_ERROR_NONE)
+        return;
+    footprint_begin(&start);
+    initiator_key = handshake_keypair(id.dh_id);
+    responder_key = handshake_keypair(id.dh_id);
+    if (!initiator_key || !responder_key) {
+        noise_dhstate_free(initiator_key);
+        noise_dhstate_free(responder_key);
+        return;
+    }
+
+    /* Measure the cost of creating the handshake object */
+    footprint_begin(&mark);
+    err = noise_handshakestate_new_by_name
+        (&initiator, protocol, NOISE_ROLE_INITIATOR);
+    new_allocs = num_allocs - mark.allocs;
+    new_bytes = live_bytes - mark.bytes;
+
+    /* Run the handshake, which includes creating the responder */
+    if (err == NOISE_ERROR_NONE) {
+        err = run_handshake(&id, initiator, initiator_key, responder_key,
+                            &send_cipher, &recv_cipher);
+    }
+    hs_allocs = num_allocs - mark.allocs;
+    hs_frees = num_frees - mark.frees;
+    hs_peak = peak_bytes - mark.bytes;
+
+    /* Measure the memory that is held by the transport session */
+    noise_handshakestate_free(initiator);
+    session = live_bytes - mark.bytes;
+    noise_cipherstate_free(send_cipher);
+    noise_cipherstate_free(recv_cipher);
+    noise_dhstate_free(initiator_key);
+    noise_dhstate_free(responder_key);
+    if (err != NOISE_ERROR_NONE) {
+        printf("%-48s  failed\n", protocol);
+        ++budget_failures;
+        return;
+    }
+
+    printf("%-48s%4lu%8lu%8lu%8lu%8lu%8lu\n", protocol,
+           (unsigned long)new_allocs, (unsigned long)new_bytes,
+           (unsigned long)hs_allocs, (unsigned long)hs_frees,
+           (unsigned long)hs_peak, (unsigned long)session);
+    check_budget(protocol, "handshake object size", new_bytes, max_new);
+    check_budget(protocol, "number of allocations", hs_allocs, max_allocs);
+    check_budget(protocol, "peak handshake memory", hs_peak, max_peak);
+    check_budget(protocol, "transport session size", session, max_session);
+    check_leaks(protocol, &start);
+}
+
+/* Fills in a certificate with typical contents */
+static int fill_certificate(Noise_Certificate *cert)
+{
+    static const char id[] = "jane.smith@example.com";
+    static const char name[] = "Jane Smith";
+    static const char role[] = "foo";
+    static const char algorithm[] = "25519";
+    static const char sign_algorithm[] = "Ed25519";
+    static const char hash_algorithm[] = "BLAKE2b";
+    static const char meta_name[] = "Expires";
+    static const char meta_value[] = "2017-06-30T00:00:00Z";
+    static const uint8_t key[32] = {0};
+    static const uint8_t signature[64] = {0};
+    Noise_SubjectInfo *subject;
+    Noise_PublicKeyInfo *key_info;
+    Noise_MetaInfo *meta;
+    Noise_Signature *sig;
+    Noise_PublicKeyInfo *signing_key;
+    int err;
+
+    err = Noise_Certificate_set_version(cert, 1);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_Certificate_get_new_subject(cert, &subject);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_SubjectInfo_set_id(subject, id, sizeof(id) - 1);
+    Noise_SubjectInfo_set_name(subject, name, sizeof(name) - 1);
+    Noise_SubjectInfo_set_role(subject, role, sizeof(role) - 1);
+    err = Noise_SubjectInfo_add_keys(subject, &key_info);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_PublicKeyInfo_set_algorithm
+        (key_info, algorithm, sizeof(algorithm) - 1);
+    Noise_PublicKeyInfo_set_key(key_info, key, sizeof(key));
+    err = Noise_SubjectInfo_add_meta(subject, &meta);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_MetaInfo_set_name(meta, meta_name, sizeof(meta_name) - 1);
+    Noise_MetaInfo_set_value(meta, meta_value, sizeof(meta_value) - 1);
+    err = Noise_Certificate_add_signatures(cert, &sig);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_Signature_set_id(sig, id, sizeof(id) - 1);
+    Noise_Signature_set_name(sig, name, sizeof(name) - 1);
+    err = Noise_Signature_get_new_signing_key(sig, &signing_key);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_PublicKeyInfo_set_algorithm
+        (signing_key, sign_algorithm, sizeof(sign_algorithm) - 1);
+    Noise_PublicKeyInfo_set_key(signing_key, key, sizeof(key));
+    Noise_Signature_set_hash_algorithm
+        (sig, hash_algorithm, sizeof(hash_algorithm) - 1);
+    return Noise_Signature_set_signature(sig, signature, sizeof(signature));
+}
+
+/* Prints and checks the footprint of loading an object */
+static void report_load
+    (const char *name, int err, size_t allocs, size_t frees, size_t peak,
+     size_t held, size_t max_allocs, size_t max_peak,
+     const FootprintMark *start)
+{
+    if (err != NOISE_ERROR_NONE) {
+        printf("%-48s  failed\n", name);
+        ++budget_failures;
+        return;
+    }
+    printf("%-48s%6lu%8lu%8lu%8lu\n", name, (unsigned long)allocs,
+           (unsigned long)frees, (unsigned long)held, (unsigned long)peak);
+    check_budget(name, "number of allocations", allocs, max_allocs);
+    check_budget(name, "peak memory", peak, max_peak);
+    check_leaks(name, start);
+}
+
+/* Measures the footprint of loading a certificate */
+static void footprint_certificate(size_t max_allocs, size_t max_peak)
+{
+    static const char name[] = "Noise_Certificate";
+    Noise_Certificate *cert = 0;
+    NoiseProtobuf pbuf;
+    uint8_t buffer[CERT_BUFSIZ];
+    uint8_t *data = 0;
+    size_t size = 0;
+    FootprintMark start, mark;
+    size_t allocs, frees, peak, held;
+    int err;
+
+    /* Create the serialized certificate to be loaded */
+    footprint_begin(&start);
+    err = Noise_Certificate_new(&cert);
+    if (err == NOISE_ERROR_NONE)
+        err = fill_certificate(cert);
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_output(&pbuf, buffer, sizeof(buffer));
+        err = noise_save_certificate_to_buffer(cert, &pbuf);
+        if (err == NOISE_ERROR_NONE)
+            err = noise_protobuf_finish_output(&pbuf, &data, &size);
+    }
+    Noise_Certificate_free(cert);
+    cert = 0;
+
+    /* Load the certificate back again */
+    footprint_begin(&mark);
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_input(&pbuf, data, size);
+        err = noise_load_certificate_from_buffer(&cert, &pbuf);
+    }
+    allocs = num_allocs - mark.allocs;
+    frees = num_frees - mark.frees;
+    peak = peak_bytes - start.bytes;
+    held = live_bytes - start.bytes;
+    Noise_Certificate_free(cert);
+    report_load(name, err, allocs, frees, peak, held, max_allocs, max_peak,
+                &start);
+}
+
+/* Measures the footprint of loading a certificate chain */
+static void footprint_certificate_chain(size_t max_allocs, size_t max_peak)
+{
+    static const char name[] = "Noise_CertificateChain (3 certificates)";
+    Noise_CertificateChain *chain = 0;
+    Noise_Certificate *cert;
+    NoiseProtobuf pbuf;
+    uint8_t buffer[CERT_BUFSIZ];
+    uint8_t *data = 0;
+    size_t size = 0;
+    FootprintMark start, mark;
+    size_t allocs, frees, peak, held;
+    int index, err;
+
+    /* Create the serialized certificate chain to be loaded */
+    footprint_begin(&start);
+    err = Noise_CertificateChain_new(&chain);
+    for (index = 0; index < CHAIN_LENGTH && err == NOISE_ERROR_NONE; ++index) {
+        err = Noise_CertificateChain_add_certs(chain, &cert);
+        if (err == NOISE_ERROR_NONE)
+            err = fill_certificate(cert);
+    }
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_output(&pbuf, buffer, sizeof(buffer));
+        err = noise_save_certificate_chain_to_buffer(chain, &pbuf);
+        if (err == NOISE_ERROR_NONE)
+            err = noise_protobuf_finish_output(&pbuf, &data, &size);
+    }
+    Noise_CertificateChain_free(chain);
+    chain = 0;
+
+    /* Load the certificate chain back again */
+    footprint_begin(&mark);
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_input(&pbuf, data, size);
+        err = noise_load_certificate_chain_from_buffer(&chain, &pbuf);
+    }
+    allocs = num_allocs - mark.allocs;
+    frees = num_frees - mark.frees;
+    peak = peak_bytes - start.bytes;
+    held = live_bytes - start.bytes;
+    Noise_CertificateChain_free(chain);
+    report_load(name, err, allocs, frees, peak, held, max_allocs, max_peak,
+                &start);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "--check")) {
+        check_budgets = 1;
+    } else if (argc > 1) {
+        fprintf(stderr, "Usage: %s [--check]\n", argv[0]);
+        return 1;
+    }
+
+    if (noise_init() != NOISE_ERROR_NONE) {
+        fprintf(stderr, "Noise initialization failed\n");
+        return 1;
+    }
+
+    /* Measure the handshakes.  The columns are the number of allocations
+       and bytes for noise_handshakestate_new_by_name(), the allocations,
+       frees and peak bytes for the whole handshake including the
+       responder, and the bytes held by the initiator's transport session.
+       The budgets are for the handshake object size, the number of
+       allocations and the peak memory for the handshake, and the
+       transport session size, with about 25% headroom over the
+       reference backend */
+    printf("Protocol                                        "
+           " new   bytes  allocs   frees    peak session\n");
+    footprint_handshake
+        ("Noise_NN_25519_ChaChaPoly_BLAKE2s", 1792, 18, 4352, 1024);
+    footprint_handshake
+        ("Noise_XX_25519_ChaChaPoly_BLAKE2s", 2176, 23, 5248, 1024);
+    footprint_handshake
+        ("Noise_IK_25519_ChaChaPoly_BLAKE2b", 2304, 23, 5504, 1024);
+    footprint_handshake
+        ("Noise_XX_25519_AESGCM_SHA256", 3328, 23, 9856, 3328);
+    footprint_handshake
+        ("Noise_XX_448_ChaChaPoly_SHA512", 2560, 23, 5952, 1024);
+    footprint_handshake
+        ("Noise_NNhfs_25519+NewHope_ChaChaPoly_BLAKE2s",
+         12288, 23, 25856, 1024);
+
+    /* Measure loading objects with the keys and protobufs libraries */
+    printf("\n");
+    printf("Object                                          "
+           "allocs   frees    held    peak\n");
+    footprint_certificate(28, 832);
+    footprint_certificate_chain(85, 2560);
+
+    if (budget_failures) {
+        fprintf(stderr, "%d footprint check(s) failed\n", budget_failures);
+        return 1;
+    }
+    return 0;
+}
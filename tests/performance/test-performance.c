@@ -30,15 +30,19 @@
 */
 
 #include <noise/protocol.h>
+#include <noise/keys.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include "md5.h"
-#if defined(__APPLE__)
-#include <sys/time.h>
-#endif
-#if defined(__WIN32__) || defined(WIN32)
-#include <windows.h>
+#include "handshake-keys.h"
+#include "timing.h"
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define HAVE_PERF_EVENTS 1
 #endif
 
 #define BLOCK_SIZE      1024
@@ -46,52 +50,186 @@
 #define MB_COUNT        200
 #define DH_COUNT        1000
 #define PQ_DH_COUNT     2000
-
-typedef uint64_t timestamp_t;
+#define FLOOD_COUNT     1000
+#define FLOOD_PROTOCOL  "Noise_IK_25519_ChaChaPoly_BLAKE2s"
+#define HFS_COUNT       500
+#define SMALL_COUNT     200000
+#define SMALL_SIZE      64
+#define SMALL_BATCH     4
+#define PAYLOAD_SIZE    4096
+#define PAYLOAD_COUNT   10000
+#define HANDSHAKE_COUNT 500
+#define KEYS_COUNT      2000
+#define KEYS_BUFSIZ     NOISE_MAX_PAYLOAD_LEN
+#define KEYS_HASH_LEN   64
+#define PRIVKEY_COUNT   5
 
 static double units;
 
-#if defined(__WIN32__) || defined(WIN32)
+/* Hardware performance counters that are collected when the program is
+   run with the "--counters" option.  Each measured region runs between
+   begin_timing() and end_timing(), and the counts are accumulated until
+   report_counters() prints them.  Counts are scaled if the kernel had to
+   multiplex the counters.  Only supported on Linux */
+#define NUM_COUNTERS    5
+#define CTR_CYCLES      0
+#define CTR_INSTRS      1
+#define CTR_BR_MISSES   2
+#define CTR_L1D_MISSES  3
+#define CTR_LLC_MISSES  4
+
+static int counters_enabled = 0;
+static double counter_totals[NUM_COUNTERS];
+
+#if HAVE_PERF_EVENTS
+
+static int counter_fds[NUM_COUNTERS] = {-1, -1, -1, -1, -1};
+static double counter_base[NUM_COUNTERS];
 
-static timestamp_t current_timestamp(void)
+static int open_counter(uint32_t type, uint64_t config)
 {
-    return GetTickCount();
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Opens the counters, returning zero if none of them are available */
+static int open_counters(void)
+{
+    int index, have_any = 0;
+    counter_fds[CTR_CYCLES] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counter_fds[CTR_INSTRS] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counter_fds[CTR_BR_MISSES] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counter_fds[CTR_L1D_MISSES] =
+        open_counter(PERF_TYPE_HW_CACHE,
+                     PERF_COUNT_HW_CACHE_L1D |
+                     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    counter_fds[CTR_LLC_MISSES] =
+        open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    for (index = 0; index < NUM_COUNTERS; ++index) {
+        if (counter_fds[index] >= 0)
+            have_any = 1;
+    }
+    return have_any;
 }
 
-static double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+static void read_counters(double *values)
 {
-    return (end - start) / 1000.0;
+    uint64_t data[3];
+    int index;
+    for (index = 0; index < NUM_COUNTERS; ++index) {
+        values[index] = 0;
+        if (counter_fds[index] < 0)
+            continue;
+        if (read(counter_fds[index], data, sizeof(data)) != sizeof(data))
+            continue;
+        if (data[2] != 0 && data[2] < data[1])
+            values[index] = (double)(data[0]) * data[1] / data[2];
+        else
+            values[index] = (double)(data[0]);
+    }
 }
 
-#elif defined(__APPLE__)
+/* Closes the counters once all of the measurements are done */
+static void close_counters(void)
+{
+    int index;
+    for (index = 0; index < NUM_COUNTERS; ++index) {
+        if (counter_fds[index] >= 0) {
+            close(counter_fds[index]);
+            counter_fds[index] = -1;
+        }
+    }
+}
 
-static timestamp_t current_timestamp(void)
+static timestamp_t begin_timing(void)
 {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    return ((uint64_t)(now.tv_sec)) * 1000000ULL + now.tv_usec;
+    if (counters_enabled)
+        read_counters(counter_base);
+    return current_timestamp();
 }
 
-static double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+static timestamp_t end_timing(void)
 {
-    return (end - start) / 1000000.0;
+    timestamp_t end = current_timestamp();
+    double values[NUM_COUNTERS];
+    int index;
+    if (counters_enabled) {
+        read_counters(values);
+        for (index = 0; index < NUM_COUNTERS; ++index)
+            counter_totals[index] += values[index] - counter_base[index];
+    }
+    return end;
 }
 
 #else
 
-static timestamp_t current_timestamp(void)
+static int open_counters(void)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
-    return ((uint64_t)(ts.tv_sec)) * 1000000000ULL + ts.tv_nsec;
+    return 0;
 }
 
-static double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+static void close_counters(void)
 {
-    return (end - start) / 1000000000.0;
 }
 
+#define begin_timing()  current_timestamp()
+#define end_timing()    current_timestamp()
+
+#endif
+
+/* Prints a counter value per unit, or "n/a" if it is not available */
+static void print_counter(const char *name, int counter, double count)
+{
+#if HAVE_PERF_EVENTS
+    if (counter_fds[counter] >= 0) {
+        double value = counter_totals[counter] / count;
+        printf("  %s %.*f", name, value < 10.0 ? 4 : 1, value);
+        return;
+    }
 #endif
+    printf("  %s n/a", name);
+}
+
+/* Prints the counters that were accumulated since the last report,
+   divided by "count" bytes or operations as described by "unit" */
+static void report_counters(double count, const char *unit)
+{
+    char name[32];
+    if (counters_enabled) {
+        printf("    ");
+        snprintf(name, sizeof(name), "cycles/%s", unit);
+        print_counter(name, CTR_CYCLES, count);
+        if (counter_totals[CTR_CYCLES] > 0 && counter_totals[CTR_INSTRS] > 0)
+            printf("  IPC %.2f", counter_totals[CTR_INSTRS] /
+                                 counter_totals[CTR_CYCLES]);
+        else
+            printf("  IPC n/a");
+        snprintf(name, sizeof(name), "br-miss/%s", unit);
+        print_counter(name, CTR_BR_MISSES, count);
+        snprintf(name, sizeof(name), "L1d-miss/%s", unit);
+        print_counter(name, CTR_L1D_MISSES, count);
+        snprintf(name, sizeof(name), "LLC-miss/%s", unit);
+        print_counter(name, CTR_LLC_MISSES, count);
+        printf("\n");
+    }
+    memset(counter_totals, 0, sizeof(counter_totals));
+}
+
+/* Number of bytes processed in the tests that report MB/sec */
+#define MB_BYTES    ((double)MB_COUNT * 1024.0 * 1024.0)
 
 /* Calibrates the performance measurements to determine the "MD5 unit" */
 static void calibrate_md5(void)
@@ -102,10 +240,10 @@ static void calibrate_md5(void)
     int count;
     memset(data, 0xAA, sizeof(data));
     md5_reset(&context);
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < (MB_COUNT * BLOCKS_PER_MB); ++count)
         md5_update(&context, data, sizeof(data));
-    end = current_timestamp();
+    end = end_timing();
     units = elapsed_to_seconds(start, end) / (double)MB_COUNT;
 }
 
@@ -123,16 +261,103 @@ static void perf_hash(int id)
 
     memset(data, 0xAA, sizeof(data));
     noise_hashstate_reset(hash);
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < (MB_COUNT * BLOCKS_PER_MB); ++count)
         noise_hashstate_update(hash, data, sizeof(data));
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)MB_COUNT;
     printf("%-20s%8.2f          %8.2f\n",
            noise_id_to_name(NOISE_HASH_CATEGORY, id),
            1.0 / elapsed, units / elapsed);
+    report_counters(MB_BYTES, "B");
+
+    noise_hashstate_free(hash);
+}
+
+/* Number and size of the short inputs for the multi-buffer hash test */
+#define HASH_MANY_COUNT 64
+#define HASH_MANY_SIZE  64
+#define HASH_MANY_PER_MB ((1024 * 1024) / (HASH_MANY_COUNT * HASH_MANY_SIZE))
+
+/* Measure the performance of hashing many short inputs at once */
+static void perf_hash_many(int id)
+{
+    char name[64];
+    static uint8_t data[HASH_MANY_COUNT][HASH_MANY_SIZE];
+    static uint8_t hashes[HASH_MANY_COUNT][64];
+    const uint8_t *inputs[HASH_MANY_COUNT];
+    size_t input_lens[HASH_MANY_COUNT];
+    uint8_t *outputs[HASH_MANY_COUNT];
+    size_t hash_len;
+    timestamp_t start, end;
+    NoiseHashState *hash;
+    int count;
+    double elapsed;
+
+    if (noise_hashstate_new_by_id(&hash, id) != NOISE_ERROR_NONE)
+        return;
+    hash_len = noise_hashstate_get_hash_length(hash);
+    noise_hashstate_free(hash);
+
+    memset(data, 0xAA, sizeof(data));
+    for (count = 0; count < HASH_MANY_COUNT; ++count) {
+        inputs[count] = data[count];
+        input_lens[count] = HASH_MANY_SIZE;
+        outputs[count] = hashes[count];
+    }
+
+    /* Report MB/sec like perf_hash() so that the lines can be compared */
+    start = begin_timing();
+    for (count = 0; count < (MB_COUNT * HASH_MANY_PER_MB); ++count) {
+        noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                  hash_len, HASH_MANY_COUNT);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)MB_COUNT;
+    snprintf(name, sizeof(name), "%s many",
+             noise_id_to_name(NOISE_HASH_CATEGORY, id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(MB_BYTES, "B");
+}
+
+/* Size of each update for the large input hash test */
+#define HASH_LARGE_SIZE (4 * 1024 * 1024)
+
+/* Measure the performance of hashing large inputs in a single update,
+   which lets tree hashes like BLAKE3 hash many chunks in parallel */
+static void perf_hash_large(int id)
+{
+    char name[64];
+    NoiseHashState *hash;
+    uint8_t *data;
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+
+    if (noise_hashstate_new_by_id(&hash, id) != NOISE_ERROR_NONE)
+        return;
+    data = (uint8_t *)malloc(HASH_LARGE_SIZE);
+    if (!data) {
+        noise_hashstate_free(hash);
+        return;
+    }
+
+    memset(data, 0xAA, HASH_LARGE_SIZE);
+    noise_hashstate_reset(hash);
+    start = begin_timing();
+    for (count = 0; count < (MB_COUNT * 1024 * 1024 / HASH_LARGE_SIZE); ++count)
+        noise_hashstate_update(hash, data, HASH_LARGE_SIZE);
+    end = end_timing();
 
+    elapsed = elapsed_to_seconds(start, end) / (double)MB_COUNT;
+    snprintf(name, sizeof(name), "%s 4M",
+             noise_id_to_name(NOISE_HASH_CATEGORY, id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(MB_BYTES, "B");
+
+    free(data);
     noise_hashstate_free(hash);
 }
 
@@ -163,21 +388,156 @@ static void perf_cipher(int id)
 
     memset(data, 0xAA, sizeof(data));
     noise_cipherstate_init_key(cipher, key, sizeof(key));
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < (MB_COUNT * BLOCKS_PER_MB); ++count) {
         noise_buffer_set_inout(mbuf, data, sizeof(data) - 16, sizeof(data));
         noise_cipherstate_encrypt_with_ad(cipher, ad, sizeof(ad), &mbuf);
     }
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)MB_COUNT;
     printf("%-20s%8.2f          %8.2f\n",
            noise_id_to_name(NOISE_CIPHER_CATEGORY, id),
            1.0 / elapsed, units / elapsed);
+    report_counters(MB_BYTES, "B");
 
     noise_cipherstate_free(cipher);
 }
 
+/* Measure the performance of encrypt_and_hash on large handshake payloads */
+static void perf_encrypt_and_hash(const char *protocol)
+{
+    static uint8_t const key[32] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+        0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20
+    };
+    char name[64];
+    NoiseSymmetricState *symmetric;
+    NoiseProtocolId id;
+    uint8_t data[PAYLOAD_SIZE + 16];
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+    NoiseBuffer mbuf;
+
+    if (noise_symmetricstate_new_by_name(&symmetric, protocol)
+            != NOISE_ERROR_NONE)
+        return;
+    noise_protocol_name_to_id(&id, protocol, strlen(protocol));
+
+    memset(data, 0xAA, sizeof(data));
+    noise_symmetricstate_mix_key(symmetric, key, sizeof(key));
+    start = begin_timing();
+    for (count = 0; count < PAYLOAD_COUNT; ++count) {
+        noise_buffer_set_inout(mbuf, data, PAYLOAD_SIZE, sizeof(data));
+        noise_symmetricstate_encrypt_and_hash(symmetric, &mbuf);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) /
+              ((double)PAYLOAD_COUNT * PAYLOAD_SIZE / (1024.0 * 1024.0));
+    snprintf(name, sizeof(name), "%s+%s",
+             noise_id_to_name(NOISE_CIPHER_CATEGORY, id.cipher_id),
+             noise_id_to_name(NOISE_HASH_CATEGORY, id.hash_id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters((double)PAYLOAD_COUNT * PAYLOAD_SIZE, "B");
+
+    noise_symmetricstate_free(symmetric);
+}
+
+/* Measure the send latency for small packets, optionally precomputing
+   the keystream outside of the timed region */
+static void perf_cipher_small(int id, int lookahead)
+{
+    static uint8_t const key[32] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+        0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20
+    };
+    char name[64];
+    NoiseCipherState *cipher;
+    uint8_t data[SMALL_SIZE + 16];
+    timestamp_t start, end;
+    timestamp_t total = 0;
+    size_t index;
+    int count;
+    double elapsed;
+    NoiseBuffer mbuf;
+
+    if (noise_cipherstate_new_by_id(&cipher, id) != NOISE_ERROR_NONE)
+        return;
+    if (lookahead &&
+            noise_cipherstate_set_lookahead(cipher, SMALL_BATCH)
+                != NOISE_ERROR_NONE) {
+        noise_cipherstate_free(cipher);
+        return;
+    }
+
+    memset(data, 0xAA, sizeof(data));
+    noise_cipherstate_init_key(cipher, key, sizeof(key));
+    for (count = 0; count < SMALL_COUNT; count += SMALL_BATCH) {
+        noise_cipherstate_precompute(cipher);
+        start = begin_timing();
+        for (index = 0; index < SMALL_BATCH; ++index) {
+            noise_buffer_set_inout(mbuf, data, SMALL_SIZE, sizeof(data));
+            noise_cipherstate_encrypt(cipher, &mbuf);
+        }
+        end = end_timing();
+        total += end - start;
+    }
+
+    elapsed = elapsed_to_seconds(0, total) / (double)SMALL_COUNT;
+    snprintf(name, sizeof(name), "%s %s",
+             noise_id_to_name(NOISE_CIPHER_CATEGORY, id),
+             lookahead ? "ahead" : "send");
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(SMALL_COUNT, "pkt");
+
+    noise_cipherstate_free(cipher);
+}
+
+/* Number of HKDF operations to perform */
+#define HKDF_COUNT 100000
+
+/* Measure the performance of HKDF with a hash primitive, which is
+   dominated by the per-call overhead of the hash on short inputs */
+static void perf_hkdf(int id)
+{
+    char name[64];
+    NoiseHashState *hash;
+    uint8_t ck[64];
+    uint8_t ikm[32];
+    uint8_t k[64];
+    size_t hash_len;
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+
+    if (noise_hashstate_new_by_id(&hash, id) != NOISE_ERROR_NONE)
+        return;
+
+    hash_len = noise_hashstate_get_hash_length(hash);
+    memset(ck, 0xAA, sizeof(ck));
+    memset(ikm, 0x55, sizeof(ikm));
+    start = begin_timing();
+    for (count = 0; count < HKDF_COUNT; ++count) {
+        noise_hashstate_hkdf(hash, ck, hash_len, ikm, sizeof(ikm),
+                             ck, hash_len, k, hash_len);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)HKDF_COUNT;
+    snprintf(name, sizeof(name), "HKDF %s",
+             noise_id_to_name(NOISE_HASH_CATEGORY, id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(HKDF_COUNT, "op");
+
+    noise_hashstate_free(hash);
+}
+
 /* Measure the performance of a DH primitive when deriving keys */
 static void perf_dh_derive(int id)
 {
@@ -194,15 +554,16 @@ static void perf_dh_derive(int id)
     key_len = noise_dhstate_get_private_key_length(dh);
 
     memset(private_key, 0xAA, sizeof(private_key));
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < DH_COUNT; ++count)
         noise_dhstate_set_keypair_private(dh, private_key, key_len);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)DH_COUNT;
     snprintf(name, sizeof(name), "%s derive key",
              noise_id_to_name(NOISE_DH_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(DH_COUNT, "op");
 
     noise_dhstate_free(dh);
 }
@@ -231,15 +592,16 @@ static void perf_dh_calculate(int id)
     noise_dhstate_set_keypair_private(dh1, private_key1, key_len);
     noise_dhstate_set_keypair_private(dh2, private_key2, key_len);
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < DH_COUNT; ++count)
         noise_dhstate_calculate(dh1, dh2, shared_key, key_len);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)DH_COUNT;
     snprintf(name, sizeof(name), "%s calculate",
              noise_id_to_name(NOISE_DH_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(DH_COUNT, "op");
 
     noise_dhstate_free(dh1);
     noise_dhstate_free(dh2);
@@ -263,35 +625,38 @@ static void perf_dh_ephemeral_only(int id)
         return;
     }
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < PQ_DH_COUNT; ++count)
         noise_dhstate_generate_keypair(dh1);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)PQ_DH_COUNT;
     snprintf(name, sizeof(name), "%s generate",
              noise_id_to_name(NOISE_DH_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(PQ_DH_COUNT, "op");
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < PQ_DH_COUNT; ++count)
         noise_dhstate_generate_dependent_keypair(dh2, dh1);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)PQ_DH_COUNT;
     snprintf(name, sizeof(name), "%s sharedb",
              noise_id_to_name(NOISE_DH_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(PQ_DH_COUNT, "op");
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < PQ_DH_COUNT; ++count)
         noise_dhstate_calculate(dh1, dh2, shared_key, sizeof(shared_key));
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)PQ_DH_COUNT;
     snprintf(name, sizeof(name), "%s shareda",
              noise_id_to_name(NOISE_DH_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(PQ_DH_COUNT, "op");
 
     noise_dhstate_free(dh1);
     noise_dhstate_free(dh2);
@@ -313,15 +678,16 @@ static void perf_sign_derive(int id)
     key_len = noise_signstate_get_private_key_length(sign);
 
     memset(private_key, 0xAA, sizeof(private_key));
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < DH_COUNT; ++count)
         noise_signstate_set_keypair_private(sign, private_key, key_len);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)DH_COUNT;
     snprintf(name, sizeof(name), "%s derive key",
              noise_id_to_name(NOISE_SIGN_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(DH_COUNT, "op");
 
     noise_signstate_free(sign);
 }
@@ -348,15 +714,66 @@ static void perf_sign_sign(int id)
     noise_signstate_set_keypair_private(sign, private_key, key_len);
     memset(message, 0x66, sizeof(message));
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < DH_COUNT; ++count)
         noise_signstate_sign(sign, message, sizeof(message), sig, sig_len);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)DH_COUNT;
     snprintf(name, sizeof(name), "%s sign",
              noise_id_to_name(NOISE_SIGN_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(DH_COUNT, "op");
+
+    noise_signstate_free(sign);
+}
+
+/* Number of messages to pass to each batch signing call */
+#define SIGN_BATCH 64
+
+/* Measure the performance of a signing primitive when signing in batches */
+static void perf_sign_batch(int id)
+{
+    char name[64];
+    NoiseSignState *sign;
+    uint8_t private_key[56];
+    uint8_t message[32];
+    static uint8_t sigs[SIGN_BATCH][56 * 2];
+    const uint8_t *msg_ptrs[SIGN_BATCH];
+    size_t msg_lens[SIGN_BATCH];
+    uint8_t *sig_ptrs[SIGN_BATCH];
+    size_t key_len;
+    size_t sig_len;
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+
+    if (noise_signstate_new_by_id(&sign, id) != NOISE_ERROR_NONE)
+        return;
+    key_len = noise_signstate_get_private_key_length(sign);
+    sig_len = noise_signstate_get_signature_length(sign);
+    memset(private_key, 0xAA, sizeof(private_key));
+    noise_signstate_set_keypair_private(sign, private_key, key_len);
+    memset(message, 0x66, sizeof(message));
+    for (count = 0; count < SIGN_BATCH; ++count) {
+        msg_ptrs[count] = message;
+        msg_lens[count] = sizeof(message);
+        sig_ptrs[count] = sigs[count];
+    }
+
+    start = begin_timing();
+    for (count = 0; count < DH_COUNT; count += SIGN_BATCH) {
+        noise_signstate_sign_batch
+            (sign, msg_ptrs, msg_lens, sig_ptrs, sig_len, SIGN_BATCH);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) /
+              (double)(((DH_COUNT + SIGN_BATCH - 1) / SIGN_BATCH) * SIGN_BATCH);
+    snprintf(name, sizeof(name), "%s batch",
+             noise_id_to_name(NOISE_SIGN_CATEGORY, id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(((DH_COUNT + SIGN_BATCH - 1) / SIGN_BATCH) * SIGN_BATCH, "op");
 
     noise_signstate_free(sign);
 }
@@ -384,42 +801,747 @@ static void perf_sign_verify(int id)
     memset(message, 0x66, sizeof(message));
     noise_signstate_sign(sign, message, sizeof(message), sig, sig_len);
 
-    start = current_timestamp();
+    start = begin_timing();
     for (count = 0; count < DH_COUNT; ++count)
         noise_signstate_verify(sign, message, sizeof(message), sig, sig_len);
-    end = current_timestamp();
+    end = end_timing();
 
     elapsed = elapsed_to_seconds(start, end) / (double)DH_COUNT;
     snprintf(name, sizeof(name), "%s verify",
              noise_id_to_name(NOISE_SIGN_CATEGORY, id));
     printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(DH_COUNT, "op");
 
     noise_signstate_free(sign);
 }
 
+/* Load callback for the flood tests that always reports being under load */
+static int flood_under_load(void *user_data)
+{
+    (void)user_data;
+    return 1;
+}
+
+/* Measure the responder's cost per packet during a handshake flood */
+static void perf_flood(void)
+{
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder;
+    NoiseCookieState *cookie_init;
+    NoiseCookieState *cookie_resp;
+    NoiseProtocolId id;
+    NoiseDHState *dh;
+    NoiseBuffer mbuf;
+    NoiseBuffer rbuf;
+    uint8_t private_key[32];
+    uint8_t public_key[32];
+    uint8_t message[256];
+    uint8_t reply[NOISE_COOKIE_REPLY_LEN];
+    uint8_t source[6] = {192, 0, 2, 1, 0x10, 0x92};
+    size_t message_len;
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+
+    /* Create an initial handshake message from the initiator */
+    memset(private_key, 0xAA, sizeof(private_key));
+    if (noise_handshakestate_new_by_name
+            (&initiator, FLOOD_PROTOCOL, NOISE_ROLE_INITIATOR)
+                != NOISE_ERROR_NONE)
+        return;
+    dh = noise_handshakestate_get_local_keypair_dh(initiator);
+    noise_dhstate_set_keypair_private(dh, private_key, sizeof(private_key));
+    dh = noise_handshakestate_get_remote_public_key_dh(initiator);
+    noise_dhstate_set_keypair_private(dh, private_key, sizeof(private_key));
+    noise_dhstate_get_public_key(dh, public_key, sizeof(public_key));
+    noise_handshakestate_start(initiator);
+    noise_buffer_set_output(mbuf, message, sizeof(message));
+    noise_handshakestate_write_message(initiator, &mbuf, 0);
+    message_len = mbuf.size;
+    noise_handshakestate_free(initiator);
+
+    /* Cost of allocating a responder and reading every packet */
+    start = begin_timing();
+    for (count = 0; count < FLOOD_COUNT; ++count) {
+        noise_handshakestate_new_by_name
+            (&responder, FLOOD_PROTOCOL, NOISE_ROLE_RESPONDER);
+        dh = noise_handshakestate_get_local_keypair_dh(responder);
+        noise_dhstate_set_keypair_private
+            (dh, private_key, sizeof(private_key));
+        noise_handshakestate_start(responder);
+        noise_buffer_set_input(mbuf, message, message_len);
+        noise_handshakestate_read_message(responder, &mbuf, 0);
+        noise_handshakestate_free(responder);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)FLOOD_COUNT;
+    printf("%-20s%8.2f          %8.2f\n", "IK responder read",
+           1.0 / elapsed, units / elapsed);
+    report_counters(FLOOD_COUNT, "pkt");
+
+    /* Cost of checking the message structure before allocating */
+    noise_protocol_name_to_id(&id, FLOOD_PROTOCOL, strlen(FLOOD_PROTOCOL));
+    start = begin_timing();
+    for (count = 0; count < FLOOD_COUNT; ++count) {
+        noise_buffer_set_input(mbuf, message, message_len - 1);
+        noise_handshakestate_check_first_message(&id, &mbuf);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)FLOOD_COUNT;
+    printf("%-20s%8.2f          %8.2f\n", "IK precheck drop",
+           1.0 / elapsed, units / elapsed);
+    report_counters(FLOOD_COUNT, "pkt");
+
+    /* Add the MAC's to the message and set up the responder's cookies */
+    noise_cookiestate_new
+        (&cookie_init, NOISE_HASH_BLAKE2s, NOISE_ROLE_INITIATOR);
+    noise_cookiestate_new
+        (&cookie_resp, NOISE_HASH_BLAKE2s, NOISE_ROLE_RESPONDER);
+    noise_cookiestate_set_responder_key
+        (cookie_init, public_key, sizeof(public_key));
+    noise_cookiestate_set_responder_key
+        (cookie_resp, public_key, sizeof(public_key));
+    noise_cookiestate_set_load_callback(cookie_resp, flood_under_load, 0);
+    noise_buffer_set_inout(mbuf, message, message_len, sizeof(message));
+    noise_cookiestate_add_macs(cookie_init, &mbuf);
+    message_len = mbuf.size;
+
+    /* Cost of dropping packets with a bad "mac1" */
+    message[0] ^= 0x01;
+    start = begin_timing();
+    for (count = 0; count < FLOOD_COUNT; ++count) {
+        noise_buffer_set_input(mbuf, message, message_len);
+        noise_cookiestate_check_macs
+            (cookie_resp, &mbuf, source, sizeof(source));
+    }
+    end = end_timing();
+    message[0] ^= 0x01;
+
+    elapsed = elapsed_to_seconds(start, end) / (double)FLOOD_COUNT;
+    printf("%-20s%8.2f          %8.2f\n", "cookie mac1 drop",
+           1.0 / elapsed, units / elapsed);
+    report_counters(FLOOD_COUNT, "pkt");
+
+    /* Cost of answering packets with a cookie reply when under load */
+    start = begin_timing();
+    for (count = 0; count < FLOOD_COUNT; ++count) {
+        noise_buffer_set_input(mbuf, message, message_len);
+        if (noise_cookiestate_check_macs
+                (cookie_resp, &mbuf, source, sizeof(source))
+                    == NOISE_ERROR_COOKIE_REQUIRED) {
+            noise_buffer_set_output(rbuf, reply, sizeof(reply));
+            noise_cookiestate_write_reply
+                (cookie_resp, &mbuf, &rbuf, source, sizeof(source));
+        }
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)FLOOD_COUNT;
+    printf("%-20s%8.2f          %8.2f\n", "cookie reply",
+           1.0 / elapsed, units / elapsed);
+    report_counters(FLOOD_COUNT, "pkt");
+
+    noise_cookiestate_free(cookie_init);
+    noise_cookiestate_free(cookie_resp);
+}
+
+/* Measure the time for a complete hybrid forward secrecy handshake */
+static void perf_hybrid_handshake(const char *protocol, int concurrent)
+{
+    char name[64];
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder;
+    NoiseHandshakeState *send;
+    NoiseHandshakeState *recv;
+    NoiseProtocolId id;
+    NoiseBuffer mbuf;
+    uint8_t message[4096];
+    timestamp_t start, end;
+    int count;
+    double elapsed;
+
+    if (noise_protocol_name_to_id(&id, protocol, strlen(protocol))
+            != NOISE_ERROR_NONE)
+        return;
+
+    start = begin_timing();
+    for (count = 0; count < HFS_COUNT; ++count) {
+        if (noise_handshakestate_new_by_id
+                (&initiator, &id, NOISE_ROLE_INITIATOR) != NOISE_ERROR_NONE)
+            return;
+        if (noise_handshakestate_new_by_id
+                (&responder, &id, NOISE_ROLE_RESPONDER) != NOISE_ERROR_NONE) {
+            noise_handshakestate_free(initiator);
+            return;
+        }
+        if (concurrent) {
+            if (noise_handshakestate_set_concurrent_hybrid(initiator, 1)
+                    != NOISE_ERROR_NONE) {
+                /* Library was built without thread support */
+                noise_handshakestate_free(initiator);
+                noise_handshakestate_free(responder);
+                return;
+            }
+            noise_handshakestate_set_concurrent_hybrid(responder, 1);
+        }
+        noise_handshakestate_start(initiator);
+        noise_handshakestate_start(responder);
+        send = initiator;
+        recv = responder;
+        while (noise_handshakestate_get_action(send)
+                    == NOISE_ACTION_WRITE_MESSAGE) {
+            noise_buffer_set_output(mbuf, message, sizeof(message));
+            noise_handshakestate_write_message(send, &mbuf, 0);
+            noise_handshakestate_read_message(recv, &mbuf, 0);
+            if (send == initiator) {
+                send = responder;
+                recv = initiator;
+            } else {
+                send = initiator;
+                recv = responder;
+            }
+        }
+        noise_handshakestate_free(initiator);
+        noise_handshakestate_free(responder);
+    }
+    end = end_timing();
+
+    elapsed = elapsed_to_seconds(start, end) / (double)HFS_COUNT;
+    snprintf(name, sizeof(name), "%s %s",
+             noise_id_to_name(NOISE_DH_CATEGORY, id.dh_id),
+             concurrent ? "concurrent" : "serial");
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(HFS_COUNT, "hs");
+}
+
+/* Measures the cost of complete handshakes for a specific pattern */
+static void perf_handshake(const char *protocol)
+{
+    char name[64];
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder;
+    NoiseHandshakeState *send;
+    NoiseHandshakeState *recv;
+    NoiseDHState *initiator_key;
+    NoiseDHState *responder_key;
+    NoiseProtocolId id;
+    NoiseBuffer mbuf;
+    uint8_t message[4096];
+    timestamp_t start, end;
+    int count;
+    int ok = 1;
+    double elapsed;
+
+    if (noise_protocol_name_to_id(&id, protocol, strlen(protocol))
+            != NOISE_ERROR_NONE)
+        return;
+    initiator_key = handshake_keypair(id.dh_id);
+    responder_key = handshake_keypair(id.dh_id);
+    if (!initiator_key || !responder_key) {
+        noise_dhstate_free(initiator_key);
+        noise_dhstate_free(responder_key);
+        return;
+    }
+
+    start = begin_timing();
+    for (count = 0; ok && count < HANDSHAKE_COUNT; ++count) {
+        if (noise_handshakestate_new_by_id
+                (&initiator, &id, NOISE_ROLE_INITIATOR) != NOISE_ERROR_NONE) {
+            ok = 0;
+            break;
+        }
+        if (noise_handshakestate_new_by_id
+                (&responder, &id, NOISE_ROLE_RESPONDER) != NOISE_ERROR_NONE) {
+            noise_handshakestate_free(initiator);
+            ok = 0;
+            break;
+        }
+        if (handshake_setup_keys(initiator, initiator_key, responder_key)
+                    != NOISE_ERROR_NONE ||
+                handshake_setup_keys(responder, responder_key, initiator_key)
+                    != NOISE_ERROR_NONE ||
+                noise_handshakestate_start(initiator) != NOISE_ERROR_NONE ||
+                noise_handshakestate_start(responder) != NOISE_ERROR_NONE)
+            ok = 0;
+        send = initiator;
+        recv = responder;
+        while (ok && noise_handshakestate_get_action(send)
+                    == NOISE_ACTION_WRITE_MESSAGE) {
+            noise_buffer_set_output(mbuf, message, sizeof(message));
+            if (noise_handshakestate_write_message(send, &mbuf, 0)
+                        != NOISE_ERROR_NONE ||
+                    noise_handshakestate_read_message(recv, &mbuf, 0)
+                        != NOISE_ERROR_NONE)
+                ok = 0;
+            if (send == initiator) {
+                send = responder;
+                recv = initiator;
+            } else {
+                send = initiator;
+                recv = responder;
+            }
+        }
+        if (noise_handshakestate_get_action(initiator) != NOISE_ACTION_SPLIT)
+            ok = 0;
+        noise_handshakestate_free(initiator);
+        noise_handshakestate_free(responder);
+    }
+    end = end_timing();
+    noise_dhstate_free(initiator_key);
+    noise_dhstate_free(responder_key);
+    if (!ok) {
+        printf("%-20s  failed\n", protocol);
+        return;
+    }
+
+    elapsed = elapsed_to_seconds(start, end) / (double)HANDSHAKE_COUNT;
+    snprintf(name, sizeof(name), "%s %s",
+             noise_id_to_name(NOISE_PATTERN_CATEGORY, id.pattern_id),
+             noise_id_to_name(NOISE_DH_CATEGORY, id.dh_id));
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(HANDSHAKE_COUNT, "hs");
+}
+
+/* Number of certificates in the chain and number of keys in each
+   certificate for the keys library tests */
+static int chain_depth = 4;
+static int cert_keys = 2;
+
+/* Computes the hash that a certificate signature covers: the encoded
+   subject information followed by the signer's extra signed information */
+static int keys_signed_hash
+    (const Noise_SubjectInfo *subject, const Noise_ExtraSignedInfo *extra,
+     uint8_t *hash)
+{
+    static uint8_t buffer[KEYS_BUFSIZ];
+    NoiseProtobuf pbuf;
+    NoiseHashState *state;
+    uint8_t *data;
+    size_t size;
+    int err;
+
+    /* Protobufs are written back to front, so write the extra info first */
+    noise_protobuf_prepare_output(&pbuf, buffer, sizeof(buffer));
+    Noise_ExtraSignedInfo_write(&pbuf, 0, extra);
+    Noise_SubjectInfo_write(&pbuf, 0, subject);
+    err = noise_protobuf_finish_output(&pbuf, &data, &size);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    err = noise_hashstate_new_by_id(&state, NOISE_HASH_BLAKE2b);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    err = noise_hashstate_hash_one(state, data, size, hash, KEYS_HASH_LEN);
+    noise_hashstate_free(state);
+    return err;
+}
+
+/* Fills in a synthetic certificate with "cert_keys" keys that is
+   signed by "signer" */
+static int keys_make_certificate
+    (Noise_Certificate *cert, int index, NoiseSignState *signer)
+{
+    static const char role[] = "benchmark";
+    static const char hash_algorithm[] = "BLAKE2b";
+    static const char valid_from[] = "2016-01-01T00:00:00Z";
+    static const char valid_to[] = "2026-01-01T00:00:00Z";
+    char name[64];
+    uint8_t key[64];
+    uint8_t hash[KEYS_HASH_LEN];
+    Noise_SubjectInfo *subject;
+    Noise_PublicKeyInfo *key_info;
+    Noise_MetaInfo *meta;
+    Noise_Signature *sig;
+    Noise_ExtraSignedInfo *extra;
+    size_t key_len;
+    int key_index;
+    int err;
+
+    err = Noise_Certificate_set_version(cert, 1);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_Certificate_get_new_subject(cert, &subject);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    snprintf(name, sizeof(name), "user%d@example.com", index);
+    Noise_SubjectInfo_set_id(subject, name, strlen(name));
+    snprintf(name, sizeof(name), "User %d", index);
+    Noise_SubjectInfo_set_name(subject, name, strlen(name));
+    Noise_SubjectInfo_set_role(subject, role, sizeof(role) - 1);
+    for (key_index = 0; key_index < cert_keys; ++key_index) {
+        err = Noise_SubjectInfo_add_keys(subject, &key_info);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        noise_randstate_generate_simple(key, sizeof(key));
+        key_len = (key_index % 2) ? 56 : 32;
+        Noise_PublicKeyInfo_set_algorithm
+            (key_info, (key_index % 2) ? "448" : "25519",
+             (key_index % 2) ? 3 : 5);
+        Noise_PublicKeyInfo_set_key(key_info, key, key_len);
+        err = Noise_SubjectInfo_add_meta(subject, &meta);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        snprintf(name, sizeof(name), "Key-Usage-%d", key_index);
+        Noise_MetaInfo_set_name(meta, name, strlen(name));
+        Noise_MetaInfo_set_value(meta, role, sizeof(role) - 1);
+    }
+
+    /* Add a signature from the signer */
+    err = Noise_Certificate_add_signatures(cert, &sig);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_Signature_get_new_signing_key(sig, &key_info);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_Signature_get_new_extra_signed_info(sig, &extra);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    Noise_Signature_set_id(sig, "ca@example.com", 14);
+    Noise_Signature_set_name(sig, "Certificate Authority", 21);
+    key_len = noise_signstate_get_public_key_length(signer);
+    noise_signstate_get_public_key(signer, key, key_len);
+    Noise_PublicKeyInfo_set_algorithm(key_info, "Ed25519", 7);
+    Noise_PublicKeyInfo_set_key(key_info, key, key_len);
+    Noise_Signature_set_hash_algorithm
+        (sig, hash_algorithm, sizeof(hash_algorithm) - 1);
+    noise_randstate_generate_simple(key, 16);
+    Noise_ExtraSignedInfo_set_nonce(extra, key, 16);
+    Noise_ExtraSignedInfo_set_valid_from
+        (extra, valid_from, sizeof(valid_from) - 1);
+    Noise_ExtraSignedInfo_set_valid_to(extra, valid_to, sizeof(valid_to) - 1);
+    err = keys_signed_hash(subject, extra, hash);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    key_len = noise_signstate_get_signature_length(signer);
+    err = noise_signstate_sign(signer, hash, sizeof(hash), key, key_len);
+    if (err != NOISE_ERROR_NONE)
+        return err;
+    return Noise_Signature_set_signature(sig, key, key_len);
+}
+
+/* Verifies every signature on a certificate */
+static int keys_verify_certificate(const Noise_Certificate *cert)
+{
+    const Noise_Signature *sig;
+    const Noise_PublicKeyInfo *key_info;
+    NoiseSignState *verifier;
+    uint8_t hash[KEYS_HASH_LEN];
+    size_t index;
+    int err;
+
+    for (index = 0; index < Noise_Certificate_count_signatures(cert); ++index) {
+        sig = Noise_Certificate_get_at_signatures(cert, index);
+        key_info = Noise_Signature_get_signing_key(sig);
+        if (!key_info)
+            return NOISE_ERROR_INVALID_FORMAT;
+        err = keys_signed_hash
+            (Noise_Certificate_get_subject(cert),
+             Noise_Signature_get_extra_signed_info(sig), hash);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        err = noise_signstate_new_by_name
+            (&verifier, Noise_PublicKeyInfo_get_algorithm(key_info));
+        if (err != NOISE_ERROR_NONE)
+            return err;
+        err = noise_signstate_set_public_key
+            (verifier, Noise_PublicKeyInfo_get_key(key_info),
+             Noise_PublicKeyInfo_get_size_key(key_info));
+        if (err == NOISE_ERROR_NONE) {
+            err = noise_signstate_verify
+                (verifier, hash, sizeof(hash),
+                 Noise_Signature_get_signature(sig),
+                 Noise_Signature_get_size_signature(sig));
+        }
+        noise_signstate_free(verifier);
+        if (err != NOISE_ERROR_NONE)
+            return err;
+    }
+    return NOISE_ERROR_NONE;
+}
+
+/* Prints a keys library result, which is measured in operations */
+static void keys_report
+    (const char *name, timestamp_t start, timestamp_t end, int count)
+{
+    double elapsed = elapsed_to_seconds(start, end) / (double)count;
+    printf("%-20s%8.2f          %8.2f\n", name, 1.0 / elapsed, units / elapsed);
+    report_counters(count, "op");
+}
+
+/* Measures serializing and parsing certificates, loading certificate
+   chains, verifying certificate signatures, and loading private keys */
+static void perf_keys(void)
+{
+    static uint8_t buffer[KEYS_BUFSIZ];
+    static uint8_t output[KEYS_BUFSIZ];
+    static const char passphrase[] = "correct horse battery staple";
+    char name[64];
+    NoiseSignState *signer = 0;
+    Noise_CertificateChain *chain = 0;
+    Noise_Certificate *cert = 0;
+    Noise_Certificate *cert2;
+    Noise_PrivateKey *key = 0;
+    Noise_PrivateKeyInfo *key_info;
+    NoiseProtobuf pbuf;
+    uint8_t *cert_data = 0;
+    uint8_t *chain_data = 0;
+    uint8_t *key_data = 0;
+    size_t cert_size = 0;
+    size_t chain_size = 0;
+    size_t key_size = 0;
+    uint8_t *data;
+    size_t size;
+    uint8_t private_key[32];
+    timestamp_t start, end;
+    int count, index, err;
+
+    /* Generate the certificate chain that the tests operate on */
+    err = noise_signstate_new_by_id(&signer, NOISE_SIGN_ED25519);
+    if (err == NOISE_ERROR_NONE)
+        err = noise_signstate_generate_keypair(signer);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_CertificateChain_new(&chain);
+    for (index = 0; index < chain_depth && err == NOISE_ERROR_NONE; ++index) {
+        err = Noise_CertificateChain_add_certs(chain, &cert2);
+        if (err == NOISE_ERROR_NONE)
+            err = keys_make_certificate(cert2, index, signer);
+    }
+    if (err == NOISE_ERROR_NONE) {
+        cert = Noise_CertificateChain_get_at_certs(chain, 0);
+        noise_protobuf_prepare_output(&pbuf, buffer, sizeof(buffer));
+        err = noise_save_certificate_chain_to_buffer(chain, &pbuf);
+    }
+    if (err == NOISE_ERROR_NONE)
+        err = noise_protobuf_finish_output(&pbuf, &chain_data, &chain_size);
+    if (err == NOISE_ERROR_NONE) {
+        /* Keep a private copy because "buffer" is about to be reused */
+        cert_data = (uint8_t *)malloc(chain_size);
+        if (!cert_data) {
+            err = NOISE_ERROR_NO_MEMORY;
+        } else {
+            memcpy(cert_data, chain_data, chain_size);
+            chain_data = cert_data;
+            cert_data = 0;
+        }
+    }
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_output(&pbuf, buffer, sizeof(buffer));
+        err = noise_save_certificate_to_buffer(cert, &pbuf);
+    }
+    if (err == NOISE_ERROR_NONE)
+        err = noise_protobuf_finish_output(&pbuf, &cert_data, &cert_size);
+
+    /* Generate an encrypted private key */
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_PrivateKey_new(&key);
+    if (err == NOISE_ERROR_NONE)
+        err = Noise_PrivateKey_add_keys(key, &key_info);
+    if (err == NOISE_ERROR_NONE) {
+        noise_randstate_generate_simple(private_key, sizeof(private_key));
+        Noise_PrivateKey_set_id(key, "user0@example.com", 17);
+        Noise_PrivateKeyInfo_set_algorithm(key_info, "25519", 5);
+        Noise_PrivateKeyInfo_set_key
+            (key_info, private_key, sizeof(private_key));
+        key_data = (uint8_t *)malloc(KEYS_BUFSIZ);
+        if (!key_data)
+            err = NOISE_ERROR_NO_MEMORY;
+    }
+    if (err == NOISE_ERROR_NONE) {
+        noise_protobuf_prepare_output(&pbuf, key_data, KEYS_BUFSIZ);
+        err = noise_save_private_key_to_buffer
+            (key, &pbuf, passphrase, sizeof(passphrase) - 1,
+             "ChaChaPoly_BLAKE2b_PBKDF2");
+    }
+    if (err == NOISE_ERROR_NONE) {
+        err = noise_protobuf_finish_output(&pbuf, &data, &key_size);
+        if (err == NOISE_ERROR_NONE)
+            memmove(key_data, data, key_size);
+    }
+    Noise_PrivateKey_free(key);
+    key = 0;
+    if (err != NOISE_ERROR_NONE) {
+        printf("Could not generate the certificates: %d\n", err);
+        goto cleanup;
+    }
+    printf("Certificate size    %8lu bytes, %d keys\n",
+           (unsigned long)cert_size, cert_keys);
+    printf("Chain size          %8lu bytes, %d certificates\n",
+           (unsigned long)chain_size, chain_depth);
+
+    /* Measure writing a certificate to a buffer of known size */
+    start = begin_timing();
+    for (count = 0; count < KEYS_COUNT; ++count) {
+        noise_protobuf_prepare_output(&pbuf, output, sizeof(output));
+        Noise_Certificate_write(&pbuf, 0, cert);
+        noise_protobuf_finish_output(&pbuf, &data, &size);
+    }
+    end = end_timing();
+    keys_report("Cert write", start, end, KEYS_COUNT);
+
+    /* Measure the size of a certificate and then write it */
+    start = begin_timing();
+    for (count = 0; count < KEYS_COUNT; ++count) {
+        noise_protobuf_prepare_measure(&pbuf, sizeof(output));
+        Noise_Certificate_write(&pbuf, 0, cert);
+        noise_protobuf_finish_measure(&pbuf, &size);
+        noise_protobuf_prepare_output(&pbuf, output, size);
+        Noise_Certificate_write(&pbuf, 0, cert);
+        noise_protobuf_finish_output(&pbuf, &data, &size);
+    }
+    end = end_timing();
+    keys_report("Cert measure+write", start, end, KEYS_COUNT);
+
+    /* Measure parsing a certificate */
+    start = begin_timing();
+    for (count = 0; count < KEYS_COUNT; ++count) {
+        noise_protobuf_prepare_input(&pbuf, cert_data, cert_size);
+        Noise_Certificate_read(&pbuf, 0, &cert2);
+        Noise_Certificate_free(cert2);
+    }
+    end = end_timing();
+    keys_report("Cert read", start, end, KEYS_COUNT);
+
+    /* Measure loading a certificate chain */
+    start = begin_timing();
+    for (count = 0; count < KEYS_COUNT; ++count) {
+        Noise_CertificateChain *chain2 = 0;
+        noise_protobuf_prepare_input(&pbuf, chain_data, chain_size);
+        noise_load_certificate_chain_from_buffer(&chain2, &pbuf);
+        Noise_CertificateChain_free(chain2);
+    }
+    end = end_timing();
+    snprintf(name, sizeof(name), "Chain load x%d", chain_depth);
+    keys_report(name, start, end, KEYS_COUNT);
+
+    /* Measure verifying the signatures on a certificate */
+    if (keys_verify_certificate(cert) != NOISE_ERROR_NONE) {
+        printf("Cert verify           failed\n");
+    } else {
+        start = begin_timing();
+        for (count = 0; count < DH_COUNT; ++count)
+            keys_verify_certificate(cert);
+        end = end_timing();
+        keys_report("Cert verify", start, end, DH_COUNT);
+    }
+
+    /* Measure decrypting a private key, which is dominated by PBKDF2 */
+    start = begin_timing();
+    for (count = 0; count < PRIVKEY_COUNT; ++count) {
+        noise_protobuf_prepare_input(&pbuf, key_data, key_size);
+        err = noise_load_private_key_from_buffer
+            (&key, &pbuf, passphrase, sizeof(passphrase) - 1);
+        Noise_PrivateKey_free(key);
+        key = 0;
+        if (err != NOISE_ERROR_NONE)
+            break;
+    }
+    end = end_timing();
+    if (err != NOISE_ERROR_NONE)
+        printf("Private key load      failed\n");
+    else
+        keys_report("Private key load", start, end, PRIVKEY_COUNT);
+
+cleanup:
+    noise_signstate_free(signer);
+    Noise_CertificateChain_free(chain);
+    free(chain_data);
+    free(key_data);
+}
+
 int main(int argc, char *argv[])
 {
+    int index;
+
     if (noise_init() != NOISE_ERROR_NONE) {
         fprintf(stderr, "Noise initialization failed\n");
         return 1;
     }
 
+    /* Parse the command-line options */
+    for (index = 1; index < argc; ++index) {
+        if (!strcmp(argv[index], "--counters")) {
+            close_counters();
+            counters_enabled = open_counters();
+            if (!counters_enabled) {
+                fprintf(stderr, "%s: hardware performance counters are not "
+                                "available on this system\n", argv[0]);
+            }
+        } else if (!strcmp(argv[index], "--chain-depth") &&
+                   (index + 1) < argc && atoi(argv[index + 1]) > 0) {
+            chain_depth = atoi(argv[++index]);
+        } else if (!strcmp(argv[index], "--cert-keys") &&
+                   (index + 1) < argc && atoi(argv[index + 1]) > 0) {
+            cert_keys = atoi(argv[++index]);
+        } else {
+            fprintf(stderr, "Usage: %s [--counters] [--chain-depth N] "
+                            "[--cert-keys N]\n", argv[0]);
+            close_counters();
+            return 1;
+        }
+    }
+
+#if NOISE_FIXED_SUITE
+    /* Label the output so that the two build modes can be compared */
+    printf("Fixed suite: 25519_ChaChaPoly_BLAKE2s\n\n");
+#endif
+
     /* Print the header */
     printf("Algorithm             MB/sec         MD5 units\n");
 
     /* Calibrate the performance measurements */
     calibrate_md5();
     printf("%-20s%8.2f          %8.2f\n", "MD5 calibration", 1.0 / units, 1.0);
+    report_counters(MB_BYTES, "B");
 
     /* Measure the performance of the hashing primitives */
     perf_hash(NOISE_HASH_BLAKE2s);
     perf_hash(NOISE_HASH_BLAKE2b);
     perf_hash(NOISE_HASH_SHA256);
     perf_hash(NOISE_HASH_SHA512);
+#if NOISE_USE_BLAKE3
+    perf_hash(NOISE_HASH_BLAKE3);
+#endif
+    perf_hash_many(NOISE_HASH_BLAKE2s);
+    perf_hash_many(NOISE_HASH_BLAKE2b);
+    perf_hash_many(NOISE_HASH_SHA256);
+    perf_hash_many(NOISE_HASH_SHA512);
+    perf_hash_large(NOISE_HASH_BLAKE2s);
+#if NOISE_USE_BLAKE3
+    perf_hash_large(NOISE_HASH_BLAKE3);
+#endif
 
     /* Measure the performance of the AEAD primitives */
     perf_cipher(NOISE_CIPHER_CHACHAPOLY);
     perf_cipher(NOISE_CIPHER_AESGCM);
+#if NOISE_USE_AEGIS256
+    perf_cipher(NOISE_CIPHER_AEGIS256);
+#endif
+
+    /* Measure the performance of encrypting large handshake payloads */
+    printf("\n");
+    printf("encrypt_and_hash      MB/sec         MD5 units\n");
+    perf_encrypt_and_hash("Noise_XX_25519_ChaChaPoly_BLAKE2s");
+    perf_encrypt_and_hash("Noise_XX_25519_ChaChaPoly_BLAKE2b");
+    perf_encrypt_and_hash("Noise_XX_25519_ChaChaPoly_SHA256");
+    perf_encrypt_and_hash("Noise_XX_25519_ChaChaPoly_SHA512");
+    perf_encrypt_and_hash("Noise_XX_25519_AESGCM_BLAKE2s");
+    perf_encrypt_and_hash("Noise_XX_25519_AESGCM_SHA256");
+
+    /* Measure the latency of sending small packets */
+    printf("\n");
+    printf("64-byte packets     pkts/sec         MD5 units\n");
+    perf_cipher_small(NOISE_CIPHER_CHACHAPOLY, 0);
+    perf_cipher_small(NOISE_CIPHER_CHACHAPOLY, 1);
+    perf_cipher_small(NOISE_CIPHER_AESGCM, 0);
+#if NOISE_USE_AEGIS256
+    perf_cipher_small(NOISE_CIPHER_AEGIS256, 0);
+#endif
+
+    /* Measure the cost of the key derivations in mix_key() and split() */
+    printf("\n");
+    printf("Key derivation       ops/sec         MD5 units\n");
+    perf_hkdf(NOISE_HASH_BLAKE2s);
+    perf_hkdf(NOISE_HASH_BLAKE2b);
+    perf_hkdf(NOISE_HASH_SHA256);
+    perf_hkdf(NOISE_HASH_SHA512);
 
     /* Measure the performance of the DH primitives */
     printf("\n");
@@ -433,8 +1555,40 @@ int main(int argc, char *argv[])
     /* Measure the performance of the signing primitives */
     perf_sign_derive(NOISE_SIGN_ED25519);
     perf_sign_sign(NOISE_SIGN_ED25519);
+    perf_sign_batch(NOISE_SIGN_ED25519);
     perf_sign_verify(NOISE_SIGN_ED25519);
 
+    /* Measure the responder's cost per packet during a handshake flood */
+    printf("\n");
+    printf("Handshake flood     pkts/sec         MD5 units\n");
+    perf_flood();
+
+    /* Measure the latency of hybrid forward secrecy handshakes */
+    printf("\n");
+    printf("NNhfs handshake     hs/sec           MD5 units\n");
+    perf_hybrid_handshake("Noise_NNhfs_25519+NewHope_ChaChaPoly_BLAKE2s", 0);
+    perf_hybrid_handshake("Noise_NNhfs_25519+NewHope_ChaChaPoly_BLAKE2s", 1);
+    perf_hybrid_handshake("Noise_NNhfs_448+NewHope_ChaChaPoly_BLAKE2b", 0);
+    perf_hybrid_handshake("Noise_NNhfs_448+NewHope_ChaChaPoly_BLAKE2b", 1);
+
+    /* Measure the cost of complete handshakes for each common pattern */
+    printf("\n");
+    printf("Handshake pattern   hs/sec           MD5 units\n");
+    perf_handshake("Noise_N_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_NN_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_NK_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_XX_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_XK_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_IK_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_IX_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_KK_25519_ChaChaPoly_BLAKE2s");
+
+    /* Measure loading and parsing certificates and private keys */
+    printf("\n");
+    printf("Keys library        ops/sec          MD5 units\n");
+    perf_keys();
+
     /* Done */
+    close_counters();
     return 0;
 }
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Measures the wall-clock throughput of encrypting a long stream of
+ * records for a single session, comparing a plain CipherState loop
+ * against a StreamState with different numbers of worker threads.
+ * The speedup is bounded by the number of CPU cores in the machine.
+ *
+ * It then measures sending a large file from tmpfs to a socket, where a
+ * child process discards the data, comparing a read/encrypt/write loop
+ * against noise_streamstate_send_file().
+ */
+
+#include <noise/protocol.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+/* Number of records to encrypt in each test */
+#define RECORD_COUNT    8192
+
+/* Size of the plaintext in each record */
+#define RECORD_SIZE     16384
+
+/* Length of the MAC on each record */
+#define MAC_LEN         16
+
+/* Number of times to repeat each measurement, keeping the best result */
+#define REPEATS         3
+
+/* Size of the file to send in the file tests */
+#define FILE_SIZE       (128 * 1024 * 1024)
+
+static uint8_t const key[32] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f
+};
+
+static uint8_t input[RECORD_SIZE];
+static uint8_t output[NOISE_STREAM_MAX_PENDING][RECORD_SIZE + MAC_LEN];
+
+static double wall_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static NoiseCipherState *new_cipher(int id)
+{
+    NoiseCipherState *cipher;
+    if (noise_cipherstate_new_by_id(&cipher, id) != NOISE_ERROR_NONE)
+        return 0;
+    noise_cipherstate_init_key(cipher, key, sizeof(key));
+    return cipher;
+}
+
+/* Encrypts the records one after the other on the calling thread,
+   copying each one to its output slot like the writer would */
+static double perf_serial(int id)
+{
+    NoiseCipherState *cipher = new_cipher(id);
+    NoiseBuffer mbuf;
+    uint8_t *record;
+    double start;
+    double elapsed;
+    int count;
+    if (!cipher)
+        return -1;
+    start = wall_seconds();
+    for (count = 0; count < RECORD_COUNT; ++count) {
+        record = output[count % NOISE_STREAM_MAX_PENDING];
+        memcpy(record, input, RECORD_SIZE);
+        noise_buffer_set_inout(mbuf, record, RECORD_SIZE,
+                               RECORD_SIZE + MAC_LEN);
+        if (noise_cipherstate_encrypt(cipher, &mbuf) != NOISE_ERROR_NONE) {
+            noise_cipherstate_free(cipher);
+            return -1;
+        }
+    }
+    elapsed = wall_seconds() - start;
+    noise_cipherstate_free(cipher);
+    return elapsed;
+}
+
+/* Encrypts the records with a StreamState, keeping the ring full */
+static double perf_stream(int id, size_t threads)
+{
+    NoiseCipherState *cipher = new_cipher(id);
+    NoiseStreamState *stream;
+    NoiseBuffer mbuf;
+    double start;
+    double elapsed = -1;
+    int submitted = 0;
+    int collected = 0;
+    if (!cipher)
+        return -1;
+    if (noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                              threads) != NOISE_ERROR_NONE) {
+        noise_cipherstate_free(cipher);
+        return -1;
+    }
+    start = wall_seconds();
+    while (collected < RECORD_COUNT) {
+        while (submitted < RECORD_COUNT &&
+                    noise_streamstate_get_pending(stream) <
+                        NOISE_STREAM_MAX_PENDING) {
+            if (noise_streamstate_submit
+                    (stream, input, RECORD_SIZE,
+                     output[submitted % NOISE_STREAM_MAX_PENDING],
+                     RECORD_SIZE + MAC_LEN) != NOISE_ERROR_NONE)
+                goto done;
+            ++submitted;
+        }
+        if (noise_streamstate_next(stream, &mbuf) != NOISE_ERROR_NONE ||
+                mbuf.size != RECORD_SIZE + MAC_LEN)
+            goto done;
+        ++collected;
+    }
+    elapsed = wall_seconds() - start;
+done:
+    noise_streamstate_free(stream);
+    noise_cipherstate_free(cipher);
+    return elapsed;
+}
+
+static void report(const char *name, double elapsed, double serial)
+{
+    double mbytes = (double)RECORD_COUNT * RECORD_SIZE / (1024.0 * 1024.0);
+    if (elapsed <= 0) {
+        printf("%-24s  failed\n", name);
+        return;
+    }
+    printf("%-24s%10.1f%8.2f\n", name, mbytes / elapsed, serial / elapsed);
+}
+
+static void perf_cipher(int id)
+{
+    static size_t const threads[] = {0, 1, 2, 4};
+    const char *cipher_name = noise_id_to_name(NOISE_CIPHER_CATEGORY, id);
+    char name[64];
+    double serial = 0;
+    double best;
+    double elapsed;
+    size_t index;
+    int repeat;
+
+    for (repeat = 0; repeat < REPEATS; ++repeat) {
+        elapsed = perf_serial(id);
+        if (repeat == 0 || (elapsed > 0 && elapsed < serial))
+            serial = elapsed;
+    }
+    snprintf(name, sizeof(name), "%s serial", cipher_name);
+    report(name, serial, serial);
+
+    for (index = 0; index < sizeof(threads) / sizeof(threads[0]); ++index) {
+        best = 0;
+        for (repeat = 0; repeat < REPEATS; ++repeat) {
+            elapsed = perf_stream(id, threads[index]);
+            if (repeat == 0 || (elapsed > 0 && elapsed < best))
+                best = elapsed;
+        }
+        snprintf(name, sizeof(name), "%s %u threads",
+                 cipher_name, (unsigned)(threads[index]));
+        report(name, best, serial);
+    }
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+
+/* Creates a socket whose data is read and discarded by a child process */
+static int start_sink(pid_t *pid)
+{
+    static uint8_t discard[65536];
+    int size = 4 * 1024 * 1024;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    *pid = fork();
+    if (*pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (*pid == 0) {
+        close(fds[0]);
+        while (read(fds[1], discard, sizeof(discard)) > 0)
+            ;
+        _exit(0);
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+static void stop_sink(int sock, pid_t pid)
+{
+    close(sock);
+    waitpid(pid, 0, 0);
+}
+
+/* Sends the file the obvious way: read a record, encrypt it in place,
+   and write it, one after the other */
+static double perf_file_naive(int id, int fd)
+{
+    static uint8_t message[NOISE_MAX_PAYLOAD_LEN + 2];
+    NoiseCipherState *cipher = new_cipher(id);
+    NoiseBuffer mbuf;
+    double start;
+    double elapsed = -1;
+    ssize_t len;
+    pid_t pid;
+    int sock;
+    if (!cipher)
+        return -1;
+    sock = start_sink(&pid);
+    if (sock < 0) {
+        noise_cipherstate_free(cipher);
+        return -1;
+    }
+    start = wall_seconds();
+    lseek(fd, 0, SEEK_SET);
+    while ((len = read(fd, message + 2,
+                       NOISE_MAX_PAYLOAD_LEN - MAC_LEN)) > 0) {
+        noise_buffer_set_inout(mbuf, message + 2, (size_t)len,
+                               NOISE_MAX_PAYLOAD_LEN);
+        if (noise_cipherstate_encrypt(cipher, &mbuf) != NOISE_ERROR_NONE)
+            goto done;
+        message[0] = (uint8_t)(mbuf.size >> 8);
+        message[1] = (uint8_t)mbuf.size;
+        if (write(sock, message, mbuf.size + 2) != (ssize_t)(mbuf.size + 2))
+            goto done;
+    }
+    if (len == 0)
+        elapsed = wall_seconds() - start;
+done:
+    stop_sink(sock, pid);
+    noise_cipherstate_free(cipher);
+    return elapsed;
+}
+
+/* Sends the file with noise_streamstate_send_file() */
+static double perf_file_stream(int id, int fd, size_t threads)
+{
+    NoiseCipherState *cipher = new_cipher(id);
+    NoiseStreamState *stream;
+    double start;
+    double elapsed = -1;
+    pid_t pid;
+    int sock;
+    if (!cipher)
+        return -1;
+    if (noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                              threads) != NOISE_ERROR_NONE) {
+        noise_cipherstate_free(cipher);
+        return -1;
+    }
+    sock = start_sink(&pid);
+    if (sock >= 0) {
+        start = wall_seconds();
+        if (noise_streamstate_send_file(stream, sock, fd, 0, FILE_SIZE) ==
+                NOISE_ERROR_NONE)
+            elapsed = wall_seconds() - start;
+        stop_sink(sock, pid);
+    }
+    noise_streamstate_free(stream);
+    noise_cipherstate_free(cipher);
+    return elapsed;
+}
+
+/* Creates the file to send on tmpfs if possible */
+static int create_file(void)
+{
+    static uint8_t block[1024 * 1024];
+    char name[] = "/dev/shm/noise-stream-XXXXXX";
+    char tmp_name[] = "/tmp/noise-stream-XXXXXX";
+    size_t posn;
+    int fd;
+    fd = mkstemp(name);
+    if (fd >= 0) {
+        unlink(name);
+    } else {
+        fd = mkstemp(tmp_name);
+        if (fd < 0) {
+            perror("mkstemp");
+            return -1;
+        }
+        unlink(tmp_name);
+    }
+    for (posn = 0; posn < sizeof(block); ++posn)
+        block[posn] = (uint8_t)(posn * 7);
+    for (posn = 0; posn < FILE_SIZE; posn += sizeof(block)) {
+        if (write(fd, block, sizeof(block)) != (ssize_t)sizeof(block)) {
+            perror("write");
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void perf_file(int id, int fd)
+{
+    static size_t const threads[] = {0, 1, 2, 4};
+    const char *cipher_name = noise_id_to_name(NOISE_CIPHER_CATEGORY, id);
+    double mbytes = FILE_SIZE / (1024.0 * 1024.0);
+    char name[64];
+    double naive = 0;
+    double best;
+    double elapsed;
+    size_t index;
+    int repeat;
+
+    for (repeat = 0; repeat < REPEATS; ++repeat) {
+        elapsed = perf_file_naive(id, fd);
+        if (repeat == 0 || (elapsed > 0 && elapsed < naive))
+            naive = elapsed;
+    }
+    snprintf(name, sizeof(name), "%s naive loop", cipher_name);
+    if (naive > 0)
+        printf("%-24s%10.1f%8.2f\n", name, mbytes / naive, 1.0);
+    else
+        printf("%-24s  failed\n", name);
+
+    for (index = 0; index < sizeof(threads) / sizeof(threads[0]); ++index) {
+        best = 0;
+        for (repeat = 0; repeat < REPEATS; ++repeat) {
+            elapsed = perf_file_stream(id, fd, threads[index]);
+            if (repeat == 0 || (elapsed > 0 && elapsed < best))
+                best = elapsed;
+        }
+        snprintf(name, sizeof(name), "%s send_file %u",
+                 cipher_name, (unsigned)(threads[index]));
+        if (best > 0 && naive > 0)
+            printf("%-24s%10.1f%8.2f\n", name, mbytes / best, naive / best);
+        else
+            printf("%-24s  failed\n", name);
+    }
+}
+
+#endif
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s\n", argv[0]);
+        return 1;
+    }
+    if (noise_init() != NOISE_ERROR_NONE) {
+        fprintf(stderr, "Noise initialization failed\n");
+        return 1;
+    }
+
+    printf("%d records of %d bytes\n", RECORD_COUNT, RECORD_SIZE);
+    printf("Operation                     MB/s speedup\n");
+    perf_cipher(NOISE_CIPHER_CHACHAPOLY);
+    perf_cipher(NOISE_CIPHER_AESGCM);
+
+#if !defined(__WIN32__) && !defined(WIN32)
+    {
+        int fd = create_file();
+        if (fd < 0)
+            return 1;
+        signal(SIGPIPE, SIG_IGN);
+        printf("\nSending a %d MB file to a socket\n",
+               FILE_SIZE / (1024 * 1024));
+        printf("Operation                     MB/s speedup\n");
+        perf_file(NOISE_CIPHER_CHACHAPOLY, fd);
+        perf_file(NOISE_CIPHER_AESGCM, fd);
+        close(fd);
+    }
+#endif
+    return 0;
+}
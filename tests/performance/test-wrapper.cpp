@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compares the cost of the C++ wrappers in <noise/protocol.hpp> against
+ * the equivalent C calls.  Each test runs the same operations through
+ * both APIs and reports the time per operation and the ratio between
+ * them, which should be 1.00 within the noise of the measurement.
+ */
+
+#include <noise/protocol.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+/* Number of packets to encrypt and decrypt in each transport test */
+#define PACKET_COUNT    200000
+
+/* Size of the packet payloads, which is small to expose call overhead */
+#define PACKET_SIZE     64
+
+/* Number of handshakes to perform in each handshake test */
+#define HANDSHAKE_COUNT 500
+
+/* Number of times to repeat each measurement, keeping the best result */
+#define REPEATS         5
+
+typedef std::chrono::steady_clock perf_clock;
+
+static const uint8_t key[32] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f
+};
+
+/* Runs a test function several times and returns the best ns/op */
+template <typename Func>
+static double best_of(int count, Func func)
+{
+    double best = 0;
+    for (int repeat = 0; repeat < REPEATS; ++repeat) {
+        perf_clock::time_point start = perf_clock::now();
+        if (!func())
+            return -1;
+        perf_clock::time_point end = perf_clock::now();
+        double ns = std::chrono::duration<double, std::nano>
+            (end - start).count() / count;
+        if (repeat == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static void report(const char *name, double c_ns, double cxx_ns)
+{
+    if (c_ns < 0 || cxx_ns < 0) {
+        printf("%-28s  failed\n", name);
+        return;
+    }
+    printf("%-28s%10.1f%10.1f%10.2f\n", name, c_ns, cxx_ns, cxx_ns / c_ns);
+}
+
+/* Encrypts and decrypts small packets in place with the C API */
+static bool transport_c(int id)
+{
+    NoiseCipherState *send;
+    NoiseCipherState *recv;
+    uint8_t packet[PACKET_SIZE + 16];
+    NoiseBuffer mbuf;
+    bool ok = true;
+
+    if (noise_cipherstate_new_by_id(&send, id) != NOISE_ERROR_NONE)
+        return false;
+    if (noise_cipherstate_new_by_id(&recv, id) != NOISE_ERROR_NONE) {
+        noise_cipherstate_free(send);
+        return false;
+    }
+    noise_cipherstate_init_key(send, key, sizeof(key));
+    noise_cipherstate_init_key(recv, key, sizeof(key));
+    memset(packet, 0xAA, sizeof(packet));
+    for (int count = 0; count < PACKET_COUNT && ok; ++count) {
+        noise_buffer_set_inout(mbuf, packet, PACKET_SIZE, sizeof(packet));
+        ok = noise_cipherstate_encrypt(send, &mbuf) == NOISE_ERROR_NONE &&
+             noise_cipherstate_decrypt(recv, &mbuf) == NOISE_ERROR_NONE;
+    }
+    noise_cipherstate_free(send);
+    noise_cipherstate_free(recv);
+    return ok;
+}
+
+/* Encrypts and decrypts small packets in place with the C++ API */
+static bool transport_cxx(int id)
+{
+    std::error_code ec;
+    noise::cipher_state send = noise::cipher_state::by_id(id, ec);
+    if (ec)
+        return false;
+    noise::cipher_state recv = noise::cipher_state::by_id(id, ec);
+    if (ec)
+        return false;
+    send.init_key(key);
+    recv.init_key(key);
+    uint8_t packet[PACKET_SIZE + 16];
+    memset(packet, 0xAA, sizeof(packet));
+    for (int count = 0; count < PACKET_COUNT; ++count) {
+        size_t len = PACKET_SIZE;
+        if (send.encrypt(packet, len) || recv.decrypt(packet, len))
+            return false;
+    }
+    return true;
+}
+
+/* Runs a complete handshake between two parties with the C API */
+static bool handshake_c(const char *protocol)
+{
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder;
+    NoiseHandshakeState *writer;
+    NoiseHandshakeState *reader;
+    NoiseCipherState *c1;
+    NoiseCipherState *c2;
+    uint8_t message[NOISE_MAX_PAYLOAD_LEN];
+    NoiseBuffer mbuf;
+    bool ok = true;
+
+    if (noise_handshakestate_new_by_name
+            (&initiator, protocol, NOISE_ROLE_INITIATOR) != NOISE_ERROR_NONE)
+        return false;
+    if (noise_handshakestate_new_by_name
+            (&responder, protocol, NOISE_ROLE_RESPONDER) != NOISE_ERROR_NONE) {
+        noise_handshakestate_free(initiator);
+        return false;
+    }
+    ok = noise_handshakestate_start(initiator) == NOISE_ERROR_NONE &&
+         noise_handshakestate_start(responder) == NOISE_ERROR_NONE;
+    while (ok && noise_handshakestate_get_action(initiator) !=
+                     NOISE_ACTION_SPLIT) {
+        if (noise_handshakestate_get_action(initiator) ==
+                NOISE_ACTION_WRITE_MESSAGE) {
+            writer = initiator;
+            reader = responder;
+        } else {
+            writer = responder;
+            reader = initiator;
+        }
+        noise_buffer_set_output(mbuf, message, sizeof(message));
+        ok = noise_handshakestate_write_message(writer, &mbuf, NULL) ==
+                NOISE_ERROR_NONE &&
+             noise_handshakestate_read_message(reader, &mbuf, NULL) ==
+                NOISE_ERROR_NONE;
+    }
+    if (ok && noise_handshakestate_split(initiator, &c1, &c2) ==
+            NOISE_ERROR_NONE) {
+        noise_cipherstate_free(c1);
+        noise_cipherstate_free(c2);
+    } else {
+        ok = false;
+    }
+    noise_handshakestate_free(initiator);
+    noise_handshakestate_free(responder);
+    return ok;
+}
+
+/* Runs a complete handshake between two parties with the C++ API */
+static bool handshake_cxx(const char *protocol)
+{
+    std::error_code ec;
+    noise::handshake_state initiator =
+        noise::handshake_state::by_name(protocol, NOISE_ROLE_INITIATOR, ec);
+    if (ec)
+        return false;
+    noise::handshake_state responder =
+        noise::handshake_state::by_name(protocol, NOISE_ROLE_RESPONDER, ec);
+    if (ec || initiator.start() || responder.start())
+        return false;
+    uint8_t message[NOISE_MAX_PAYLOAD_LEN];
+    while (initiator.action() != NOISE_ACTION_SPLIT) {
+        bool init_writes = initiator.action() == NOISE_ACTION_WRITE_MESSAGE;
+        noise::handshake_state &writer = init_writes ? initiator : responder;
+        noise::handshake_state &reader = init_writes ? responder : initiator;
+        size_t len, payload_len;
+        if (writer.write_message(message, len) ||
+                reader.read_message(noise::bytes(message, len), {},
+                                    payload_len))
+            return false;
+    }
+    noise::cipher_state c1, c2;
+    return !initiator.split(c1, c2);
+}
+
+static void perf_transport(int id)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s %d-byte packet",
+             noise_id_to_name(NOISE_CIPHER_CATEGORY, id), PACKET_SIZE);
+    double c_ns = best_of(PACKET_COUNT, [id] { return transport_c(id); });
+    double cxx_ns = best_of(PACKET_COUNT, [id] { return transport_cxx(id); });
+    report(name, c_ns, cxx_ns);
+}
+
+static void perf_handshake(const char *protocol)
+{
+    auto run = [protocol](bool (*func)(const char *)) {
+        return best_of(HANDSHAKE_COUNT, [protocol, func] {
+            for (int count = 0; count < HANDSHAKE_COUNT; ++count) {
+                if (!func(protocol))
+                    return false;
+            }
+            return true;
+        });
+    };
+    double c_ns = run(handshake_c);
+    double cxx_ns = run(handshake_cxx);
+    report(protocol + 6, c_ns, cxx_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s\n", argv[0]);
+        return 1;
+    }
+    if (noise_init() != NOISE_ERROR_NONE) {
+        fprintf(stderr, "Noise initialization failed\n");
+        return 1;
+    }
+
+    printf("Operation                      C ns/op C++ ns/op     ratio\n");
+    perf_transport(NOISE_CIPHER_CHACHAPOLY);
+    perf_transport(NOISE_CIPHER_AESGCM);
+    perf_handshake("Noise_NN_25519_ChaChaPoly_BLAKE2s");
+    perf_handshake("Noise_NN_448_AESGCM_SHA512");
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "timing.h"
+#include <time.h>
+#if defined(__APPLE__)
+#include <sys/time.h>
+#endif
+#if defined(__WIN32__) || defined(WIN32)
+#include <windows.h>
+#endif
+
+#if defined(__WIN32__) || defined(WIN32)
+
+timestamp_t current_timestamp(void)
+{
+    return GetTickCount();
+}
+
+double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+{
+    return (end - start) / 1000.0;
+}
+
+#elif defined(__APPLE__)
+
+timestamp_t current_timestamp(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((uint64_t)(now.tv_sec)) * 1000000ULL + now.tv_usec;
+}
+
+double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+{
+    return (end - start) / 1000000.0;
+}
+
+#else
+
+timestamp_t current_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)(ts.tv_sec)) * 1000000000ULL + ts.tv_nsec;
+}
+
+double elapsed_to_seconds(timestamp_t start, timestamp_t end)
+{
+    return (end - start) / 1000000000.0;
+}
+
+#endif
@@ -21,6 +21,7 @@
  */
 
 #include "test-helpers.h"
+#include "protocol/internal.h"
 
 #define MAX_KEY_LEN 32
 #define MAX_AD_LEN 32
@@ -278,6 +279,287 @@ static void cipherstate_check_test_vectors(void)
          "0x00000000000000000000000000000000",
          "0xcea7403d4d606b6e074ec5d3baf39d18",
          "0xd0d1c8a799996bf0265b98b5d48ab919");
+
+#if NOISE_USE_AEGIS256
+    /* AEGIS256 - there are no published vectors that use the Noise nonce
+       format, so this was cross-checked against the vectors in
+       draft-irtf-cfrg-aegis-aead with both the AES-NI and bitsliced code */
+    check_cipher
+        (NOISE_CIPHER_AEGIS256, 32, 16, "AEGIS256",
+         "0x0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20",
+         0x0102030405060708,
+         "0x0001020304050607",
+         "0x404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+           "6061626364",
+         "0xbf899b7b2c5452224a576db518b3dd2dddddafc6971cff1c0655ea43a08db68e"
+           "4a00bc4a2b",
+         "0x0b9c33ca14d7dc7e251b4bc7162614f8");
+#endif
+}
+
+#if NOISE_USE_AEGIS256
+
+/* Check one of the raw AEGIS256 implementations against a published test
+   vector, and check that a bad tag leaves the ciphertext alone */
+static void check_aegis256_vector
+    (int aesni, const char *key, const char *nonce, const char *ad,
+     const char *plaintext, const char *ciphertext, const char *mac,
+     int valid)
+{
+    uint8_t k[32];
+    uint8_t n[32];
+    uint8_t a[MAX_AD_LEN + 16];
+    uint8_t pt[MAX_CIPHER_DATA];
+    uint8_t ct[MAX_CIPHER_DATA + MAX_MAC_LEN];
+    uint8_t buffer[MAX_CIPHER_DATA + MAX_MAC_LEN];
+    size_t ad_len;
+    size_t len;
+    int err;
+
+    compare(string_to_data(k, sizeof(k), key), 32);
+    compare(string_to_data(n, sizeof(n), nonce), 32);
+    ad_len = string_to_data(a, sizeof(a), ad);
+    len = string_to_data(ct, sizeof(ct), ciphertext);
+    compare(string_to_data(ct + len, MAX_MAC_LEN, mac), 16);
+
+    /* Decrypt the ciphertext */
+    memcpy(buffer, ct, len + 16);
+    err = noise_aegis256_decrypt_raw(aesni, k, n, a, ad_len, buffer, len);
+    if (err == NOISE_ERROR_NOT_APPLICABLE)
+        return;
+    if (!valid) {
+        compare(err, NOISE_ERROR_MAC_FAILURE);
+        compare_blocks(buffer, len + 16, ct, len + 16);
+        return;
+    }
+    compare(err, NOISE_ERROR_NONE);
+    compare(string_to_data(pt, sizeof(pt), plaintext), len);
+    compare_blocks(buffer, len, pt, len);
+
+    /* Encrypt the plaintext */
+    memcpy(buffer, pt, len);
+    compare(noise_aegis256_encrypt_raw(aesni, k, n, a, ad_len, buffer, len),
+            NOISE_ERROR_NONE);
+    compare_blocks(buffer, len + 16, ct, len + 16);
+
+    /* Corrupt the tag and the ciphertext in turn */
+    buffer[len] ^= 0x01;
+    compare(noise_aegis256_decrypt_raw(aesni, k, n, a, ad_len, buffer, len),
+            NOISE_ERROR_MAC_FAILURE);
+    buffer[len] ^= 0x01;
+    compare_blocks(buffer, len + 16, ct, len + 16);
+    if (len > 0) {
+        buffer[len - 1] ^= 0x80;
+        compare(noise_aegis256_decrypt_raw
+                    (aesni, k, n, a, ad_len, buffer, len),
+                NOISE_ERROR_MAC_FAILURE);
+        buffer[len - 1] ^= 0x80;
+        compare_blocks(buffer, len + 16, ct, len + 16);
+    }
+}
+
+/* Check both AEGIS256 implementations against the test vectors in
+   draft-irtf-cfrg-aegis-aead, appendix A.3, with the 128-bit tag.
+   The portable version is always checked, even on AES-NI machines */
+static void check_aegis256_vectors(int aesni)
+{
+    static char const key[] =
+        "0x1001000000000000000000000000000000000000000000000000000000000000";
+    static char const nonce[] =
+        "0x1000020000000000000000000000000000000000000000000000000000000000";
+
+    /* Test vectors 1 to 5 */
+    check_aegis256_vector
+        (aesni, key, nonce, "",
+         "0x00000000000000000000000000000000",
+         "0x754fc3d8c973246dcc6d741412a4b236",
+         "0x3fe91994768b332ed7f570a19ec5896e", 1);
+    check_aegis256_vector
+        (aesni, key, nonce, "", "", "",
+         "0xe3def978a0f054afd1e761d7553afba3", 1);
+    check_aegis256_vector
+        (aesni, key, nonce, "0x0001020304050607",
+         "0x000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+         "0xf373079ed84b2709faee373584585d60accd191db310ef5d8b11833df9dec711",
+         "0x8d86f91ee606e9ff26a01b64ccbdd91d", 1);
+    check_aegis256_vector
+        (aesni, key, nonce, "0x0001020304050607",
+         "0x000102030405060708090a0b0c0d",
+         "0xf373079ed84b2709faee37358458",
+         "0xc60b9c2d33ceb058f96e6dd03c215652", 1);
+    check_aegis256_vector
+        (aesni, key, nonce,
+         "0x000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+           "20212223242526272829",
+         "0x101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f"
+           "3031323334353637",
+         "0x57754a7d09963e7c787583a2e7b859bb24fa1e04d49fd550b2511a358e3bca25"
+           "2a9b1b8b30cc4a67",
+         "0xab8a7d53fd0e98d727accca94925e128", 1);
+
+    /* Test vectors 6 to 9, which must fail to decrypt */
+    check_aegis256_vector
+        (aesni, nonce, key, "0x0001020304050607", "",
+         "0xf373079ed84b2709faee37358458",
+         "0xc60b9c2d33ceb058f96e6dd03c215652", 0);
+    check_aegis256_vector
+        (aesni, key, nonce, "0x0001020304050607", "",
+         "0xf373079ed84b2709faee37358459",
+         "0xc60b9c2d33ceb058f96e6dd03c215652", 0);
+    check_aegis256_vector
+        (aesni, key, nonce, "0x0001020304050608", "",
+         "0xf373079ed84b2709faee37358458",
+         "0xc60b9c2d33ceb058f96e6dd03c215652", 0);
+    check_aegis256_vector
+        (aesni, key, nonce, "0x0001020304050607", "",
+         "0xf373079ed84b2709faee37358458",
+         "0xc60b9c2d33ceb058f96e6dd03c215653", 0);
+}
+
+/* Messages longer than the decryption scratch buffer take a different
+   path, so check that both implementations agree on them and that the
+   ciphertext survives a bad tag */
+static void check_aegis256_long(void)
+{
+    static uint8_t const key[32] = {1, 2, 3, 4};
+    static uint8_t const nonce[32] = {5, 6, 7, 8};
+    static uint8_t pt[5000];
+    static uint8_t ct[5000 + 16];
+    static uint8_t buffer[5000 + 16];
+    static size_t const lens[] = {2047, 2048, 2049, 4099, 5000};
+    size_t index, posn, len;
+    int aesni;
+
+    for (index = 0; index < sizeof(lens) / sizeof(lens[0]); ++index) {
+        len = lens[index];
+        for (posn = 0; posn < len; ++posn)
+            pt[posn] = (uint8_t)(posn * 13 + index);
+        memcpy(ct, pt, len);
+        compare(noise_aegis256_encrypt_raw(0, key, nonce, 0, 0, ct, len),
+                NOISE_ERROR_NONE);
+        for (aesni = 0; aesni < 2; ++aesni) {
+            memcpy(buffer, pt, len);
+            if (noise_aegis256_encrypt_raw
+                    (aesni, key, nonce, 0, 0, buffer, len) ==
+                        NOISE_ERROR_NOT_APPLICABLE)
+                continue;
+            compare_blocks(buffer, len + 16, ct, len + 16);
+            buffer[len / 3] ^= 0x04;
+            compare(noise_aegis256_decrypt_raw
+                        (aesni, key, nonce, 0, 0, buffer, len),
+                    NOISE_ERROR_MAC_FAILURE);
+            buffer[len / 3] ^= 0x04;
+            compare_blocks(buffer, len + 16, ct, len + 16);
+            compare(noise_aegis256_decrypt_raw
+                        (aesni, key, nonce, 0, 0, buffer, len),
+                    NOISE_ERROR_NONE);
+            compare_blocks(buffer, len, pt, len);
+        }
+    }
+}
+
+#endif
+
+/* Check that keystream lookahead produces the same packets as the
+   regular encryption path */
+static void check_lookahead(int id)
+{
+    static size_t const sizes[] = {0, 1, 63, 64, 65, 255, 256, 257, 500};
+    static uint8_t const key[32] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+        0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20
+    };
+    NoiseCipherState *plain;
+    NoiseCipherState *ahead;
+    NoiseCipherState *recv;
+    NoiseBuffer mbuf;
+    uint8_t buffer[MAX_CIPHER_DATA + MAX_MAC_LEN];
+    uint8_t expected[MAX_CIPHER_DATA + MAX_MAC_LEN];
+    size_t depth;
+    size_t index;
+    size_t len;
+
+    data_name = noise_id_to_name(NOISE_CIPHER_CATEGORY, id);
+    compare(noise_cipherstate_new_by_id(&plain, id), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_new_by_id(&ahead, id), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_new_by_id(&recv, id), NOISE_ERROR_NONE);
+
+    /* Back ends without lookahead support should say so */
+    depth = noise_cipherstate_get_max_lookahead(ahead);
+    if (!depth) {
+        compare(noise_cipherstate_set_lookahead(ahead, 1),
+                NOISE_ERROR_NOT_APPLICABLE);
+        noise_cipherstate_free(plain);
+        noise_cipherstate_free(ahead);
+        noise_cipherstate_free(recv);
+        return;
+    }
+    compare(noise_cipherstate_set_lookahead(ahead, depth + 1),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_cipherstate_set_lookahead(ahead, depth), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_set_lookahead(recv, depth), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_precompute(ahead), NOISE_ERROR_INVALID_STATE);
+
+    /* Set the same key on all objects */
+    compare(noise_cipherstate_init_key(plain, key, sizeof(key)),
+            NOISE_ERROR_NONE);
+    compare(noise_cipherstate_init_key(ahead, key, sizeof(key)),
+            NOISE_ERROR_NONE);
+    compare(noise_cipherstate_init_key(recv, key, sizeof(key)),
+            NOISE_ERROR_NONE);
+
+    /* Encrypt packets of various sizes, precomputing before some of them */
+    for (index = 0; index < 3 * sizeof(sizes) / sizeof(sizes[0]); ++index) {
+        len = sizes[index % (sizeof(sizes) / sizeof(sizes[0]))];
+        if ((index % 3) != 2) {
+            compare(noise_cipherstate_precompute(ahead), NOISE_ERROR_NONE);
+            compare(noise_cipherstate_precompute(recv), NOISE_ERROR_NONE);
+        }
+        if (index == 10) {
+            /* Skipping forward must not reuse stale keystream */
+            compare(noise_cipherstate_set_nonce(plain, 42), NOISE_ERROR_NONE);
+            compare(noise_cipherstate_set_nonce(ahead, 42), NOISE_ERROR_NONE);
+            compare(noise_cipherstate_set_nonce(recv, 42), NOISE_ERROR_NONE);
+            compare(noise_cipherstate_precompute(recv), NOISE_ERROR_NONE);
+        }
+        memset(expected, (int)index, len);
+        noise_buffer_set_inout(mbuf, expected, len, sizeof(expected));
+        compare(noise_cipherstate_encrypt(plain, &mbuf), NOISE_ERROR_NONE);
+        memset(buffer, (int)index, len);
+        noise_buffer_set_inout(mbuf, buffer, len, sizeof(buffer));
+        compare(noise_cipherstate_encrypt(ahead, &mbuf), NOISE_ERROR_NONE);
+        compare_blocks(buffer, mbuf.size, expected, mbuf.size);
+
+        /* Corrupted packets must not consume the receiver's keystream */
+        buffer[0] ^= 0x01;
+        compare(noise_cipherstate_decrypt(recv, &mbuf),
+                NOISE_ERROR_MAC_FAILURE);
+        buffer[0] ^= 0x01;
+        compare(noise_cipherstate_decrypt(recv, &mbuf), NOISE_ERROR_NONE);
+        compare(mbuf.size, len);
+        memset(expected, (int)index, len);
+        compare_blocks(buffer, len, expected, len);
+    }
+
+    /* Disabling lookahead makes precompute a no-op */
+    compare(noise_cipherstate_set_lookahead(ahead, 0), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_precompute(ahead), NOISE_ERROR_NONE);
+
+    noise_cipherstate_free(plain);
+    noise_cipherstate_free(ahead);
+    noise_cipherstate_free(recv);
+}
+
+/* Check keystream lookahead for all ciphers */
+static void cipherstate_check_lookahead(void)
+{
+    check_lookahead(NOISE_CIPHER_CHACHAPOLY);
+    check_lookahead(NOISE_CIPHER_AESGCM);
+#if NOISE_USE_AEGIS256
+    check_lookahead(NOISE_CIPHER_AEGIS256);
+#endif
 }
 
 /* Check other error conditions that can be reported by the functions */
@@ -290,6 +572,9 @@ static void cipherstate_check_errors(void)
     compare(noise_cipherstate_get_cipher_id(0), NOISE_CIPHER_NONE);
     compare(noise_cipherstate_get_key_length(0), 0);
     compare(noise_cipherstate_get_mac_length(0), 0);
+    compare(noise_cipherstate_get_max_lookahead(0), 0);
+    compare(noise_cipherstate_set_lookahead(0, 1), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cipherstate_precompute(0), NOISE_ERROR_INVALID_PARAM);
     compare(noise_cipherstate_new_by_id(0, NOISE_HASH_BLAKE2s),
             NOISE_ERROR_INVALID_PARAM);
     compare(noise_cipherstate_new_by_name(0, "ChaChaPoly"),
@@ -313,5 +598,11 @@ static void cipherstate_check_errors(void)
 void test_cipherstate(void)
 {
     cipherstate_check_test_vectors();
+#if NOISE_USE_AEGIS256
+    check_aegis256_vectors(0);
+    check_aegis256_vectors(1);
+    check_aegis256_long();
+#endif
+    cipherstate_check_lookahead();
     cipherstate_check_errors();
 }
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test-helpers.h"
+
+#define MAX_MESSAGE_LEN 128
+
+/* Load callback that reports the value of an integer flag */
+static int check_load(void *user_data)
+{
+    return *((const int *)user_data);
+}
+
+/* Runs a cookie exchange between an initiator and a responder */
+static void cookiestate_exchange(int hash_id)
+{
+    static uint8_t const responder_key[32] = {
+        0x31, 0xe0, 0x30, 0x3f, 0xd6, 0x41, 0x8d, 0x2f,
+        0x8c, 0x0e, 0x78, 0xb9, 0x1f, 0x22, 0xe8, 0xca,
+        0xed, 0x0f, 0xbe, 0x48, 0x65, 0x6d, 0xcf, 0x47,
+        0x67, 0xe4, 0x83, 0x4f, 0x70, 0x1b, 0x8f, 0x62
+    };
+    static char const source1[] = "192.0.2.1:4242";
+    static char const source2[] = "192.0.2.2:4242";
+    NoiseCookieState *initiator;
+    NoiseCookieState *responder;
+    NoiseBuffer mbuf;
+    NoiseBuffer rbuf;
+    uint8_t message[MAX_MESSAGE_LEN];
+    uint8_t saved[MAX_MESSAGE_LEN];
+    uint8_t reply[NOISE_COOKIE_REPLY_LEN];
+    size_t body_len = 48;
+    size_t index;
+    int under_load = 0;
+
+    /* Create the objects and bind them to the responder's key */
+    compare(noise_cookiestate_new(&initiator, hash_id, NOISE_ROLE_INITIATOR),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_new(&responder, hash_id, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_get_role(initiator), NOISE_ROLE_INITIATOR);
+    compare(noise_cookiestate_get_role(responder), NOISE_ROLE_RESPONDER);
+    compare(noise_cookiestate_set_responder_key
+                (initiator, responder_key, sizeof(responder_key)),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_set_responder_key
+                (responder, responder_key, sizeof(responder_key)),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_set_load_callback
+                (responder, check_load, &under_load),
+            NOISE_ERROR_NONE);
+    verify(!noise_cookiestate_is_under_load(responder));
+    verify(!noise_cookiestate_has_cookie(initiator));
+
+    /* Create a dummy handshake message and add the MAC's */
+    for (index = 0; index < body_len; ++index)
+        message[index] = (uint8_t)(index * 7);
+    noise_buffer_set_inout(mbuf, message, body_len, sizeof(message));
+    compare(noise_cookiestate_add_macs(initiator, &mbuf), NOISE_ERROR_NONE);
+    compare(mbuf.size, body_len + NOISE_COOKIE_MACS_LEN);
+    memcpy(saved, message, mbuf.size);
+
+    /* The responder accepts the message when it is not under load */
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_NONE);
+    compare(mbuf.size, body_len);
+
+    /* A corrupted message fails "mac1" */
+    noise_buffer_set_input(mbuf, message, body_len + NOISE_COOKIE_MACS_LEN);
+    message[3] ^= 0x01;
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_MAC_FAILURE);
+    message[3] ^= 0x01;
+
+    /* Under load the message needs a cookie and is left untouched */
+    under_load = 1;
+    verify(noise_cookiestate_is_under_load(responder));
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_COOKIE_REQUIRED);
+    compare_blocks(message, mbuf.size, saved,
+                   body_len + NOISE_COOKIE_MACS_LEN);
+
+    /* Send a cookie reply and check that the initiator accepts it */
+    noise_buffer_set_output(rbuf, reply, sizeof(reply));
+    compare(noise_cookiestate_write_reply
+                (responder, &mbuf, &rbuf, source1, sizeof(source1)),
+            NOISE_ERROR_NONE);
+    compare(rbuf.size, NOISE_COOKIE_REPLY_LEN);
+    reply[20] ^= 0x01;
+    compare(noise_cookiestate_read_reply(initiator, &rbuf),
+            NOISE_ERROR_MAC_FAILURE);
+    verify(!noise_cookiestate_has_cookie(initiator));
+    reply[20] ^= 0x01;
+    compare(noise_cookiestate_read_reply(initiator, &rbuf), NOISE_ERROR_NONE);
+    verify(noise_cookiestate_has_cookie(initiator));
+
+    /* Resend the message with the cookie and check that it is accepted */
+    noise_buffer_set_inout(mbuf, message, body_len, sizeof(message));
+    compare(noise_cookiestate_add_macs(initiator, &mbuf), NOISE_ERROR_NONE);
+    memcpy(saved, message, mbuf.size);
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_NONE);
+    compare(mbuf.size, body_len);
+
+    /* The cookie is bound to the source address */
+    noise_buffer_set_input(mbuf, message, body_len + NOISE_COOKIE_MACS_LEN);
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source2, sizeof(source2)),
+            NOISE_ERROR_COOKIE_REQUIRED);
+
+    /* The cookie survives one rotation of the secret but not two */
+    compare(noise_cookiestate_rotate_secret(responder), NOISE_ERROR_NONE);
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_NONE);
+    noise_buffer_set_input(mbuf, message, body_len + NOISE_COOKIE_MACS_LEN);
+    compare(noise_cookiestate_rotate_secret(responder), NOISE_ERROR_NONE);
+    compare(noise_cookiestate_check_macs
+                (responder, &mbuf, source1, sizeof(source1)),
+            NOISE_ERROR_COOKIE_REQUIRED);
+
+    /* A reply to some other message is rejected by the initiator */
+    saved[body_len] ^= 0x01;
+    noise_buffer_set_input(mbuf, saved, body_len + NOISE_COOKIE_MACS_LEN);
+    noise_buffer_set_output(rbuf, reply, sizeof(reply));
+    compare(noise_cookiestate_write_reply
+                (responder, &mbuf, &rbuf, source1, sizeof(source1)),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_read_reply(initiator, &rbuf),
+            NOISE_ERROR_MAC_FAILURE);
+
+    /* Clear the cookie */
+    compare(noise_cookiestate_clear_cookie(initiator), NOISE_ERROR_NONE);
+    verify(!noise_cookiestate_has_cookie(initiator));
+
+    /* Clean up */
+    compare(noise_cookiestate_free(initiator), NOISE_ERROR_NONE);
+    compare(noise_cookiestate_free(responder), NOISE_ERROR_NONE);
+}
+
+/* Check the handling of bad parameters and roles */
+static void cookiestate_bad_params(void)
+{
+    NoiseCookieState *initiator;
+    NoiseCookieState *responder;
+    NoiseBuffer mbuf;
+    NoiseBuffer rbuf;
+    uint8_t message[MAX_MESSAGE_LEN];
+    uint8_t reply[NOISE_COOKIE_REPLY_LEN];
+
+    compare(noise_cookiestate_new(0, NOISE_HASH_BLAKE2s, NOISE_ROLE_INITIATOR),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_new(&initiator, NOISE_HASH_BLAKE2s, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_new
+                (&initiator, NOISE_CIPHER_AESGCM, NOISE_ROLE_INITIATOR),
+            NOISE_ERROR_UNKNOWN_ID);
+    compare(noise_cookiestate_new
+                (&initiator, NOISE_HASH_BLAKE2s, NOISE_ROLE_INITIATOR),
+            NOISE_ERROR_NONE);
+    compare(noise_cookiestate_new
+                (&responder, NOISE_HASH_BLAKE2s, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    memset(message, 0, sizeof(message));
+
+    /* Functions for the wrong role */
+    noise_buffer_set_inout(mbuf, message, 16, sizeof(message));
+    noise_buffer_set_output(rbuf, reply, sizeof(reply));
+    compare(noise_cookiestate_add_macs(responder, &mbuf),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_cookiestate_check_macs(initiator, &mbuf, 0, 0),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_cookiestate_write_reply(initiator, &mbuf, &rbuf, 0, 0),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_cookiestate_rotate_secret(initiator),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_cookiestate_set_load_callback(initiator, check_load, 0),
+            NOISE_ERROR_INVALID_STATE);
+    noise_buffer_set_input(rbuf, reply, sizeof(reply));
+    compare(noise_cookiestate_read_reply(responder, &rbuf),
+            NOISE_ERROR_INVALID_STATE);
+
+    /* Cannot read a reply before sending a message */
+    compare(noise_cookiestate_read_reply(initiator, &rbuf),
+            NOISE_ERROR_INVALID_STATE);
+
+    /* Messages and replies that are the wrong size */
+    noise_buffer_set_inout(mbuf, message, 16, 16 + NOISE_COOKIE_MACS_LEN - 1);
+    compare(noise_cookiestate_add_macs(initiator, &mbuf),
+            NOISE_ERROR_INVALID_LENGTH);
+    noise_buffer_set_input(mbuf, message, NOISE_COOKIE_MACS_LEN - 1);
+    compare(noise_cookiestate_check_macs(responder, &mbuf, 0, 0),
+            NOISE_ERROR_INVALID_LENGTH);
+    noise_buffer_set_output(rbuf, reply, sizeof(reply) - 1);
+    noise_buffer_set_input(mbuf, message, NOISE_COOKIE_MACS_LEN);
+    compare(noise_cookiestate_write_reply(responder, &mbuf, &rbuf, 0, 0),
+            NOISE_ERROR_INVALID_LENGTH);
+    noise_buffer_set_inout(mbuf, message, 16, sizeof(message));
+    compare(noise_cookiestate_add_macs(initiator, &mbuf), NOISE_ERROR_NONE);
+    noise_buffer_set_input(rbuf, reply, sizeof(reply) - 1);
+    compare(noise_cookiestate_read_reply(initiator, &rbuf),
+            NOISE_ERROR_INVALID_LENGTH);
+
+    /* NULL parameters */
+    compare(noise_cookiestate_free(0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_get_role(0), 0);
+    compare(noise_cookiestate_set_responder_key(0, reply, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_set_responder_key(initiator, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_set_load_callback(0, check_load, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_is_under_load(0), 0);
+    compare(noise_cookiestate_rotate_secret(0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_add_macs(0, &mbuf), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_add_macs(initiator, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_check_macs(0, &mbuf, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_check_macs(responder, 0, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_check_macs(responder, &mbuf, 0, 4),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_write_reply(responder, &mbuf, 0, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_read_reply(0, &rbuf), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_read_reply(initiator, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cookiestate_has_cookie(0), 0);
+    compare(noise_cookiestate_clear_cookie(0), NOISE_ERROR_INVALID_PARAM);
+
+    compare(noise_cookiestate_free(initiator), NOISE_ERROR_NONE);
+    compare(noise_cookiestate_free(responder), NOISE_ERROR_NONE);
+}
+
+void test_cookiestate(void)
+{
+    cookiestate_exchange(NOISE_HASH_BLAKE2s);
+    cookiestate_exchange(NOISE_HASH_BLAKE2b);
+    cookiestate_exchange(NOISE_HASH_SHA256);
+    cookiestate_exchange(NOISE_HASH_SHA512);
+    cookiestate_bad_params();
+}
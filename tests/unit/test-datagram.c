@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test-helpers.h"
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_PACKET_LEN  256
+
+static uint8_t const key_ab[32] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+    0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+    0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20
+};
+static uint8_t const key_ba[32] = {
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff, 0xe0,
+    0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+    0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef, 0xd0
+};
+
+/* Creates a UDP socket that is bound to an ephemeral loopback port */
+static int datagram_socket(struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(struct sockaddr_in);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    verify(fd >= 0);
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    compare(bind(fd, (struct sockaddr *)addr, len), 0);
+    compare(getsockname(fd, (struct sockaddr *)addr, &len), 0);
+    return fd;
+}
+
+static NoiseCipherState *datagram_cipher(int cipher_id, const uint8_t *key)
+{
+    NoiseCipherState *cipher;
+    compare(noise_cipherstate_new_by_id(&cipher, cipher_id), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_init_key(cipher, key, 32), NOISE_ERROR_NONE);
+    return cipher;
+}
+
+/* Formats a packet by hand with an arbitrary session index and nonce */
+static size_t datagram_craft
+    (int cipher_id, uint32_t index, uint64_t nonce, uint8_t *packet)
+{
+    NoiseCipherState *cipher = datagram_cipher(cipher_id, key_ab);
+    NoiseBuffer mbuf;
+    int posn;
+    for (posn = 0; posn < 4; ++posn)
+        packet[posn] = (uint8_t)(index >> (24 - posn * 8));
+    for (posn = 0; posn < 8; ++posn)
+        packet[4 + posn] = (uint8_t)(nonce >> (56 - posn * 8));
+    memset(packet + NOISE_DATAGRAM_HEADER_LEN, (uint8_t)nonce, 20);
+    compare(noise_cipherstate_set_nonce(cipher, nonce), NOISE_ERROR_NONE);
+    noise_buffer_set_inout(mbuf, packet + NOISE_DATAGRAM_HEADER_LEN, 20,
+                           MAX_PACKET_LEN - NOISE_DATAGRAM_HEADER_LEN);
+    compare(noise_cipherstate_encrypt_with_ad
+                (cipher, packet, NOISE_DATAGRAM_HEADER_LEN, &mbuf),
+            NOISE_ERROR_NONE);
+    compare(noise_cipherstate_free(cipher), NOISE_ERROR_NONE);
+    return NOISE_DATAGRAM_HEADER_LEN + mbuf.size;
+}
+
+static void datagram_send_raw
+    (int fd, const struct sockaddr_in *to, const uint8_t *packet, size_t len)
+{
+    compare(sendto(fd, packet, len, 0, (const struct sockaddr *)to,
+                   sizeof(struct sockaddr_in)), (ssize_t)len);
+}
+
+/* Exchanges packets between two DatagramState objects over loopback */
+static void datagram_exchange(int cipher_id)
+{
+    static int const expected_errors[] = {
+        NOISE_ERROR_NONE,           /* nonce 10 */
+        NOISE_ERROR_NONE,           /* nonce 8, reordered */
+        NOISE_ERROR_NONE,           /* nonce 9, reordered */
+        NOISE_ERROR_INVALID_NONCE,  /* nonce 8 again, replayed */
+        NOISE_ERROR_INVALID_NONCE,  /* nonce 1, replayed from first batch */
+        NOISE_ERROR_NONE,           /* nonce 100 */
+        NOISE_ERROR_INVALID_NONCE,  /* nonce 20, older than the window */
+        NOISE_ERROR_NONE,           /* nonce 40, just inside the window */
+        NOISE_ERROR_UNKNOWN_ID,     /* session 7 */
+        NOISE_ERROR_UNKNOWN_ID,     /* session 0 */
+        NOISE_ERROR_MAC_FAILURE,    /* tampered */
+        NOISE_ERROR_INVALID_LENGTH  /* truncated */
+    };
+    NoiseDatagramState *a;
+    NoiseDatagramState *b;
+    NoiseDatagram *packets;
+    struct sockaddr_in addr_a;
+    struct sockaddr_in addr_b;
+    uint8_t packet[MAX_PACKET_LEN];
+    uint8_t payload[MAX_PACKET_LEN];
+    uint32_t index_a;
+    uint32_t index_b;
+    size_t count;
+    size_t len;
+    size_t posn;
+    int fd_a = datagram_socket(&addr_a);
+    int fd_b = datagram_socket(&addr_b);
+
+    /* Set up a session between the two ends.  Both tables are empty, so
+       each end knows that the other will assign index 1 */
+    compare(noise_datagramstate_new(&a, fd_a, MAX_PACKET_LEN),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_new(&b, fd_b, MAX_PACKET_LEN),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_add_session
+                (a, datagram_cipher(cipher_id, key_ab),
+                 datagram_cipher(cipher_id, key_ba), 1,
+                 &addr_b, sizeof(addr_b), &index_a),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_add_session
+                (b, datagram_cipher(cipher_id, key_ba),
+                 datagram_cipher(cipher_id, key_ab), 1,
+                 &addr_a, sizeof(addr_a), &index_b),
+            NOISE_ERROR_NONE);
+    compare(index_a, 1);
+    compare(index_b, 1);
+
+    /* Send a batch from a to b */
+    for (posn = 0; posn < 3; ++posn) {
+        memset(payload, (int)posn, posn * 10 + 1);
+        compare(noise_datagramstate_send(a, index_a, payload, posn * 10 + 1),
+                NOISE_ERROR_NONE);
+    }
+    compare(noise_datagramstate_flush(a), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_receive(b, &packets, &count),
+            NOISE_ERROR_NONE);
+    compare(count, 3);
+    for (posn = 0; posn < count; ++posn) {
+        compare(packets[posn].error, NOISE_ERROR_NONE);
+        compare(packets[posn].session, index_b);
+        compare(packets[posn].payload.size, posn * 10 + 1);
+        memset(payload, (int)posn, posn * 10 + 1);
+        compare_blocks(packets[posn].payload.data,
+                       packets[posn].payload.size, payload, posn * 10 + 1);
+        compare(packets[posn].source_len, sizeof(addr_a));
+        verify(!memcmp(packets[posn].source, &addr_a, sizeof(addr_a)));
+    }
+
+    /* Reply from b to a */
+    compare(noise_datagramstate_send(b, index_b, (const uint8_t *)"pong", 4),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_flush(b), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_receive(a, &packets, &count),
+            NOISE_ERROR_NONE);
+    compare(count, 1);
+    compare(packets[0].error, NOISE_ERROR_NONE);
+    compare_blocks(packets[0].payload.data,
+                   packets[0].payload.size, (const uint8_t *)"pong", 4);
+
+    /* Reordered, replayed, unknown, and corrupted packets in one batch */
+    len = datagram_craft(cipher_id, 1, 10, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 8, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 9, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 8, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 1, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 100, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 20, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 40, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 7, 11, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 0, 12, packet);
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    len = datagram_craft(cipher_id, 1, 13, packet);
+    packet[len - 1] ^= 0x01;
+    datagram_send_raw(fd_a, &addr_b, packet, len);
+    datagram_send_raw(fd_a, &addr_b, packet, NOISE_DATAGRAM_HEADER_LEN + 4);
+    compare(noise_datagramstate_receive(b, &packets, &count),
+            NOISE_ERROR_NONE);
+    compare(count, sizeof(expected_errors) / sizeof(expected_errors[0]));
+    for (posn = 0; posn < count; ++posn) {
+        compare(packets[posn].error, expected_errors[posn]);
+        if (expected_errors[posn] == NOISE_ERROR_NONE)
+            compare(packets[posn].payload.size, 20);
+        else
+            compare(packets[posn].payload.size, 0);
+    }
+
+    /* Removed sessions are unknown until the index is reused */
+    compare(noise_datagramstate_remove_session(a, index_a), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_remove_session(a, index_a),
+            NOISE_ERROR_UNKNOWN_ID);
+    compare(noise_datagramstate_send(a, index_a, payload, 1),
+            NOISE_ERROR_UNKNOWN_ID);
+    compare(noise_datagramstate_add_session
+                (a, datagram_cipher(cipher_id, key_ab),
+                 datagram_cipher(cipher_id, key_ba), 1,
+                 &addr_b, sizeof(addr_b), &index_a),
+            NOISE_ERROR_NONE);
+    compare(index_a, 1);
+
+    /* Payloads that do not fit in a packet are rejected */
+    compare(noise_datagramstate_send
+                (a, index_a, payload,
+                 MAX_PACKET_LEN - NOISE_DATAGRAM_HEADER_LEN - 15),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_datagramstate_send
+                (a, index_a, payload,
+                 MAX_PACKET_LEN - NOISE_DATAGRAM_HEADER_LEN - 16),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_flush(a), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_receive(b, &packets, &count),
+            NOISE_ERROR_NONE);
+    compare(count, 1);
+    compare(packets[0].error, NOISE_ERROR_INVALID_NONCE);
+
+    compare(noise_datagramstate_free(a), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_free(b), NOISE_ERROR_NONE);
+    close(fd_a);
+    close(fd_b);
+}
+
+/* Sends runs of packets with GSO and receives them with GRO */
+static void datagram_offload(int cipher_id)
+{
+    static size_t const sizes[] = {
+        100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 50, 100, 100, 80
+    };
+    NoiseDatagramState *a;
+    NoiseDatagramState *b;
+    NoiseDatagram *packets;
+    struct sockaddr_in addr_a;
+    struct sockaddr_in addr_b;
+    uint8_t payload[MAX_PACKET_LEN];
+    uint32_t index_a;
+    uint32_t index_b;
+    size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    size_t received = 0;
+    size_t count;
+    size_t posn;
+    int round;
+    int fd_a = datagram_socket(&addr_a);
+    int fd_b = datagram_socket(&addr_b);
+
+    compare(noise_datagramstate_new(&a, fd_a, MAX_PACKET_LEN),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_new(&b, fd_b, MAX_PACKET_LEN),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_get_offload(a), 0);
+    if (noise_datagramstate_set_offload(a, NOISE_DATAGRAM_OFFLOAD_GSO) !=
+                NOISE_ERROR_NONE ||
+            noise_datagramstate_set_offload(b, NOISE_DATAGRAM_OFFLOAD_GRO) !=
+                NOISE_ERROR_NONE) {
+        /* The kernel does not support UDP segmentation offload */
+        compare(noise_datagramstate_free(a), NOISE_ERROR_NONE);
+        compare(noise_datagramstate_free(b), NOISE_ERROR_NONE);
+        close(fd_a);
+        close(fd_b);
+        return;
+    }
+    compare(noise_datagramstate_get_offload(b), NOISE_DATAGRAM_OFFLOAD_GRO);
+    compare(noise_datagramstate_add_session
+                (a, datagram_cipher(cipher_id, key_ab),
+                 datagram_cipher(cipher_id, key_ba), 1,
+                 &addr_b, sizeof(addr_b), &index_a),
+            NOISE_ERROR_NONE);
+    compare(noise_datagramstate_add_session
+                (b, datagram_cipher(cipher_id, key_ba),
+                 datagram_cipher(cipher_id, key_ab), 1,
+                 &addr_a, sizeof(addr_a), &index_b),
+            NOISE_ERROR_NONE);
+
+    /* The short packets split the queue into several GSO messages, and
+       every packet must come out of GRO in order and intact */
+    for (round = 0; round < 2; ++round) {
+        for (posn = 0; posn < num_sizes; ++posn) {
+            memset(payload, (int)posn, sizes[posn]);
+            compare(noise_datagramstate_send
+                        (a, index_a, payload, sizes[posn]),
+                    NOISE_ERROR_NONE);
+        }
+        compare(noise_datagramstate_flush(a), NOISE_ERROR_NONE);
+        received = 0;
+        while (received < num_sizes) {
+            compare(noise_datagramstate_receive(b, &packets, &count),
+                    NOISE_ERROR_NONE);
+            verify(count > 0);
+            verify((received + count) <= num_sizes);
+            for (posn = 0; posn < count; ++posn, ++received) {
+                compare(packets[posn].error, NOISE_ERROR_NONE);
+                memset(payload, (int)received, sizes[received]);
+                compare_blocks(packets[posn].payload.data,
+                               packets[posn].payload.size,
+                               payload, sizes[received]);
+                compare(packets[posn].source_len, sizeof(addr_a));
+            }
+        }
+    }
+
+    /* Replies from b still go one datagram at a time and a receives
+       them with GRO disabled */
+    compare(noise_datagramstate_set_offload(a, 0), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_set_offload(b, NOISE_DATAGRAM_OFFLOAD_GSO |
+                                               NOISE_DATAGRAM_OFFLOAD_GRO),
+            NOISE_ERROR_NONE);
+    for (posn = 0; posn < 3; ++posn) {
+        compare(noise_datagramstate_send
+                    (b, index_b, (const uint8_t *)"pong", 4),
+                NOISE_ERROR_NONE);
+    }
+    compare(noise_datagramstate_flush(b), NOISE_ERROR_NONE);
+    for (received = 0; received < 3; received += count) {
+        compare(noise_datagramstate_receive(a, &packets, &count),
+                NOISE_ERROR_NONE);
+        for (posn = 0; posn < count; ++posn) {
+            compare(packets[posn].error, NOISE_ERROR_NONE);
+            compare_blocks(packets[posn].payload.data,
+                           packets[posn].payload.size,
+                           (const uint8_t *)"pong", 4);
+        }
+    }
+    compare(received, 3);
+
+    compare(noise_datagramstate_free(a), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_free(b), NOISE_ERROR_NONE);
+    close(fd_a);
+    close(fd_b);
+}
+
+/* Check the handling of bad parameters */
+static void datagram_bad_params(void)
+{
+    NoiseDatagramState *state;
+    NoiseCipherState *send;
+    NoiseCipherState *recv;
+    NoiseDatagram *packets;
+    struct sockaddr_in addr;
+    uint32_t local_index;
+    size_t count;
+    int fd = datagram_socket(&addr);
+
+    compare(noise_datagramstate_new(0, fd, MAX_PACKET_LEN),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_new(&state, -1, MAX_PACKET_LEN),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_new
+                (&state, fd, NOISE_DATAGRAM_HEADER_LEN + 15),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_new
+                (&state, fd, NOISE_DATAGRAM_HEADER_LEN +
+                             NOISE_MAX_PAYLOAD_LEN + 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_new(&state, fd, MAX_PACKET_LEN),
+            NOISE_ERROR_NONE);
+
+    /* Sessions need keyed ciphers */
+    compare(noise_cipherstate_new_by_id(&send, NOISE_CIPHER_CHACHAPOLY),
+            NOISE_ERROR_NONE);
+    recv = datagram_cipher(NOISE_CIPHER_CHACHAPOLY, key_ab);
+    compare(noise_datagramstate_add_session
+                (state, send, recv, 1, &addr, sizeof(addr), &local_index),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_datagramstate_add_session
+                (state, send, recv, 1, &addr, 0, &local_index),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_add_session
+                (state, send, recv, 1, 0, sizeof(addr), &local_index),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_add_session
+                (state, 0, recv, 1, &addr, sizeof(addr), &local_index),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_add_session
+                (state, send, recv, 1, &addr, sizeof(addr), 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_add_session
+                (0, send, recv, 1, &addr, sizeof(addr), &local_index),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_cipherstate_free(send), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_free(recv), NOISE_ERROR_NONE);
+
+    compare(noise_datagramstate_remove_session(0, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_remove_session(state, 0),
+            NOISE_ERROR_UNKNOWN_ID);
+    compare(noise_datagramstate_receive(0, &packets, &count),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_receive(state, 0, &count),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_receive(state, &packets, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_send(0, 1, key_ab, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_send(state, 1, 0, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_send(state, 1, key_ab, 1),
+            NOISE_ERROR_UNKNOWN_ID);
+    compare(noise_datagramstate_flush(0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_flush(state), NOISE_ERROR_NONE);
+    compare(noise_datagramstate_set_offload(0, 0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_set_offload(state, 0x80),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_get_offload(0), 0);
+    compare(noise_datagramstate_free(0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_datagramstate_free(state), NOISE_ERROR_NONE);
+    close(fd);
+}
+
+#endif
+
+void test_datagram(void)
+{
+#if !defined(__WIN32__) && !defined(WIN32)
+    datagram_exchange(NOISE_CIPHER_CHACHAPOLY);
+    datagram_exchange(NOISE_CIPHER_AESGCM);
+    datagram_offload(NOISE_CIPHER_CHACHAPOLY);
+    datagram_offload(NOISE_CIPHER_AESGCM);
+    datagram_bad_params();
+#endif
+}
@@ -22,6 +22,9 @@
 
 #include "test-helpers.h"
 #include "protocol/internal.h"
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 
 /* Key values for testing purposes */
 static uint8_t const init_private_25519[32] = {
@@ -152,9 +155,11 @@ static void check_handshake_protocol(const char *name)
     uint8_t message[4096];
     uint8_t payload[23];
     NoiseBuffer mbuf;
+    NoiseBuffer mbuf2;
     NoiseBuffer pbuf;
     int action;
     int index;
+    int first = 1;
 
     /* Set the name of this test for error reporting */
     data_name = name;
@@ -320,6 +325,23 @@ static void check_handshake_protocol(const char *name)
                 NOISE_ERROR_NOT_APPLICABLE);
     }
 
+    /* Run the hybrid operations concurrently on one side only so that the
+       result is checked against the serial implementation.  Alternate the
+       side to cover both the read and write paths */
+    if (id.hybrid_id != NOISE_DH_NONE) {
+#if defined(HAVE_PTHREAD)
+        compare(noise_handshakestate_set_concurrent_hybrid
+                    (id.dh_id == NOISE_DH_CURVE25519 ? responder : initiator, 1),
+                NOISE_ERROR_NONE);
+#else
+        compare(noise_handshakestate_set_concurrent_hybrid(responder, 1),
+                NOISE_ERROR_NOT_APPLICABLE);
+#endif
+    } else {
+        compare(noise_handshakestate_set_concurrent_hybrid(responder, 1),
+                NOISE_ERROR_NOT_APPLICABLE);
+    }
+
     /* Start the handshake running */
     compare(noise_handshakestate_start(initiator), NOISE_ERROR_NONE);
     compare(noise_handshakestate_start(responder), NOISE_ERROR_NONE);
@@ -390,6 +412,20 @@ static void check_handshake_protocol(const char *name)
         noise_buffer_set_input(pbuf, payload, sizeof(payload));
         compare(noise_handshakestate_write_message(send, &mbuf, &pbuf),
                 NOISE_ERROR_NONE);
+
+        /* Check the size of the first message without a HandshakeState */
+        if (first) {
+            compare(noise_handshakestate_check_first_message(&id, &mbuf),
+                    NOISE_ERROR_NONE);
+            noise_buffer_set_input
+                (mbuf2, message, mbuf.size - sizeof(payload));
+            compare(noise_handshakestate_check_first_message(&id, &mbuf2),
+                    NOISE_ERROR_NONE);
+            --(mbuf2.size);
+            compare(noise_handshakestate_check_first_message(&id, &mbuf2),
+                    NOISE_ERROR_INVALID_LENGTH);
+            first = 0;
+        }
         noise_buffer_set_output(pbuf, payload, sizeof(payload));
         compare(noise_handshakestate_read_message(recv, &mbuf, &pbuf),
                 NOISE_ERROR_NONE);
@@ -472,6 +508,10 @@ static void handshakestate_check_protocols(void)
     check_handshake_protocol("NoisePSK_IN_25519_ChaChaPoly_BLAKE2s");
     check_handshake_protocol("NoisePSK_IK_25519_AESGCM_BLAKE2b");
     check_handshake_protocol("NoisePSK_IX_448_AESGCM_SHA512");
+
+    check_handshake_protocol("Noise_NN_NewHope_ChaChaPoly_BLAKE2s");
+    check_handshake_protocol("Noise_NNhfs_25519+NewHope_AESGCM_SHA256");
+    check_handshake_protocol("Noise_IKhfs_448+NewHope_ChaChaPoly_BLAKE2b");
 }
 
 /* Check that "IK" correctly falls back to "XXfallback" */
@@ -667,10 +707,374 @@ static void handshakestate_check_fallback(void)
     check_fallback_protocol("Noise_IK_448_ChaChaPoly_BLAKE2b", 0, 1);
 }
 
+/* State for checking the remote static key callback */
+typedef struct
+{
+    int calls;
+    int result;
+    uint8_t key[56];
+    size_t key_len;
+} RemoteKeyCheck;
+
+static int check_remote_key(void *user_data, const NoiseDHState *remote_key)
+{
+    RemoteKeyCheck *check = (RemoteKeyCheck *)user_data;
+    ++(check->calls);
+    check->key_len = noise_dhstate_get_public_key_length(remote_key);
+    compare(noise_dhstate_get_public_key
+                (remote_key, check->key, check->key_len),
+            NOISE_ERROR_NONE);
+    return check->result;
+}
+
+/* Check that the remote static key callback is invoked by "IK" responders */
+static void check_remote_key_callback(const char *name, int reject)
+{
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder;
+    RemoteKeyCheck check;
+    NoiseDHState *dh;
+    uint8_t message[4096];
+    uint8_t payload[23];
+    NoiseBuffer mbuf;
+    NoiseBuffer pbuf;
+
+    /* Set the name of this test for error reporting */
+    data_name = name;
+
+    /* Create the two objects and set up the keys */
+    compare(noise_handshakestate_new_by_name
+                (&initiator, name, NOISE_ROLE_INITIATOR),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_name
+                (&responder, name, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    dh = noise_handshakestate_get_local_keypair_dh(initiator);
+    compare(noise_dhstate_set_keypair_private
+                (dh, init_private_25519, sizeof(init_private_25519)),
+            NOISE_ERROR_NONE);
+    dh = noise_handshakestate_get_remote_public_key_dh(initiator);
+    compare(noise_dhstate_set_public_key
+                (dh, resp_public_25519, sizeof(resp_public_25519)),
+            NOISE_ERROR_NONE);
+    dh = noise_handshakestate_get_local_keypair_dh(responder);
+    compare(noise_dhstate_set_keypair_private
+                (dh, resp_private_25519, sizeof(resp_private_25519)),
+            NOISE_ERROR_NONE);
+    if (noise_handshakestate_needs_pre_shared_key(initiator)) {
+        compare(noise_handshakestate_set_pre_shared_key
+                    (initiator, psk, sizeof(psk)),
+                NOISE_ERROR_NONE);
+        compare(noise_handshakestate_set_pre_shared_key
+                    (responder, psk, sizeof(psk)),
+                NOISE_ERROR_NONE);
+    }
+
+    /* Register the callback on the responder */
+    memset(&check, 0, sizeof(check));
+    check.result = reject ? NOISE_ERROR_INVALID_PUBLIC_KEY : NOISE_ERROR_NONE;
+    compare(noise_handshakestate_set_remote_key_callback
+                (0, check_remote_key, &check),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_handshakestate_set_remote_key_callback
+                (responder, check_remote_key, &check),
+            NOISE_ERROR_NONE);
+
+    /* Start the handshakes and send the first message */
+    compare(noise_handshakestate_start(initiator), NOISE_ERROR_NONE);
+    compare(noise_handshakestate_start(responder), NOISE_ERROR_NONE);
+    memset(payload, 0x66, sizeof(payload));
+    noise_buffer_set_output(mbuf, message, sizeof(message));
+    noise_buffer_set_input(pbuf, payload, sizeof(payload));
+    compare(noise_handshakestate_write_message(initiator, &mbuf, &pbuf),
+            NOISE_ERROR_NONE);
+    compare(check.calls, 0);
+
+    /* Read the message on the responder, which should invoke the callback */
+    noise_buffer_set_output(pbuf, payload, sizeof(payload));
+    if (reject) {
+        compare(noise_handshakestate_read_message(responder, &mbuf, &pbuf),
+                NOISE_ERROR_INVALID_PUBLIC_KEY);
+        compare(noise_handshakestate_get_action(responder),
+                NOISE_ACTION_FAILED);
+        compare(pbuf.size, 0);
+    } else {
+        compare(noise_handshakestate_read_message(responder, &mbuf, &pbuf),
+                NOISE_ERROR_NONE);
+        compare(noise_handshakestate_get_action(responder),
+                NOISE_ACTION_WRITE_MESSAGE);
+        compare(pbuf.size, sizeof(payload));
+    }
+    compare(check.calls, 1);
+    compare_blocks(check.key, check.key_len,
+                   init_public_25519, sizeof(init_public_25519));
+
+    /* Clean up */
+    compare(noise_handshakestate_free(initiator), NOISE_ERROR_NONE);
+    compare(noise_handshakestate_free(responder), NOISE_ERROR_NONE);
+}
+
+static void handshakestate_check_remote_key_callback(void)
+{
+    check_remote_key_callback("Noise_IK_25519_ChaChaPoly_BLAKE2s", 0);
+    check_remote_key_callback("Noise_IK_25519_AESGCM_SHA256", 1);
+    check_remote_key_callback("NoisePSK_IK_25519_ChaChaPoly_SHA512", 0);
+}
+
+/* Runs a handshake between two objects that have already started */
+static void run_shared_key_handshake
+    (NoiseHandshakeState *initiator, NoiseHandshakeState *responder)
+{
+    NoiseHandshakeState *send = initiator;
+    NoiseHandshakeState *recv = responder;
+    NoiseHandshakeState *temp;
+    uint8_t message[4096];
+    NoiseBuffer mbuf;
+
+    while (noise_handshakestate_get_action(send)
+                == NOISE_ACTION_WRITE_MESSAGE) {
+        noise_buffer_set_output(mbuf, message, sizeof(message));
+        compare(noise_handshakestate_write_message(send, &mbuf, 0),
+                NOISE_ERROR_NONE);
+        compare(noise_handshakestate_read_message(recv, &mbuf, 0),
+                NOISE_ERROR_NONE);
+        temp = send;
+        send = recv;
+        recv = temp;
+    }
+    compare(noise_handshakestate_get_action(initiator), NOISE_ACTION_SPLIT);
+    compare(noise_handshakestate_get_action(responder), NOISE_ACTION_SPLIT);
+}
+
+/* Check sharing a single static keypair between several responders */
+static void handshakestate_check_shared_key(void)
+{
+    static const char name[] = "Noise_IK_25519_ChaChaPoly_BLAKE2s";
+    NoiseHandshakeState *initiator;
+    NoiseHandshakeState *responder1;
+    NoiseHandshakeState *responder2;
+    NoiseHandshakeState *other;
+    NoiseDHState *key;
+    NoiseDHState *dh;
+    int index;
+
+    data_name = name;
+
+    /* Create the long-term key that the responders will share */
+    compare(noise_dhstate_new_by_id(&key, NOISE_DH_CURVE25519),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_name
+                (&responder1, name, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_name
+                (&responder2, name, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_set_local_keypair_shared(responder1, key),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_share(key), NOISE_ERROR_INVALID_STATE);
+    verify(!noise_dhstate_is_shared(key));
+    compare(noise_dhstate_set_keypair_private
+                (key, resp_private_25519, sizeof(resp_private_25519)),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_set_local_keypair_shared(responder1, key),
+            NOISE_ERROR_INVALID_STATE);
+    verify(!noise_dhstate_is_shared(key));
+    compare(noise_dhstate_share(key), NOISE_ERROR_NONE);
+    compare(noise_dhstate_share(key), NOISE_ERROR_NONE);
+    compare(key->refs, 0);
+    compare(noise_handshakestate_set_local_keypair_shared(responder1, key),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_set_local_keypair_shared(responder2, key),
+            NOISE_ERROR_NONE);
+    verify(noise_dhstate_is_shared(key));
+    verify(noise_handshakestate_get_local_keypair_dh(responder1) == key);
+    verify(noise_handshakestate_get_local_keypair_dh(responder2) == key);
+    verify(!noise_handshakestate_needs_local_keypair(responder1));
+    verify(noise_handshakestate_has_local_keypair(responder2));
+    compare(key->refs, 2);
+
+    /* The shared key can no longer be modified */
+    compare(noise_dhstate_generate_keypair(key), NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_set_keypair_private
+                (key, init_private_25519, sizeof(init_private_25519)),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_set_public_key
+                (key, init_public_25519, sizeof(init_public_25519)),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_clear_key(key), NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_new_by_id(&dh, NOISE_DH_CURVE25519),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_copy(key, dh), NOISE_ERROR_INVALID_STATE);
+    compare(noise_dhstate_free(dh), NOISE_ERROR_NONE);
+    verify(noise_dhstate_has_keypair(key));
+
+    /* Drop our own reference; the responders keep the key alive */
+    compare(noise_dhstate_free(key), NOISE_ERROR_NONE);
+
+    /* Run a handshake against each responder in turn */
+    for (index = 0; index < 2; ++index) {
+        NoiseHandshakeState *responder = index ? responder2 : responder1;
+        compare(noise_handshakestate_new_by_name
+                    (&initiator, name, NOISE_ROLE_INITIATOR),
+                NOISE_ERROR_NONE);
+        dh = noise_handshakestate_get_local_keypair_dh(initiator);
+        compare(noise_dhstate_set_keypair_private
+                    (dh, init_private_25519, sizeof(init_private_25519)),
+                NOISE_ERROR_NONE);
+        dh = noise_handshakestate_get_remote_public_key_dh(initiator);
+        compare(noise_dhstate_set_public_key
+                    (dh, resp_public_25519, sizeof(resp_public_25519)),
+                NOISE_ERROR_NONE);
+        compare(noise_handshakestate_start(initiator), NOISE_ERROR_NONE);
+        compare(noise_handshakestate_start(responder), NOISE_ERROR_NONE);
+        compare(noise_handshakestate_set_local_keypair_shared
+                    (responder, noise_handshakestate_get_local_keypair_dh
+                                    (responder)),
+                NOISE_ERROR_INVALID_STATE);
+        run_shared_key_handshake(initiator, responder);
+        compare(noise_handshakestate_free(initiator), NOISE_ERROR_NONE);
+
+        /* Free the first responder before using the second */
+        if (!index)
+            compare(noise_handshakestate_free(responder1), NOISE_ERROR_NONE);
+    }
+    compare(noise_handshakestate_free(responder2), NOISE_ERROR_NONE);
+
+    /* Errors when the key is not suitable for the handshake */
+    compare(noise_dhstate_new_by_id(&key, NOISE_DH_CURVE448),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_generate_keypair(key), NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_name
+                (&other, name, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_set_local_keypair_shared(other, key),
+            NOISE_ERROR_NOT_APPLICABLE);
+    compare(noise_handshakestate_set_local_keypair_shared(other, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_handshakestate_set_local_keypair_shared(0, key),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_handshakestate_free(other), NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_name
+                (&other, "Noise_NN_448_ChaChaPoly_BLAKE2s",
+                 NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_set_local_keypair_shared(other, key),
+            NOISE_ERROR_NOT_APPLICABLE);
+    compare(noise_handshakestate_free(other), NOISE_ERROR_NONE);
+    verify(!noise_dhstate_is_shared(key));
+    compare(noise_dhstate_free(key), NOISE_ERROR_NONE);
+    compare(noise_dhstate_new_by_id(&key, NOISE_DH_NEWHOPE),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_generate_keypair(key), NOISE_ERROR_NONE);
+    compare(noise_dhstate_share(key), NOISE_ERROR_NOT_APPLICABLE);
+    compare(noise_dhstate_free(key), NOISE_ERROR_NONE);
+    compare(noise_dhstate_share(0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_dhstate_is_shared(0), 0);
+}
+
+#if defined(HAVE_PTHREAD)
+
+#define SHARED_KEY_THREADS      8
+#define SHARED_KEY_HANDSHAKES   64
+
+/* State for one thread that attaches a shared key to its handshakes */
+typedef struct
+{
+    NoiseDHState *key;
+    NoiseHandshakeState *handshakes[SHARED_KEY_HANDSHAKES];
+    pthread_t thread;
+    int errors;
+
+} SharedKeyThread;
+
+static pthread_mutex_t shared_key_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shared_key_cond = PTHREAD_COND_INITIALIZER;
+static int shared_key_go;
+
+static void *shared_key_attach(void *arg)
+{
+    SharedKeyThread *t = (SharedKeyThread *)arg;
+    int index;
+
+    /* Wait until every thread is ready so that the attaches overlap */
+    pthread_mutex_lock(&shared_key_mutex);
+    while (!shared_key_go)
+        pthread_cond_wait(&shared_key_cond, &shared_key_mutex);
+    pthread_mutex_unlock(&shared_key_mutex);
+
+    /* Attach the key to every handshake and then release them again */
+    for (index = 0; index < SHARED_KEY_HANDSHAKES; ++index) {
+        if (noise_handshakestate_set_local_keypair_shared
+                (t->handshakes[index], t->key) != NOISE_ERROR_NONE)
+            ++(t->errors);
+        if (noise_handshakestate_get_local_keypair_dh
+                (t->handshakes[index]) != t->key)
+            ++(t->errors);
+    }
+    for (index = 0; index < SHARED_KEY_HANDSHAKES; ++index) {
+        if (noise_handshakestate_free(t->handshakes[index])
+                != NOISE_ERROR_NONE)
+            ++(t->errors);
+    }
+    return 0;
+}
+
+#endif
+
+/* Check that several threads can attach the same shared key at once */
+static void handshakestate_check_shared_key_threads(void)
+{
+#if defined(HAVE_PTHREAD)
+    static SharedKeyThread threads[SHARED_KEY_THREADS];
+    NoiseDHState *key;
+    int thread, index;
+
+    compare(noise_dhstate_new_by_id(&key, NOISE_DH_CURVE25519),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_set_keypair_private
+                (key, resp_private_25519, sizeof(resp_private_25519)),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_share(key), NOISE_ERROR_NONE);
+
+    /* Create the handshakes up front and start the threads */
+    shared_key_go = 0;
+    for (thread = 0; thread < SHARED_KEY_THREADS; ++thread) {
+        threads[thread].key = key;
+        threads[thread].errors = 0;
+        for (index = 0; index < SHARED_KEY_HANDSHAKES; ++index) {
+            compare(noise_handshakestate_new_by_name
+                        (&(threads[thread].handshakes[index]),
+                         "Noise_XX_25519_ChaChaPoly_BLAKE2s",
+                         NOISE_ROLE_RESPONDER),
+                    NOISE_ERROR_NONE);
+        }
+        compare(pthread_create(&(threads[thread].thread), 0,
+                               shared_key_attach, &(threads[thread])), 0);
+    }
+
+    /* Release the threads all at once and wait for them to finish */
+    pthread_mutex_lock(&shared_key_mutex);
+    shared_key_go = 1;
+    pthread_cond_broadcast(&shared_key_cond);
+    pthread_mutex_unlock(&shared_key_mutex);
+    for (thread = 0; thread < SHARED_KEY_THREADS; ++thread) {
+        compare(pthread_join(threads[thread].thread, 0), 0);
+        compare(threads[thread].errors, 0);
+    }
+
+    /* Every reference taken by a handshake has been given back */
+    compare(key->refs, 0);
+    verify(noise_dhstate_has_keypair(key));
+    compare(noise_dhstate_free(key), NOISE_ERROR_NONE);
+#endif
+}
+
 static void handshakestate_check_errors(void)
 {
     NoiseHandshakeState *state;
     NoiseProtocolId id;
+    NoiseBuffer mbuf;
+    uint8_t message[64];
 
     /* NULL parameters in various positions */
     compare(noise_handshakestate_has_local_keypair(0), 0);
@@ -703,6 +1107,8 @@ static void handshakestate_check_errors(void)
                  NOISE_DH_CURVE25519),
             NOISE_ERROR_INVALID_PARAM);
     verify(state == NULL);
+    compare(noise_handshakestate_set_concurrent_hybrid(0, 1),
+            NOISE_ERROR_INVALID_PARAM);
     id.prefix_id = NOISE_PREFIX_STANDARD;
     id.pattern_id = NOISE_PATTERN_XX;
     id.dh_id = NOISE_DH_CURVE25519;
@@ -712,6 +1118,30 @@ static void handshakestate_check_errors(void)
     compare(noise_handshakestate_new_by_id(&state, &id, NOISE_DH_CURVE25519),
             NOISE_ERROR_INVALID_PARAM);
     verify(state == NULL);
+
+    /* Errors when checking the first message without a HandshakeState */
+    memset(message, 0, sizeof(message));
+    noise_buffer_set_input(mbuf, message, sizeof(message));
+    compare(noise_handshakestate_check_first_message(0, &mbuf),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_handshakestate_check_first_message(&id, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_handshakestate_check_first_message(&id, &mbuf),
+            NOISE_ERROR_INVALID_PUBLIC_KEY);
+    message[0] = 0x09;
+    compare(noise_handshakestate_check_first_message(&id, &mbuf),
+            NOISE_ERROR_NONE);
+    id.pattern_id = NOISE_PATTERN_XX_FALLBACK;
+    compare(noise_handshakestate_check_first_message(&id, &mbuf),
+            NOISE_ERROR_NOT_APPLICABLE);
+    id.pattern_id = NOISE_PATTERN_XX;
+    id.hybrid_id = NOISE_DH_NEWHOPE;
+    compare(noise_handshakestate_check_first_message(&id, &mbuf),
+            NOISE_ERROR_NOT_APPLICABLE);
+    id.hybrid_id = NOISE_DH_NONE;
+    id.cipher_id = NOISE_HASH_SHA256;
+    compare(noise_handshakestate_check_first_message(&id, &mbuf),
+            NOISE_ERROR_UNKNOWN_ID);
 }
 
 void test_handshakestate(void)
@@ -719,5 +1149,8 @@ void test_handshakestate(void)
     handshakestate_derive_keys();
     handshakestate_check_protocols();
     handshakestate_check_fallback();
+    handshakestate_check_remote_key_callback();
+    handshakestate_check_shared_key();
+    handshakestate_check_shared_key_threads();
     handshakestate_check_errors();
 }
@@ -209,8 +209,94 @@ static void hashstate_check_test_vectors(void)
          "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
          "0x8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
            "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909");
+
+#if NOISE_USE_BLAKE3
+    /* BLAKE3 */
+    check_hash
+        (NOISE_HASH_BLAKE3, 32, 64, "BLAKE3",
+         "",
+         "0xaf1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+    check_hash
+        (NOISE_HASH_BLAKE3, 32, 64, "BLAKE3",
+         "abc",
+         "0x6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+    check_hash
+        (NOISE_HASH_BLAKE3, 32, 64, "BLAKE3",
+         "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "0xc19012cc2aaf0dc3d8e5c45a1b79114d2df42abb2a410bf54be09e891af06ff8");
+#endif
+}
+
+#if NOISE_USE_BLAKE3
+
+/* Check a BLAKE3 hash of a long input made up of the bytes 0..250
+   repeated, which is the input format of the published BLAKE3 test
+   vectors in test_vectors.json */
+static void check_blake3_tree(size_t len, const char *hash)
+{
+    static size_t const steps[] = {1000, 1024, 4097, 65536};
+    NoiseHashState *state;
+    uint8_t *input;
+    uint8_t output[32];
+    uint8_t temp[32];
+    size_t index, posn, step;
+
+    input = (uint8_t *)malloc(len);
+    verify(input != 0);
+    for (index = 0; index < len; ++index)
+        input[index] = (uint8_t)(index % 251);
+    compare(string_to_data(output, sizeof(output), hash), 32);
+    compare(noise_hashstate_new_by_id(&state, NOISE_HASH_BLAKE3),
+            NOISE_ERROR_NONE);
+
+    /* Hash the input in one hit, which uses the tree-parallel path */
+    memset(temp, 0xAA, sizeof(temp));
+    compare(noise_hashstate_hash_one(state, input, len, temp, 32),
+            NOISE_ERROR_NONE);
+    verify(!memcmp(temp, output, 32));
+
+    /* Hash the input in pieces that do not line up with the chunks */
+    for (index = 0; index < sizeof(steps) / sizeof(steps[0]); ++index) {
+        step = steps[index];
+        memset(temp, 0xAA, sizeof(temp));
+        compare(noise_hashstate_reset(state), NOISE_ERROR_NONE);
+        for (posn = 0; posn < len; posn += step) {
+            compare(noise_hashstate_update
+                        (state, input + posn,
+                         (len - posn) < step ? (len - posn) : step),
+                    NOISE_ERROR_NONE);
+        }
+        compare(noise_hashstate_finalize(state, temp, 32), NOISE_ERROR_NONE);
+        verify(!memcmp(temp, output, 32));
+    }
+
+    compare(noise_hashstate_free(state), NOISE_ERROR_NONE);
+    free(input);
+}
+
+/* Check that the BLAKE3 tree mode works across chunks and subtrees */
+static void hashstate_check_blake3_tree(void)
+{
+    check_blake3_tree
+        (1025,
+         "0xd00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444");
+    check_blake3_tree
+        (8193,
+         "0xbab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b");
+    check_blake3_tree
+        (102400,
+         "0xbc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085");
+
+    /* Large enough to be split across several threads when configured
+       with --enable-blake3-threads.  This length is not in the published
+       test vectors; the expected hash is from the "blake3" Python package */
+    check_blake3_tree
+        (2 * 1024 * 1024 + 1,
+         "0x52dc212cb4cc61cb94d25bd7b1d47b256e4c3a6d68956df50c235c37a2aeacd7");
 }
 
+#endif
+
 /* Formats a key for the simple implementation of HMAC */
 static void format_hmac_key(NoiseHashState *state, uint8_t *block,
                             const uint8_t *key, size_t key_len, uint8_t pad)
@@ -339,6 +425,113 @@ static void hashstate_check_hkdf(void)
     hashstate_check_hkdf_algorithm(NOISE_HASH_BLAKE2b);
     hashstate_check_hkdf_algorithm(NOISE_HASH_SHA256);
     hashstate_check_hkdf_algorithm(NOISE_HASH_SHA512);
+#if NOISE_USE_BLAKE3
+    hashstate_check_hkdf_algorithm(NOISE_HASH_BLAKE3);
+#endif
+}
+
+/* Number of inputs for the noise_hashstate_hash_many() tests, chosen so
+   that the inputs do not divide evenly into the SIMD lanes */
+#define HASH_MANY_COUNT 21
+#define HASH_MANY_MAX_INPUT 300
+
+/* Check noise_hashstate_hash_many() against hashing one input at a time */
+static void hashstate_check_hash_many_algorithm(int id)
+{
+    NoiseHashState *state;
+    static uint8_t data[HASH_MANY_COUNT][HASH_MANY_MAX_INPUT];
+    static uint8_t hashes[HASH_MANY_COUNT][MAX_HASH_OUTPUT];
+    static uint8_t expected[HASH_MANY_COUNT][MAX_HASH_OUTPUT];
+    uint8_t untouched[MAX_HASH_OUTPUT];
+    const uint8_t *inputs[HASH_MANY_COUNT];
+    size_t input_lens[HASH_MANY_COUNT];
+    uint8_t *outputs[HASH_MANY_COUNT];
+    size_t hash_len;
+    size_t index, posn;
+
+    compare(noise_hashstate_new_by_id(&state, id), NOISE_ERROR_NONE);
+    hash_len = noise_hashstate_get_hash_length(state);
+
+    /* Lengths around the block and padding boundaries for all algorithms */
+    for (index = 0; index < HASH_MANY_COUNT; ++index) {
+        static size_t const lens[HASH_MANY_COUNT] = {
+            0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129,
+            200, 239, 240, 255, 256, 257, 32, 300, 0
+        };
+        for (posn = 0; posn < HASH_MANY_MAX_INPUT; ++posn)
+            data[index][posn] = (uint8_t)(index * 31 + posn);
+        inputs[index] = data[index];
+        input_lens[index] = lens[index];
+        outputs[index] = hashes[index];
+    }
+
+    /* Hash everything at once and check against the serial results */
+    compare(noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                      hash_len, HASH_MANY_COUNT),
+            NOISE_ERROR_NONE);
+    for (index = 0; index < HASH_MANY_COUNT; ++index) {
+        compare(noise_hashstate_hash_one(state, inputs[index],
+                                         input_lens[index],
+                                         expected[index], hash_len),
+                NOISE_ERROR_NONE);
+        compare_blocks(hashes[index], hash_len, expected[index], hash_len);
+    }
+
+    /* Batches of every size up to the maximum give the same results,
+       and the outputs past the end of the batch are left alone */
+    memset(untouched, 0xAA, sizeof(untouched));
+    for (index = 1; index <= HASH_MANY_COUNT; ++index) {
+        memset(hashes, 0xAA, sizeof(hashes));
+        compare(noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                          hash_len, index),
+                NOISE_ERROR_NONE);
+        for (posn = 0; posn < HASH_MANY_COUNT; ++posn) {
+            if (posn < index) {
+                compare_blocks(hashes[posn], hash_len,
+                               expected[posn], hash_len);
+            } else {
+                compare_blocks(hashes[posn], hash_len, untouched, hash_len);
+            }
+        }
+    }
+
+    /* Error conditions */
+    compare(noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                      hash_len, 0),
+            NOISE_ERROR_NONE);
+    compare(noise_hashstate_hash_many(id, 0, input_lens, outputs,
+                                      hash_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_hashstate_hash_many(id, inputs, 0, outputs,
+                                      hash_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_hashstate_hash_many(id, inputs, input_lens, 0,
+                                      hash_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                      hash_len - 1, 1),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_hashstate_hash_many(NOISE_CIPHER_AESGCM, inputs, input_lens,
+                                      outputs, hash_len, 1),
+            NOISE_ERROR_UNKNOWN_ID);
+    outputs[2] = 0;
+    compare(noise_hashstate_hash_many(id, inputs, input_lens, outputs,
+                                      hash_len, 3),
+            NOISE_ERROR_INVALID_PARAM);
+
+    compare(noise_hashstate_free(state), NOISE_ERROR_NONE);
+}
+
+/* Check the behaviour of the noise_hashstate_hash_many() function */
+static void hashstate_check_hash_many(void)
+{
+    hashstate_check_hash_many_algorithm(NOISE_HASH_BLAKE2s);
+    hashstate_check_hash_many_algorithm(NOISE_HASH_BLAKE2b);
+    hashstate_check_hash_many_algorithm(NOISE_HASH_SHA256);
+    hashstate_check_hash_many_algorithm(NOISE_HASH_SHA512);
+#if NOISE_USE_BLAKE3
+    hashstate_check_hash_many_algorithm(NOISE_HASH_BLAKE3);
+#endif
 }
 
 /* Check the behaviour of the noise_hashstate_pbkdf2() function */
@@ -454,7 +647,11 @@ static void hashstate_check_errors(void)
 void test_hashstate(void)
 {
     hashstate_check_test_vectors();
+#if NOISE_USE_BLAKE3
+    hashstate_check_blake3_tree();
+#endif
     hashstate_check_hkdf();
+    hashstate_check_hash_many();
     hashstate_check_pbkdf2();
     hashstate_check_errors();
 }
@@ -41,15 +41,19 @@ int main(int argc, char *argv[])
 
     /* Run all tests */
     test(cipherstate);
+    test(cookiestate);
+    test(datagram);
     test(dhstate);
     test(errors);
     test(handshakestate);
     test(hashstate);
     test(names);
     test(patterns);
+    test(pipestate);
     test(protobufs);
     test(randstate);
     test(signstate);
+    test(streamstate);
     test(symmetricstate);
 
     /* Report the results */
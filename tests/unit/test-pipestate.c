@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test-helpers.h"
+
+static uint8_t const psk[32] = {
+    0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20,
+    0x6d, 0x79, 0x20, 0x41, 0x75, 0x73, 0x74, 0x72,
+    0x61, 0x6c, 0x69, 0x61, 0x6e, 0x20, 0x70, 0x65,
+    0x72, 0x6d, 0x69, 0x74, 0x2d, 0x61, 0x6c, 0x6c
+};
+
+/* Sets the prologue and PSK on a HandshakeState and starts it */
+static void pipe_start(NoiseHandshakeState *state)
+{
+    compare(noise_handshakestate_set_prologue(state, "Pipes", 5),
+            NOISE_ERROR_NONE);
+    if (noise_handshakestate_needs_pre_shared_key(state)) {
+        compare(noise_handshakestate_set_pre_shared_key
+                    (state, psk, sizeof(psk)),
+                NOISE_ERROR_NONE);
+    }
+    compare(noise_handshakestate_start(state), NOISE_ERROR_NONE);
+}
+
+/* Connects a client PipeState to a server with a specific static key */
+static void pipe_connect
+    (NoisePipeState *pipe, const NoiseDHState *server_key,
+     int expected_pattern)
+{
+    NoiseHandshakeState *client;
+    NoiseHandshakeState *server;
+    NoiseProtocolId id;
+    uint8_t message[8192];
+    uint8_t payload[23];
+    uint8_t key1[56];
+    uint8_t key2[56];
+    size_t key_len;
+    NoiseBuffer mbuf;
+    NoiseBuffer pbuf;
+    int err;
+
+    /* Create the client's HandshakeState and write the first message */
+    compare(noise_pipestate_new_handshake(pipe, &client), NOISE_ERROR_NONE);
+    pipe_start(client);
+    memset(payload, 0x66, sizeof(payload));
+    noise_buffer_set_output(mbuf, message, sizeof(message));
+    noise_buffer_set_input(pbuf, payload, sizeof(payload));
+    compare(noise_handshakestate_write_message(client, &mbuf, &pbuf),
+            NOISE_ERROR_NONE);
+
+    /* Create the server and read the first message, falling back if
+       the client used the wrong key for the abbreviated handshake */
+    compare(noise_handshakestate_get_protocol_id(client, &id),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_new_by_id(&server, &id, NOISE_ROLE_RESPONDER),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_copy
+                (noise_handshakestate_get_local_keypair_dh(server), server_key),
+            NOISE_ERROR_NONE);
+    pipe_start(server);
+    noise_buffer_set_output(pbuf, payload, sizeof(payload));
+    err = noise_handshakestate_read_message(server, &mbuf, &pbuf);
+    if (err == NOISE_ERROR_MAC_FAILURE) {
+        if (id.pattern_id == NOISE_PATTERN_IK) {
+            compare(noise_handshakestate_fallback(server), NOISE_ERROR_NONE);
+        } else {
+            compare(noise_handshakestate_fallback_to
+                        (server, NOISE_PATTERN_XX_FALLBACK_HFS),
+                    NOISE_ERROR_NONE);
+        }
+        pipe_start(server);
+    } else {
+        compare(err, NOISE_ERROR_NONE);
+    }
+
+    /* Run the rest of the handshake, reading on the client via the pipe */
+    for (;;) {
+        if (noise_handshakestate_get_action(server) ==
+                NOISE_ACTION_WRITE_MESSAGE) {
+            noise_buffer_set_output(mbuf, message, sizeof(message));
+            noise_buffer_set_input(pbuf, payload, sizeof(payload));
+            compare(noise_handshakestate_write_message(server, &mbuf, &pbuf),
+                    NOISE_ERROR_NONE);
+            noise_buffer_set_output(pbuf, payload, sizeof(payload));
+            compare(noise_pipestate_read_message(pipe, client, &mbuf, &pbuf),
+                    NOISE_ERROR_NONE);
+        } else if (noise_handshakestate_get_action(client) ==
+                        NOISE_ACTION_WRITE_MESSAGE) {
+            noise_buffer_set_output(mbuf, message, sizeof(message));
+            noise_buffer_set_input(pbuf, payload, sizeof(payload));
+            compare(noise_handshakestate_write_message(client, &mbuf, &pbuf),
+                    NOISE_ERROR_NONE);
+            noise_buffer_set_output(pbuf, payload, sizeof(payload));
+            compare(noise_handshakestate_read_message(server, &mbuf, &pbuf),
+                    NOISE_ERROR_NONE);
+        } else {
+            break;
+        }
+    }
+
+    /* Check that the handshake finished with the expected pattern */
+    compare(noise_handshakestate_get_action(client), NOISE_ACTION_SPLIT);
+    compare(noise_handshakestate_get_action(server), NOISE_ACTION_SPLIT);
+    compare(noise_handshakestate_get_handshake_hash(client, message, 64),
+            NOISE_ERROR_NONE);
+    compare(noise_handshakestate_get_handshake_hash(server, message + 64, 64),
+            NOISE_ERROR_NONE);
+    verify(!memcmp(message, message + 64, 64));
+    compare(noise_handshakestate_get_protocol_id(client, &id),
+            NOISE_ERROR_NONE);
+    compare(id.pattern_id, expected_pattern);
+
+    /* The cache should now contain the server's key */
+    key_len = noise_dhstate_get_public_key_length(server_key);
+    compare(noise_dhstate_get_public_key(server_key, key1, key_len),
+            NOISE_ERROR_NONE);
+    compare(noise_dhstate_get_public_key
+                (noise_pipestate_get_remote_public_key_dh(pipe), key2, key_len),
+            NOISE_ERROR_NONE);
+    compare_blocks(key2, key_len, key1, key_len);
+
+    /* Clean up */
+    compare(noise_handshakestate_free(client), NOISE_ERROR_NONE);
+    compare(noise_handshakestate_free(server), NOISE_ERROR_NONE);
+}
+
+/* Run a sequence of connections with changing server keys */
+static void check_pipe_protocol(const char *name)
+{
+    NoisePipeState *pipe;
+    NoiseHandshakeState *handshake;
+    NoiseDHState *server_key1;
+    NoiseDHState *server_key2;
+    NoiseDHState *dh;
+    NoiseProtocolId id;
+    int abbrev_pattern;
+    int full_pattern;
+    int fallback_pattern;
+
+    /* Set the name of this test for error reporting */
+    data_name = name;
+    compare(noise_protocol_name_to_id(&id, name, strlen(name)),
+            NOISE_ERROR_NONE);
+    abbrev_pattern = id.pattern_id;
+    if (abbrev_pattern == NOISE_PATTERN_IK) {
+        full_pattern = NOISE_PATTERN_XX;
+        fallback_pattern = NOISE_PATTERN_XX_FALLBACK;
+    } else {
+        full_pattern = NOISE_PATTERN_XX_HFS;
+        fallback_pattern = NOISE_PATTERN_XX_FALLBACK_HFS;
+    }
+
+    /* Create the pipe and the two static keys for the server */
+    compare(noise_pipestate_new_by_name(&pipe, name), NOISE_ERROR_NONE);
+    compare(noise_dhstate_new_by_id(&server_key1, id.dh_id), NOISE_ERROR_NONE);
+    compare(noise_dhstate_new_by_id(&server_key2, id.dh_id), NOISE_ERROR_NONE);
+    compare(noise_dhstate_generate_keypair(server_key1), NOISE_ERROR_NONE);
+    compare(noise_dhstate_generate_keypair(server_key2), NOISE_ERROR_NONE);
+
+    /* Cannot create a handshake until the local keypair is set */
+    dh = noise_pipestate_get_local_keypair_dh(pipe);
+    verify(dh != 0);
+    verify(noise_pipestate_get_remote_public_key_dh(pipe) != 0);
+    compare(noise_pipestate_new_handshake(pipe, &handshake),
+            NOISE_ERROR_LOCAL_KEY_REQUIRED);
+    verify(handshake == 0);
+    compare(noise_dhstate_generate_keypair(dh), NOISE_ERROR_NONE);
+
+    /* First connection uses the full handshake and fills the cache */
+    verify(!noise_dhstate_has_public_key
+                (noise_pipestate_get_remote_public_key_dh(pipe)));
+    pipe_connect(pipe, server_key1, full_pattern);
+
+    /* Second connection uses the abbreviated handshake */
+    pipe_connect(pipe, server_key1, abbrev_pattern);
+
+    /* The server changes its key, so we fall back and update the cache */
+    pipe_connect(pipe, server_key2, fallback_pattern);
+    pipe_connect(pipe, server_key2, abbrev_pattern);
+
+    /* Clearing the cache forces the full handshake again */
+    compare(noise_dhstate_clear_key
+                (noise_pipestate_get_remote_public_key_dh(pipe)),
+            NOISE_ERROR_NONE);
+    pipe_connect(pipe, server_key1, full_pattern);
+
+    /* Clean up */
+    compare(noise_pipestate_free(pipe), NOISE_ERROR_NONE);
+    noise_dhstate_free(server_key1);
+    noise_dhstate_free(server_key2);
+}
+
+/* Check the handling of bad parameters */
+static void pipestate_check_errors(void)
+{
+    NoisePipeState *pipe;
+    NoiseHandshakeState *handshake;
+    NoiseBuffer mbuf;
+    uint8_t message[16];
+
+    pipe = (NoisePipeState *)8;
+    compare(noise_pipestate_new_by_name(&pipe, 0), NOISE_ERROR_INVALID_PARAM);
+    verify(pipe == 0);
+    compare(noise_pipestate_new_by_name(0, "Noise_IK_25519_AESGCM_SHA256"),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_pipestate_new_by_id(&pipe, 0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_pipestate_new_by_name(&pipe, "Noise_IK_25519_AESGCM_SHA"),
+            NOISE_ERROR_UNKNOWN_NAME);
+    compare(noise_pipestate_new_by_name(&pipe, "Noise_XX_25519_AESGCM_SHA256"),
+            NOISE_ERROR_NOT_APPLICABLE);
+    verify(pipe == 0);
+
+    compare(noise_pipestate_new_by_name(&pipe, "Noise_IK_25519_AESGCM_SHA256"),
+            NOISE_ERROR_NONE);
+    compare(noise_pipestate_free(0), NOISE_ERROR_INVALID_PARAM);
+    verify(noise_pipestate_get_local_keypair_dh(0) == 0);
+    verify(noise_pipestate_get_remote_public_key_dh(0) == 0);
+    compare(noise_pipestate_new_handshake(0, &handshake),
+            NOISE_ERROR_INVALID_PARAM);
+    verify(handshake == 0);
+    compare(noise_pipestate_new_handshake(pipe, 0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_dhstate_generate_keypair
+                (noise_pipestate_get_local_keypair_dh(pipe)),
+            NOISE_ERROR_NONE);
+    compare(noise_pipestate_new_handshake(pipe, &handshake), NOISE_ERROR_NONE);
+    noise_buffer_set_input(mbuf, message, sizeof(message));
+    compare(noise_pipestate_read_message(0, handshake, &mbuf, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_pipestate_read_message(pipe, 0, &mbuf, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_pipestate_read_message(pipe, handshake, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_pipestate_read_message(pipe, handshake, &mbuf, 0),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_handshakestate_free(handshake), NOISE_ERROR_NONE);
+    compare(noise_pipestate_free(pipe), NOISE_ERROR_NONE);
+}
+
+void test_pipestate(void)
+{
+    check_pipe_protocol("Noise_IK_25519_ChaChaPoly_BLAKE2s");
+    check_pipe_protocol("NoisePSK_IK_448_AESGCM_SHA512");
+    check_pipe_protocol("Noise_IKhfs_25519+NewHope_ChaChaPoly_SHA256");
+    pipestate_check_errors();
+}
@@ -376,6 +376,94 @@ static void signstate_check_generate_keypair(void)
     check_dh_generate(NOISE_SIGN_ED25519);
 }
 
+/* Number of messages to sign in the batch test; not a multiple of the
+   batch size used internally by the Ed25519 back end */
+#define BATCH_COUNT 37
+
+/* Check that batch signing gives the same results as signing one at a time */
+static void check_sign_batch(int id)
+{
+    NoiseSignState *state;
+    static uint8_t msgs[BATCH_COUNT][MAX_MESSAGE_LEN];
+    static uint8_t sigs[BATCH_COUNT][MAX_SIGNATURE_LEN];
+    uint8_t sig[MAX_SIGNATURE_LEN];
+    const uint8_t *msg_ptrs[BATCH_COUNT];
+    uint8_t *sig_ptrs[BATCH_COUNT];
+    size_t msg_lens[BATCH_COUNT];
+    size_t signature_len;
+    size_t index;
+
+    compare(noise_signstate_new_by_id(&state, id), NOISE_ERROR_NONE);
+    signature_len = noise_signstate_get_signature_length(state);
+
+    /* Cannot sign without a keypair */
+    msg_ptrs[0] = msgs[0];
+    msg_lens[0] = 0;
+    sig_ptrs[0] = sigs[0];
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, sig_ptrs, signature_len, 1),
+            NOISE_ERROR_INVALID_PRIVATE_KEY);
+    compare(noise_signstate_generate_keypair(state), NOISE_ERROR_NONE);
+
+    /* Set up messages of various lengths */
+    for (index = 0; index < BATCH_COUNT; ++index) {
+        memset(msgs[index], (int)(index + 1), MAX_MESSAGE_LEN);
+        msg_ptrs[index] = msgs[index];
+        msg_lens[index] = (index * 7) % (MAX_MESSAGE_LEN + 1);
+        sig_ptrs[index] = sigs[index];
+    }
+
+    /* Sign and check against the single-message results */
+    memset(sigs, 0x66, sizeof(sigs));
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, sig_ptrs, signature_len,
+                 BATCH_COUNT),
+            NOISE_ERROR_NONE);
+    for (index = 0; index < BATCH_COUNT; ++index) {
+        compare(noise_signstate_sign(state, msgs[index], msg_lens[index],
+                                     sig, signature_len),
+                NOISE_ERROR_NONE);
+        compare_blocks(sigs[index], signature_len, sig, signature_len);
+        compare(noise_signstate_verify(state, msgs[index], msg_lens[index],
+                                       sigs[index], signature_len),
+                NOISE_ERROR_NONE);
+    }
+
+    /* An empty batch does nothing */
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, sig_ptrs, signature_len, 0),
+            NOISE_ERROR_NONE);
+
+    /* Error conditions */
+    compare(noise_signstate_sign_batch
+                (0, msg_ptrs, msg_lens, sig_ptrs, signature_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_signstate_sign_batch
+                (state, 0, msg_lens, sig_ptrs, signature_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, 0, sig_ptrs, signature_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, 0, signature_len, 1),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, sig_ptrs, signature_len - 1, 1),
+            NOISE_ERROR_INVALID_LENGTH);
+    sig_ptrs[1] = 0;
+    compare(noise_signstate_sign_batch
+                (state, msg_ptrs, msg_lens, sig_ptrs, signature_len, 2),
+            NOISE_ERROR_INVALID_PARAM);
+
+    compare(noise_signstate_free(state), NOISE_ERROR_NONE);
+}
+
+/* Check signing of several messages at once */
+static void signstate_check_sign_batch(void)
+{
+    check_sign_batch(NOISE_SIGN_ED25519);
+}
+
 /* Check other error conditions that can be reported by the functions */
 static void signstate_check_errors(void)
 {
@@ -414,5 +502,6 @@ void test_signstate(void)
 {
     signstate_check_test_vectors();
     signstate_check_generate_keypair();
+    signstate_check_sign_batch();
     signstate_check_errors();
 }
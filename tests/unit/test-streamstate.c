@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2016 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test-helpers.h"
+#if !defined(__WIN32__) && !defined(WIN32)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#define RECORD_COUNT    600
+#define MAX_RECORD_LEN  300
+#define MAC_LEN         16
+
+static uint8_t const stream_key[32] = {
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f
+};
+
+static uint8_t plaintext[RECORD_COUNT][MAX_RECORD_LEN];
+static uint8_t ciphertext[RECORD_COUNT][MAX_RECORD_LEN + MAC_LEN];
+static uint8_t output[RECORD_COUNT][MAX_RECORD_LEN + MAC_LEN];
+
+static size_t record_len(size_t index)
+{
+    return (index * 37) % MAX_RECORD_LEN;
+}
+
+static NoiseCipherState *stream_cipher(int cipher_id)
+{
+    NoiseCipherState *cipher;
+    compare(noise_cipherstate_new_by_id(&cipher, cipher_id), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_init_key(cipher, stream_key, 32),
+            NOISE_ERROR_NONE);
+    return cipher;
+}
+
+/* Drains the records that are pending and checks them against the
+   expected data, which is the output of a plain CipherState */
+static void stream_collect
+    (NoiseStreamState *stream, size_t *next, size_t end, int encrypt)
+{
+    NoiseBuffer mbuf;
+    size_t len;
+    while (*next < end) {
+        compare(noise_streamstate_next(stream, &mbuf), NOISE_ERROR_NONE);
+        verify(mbuf.data == output[*next]);
+        len = record_len(*next);
+        if (encrypt) {
+            compare_blocks(mbuf.data, mbuf.size,
+                           ciphertext[*next], len + MAC_LEN);
+        } else {
+            compare_blocks(mbuf.data, mbuf.size, plaintext[*next], len);
+        }
+        ++(*next);
+    }
+}
+
+/* Encrypts and decrypts a stream of records with a StreamState and
+   compares the results with a plain CipherState */
+static void streamstate_check(int cipher_id, size_t num_threads)
+{
+    NoiseCipherState *serial = stream_cipher(cipher_id);
+    NoiseCipherState *cipher;
+    NoiseStreamState *stream;
+    NoiseBuffer mbuf;
+    size_t index;
+    size_t next;
+    size_t len;
+
+    /* Generate the expected ciphertext, starting at a non-zero nonce */
+    compare(noise_cipherstate_set_nonce(serial, 5), NOISE_ERROR_NONE);
+    for (index = 0; index < RECORD_COUNT; ++index) {
+        len = record_len(index);
+        memset(plaintext[index], (int)(index * 3), len);
+        memcpy(ciphertext[index], plaintext[index], len);
+        noise_buffer_set_inout(mbuf, ciphertext[index], len,
+                               sizeof(ciphertext[index]));
+        compare(noise_cipherstate_encrypt(serial, &mbuf), NOISE_ERROR_NONE);
+        compare(mbuf.size, len + MAC_LEN);
+    }
+
+    /* Encrypt the stream out of place.  The records are submitted in
+       bursts so that the ring fills up and wraps around */
+    cipher = stream_cipher(cipher_id);
+    compare(noise_cipherstate_set_nonce(cipher, 5), NOISE_ERROR_NONE);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                                  num_threads),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_get_threads(stream), num_threads);
+    next = 0;
+    for (index = 0; index < RECORD_COUNT; ++index) {
+        if (noise_streamstate_get_pending(stream) == NOISE_STREAM_MAX_PENDING) {
+            compare(noise_streamstate_submit
+                        (stream, plaintext[index], record_len(index),
+                         output[index], sizeof(output[index])),
+                    NOISE_ERROR_INVALID_STATE);
+            stream_collect(stream, &next, index - 100, 1);
+        }
+        compare(noise_streamstate_submit
+                    (stream, plaintext[index], record_len(index),
+                     output[index], sizeof(output[index])),
+                NOISE_ERROR_NONE);
+    }
+    stream_collect(stream, &next, RECORD_COUNT, 1);
+    compare(noise_streamstate_get_pending(stream), 0);
+    compare(noise_streamstate_next(stream, &mbuf), NOISE_ERROR_INVALID_STATE);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+
+    /* The session's nonce has moved on past the stream */
+    memset(output[0], 0x55, 10);
+    noise_buffer_set_inout(mbuf, output[0], 10, sizeof(output[0]));
+    compare(noise_cipherstate_encrypt(cipher, &mbuf), NOISE_ERROR_NONE);
+    memset(output[1], 0x55, 10);
+    noise_buffer_set_inout(mbuf, output[1], 10, sizeof(output[1]));
+    compare(noise_cipherstate_encrypt(serial, &mbuf), NOISE_ERROR_NONE);
+    compare_blocks(output[0], 10 + MAC_LEN, output[1], 10 + MAC_LEN);
+    compare(noise_cipherstate_free(cipher), NOISE_ERROR_NONE);
+
+    /* Decrypt the stream in place */
+    cipher = stream_cipher(cipher_id);
+    compare(noise_cipherstate_set_nonce(cipher, 5), NOISE_ERROR_NONE);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_DECRYPT,
+                                  num_threads),
+            NOISE_ERROR_NONE);
+    for (index = 0; index < RECORD_COUNT; ++index)
+        memcpy(output[index], ciphertext[index], record_len(index) + MAC_LEN);
+    next = 0;
+    for (index = 0; index < RECORD_COUNT; ++index) {
+        if (noise_streamstate_get_pending(stream) == NOISE_STREAM_MAX_PENDING)
+            stream_collect(stream, &next, index, 0);
+        compare(noise_streamstate_submit
+                    (stream, output[index], record_len(index) + MAC_LEN,
+                     output[index], sizeof(output[index])),
+                NOISE_ERROR_NONE);
+    }
+    stream_collect(stream, &next, RECORD_COUNT, 0);
+
+    /* A corrupted record fails on its own */
+    memcpy(output[0], ciphertext[RECORD_COUNT - 1],
+           record_len(RECORD_COUNT - 1) + MAC_LEN);
+    compare(noise_streamstate_submit
+                (stream, output[0], record_len(RECORD_COUNT - 1) + MAC_LEN,
+                 output[0], sizeof(output[0])),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_next(stream, &mbuf), NOISE_ERROR_MAC_FAILURE);
+    compare(mbuf.size, 0);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_free(cipher), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_free(serial), NOISE_ERROR_NONE);
+}
+
+/* Check the handling of bad parameters */
+static void streamstate_bad_params(void)
+{
+    NoiseCipherState *cipher;
+    NoiseStreamState *stream;
+    NoiseBuffer mbuf;
+    uint8_t data[64];
+
+    compare(noise_cipherstate_new_by_id(&cipher, NOISE_CIPHER_CHACHAPOLY),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT, 0),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_cipherstate_init_key(cipher, stream_key, 32),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_new(0, cipher, NOISE_STREAM_ENCRYPT, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_new(&stream, 0, NOISE_STREAM_ENCRYPT, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_new(&stream, cipher, 0, 0),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                                  NOISE_STREAM_MAX_THREADS + 1),
+            NOISE_ERROR_INVALID_PARAM);
+
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT, 1),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_submit(0, data, 16, data, sizeof(data)),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_submit(stream, 0, 16, data, sizeof(data)),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_submit(stream, data, 16, 0, sizeof(data)),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_submit(stream, data, 49, data, sizeof(data)),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_submit(stream, data, NOISE_MAX_PAYLOAD_LEN,
+                                     data, NOISE_MAX_PAYLOAD_LEN + MAC_LEN),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_next(0, &mbuf), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_next(stream, 0), NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_get_pending(0), 0);
+    compare(noise_streamstate_get_threads(0), 0);
+    compare(noise_streamstate_free(0), NOISE_ERROR_INVALID_PARAM);
+
+    /* Records that are never collected are discarded */
+    compare(noise_streamstate_submit(stream, data, 16, data, sizeof(data)),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_DECRYPT, 0),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_submit(stream, data, MAC_LEN - 1,
+                                     data, sizeof(data)),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_submit(stream, data, 32, data, 31),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_free(cipher), NOISE_ERROR_NONE);
+}
+
+#if !defined(__WIN32__) && !defined(WIN32)
+
+/* Size of the file for noise_streamstate_send_file(), which is big
+   enough to need several windows */
+#define FILE_SIZE       4300000
+#define FILE_OFFSET     1000
+#define FILE_PART1      2500000
+#define FILE_PART2      1700000
+
+/* Creates an empty temporary file */
+static int stream_temp_file(void)
+{
+    char name[] = "/tmp/noise-stream-XXXXXX";
+    int fd = mkstemp(name);
+    verify(fd >= 0);
+    unlink(name);
+    return fd;
+}
+
+/* Sends a file with noise_streamstate_send_file() and then decrypts the
+   result with a plain CipherState */
+static void streamstate_send_file(size_t num_threads)
+{
+    NoiseCipherState *cipher = stream_cipher(NOISE_CIPHER_CHACHAPOLY);
+    NoiseCipherState *recv = stream_cipher(NOISE_CIPHER_CHACHAPOLY);
+    NoiseStreamState *stream;
+    NoiseBuffer mbuf;
+    uint8_t *data = (uint8_t *)malloc(FILE_SIZE);
+    uint8_t *sent = (uint8_t *)malloc(FILE_SIZE * 2);
+    int in_fd = stream_temp_file();
+    int out_fd = stream_temp_file();
+    size_t posn;
+    size_t len;
+    size_t received;
+    int pipe_fds[2];
+
+    /* Create the file to be sent */
+    verify(data != 0 && sent != 0);
+    for (posn = 0; posn < FILE_SIZE; ++posn)
+        data[posn] = (uint8_t)(posn * 7 + (posn >> 12));
+    compare(write(in_fd, data, FILE_SIZE), FILE_SIZE);
+
+    /* Send the range in two parts to check that the nonces carry on */
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                                  num_threads),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, FILE_OFFSET, FILE_PART1),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, FILE_OFFSET + FILE_PART1, 0),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, FILE_OFFSET + FILE_PART1,
+                 FILE_PART2),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_get_pending(stream), 0);
+
+    /* Parts of the range that are past the end of the file */
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, FILE_SIZE - 10, 11),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, FILE_SIZE + 1, 0),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_send_file
+                (stream, out_fd, in_fd, 0xFFFFFFFFFFFFFFF0ULL, 0x20),
+            NOISE_ERROR_INVALID_LENGTH);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+
+    /* Decrypt the length-prefixed records that were written */
+    len = (size_t)lseek(out_fd, 0, SEEK_CUR);
+    verify(len < FILE_SIZE * 2);
+    compare(pread(out_fd, sent, len, 0), len);
+    posn = 0;
+    received = 0;
+    while (posn < len) {
+        verify((len - posn) >= 2);
+        mbuf.size = (((size_t)(sent[posn])) << 8) | sent[posn + 1];
+        verify(mbuf.size <= (len - posn - 2));
+        mbuf.data = sent + posn + 2;
+        mbuf.max_size = mbuf.size;
+        compare(noise_cipherstate_decrypt(recv, &mbuf), NOISE_ERROR_NONE);
+        verify(mbuf.size > 0);
+        memmove(sent + received, mbuf.data, mbuf.size);
+        received += mbuf.size;
+        posn += mbuf.size + 18;
+    }
+    compare_blocks(sent, received,
+                   data + FILE_OFFSET, FILE_PART1 + FILE_PART2);
+
+    /* Both ends agree on the next nonce */
+    memset(data, 0x66, 10);
+    noise_buffer_set_inout(mbuf, data, 10, FILE_SIZE);
+    compare(noise_cipherstate_encrypt(cipher, &mbuf), NOISE_ERROR_NONE);
+    compare(noise_cipherstate_decrypt(recv, &mbuf), NOISE_ERROR_NONE);
+
+    /* Errors from the socket are reported with errno, which is tested
+       by writing to the read end of a pipe */
+    compare(pipe(pipe_fds), 0);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_ENCRYPT,
+                                  num_threads),
+            NOISE_ERROR_NONE);
+    errno = 0;
+    compare(noise_streamstate_send_file
+                (stream, pipe_fds[0], in_fd, 0, FILE_SIZE),
+            NOISE_ERROR_SYSTEM);
+    compare(errno, EBADF);
+    compare(noise_streamstate_get_pending(stream), 0);
+    compare(noise_streamstate_send_file(stream, -1, in_fd, 0, 10),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_send_file(stream, out_fd, -1, 0, 10),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_send_file(0, out_fd, in_fd, 0, 10),
+            NOISE_ERROR_INVALID_PARAM);
+    compare(noise_streamstate_submit(stream, data, 16, data, 32),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_send_file(stream, out_fd, in_fd, 0, 10),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+    compare(noise_streamstate_new(&stream, cipher, NOISE_STREAM_DECRYPT,
+                                  num_threads),
+            NOISE_ERROR_NONE);
+    compare(noise_streamstate_send_file(stream, out_fd, in_fd, 0, 10),
+            NOISE_ERROR_INVALID_STATE);
+    compare(noise_streamstate_free(stream), NOISE_ERROR_NONE);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    close(in_fd);
+    close(out_fd);
+    free(data);
+    free(sent);
+    noise_cipherstate_free(cipher);
+    noise_cipherstate_free(recv);
+}
+
+#endif
+
+void test_streamstate(void)
+{
+    streamstate_check(NOISE_CIPHER_CHACHAPOLY, 0);
+    streamstate_check(NOISE_CIPHER_CHACHAPOLY, 1);
+    streamstate_check(NOISE_CIPHER_CHACHAPOLY, 4);
+    streamstate_check(NOISE_CIPHER_AESGCM, 0);
+    streamstate_check(NOISE_CIPHER_AESGCM, 3);
+    streamstate_bad_params();
+#if !defined(__WIN32__) && !defined(WIN32)
+    streamstate_send_file(0);
+    streamstate_send_file(2);
+#endif
+}
@@ -25,6 +25,8 @@
 
 #define MAX_HASH_OUTPUT 64
 #define MAX_DATA_LEN    128
+#define LARGE_DATA_LEN  4200
+#define MAX_MAC_LEN     16
 
 typedef struct
 {
@@ -103,11 +105,17 @@ static void check_symmetric_object
         "0123456789",
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
     };
+    static size_t const large_sizes[] = {
+        511, 512, 513, 1023, 1500, LARGE_DATA_LEN
+    };
     size_t num_data_vals = sizeof(data_vals) / sizeof(data_vals[0]);
-    HashValue ck, h;
+    size_t num_large_sizes = sizeof(large_sizes) / sizeof(large_sizes[0]);
+    static uint8_t large[LARGE_DATA_LEN + MAX_MAC_LEN];
+    static uint8_t large2[LARGE_DATA_LEN + MAX_MAC_LEN];
+    HashValue ck, h, prev;
     HKDFValue temp;
     const uint8_t *data;
-    size_t index, len;
+    size_t index, len, posn;
     size_t key_len;
     size_t mac_len;
     uint8_t buffer[MAX_DATA_LEN];
@@ -340,6 +348,49 @@ static void check_symmetric_object
                 NOISE_ERROR_INVALID_LENGTH);
     }
 
+    /* Large payloads are encrypted and hashed in chunks, so check
+       sizes around the chunk boundaries against the simple model */
+    for (index = 0; index < num_large_sizes; ++index) {
+        len = large_sizes[index];
+        for (posn = 0; posn < len; ++posn)
+            large[posn] = (uint8_t)(posn * 7 + index);
+        memcpy(large2, large, len);
+        noise_buffer_set_inout(mbuf, large2, len, sizeof(large2));
+        compare(noise_cipherstate_encrypt_with_ad
+                    (cipherstate, h.hash, hash_len, &mbuf),
+                NOISE_ERROR_NONE);
+        noise_buffer_set_inout(mbuf, large, len, sizeof(large));
+        compare(noise_symmetricstate_encrypt_and_hash(state1, &mbuf),
+                NOISE_ERROR_NONE);
+        compare(mbuf.size, len + mac_len);
+        verify(!memcmp(mbuf.data, large2, len + mac_len));
+        prev = h;
+        h = HASHTwo(h, large, len + mac_len);
+        verify(!memcmp(h.hash, state1->h, hash_len));
+        noise_buffer_set_input(mbuf, large2, len + mac_len);
+        compare(noise_symmetricstate_decrypt_and_hash(state3, &mbuf),
+                NOISE_ERROR_NONE);
+        verify(!memcmp(h.hash, state3->h, hash_len));
+
+        /* A bad MAC must not change the handshake hash */
+        large[len / 2] ^= 0x01;
+        noise_buffer_set_input(mbuf, large, len + mac_len);
+        compare(noise_symmetricstate_decrypt_and_hash(state2, &mbuf),
+                NOISE_ERROR_MAC_FAILURE);
+        verify(!memcmp(prev.hash, state2->h, hash_len));
+        large[len / 2] ^= 0x01;
+        noise_buffer_set_input(mbuf, large, len + mac_len);
+        compare(noise_symmetricstate_decrypt_and_hash(state2, &mbuf),
+                NOISE_ERROR_NONE);
+        compare(mbuf.size, len);
+        for (posn = 0; posn < len; ++posn) {
+            if (large[posn] != (uint8_t)(posn * 7 + index))
+                break;
+        }
+        compare(posn, len);
+        verify(!memcmp(h.hash, state2->h, hash_len));
+    }
+
     /* Final check on the chaining key and handshake hash */
     verify(!memcmp(ck.hash, state1->ck, hash_len));
     verify(!memcmp(h.hash, state1->h, hash_len));
@@ -546,6 +597,9 @@ static void symmetricstate_check_protocols(void)
     check_symmetric("NoisePSK_N_25519_ChaChaPoly_BLAKE2s");
     check_symmetric("NoisePSK_XXfallback_448_AESGCM_SHA512");
     check_symmetric("NoisePSK_IK_448_ChaChaPoly_BLAKE2b");
+#if NOISE_USE_AEGIS256
+    check_symmetric("Noise_XX_25519_AEGIS256_SHA256");
+#endif
 }
 
 /* Check other error conditions that can be reported by the functions */
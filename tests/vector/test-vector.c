@@ -22,6 +22,7 @@
 
 #include <noise/protocol.h>
 #include "json-reader.h"
+#include "timing.h"
 #include <setjmp.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -483,6 +484,19 @@ static void test_connection(const TestVector *vec, int is_one_way)
     compare(noise_cipherstate_free(c2resp), NOISE_ERROR_NONE);
 }
 
+/**
+ * \brief Number of times to replay each vector in benchmark mode,
+ * or zero to run each vector once as a regular test.
+ */
+static long bench_iterations = 0;
+
+/**
+ * \brief Vectors that have passed and are kept in memory for replay.
+ */
+static TestVector *bench_vectors = 0;
+static size_t bench_num_vectors = 0;
+static size_t bench_max_vectors = 0;
+
 /**
  * \brief Runs a fully parsed test vector.
  *
@@ -770,6 +784,23 @@ static int process_test_vector(JSONReader *reader)
     vec.protocol_name = strdup(protocol_name);
     if (!reader->errors) {
         retval = test_vector_run(reader, &vec);
+        if (retval && bench_iterations > 0) {
+            /* Keep the vector in memory so that it can be replayed later */
+            if (bench_num_vectors >= bench_max_vectors) {
+                size_t new_max = bench_max_vectors ? bench_max_vectors * 2 : 256;
+                TestVector *new_vectors = (TestVector *)realloc
+                    (bench_vectors, new_max * sizeof(TestVector));
+                if (!new_vectors) {
+                    json_error(reader, "Out of memory");
+                    test_vector_free(&vec);
+                    return 0;
+                }
+                bench_vectors = new_vectors;
+                bench_max_vectors = new_max;
+            }
+            bench_vectors[bench_num_vectors++] = vec;
+            return retval;
+        }
     }
     test_vector_free(&vec);
     return retval;
@@ -807,6 +838,72 @@ static void process_test_vectors(JSONReader *reader)
     }
 }
 
+/**
+ * \brief Replays a test vector for the benchmark.
+ *
+ * \param vec The test vector.
+ *
+ * \return The average time for one replay in seconds, or a negative
+ * value if the replay failed.
+ */
+static double bench_vector(const TestVector *vec)
+{
+    timestamp_t start, end;
+    long iteration;
+    if (setjmp(test_jump_back) == 0) {
+        int is_one_way = test_name_parsing(vec);
+        start = current_timestamp();
+        for (iteration = 0; iteration < bench_iterations; ++iteration)
+            test_connection(vec, is_one_way);
+        end = current_timestamp();
+        return elapsed_to_seconds(start, end) / (double)bench_iterations;
+    } else {
+        return -1.0;
+    }
+}
+
+/**
+ * \brief Replays all of the vectors that were loaded into memory and
+ * reports the time taken for each one.
+ *
+ * \return Zero if all replays succeeded, or 1 if any failed.
+ *
+ * Each replay performs the complete handshake and transport phase with
+ * the fixed ephemeral keys from the vector, so the workload is the same
+ * from one run to the next.  Times are in microseconds of process CPU
+ * time, averaged over all iterations.
+ */
+static int bench_vectors_run(void)
+{
+    double elapsed;
+    double total = 0;
+    size_t index;
+    int retval = 0;
+    printf("--------------------------------------------------------------\n");
+    printf("Replaying %lu vectors, %ld iterations each\n",
+           (unsigned long)bench_num_vectors, bench_iterations);
+    printf("%-64s%12s\n", "Vector", "usec/replay");
+    for (index = 0; index < bench_num_vectors; ++index) {
+        elapsed = bench_vector(&(bench_vectors[index]));
+        if (elapsed < 0) {
+            printf("%s -> replay failed\n", bench_vectors[index].name);
+            retval = 1;
+            continue;
+        }
+        total += elapsed;
+        printf("%-64s%12.2f\n", bench_vectors[index].name, elapsed * 1000000.0);
+    }
+    printf("%-64s%12.2f\n", "Total", total * 1000000.0);
+    printf("--------------------------------------------------------------\n");
+    for (index = 0; index < bench_num_vectors; ++index)
+        test_vector_free(&(bench_vectors[index]));
+    free(bench_vectors);
+    bench_vectors = 0;
+    bench_num_vectors = 0;
+    bench_max_vectors = 0;
+    return retval;
+}
+
 static int process_file(const char *filename)
 {
     int retval = 0;
@@ -835,8 +932,20 @@ int main(int argc, char *argv[])
 
     int retval = 0;
     char *srcdir = getenv("srcdir");
+    const char *progname = argv[0];
+    if (argc > 2 && !strcmp(argv[1], "--bench")) {
+        /* Load and check the vectors, then replay them N times each */
+        bench_iterations = atol(argv[2]);
+        if (bench_iterations <= 0) {
+            fprintf(stderr, "Invalid iteration count: %s\n", argv[2]);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
     if (argc <= 1 && !srcdir) {
-        fprintf(stderr, "Usage: %s vectors1.txt vectors2.txt ...\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--bench N] vectors1.txt vectors2.txt ...\n",
+                progname);
         return 1;
     } else if (argc > 1) {
         while (argc > 1) {
@@ -854,5 +963,13 @@ int main(int argc, char *argv[])
         retval |= process_file("noise-c-fallback.txt");
         retval |= process_file("noise-c-hybrid.txt");
     }
+    if (bench_iterations > 0) {
+        /* The totals are only comparable between runs if every vector
+           was replayed, so don't benchmark a partial set */
+        if (!retval)
+            retval |= bench_vectors_run();
+        else
+            printf("Benchmark skipped because some vectors failed\n");
+    }
     return retval;
 }